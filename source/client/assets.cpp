@@ -10,7 +10,7 @@
 #include "qcommon/string.h"
 #include "qcommon/threads.h"
 #include "client/assets.h"
-#include "client/threadpool.h"
+#include "qcommon/threadpool.h"
 
 struct Asset {
 	char * path;
@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "client/client.h"
+#include "qcommon/array.h"
 
 static void CL_PauseDemo( bool paused );
 
@@ -164,7 +165,7 @@ void CL_Record_f() {
 		return;
 	}
 
-	if( FS_FOpenFile( name, &cls.demo.file, FS_WRITE | SNAP_DEMO_GZ ) == -1 ) {
+	if( FS_FOpenFile( name, &cls.demo.file, FS_WRITE | SNAP_DEMO_COMPRESSION ) == -1 ) {
 		Com_Printf( "Error: Couldn't create the demo file.\n" );
 		Mem_ZoneFree( name );
 		return;
@@ -195,6 +196,131 @@ void CL_Record_f() {
 // demo file
 static int demofilehandle;
 static int demofilelen, demofilelentotal;
+static int demomessageofs;  // where the message being parsed starts
+
+// non-delta frames we've read so far, so seeking can start from the nearest
+// one instead of the start of the file. the configstrings that differ from
+// the ones cgame was initialised with are saved along with them
+struct demokeyframe_t {
+	int64_t serverTime;
+	int offset;
+	size_t first_configstring;
+	size_t num_configstrings;
+};
+
+struct democonfigstring_t {
+	int index;
+	char value[MAX_CONFIGSTRING_CHARS];
+};
+
+static NonRAIIDynamicArray< demokeyframe_t > demokeyframes;
+static NonRAIIDynamicArray< democonfigstring_t > demokeyframeconfigstrings;
+static char demobaseconfigstrings[MAX_CONFIGSTRINGS][MAX_CONFIGSTRING_CHARS];
+static bool demohavebaseconfigstrings;
+
+/*
+* CL_ClearDemoKeyframes
+*/
+static void CL_ClearDemoKeyframes() {
+	if( demohavebaseconfigstrings ) {
+		demokeyframes.shutdown();
+		demokeyframeconfigstrings.shutdown();
+	}
+	demohavebaseconfigstrings = false;
+}
+
+/*
+* CL_DemoPrecached
+*
+* Remembers the configstrings cgame was initialised with, so keyframes only
+* need to store what changed since
+*/
+void CL_DemoPrecached() {
+	CL_ClearDemoKeyframes();
+
+	memcpy( demobaseconfigstrings, cl.configstrings, sizeof( demobaseconfigstrings ) );
+	demokeyframes.init( sys_allocator );
+	demokeyframeconfigstrings.init( sys_allocator );
+	demohavebaseconfigstrings = true;
+}
+
+/*
+* CL_AddDemoKeyframe
+*
+* Called when a non-delta frame is parsed from the demo
+*/
+void CL_AddDemoKeyframe( int64_t serverTime ) {
+	if( !demohavebaseconfigstrings ) {
+		return;
+	}
+
+	// we see the same keyframes again after seeking back
+	if( demokeyframes.size() > 0 && demokeyframes.top().serverTime + SNAP_DEMO_KEYFRAME_INTERVAL / 2 > serverTime ) {
+		return;
+	}
+
+	demokeyframe_t keyframe;
+	keyframe.serverTime = serverTime;
+	keyframe.offset = demomessageofs;
+	keyframe.first_configstring = demokeyframeconfigstrings.size();
+	keyframe.num_configstrings = 0;
+
+	for( int i = 0; i < MAX_CONFIGSTRINGS; i++ ) {
+		if( strcmp( cl.configstrings[i], demobaseconfigstrings[i] ) != 0 ) {
+			democonfigstring_t cs;
+			cs.index = i;
+			Q_strncpyz( cs.value, cl.configstrings[i], sizeof( cs.value ) );
+			demokeyframeconfigstrings.add( cs );
+			keyframe.num_configstrings++;
+		}
+	}
+
+	demokeyframes.add( keyframe );
+}
+
+/*
+* CL_FindDemoKeyframe
+*
+* Returns the last keyframe at or before serverTime
+*/
+static const demokeyframe_t *CL_FindDemoKeyframe( int64_t serverTime ) {
+	if( !demohavebaseconfigstrings ) {
+		return NULL;
+	}
+
+	const demokeyframe_t *best = NULL;
+	for( const demokeyframe_t & keyframe : demokeyframes ) {
+		if( keyframe.serverTime > serverTime ) {
+			break;
+		}
+		best = &keyframe;
+	}
+
+	return best;
+}
+
+/*
+* CL_RestoreDemoKeyframe
+*
+* Puts the client back how it was when the keyframe was read, with cgame
+* reset as if we had replayed up to there
+*/
+static void CL_RestoreDemoKeyframe( const demokeyframe_t *keyframe ) {
+	FS_Seek( demofilehandle, keyframe->offset, FS_SEEK_SET );
+	cl.currentSnapNum = cl.receivedSnapNum = 0;
+
+	CL_GameModule_Reset();
+	S_StopAllSounds( false );
+
+	memcpy( cl.configstrings, demobaseconfigstrings, sizeof( cl.configstrings ) );
+	for( size_t i = 0; i < keyframe->num_configstrings; i++ ) {
+		const democonfigstring_t *cs = &demokeyframeconfigstrings[keyframe->first_configstring + i];
+		Q_strncpyz( cl.configstrings[cs->index], cs->value, sizeof( cl.configstrings[cs->index] ) );
+		CL_GameModule_ConfigString( cs->index, cs->value );
+	}
+
+	cls.demo.play_ignore_next_frametime = true;
+}
 
 /*
 * CL_DemoCompleted
@@ -207,6 +333,7 @@ void CL_DemoCompleted() {
 		demofilehandle = 0;
 	}
 	demofilelen = demofilelentotal = 0;
+	CL_ClearDemoKeyframes();
 
 	cls.demo.playing = false;
 	cls.demo.basetime = cls.demo.duration = cls.demo.time = 0;
@@ -245,6 +372,7 @@ static void CL_ReadDemoMessage() {
 		init = false;
 	}
 
+	demomessageofs = FS_Tell( demofilehandle );
 	read = SNAP_ReadDemoMessage( demofilehandle, &demomsg );
 	if( read == -1 ) {
 		CL_Disconnect( NULL );
@@ -278,7 +406,8 @@ void CL_ReadDemoPackets() {
 /*
 * CL_LatchedDemoJump
 *
-* See if it's time to read a new demo packet
+* Seeks to the latest keyframe before the jump target, or to the start of
+* the demo if we don't have one, unless reading on would get there sooner.
 */
 void CL_LatchedDemoJump() {
 	if( cls.demo.paused || !cls.demo.play_jump_latched ) {
@@ -293,7 +422,12 @@ void CL_LatchedDemoJump() {
 
 	CL_AdjustServerTime( 1 );
 
-	if( cl.serverTime < cl.snapShots[cl.receivedSnapNum & UPDATE_MASK].serverTime ) {
+	int64_t receivedTime = cl.snapShots[cl.receivedSnapNum & UPDATE_MASK].serverTime;
+	const demokeyframe_t *keyframe = CL_FindDemoKeyframe( cl.serverTime );
+
+	if( keyframe != NULL && ( cl.serverTime < receivedTime || keyframe->serverTime > receivedTime ) ) {
+		CL_RestoreDemoKeyframe( keyframe );
+	} else if( cl.serverTime < receivedTime ) {
 		demofilelen = demofilelentotal;
 		FS_Seek( demofilehandle, 0, FS_SEEK_SET );
 		cl.currentSnapNum = cl.receivedSnapNum = 0;
@@ -327,14 +461,14 @@ static void CL_StartDemo( const char *demoname, bool yolo ) {
 	}
 
 	if( filename ) {
-		tempdemofilelen = FS_FOpenFile( filename, &tempdemofilehandle, FS_READ | SNAP_DEMO_GZ );  // open the demo file
+		tempdemofilelen = FS_FOpenFile( filename, &tempdemofilehandle, FS_READ | SNAP_DEMO_COMPRESSION );  // open the demo file
 	}
 
 	if( !tempdemofilehandle ) {
 		// relative filename didn't work, try launching a demo from absolute path
 		snprintf( name, name_size, "%s", servername );
 		COM_DefaultExtension( name, APP_DEMO_EXTENSION_STR, name_size );
-		tempdemofilelen = FS_FOpenAbsoluteFile( name, &tempdemofilehandle, FS_READ | SNAP_DEMO_GZ );
+		tempdemofilelen = FS_FOpenAbsoluteFile( name, &tempdemofilehandle, FS_READ | SNAP_DEMO_COMPRESSION );
 	}
 
 	if( !tempdemofilehandle ) {
@@ -511,13 +645,13 @@ size_t CL_ReadDemoMetaData( const char *demopath, char *meta_data, size_t meta_d
 		snprintf( name, name_size, "demos/%s", servername );
 		COM_DefaultExtension( name, APP_DEMO_EXTENSION_STR, name_size );
 
-		demolength = FS_FOpenFile( name, &demofile, FS_READ | SNAP_DEMO_GZ );
+		demolength = FS_FOpenFile( name, &demofile, FS_READ | SNAP_DEMO_COMPRESSION );
 
 		if( !demofile || demolength < 1 ) {
 			// relative filename didn't work, try launching a demo from absolute path
 			snprintf( name, name_size, "%s", servername );
 			COM_DefaultExtension( name, APP_DEMO_EXTENSION_STR, name_size );
-			demolength = FS_FOpenAbsoluteFile( name, &demofile, FS_READ );
+			demolength = FS_FOpenAbsoluteFile( name, &demofile, FS_READ | SNAP_DEMO_COMPRESSION );
 		}
 
 		if( demolength > 0 ) {
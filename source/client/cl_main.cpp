@@ -22,7 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "client/client.h"
 #include "client/assets.h"
 #include "client/downloads.h"
-#include "client/threadpool.h"
+#include "qcommon/threadpool.h"
 #include "client/renderer/renderer.h"
 #include "qcommon/csprng.h"
 #include "qcommon/hash.h"
@@ -178,8 +178,8 @@ static void CL_SendConnectPacket() {
 	userinfo_modified = false;
 
 	TempAllocator temp = cls.frame_arena.temp();
-	Netchan_OutOfBandPrint( cls.socket, &cls.serveraddress, "%s", temp( "connect {} {} {} \"{}\"\n",
-							APP_PROTOCOL_VERSION, Netchan_ClientSessionID(), cls.challenge, Cvar_Userinfo() ) );
+	Netchan_OutOfBandPrint( cls.socket, &cls.serveraddress, "%s", temp( "connect {} {} {} \"{}\" {}\n",
+							APP_PROTOCOL_VERSION, Netchan_ClientSessionID(), cls.challenge, Cvar_Userinfo(), Netchan_CompressionOffer() ) );
 }
 
 /*
@@ -739,8 +739,10 @@ static void CL_ConnectionlessPacket( const socket_t *socket, const netadr_t *add
 		cls.rejected = false;
 
 		Q_strncpyz( cls.session, MSG_ReadStringLine( msg ), sizeof( cls.session ) );
+		NetchanCompression compression = NetchanCompression( atoi( MSG_ReadStringLine( msg ) ) );
 
 		Netchan_Setup( &cls.netchan, socket, address, Netchan_ClientSessionID() );
+		cls.netchan.compression = compression;
 		memset( cl.configstrings, 0, sizeof( cl.configstrings ) );
 		CL_SetClientState( CA_HANDSHAKE );
 		CL_AddReliableCommand( "new" );
@@ -878,7 +880,7 @@ static bool CL_ProcessPacket( netchan_t *netchan, msg_t *msg ) {
 	MSG_ReadInt32( msg ); // sequence
 	MSG_ReadInt32( msg ); // sequence_ack
 	if( msg->compressed ) {
-		zerror = Netchan_DecompressMessage( msg );
+		zerror = Netchan_DecompressMessage( netchan, msg );
 		if( zerror < 0 ) {
 			// compression error. Drop the packet
 			Com_Printf( "CL_ProcessPacket: Compression error %i. Dropping packet\n", zerror );
@@ -1005,6 +1007,7 @@ void CL_Precache_f() {
 	if( cls.demo.playing ) {
 		if( !cls.demo.play_jump ) {
 			CL_GameModule_Init();
+			CL_DemoPrecached();
 		} else {
 			CL_GameModule_Reset();
 			S_StopAllSounds( false );
@@ -1327,7 +1330,7 @@ void CL_Netchan_Transmit( msg_t *msg ) {
 	Netchan_PushAllFragments( &cls.netchan );
 
 	if( msg->cursize > 60 ) {
-		int zerror = Netchan_CompressMessage( msg );
+		int zerror = Netchan_CompressMessage( &cls.netchan, msg );
 		if( zerror < 0 ) { // it's compression error, just send uncompressed
 			Com_DPrintf( "CL_Netchan_Transmit (ignoring compression): Compression error %i\n", zerror );
 		}
@@ -1591,8 +1594,6 @@ void CL_Init() {
 
 	cl_initialized = true;
 
-	InitThreadPool();
-
 	ThreadPoolDo( []( TempAllocator * temp, void * data ) {
 		InitAssets( temp );
 	} );
@@ -1680,8 +1681,6 @@ void CL_Shutdown() {
 
 	CL_ShutdownLocal();
 
-	ShutdownThreadPool();
-
 	Con_Shutdown();
 
 	ShutdownAssets();
@@ -406,10 +406,22 @@ static void CL_ParseFrame( msg_t *msg ) {
 
 			if( !cls.demo.waiting ) {
 				cls.demo.duration = snap->serverTime - cls.demo.basetime;
+
+				// ask for a full frame every so often so playback can seek to it
+				if( !snap->delta ) {
+					cls.demo.last_keyframe = snap->serverTime;
+				} else if( snap->serverTime - cls.demo.last_keyframe >= SNAP_DEMO_KEYFRAME_INTERVAL ) {
+					CL_AddReliableCommand( "nodelta" );
+					cls.demo.last_keyframe = snap->serverTime;
+				}
 			}
 			cls.demo.time = cls.demo.duration;
 		}
 
+		if( cls.demo.playing && !snap->delta ) {
+			CL_AddDemoKeyframe( snap->serverTime );
+		}
+
 		if( cl_debug_timeDelta->integer ) {
 			if( oldSnap != NULL && ( oldSnap->serverFrame + 1 != snap->serverFrame ) ) {
 				Com_Printf( S_COLOR_RED "***** SnapShot lost\n" );
@@ -113,6 +113,7 @@ struct cl_demo_t {
 	time_t localtime;       // time of day of demo recording
 	int64_t time;           // milliseconds passed since the start of the demo
 	int64_t duration, basetime;
+	int64_t last_keyframe;  // serverTime of the last non-delta frame recorded or asked for
 
 	bool play_jump;
 	bool play_jump_latched;
@@ -308,6 +309,8 @@ void CL_PlayDemo_f();
 void CL_YoloDemo_f();
 void CL_ReadDemoPackets();
 void CL_LatchedDemoJump();
+void CL_DemoPrecached();
+void CL_AddDemoKeyframe( int64_t serverTime );
 void CL_Stop_f();
 void CL_Record_f();
 void CL_PauseDemo_f();
@@ -344,9 +347,3 @@ void CL_InitImGui();
 void CL_ShutdownImGui();
 void CL_ImGuiBeginFrame();
 void CL_ImGuiEndFrame();
-
-//
-// snap_read
-//
-void SNAP_ParseBaseline( msg_t *msg, SyncEntityState *baselines );
-snapshot_t *SNAP_ParseFrame( msg_t *msg, snapshot_t *lastFrame, snapshot_t *backup, SyncEntityState *baselines, int showNet );
@@ -8,7 +8,7 @@
 #include "gameshared/q_shared.h"
 #include "client/client.h"
 #include "client/assets.h"
-#include "client/threadpool.h"
+#include "qcommon/threadpool.h"
 #include "client/renderer/renderer.h"
 #include "client/renderer/dds.h"
 #include "cgame/cg_dynamics.h"
@@ -1,5 +1,8 @@
 #include "game/g_local.h"
 #include "gameshared/gs_public.h"
+#include "qcommon/array.h"
+#include "qcommon/cmodel.h"
+#include "qcommon/threadpool.h"
 
 static const char * bot_names[] = {
 	"vic",
@@ -46,6 +49,838 @@ static edict_t * ConnectFakeClient() {
 	return game.edicts + entNum;
 }
 
+/*
+ * navigation graph
+ *
+ * built when the map loads by dropping a player box down columns of a grid
+ * over the world, which gives a node on every floor a player could stand on.
+ * neighbouring nodes are joined if a player can walk, step, jump or drop from
+ * one to the other. only the world model is traced so doors and other movers
+ * don't cut the graph. it lives until the next map so level resets don't
+ * rebuild it
+ */
+
+#define AI_NAV_SPACING 48.0f
+#define AI_NAV_MAX_COLUMNS 512
+#define AI_NAV_MAX_FLOORS 16 // per column
+#define AI_NAV_MIN_NORMAL 0.7f
+#define AI_NAV_JUMP_HEIGHT 36.0f // a little under what DEFAULT_JUMPSPEED gets you
+#define AI_NAV_MAX_DROP 256.0f
+#define AI_NAV_JUMP_COST 32.0f
+
+struct ai_navnode_t {
+	Vec3 origin;
+	int first_edge;
+	int num_edges;
+	int component;
+};
+
+struct ai_navedge_t {
+	int node;
+	float cost;
+	bool jump;
+};
+
+struct ai_heapnode_t {
+	float f;
+	int node;
+};
+
+struct ai_navgraph_t {
+	cmodel_t * world_model;
+	Vec3 mins;
+	int columns[ 2 ];
+	int * column_first; // nodes are sorted by column, columns[ 0 ] * columns[ 1 ] + 1 entries
+
+	ai_navnode_t * nodes;
+	int num_nodes;
+	ai_navedge_t * edges;
+	int num_edges;
+
+	// A* scratch space, shared by every bot
+	float * cost;
+	int * parent;
+	u32 * visited;
+	u32 search;
+	ai_heapnode_t * heap;
+	int heap_capacity;
+};
+
+static ai_navgraph_t ai_nav;
+
+static void AI_NavTrace( trace_t * tr, Vec3 start, Vec3 end ) {
+	CM_TransformedBoxTrace( CM_Server, svs.cms, tr, start, end, playerbox_stand_mins, playerbox_stand_maxs, ai_nav.world_model, MASK_PLAYERSOLID, Vec3( 0.0f ), Vec3( 0.0f ) );
+}
+
+static void AI_FindFloors( float x, float y, float top, float bottom, NonRAIIDynamicArray< Vec3 > * origins ) {
+	float z = top;
+	int floors = 0;
+
+	while( z > bottom && floors < AI_NAV_MAX_FLOORS ) {
+		trace_t tr;
+		AI_NavTrace( &tr, Vec3( x, y, z ), Vec3( x, y, bottom ) );
+
+		if( tr.startsolid ) {
+			z -= 32.0f;
+			continue;
+		}
+		if( tr.fraction == 1.0f ) {
+			break;
+		}
+
+		if( tr.plane.normal.z >= AI_NAV_MIN_NORMAL ) {
+			Vec3 feet = tr.endpos + Vec3( 0.0f, 0.0f, playerbox_stand_mins.z + 1.0f );
+			int contents = CM_TransformedPointContents( CM_Server, svs.cms, feet, ai_nav.world_model, Vec3( 0.0f ), Vec3( 0.0f ) );
+			if( !( contents & ( CONTENTS_LAVA | CONTENTS_SLIME | CONTENTS_NODROP ) ) ) {
+				origins->add( tr.endpos );
+				floors++;
+			}
+		}
+
+		// continue with the box entirely below whatever we hit
+		z = tr.endpos.z - ( playerbox_stand_maxs.z - playerbox_stand_mins.z ) - 1.0f;
+	}
+}
+
+// returns false if a player can't get from a to b. jump is set if they need to jump
+static bool AI_CanTraverse( Vec3 a, Vec3 b, bool * jump ) {
+	float dz = b.z - a.z;
+	if( dz > AI_NAV_JUMP_HEIGHT || dz < -AI_NAV_MAX_DROP ) {
+		return false;
+	}
+
+	trace_t tr;
+
+	// go up enough to clear steps or whatever we're jumping on to
+	float raise = Max2( float( STEPSIZE ), dz + 2.0f );
+	Vec3 up = a + Vec3( 0.0f, 0.0f, raise );
+	AI_NavTrace( &tr, a, up );
+	if( tr.fraction < 1.0f ) {
+		return false;
+	}
+
+	Vec3 across = Vec3( b.x, b.y, up.z );
+	AI_NavTrace( &tr, up, across );
+	if( tr.fraction < 1.0f ) {
+		return false;
+	}
+
+	AI_NavTrace( &tr, across, b - Vec3( 0.0f, 0.0f, STEPSIZE ) );
+	if( tr.startsolid || Abs( tr.endpos.z - b.z ) > 4.0f ) {
+		return false;
+	}
+
+	*jump = dz > STEPSIZE;
+
+	// make sure there's no hole to fall in on the way
+	Vec3 middle = ( up + across ) * 0.5f;
+	AI_NavTrace( &tr, middle, middle - Vec3( 0.0f, 0.0f, raise + AI_NAV_SPACING ) );
+	if( tr.fraction == 1.0f ) {
+		*jump = true;
+	}
+
+	return true;
+}
+
+static int AI_FindComponent( int * components, int node ) {
+	while( components[ node ] != node ) {
+		components[ node ] = components[ components[ node ] ];
+		node = components[ node ];
+	}
+	return node;
+}
+
+// the graph is built a row of columns at a time on the thread pool
+struct ai_navrow_t {
+	NonRAIIDynamicArray< Vec3 > origins;
+	NonRAIIDynamicArray< ai_navedge_t > edges;
+	int * column_counts;
+};
+
+static ai_navrow_t ai_navrows[ AI_NAV_MAX_COLUMNS ];
+
+static void AI_FindFloorsJob( TempAllocator * temp, void * data ) {
+	ai_navrow_t * row = ( ai_navrow_t * ) data;
+	int y = row - ai_navrows;
+
+	Vec3 mins, maxs;
+	CM_InlineModelBounds( svs.cms, ai_nav.world_model, &mins, &maxs );
+
+	for( int x = 0; x < ai_nav.columns[ 0 ]; x++ ) {
+		size_t before = row->origins.size();
+		float fx = mins.x + ( x + 0.5f ) * AI_NAV_SPACING;
+		float fy = mins.y + ( y + 0.5f ) * AI_NAV_SPACING;
+		AI_FindFloors( fx, fy, maxs.z, mins.z, &row->origins );
+		row->column_counts[ x ] = row->origins.size() - before;
+	}
+}
+
+static void AI_FindEdgesJob( TempAllocator * temp, void * data ) {
+	ai_navrow_t * row = ( ai_navrow_t * ) data;
+	int y = row - ai_navrows;
+
+	for( int x = 0; x < ai_nav.columns[ 0 ]; x++ ) {
+		int column = y * ai_nav.columns[ 0 ] + x;
+
+		for( int i = ai_nav.column_first[ column ]; i < ai_nav.column_first[ column + 1 ]; i++ ) {
+			ai_navnode_t * node = &ai_nav.nodes[ i ];
+			// relative to the row until AI_LoadMap joins the rows up
+			node->first_edge = row->edges.size();
+
+			for( int dy = -1; dy <= 1; dy++ ) {
+				for( int dx = -1; dx <= 1; dx++ ) {
+					int nx = x + dx;
+					int ny = y + dy;
+					if( ( dx == 0 && dy == 0 ) || nx < 0 || ny < 0 || nx >= ai_nav.columns[ 0 ] || ny >= ai_nav.columns[ 1 ] ) {
+						continue;
+					}
+
+					int neighbour = ny * ai_nav.columns[ 0 ] + nx;
+					for( int j = ai_nav.column_first[ neighbour ]; j < ai_nav.column_first[ neighbour + 1 ]; j++ ) {
+						bool jump;
+						if( !AI_CanTraverse( node->origin, ai_nav.nodes[ j ].origin, &jump ) ) {
+							continue;
+						}
+
+						ai_navedge_t edge;
+						edge.node = j;
+						edge.cost = Length( ai_nav.nodes[ j ].origin - node->origin ) + ( jump ? AI_NAV_JUMP_COST : 0.0f );
+						edge.jump = jump;
+						row->edges.add( edge );
+					}
+				}
+			}
+
+			node->num_edges = row->edges.size() - node->first_edge;
+		}
+	}
+}
+
+static void AI_FreeNavGraph() {
+	FREE( sys_allocator, ai_nav.column_first );
+	FREE( sys_allocator, ai_nav.nodes );
+	FREE( sys_allocator, ai_nav.edges );
+	FREE( sys_allocator, ai_nav.cost );
+	FREE( sys_allocator, ai_nav.parent );
+	FREE( sys_allocator, ai_nav.visited );
+	FREE( sys_allocator, ai_nav.heap );
+	memset( &ai_nav, 0, sizeof( ai_nav ) );
+}
+
+void AI_LoadMap() {
+	ZoneScoped;
+
+	s64 start_time = Sys_Milliseconds();
+
+	AI_FreeNavGraph();
+	ai_nav.world_model = CM_FindCModel( CM_Server, StringHash( svs.cms->world_hash ) );
+
+	Vec3 mins, maxs;
+	CM_InlineModelBounds( svs.cms, ai_nav.world_model, &mins, &maxs );
+
+	ai_nav.mins = mins;
+	for( int i = 0; i < 2; i++ ) {
+		ai_nav.columns[ i ] = Clamp( 1, int( ceilf( ( maxs[ i ] - mins[ i ] ) / AI_NAV_SPACING ) ), AI_NAV_MAX_COLUMNS );
+	}
+
+	int num_columns = ai_nav.columns[ 0 ] * ai_nav.columns[ 1 ];
+	ai_nav.column_first = ALLOC_MANY( sys_allocator, int, num_columns + 1 );
+
+	Span< ai_navrow_t > rows( ai_navrows, ai_nav.columns[ 1 ] );
+	for( int y = 0; y < ai_nav.columns[ 1 ]; y++ ) {
+		rows[ y ].origins.init( sys_allocator );
+		rows[ y ].edges.init( sys_allocator );
+		// borrow column_first to count floors, it gets turned into offsets below
+		rows[ y ].column_counts = ai_nav.column_first + y * ai_nav.columns[ 0 ];
+	}
+	defer {
+		for( ai_navrow_t & row : rows ) {
+			row.origins.shutdown();
+			row.edges.shutdown();
+		}
+	};
+
+	ParallelFor( rows, AI_FindFloorsJob );
+
+	ai_nav.num_nodes = 0;
+	for( ai_navrow_t & row : rows ) {
+		ai_nav.num_nodes += row.origins.size();
+	}
+	ai_nav.nodes = ALLOC_MANY( sys_allocator, ai_navnode_t, Max2( ai_nav.num_nodes, 1 ) );
+
+	int node = 0;
+	for( int i = 0; i < num_columns; i++ ) {
+		int count = ai_nav.column_first[ i ];
+		ai_nav.column_first[ i ] = node;
+		node += count;
+	}
+	ai_nav.column_first[ num_columns ] = node;
+
+	for( int y = 0; y < ai_nav.columns[ 1 ]; y++ ) {
+		int first = ai_nav.column_first[ y * ai_nav.columns[ 0 ] ];
+		for( size_t i = 0; i < rows[ y ].origins.size(); i++ ) {
+			ai_nav.nodes[ first + i ].origin = rows[ y ].origins[ i ];
+		}
+	}
+
+	ParallelFor( rows, AI_FindEdgesJob );
+
+	ai_nav.num_edges = 0;
+	for( ai_navrow_t & row : rows ) {
+		ai_nav.num_edges += row.edges.size();
+	}
+	ai_nav.edges = ALLOC_MANY( sys_allocator, ai_navedge_t, Max2( ai_nav.num_edges, 1 ) );
+
+	int edge = 0;
+	for( int y = 0; y < ai_nav.columns[ 1 ]; y++ ) {
+		int first = ai_nav.column_first[ y * ai_nav.columns[ 0 ] ];
+		int last = ai_nav.column_first[ ( y + 1 ) * ai_nav.columns[ 0 ] ];
+		for( int i = first; i < last; i++ ) {
+			ai_nav.nodes[ i ].first_edge += edge;
+		}
+		if( rows[ y ].edges.size() > 0 ) {
+			memcpy( ai_nav.edges + edge, rows[ y ].edges.ptr(), rows[ y ].edges.num_bytes() );
+		}
+		edge += rows[ y ].edges.size();
+	}
+
+	// bots only pick goals in the component they're in. drops are one way so
+	// this isn't exact, failed searches are handled by picking another goal
+	int * components = ALLOC_MANY( sys_allocator, int, Max2( ai_nav.num_nodes, 1 ) );
+	defer { FREE( sys_allocator, components ); };
+	for( int i = 0; i < ai_nav.num_nodes; i++ ) {
+		components[ i ] = i;
+	}
+	for( int i = 0; i < ai_nav.num_nodes; i++ ) {
+		const ai_navnode_t * node = &ai_nav.nodes[ i ];
+		for( int j = 0; j < node->num_edges; j++ ) {
+			int a = AI_FindComponent( components, i );
+			int b = AI_FindComponent( components, ai_nav.edges[ node->first_edge + j ].node );
+			components[ Max2( a, b ) ] = Min2( a, b );
+		}
+	}
+	for( int i = 0; i < ai_nav.num_nodes; i++ ) {
+		ai_nav.nodes[ i ].component = AI_FindComponent( components, i );
+	}
+
+	ai_nav.cost = ALLOC_MANY( sys_allocator, float, Max2( ai_nav.num_nodes, 1 ) );
+	ai_nav.parent = ALLOC_MANY( sys_allocator, int, Max2( ai_nav.num_nodes, 1 ) );
+	ai_nav.visited = ALLOC_MANY( sys_allocator, u32, Max2( ai_nav.num_nodes, 1 ) );
+	memset( ai_nav.visited, 0, Max2( ai_nav.num_nodes, 1 ) * sizeof( u32 ) );
+	ai_nav.heap_capacity = ai_nav.num_nodes + ai_nav.num_edges + 1;
+	ai_nav.heap = ALLOC_MANY( sys_allocator, ai_heapnode_t, ai_nav.heap_capacity );
+
+	Com_Printf( "AI: built a navigation graph with %d nodes and %d edges in %" PRIi64 "ms\n",
+		ai_nav.num_nodes, ai_nav.num_edges, Sys_Milliseconds() - start_time );
+}
+
+static int AI_NearestNode( Vec3 p ) {
+	int cx = int( floorf( ( p.x - ai_nav.mins.x ) / AI_NAV_SPACING ) );
+	int cy = int( floorf( ( p.y - ai_nav.mins.y ) / AI_NAV_SPACING ) );
+
+	int best = -1;
+	float best_dist = FLT_MAX;
+
+	for( int y = cy - 1; y <= cy + 1; y++ ) {
+		for( int x = cx - 1; x <= cx + 1; x++ ) {
+			if( x < 0 || y < 0 || x >= ai_nav.columns[ 0 ] || y >= ai_nav.columns[ 1 ] ) {
+				continue;
+			}
+
+			int column = y * ai_nav.columns[ 0 ] + x;
+			for( int i = ai_nav.column_first[ column ]; i < ai_nav.column_first[ column + 1 ]; i++ ) {
+				Vec3 d = ai_nav.nodes[ i ].origin - p;
+				if( d.z > AI_NAV_JUMP_HEIGHT || d.z < -AI_NAV_MAX_DROP ) {
+					continue;
+				}
+
+				// prefer floors under us over ones overhead
+				float dist = d.x * d.x + d.y * d.y + d.z * d.z * ( d.z > 0.0f ? 4.0f : 1.0f );
+				if( dist < best_dist ) {
+					best = i;
+					best_dist = dist;
+				}
+			}
+		}
+	}
+
+	return best;
+}
+
+static void AI_HeapPush( int * heap_size, float f, int node ) {
+	if( *heap_size == ai_nav.heap_capacity ) {
+		return;
+	}
+
+	int i = ( *heap_size )++;
+	while( i > 0 ) {
+		int parent = ( i - 1 ) / 2;
+		if( ai_nav.heap[ parent ].f <= f ) {
+			break;
+		}
+		ai_nav.heap[ i ] = ai_nav.heap[ parent ];
+		i = parent;
+	}
+
+	ai_nav.heap[ i ].f = f;
+	ai_nav.heap[ i ].node = node;
+}
+
+static ai_heapnode_t AI_HeapPop( int * heap_size ) {
+	ai_heapnode_t top = ai_nav.heap[ 0 ];
+	ai_heapnode_t last = ai_nav.heap[ --( *heap_size ) ];
+
+	int i = 0;
+	while( true ) {
+		int child = i * 2 + 1;
+		if( child >= *heap_size ) {
+			break;
+		}
+		if( child + 1 < *heap_size && ai_nav.heap[ child + 1 ].f < ai_nav.heap[ child ].f ) {
+			child++;
+		}
+		if( last.f <= ai_nav.heap[ child ].f ) {
+			break;
+		}
+		ai_nav.heap[ i ] = ai_nav.heap[ child ];
+		i = child;
+	}
+
+	ai_nav.heap[ i ] = last;
+	return top;
+}
+
+// A* from start to goal, writes at most max_path nodes of the path into
+// path and returns how many it wrote, or 0 if there's no path
+static int AI_FindPath( int start, int goal, int * path, int max_path ) {
+	ZoneScoped;
+
+	ai_nav.search++;
+	if( ai_nav.search == 0 ) {
+		memset( ai_nav.visited, 0, ai_nav.num_nodes * sizeof( u32 ) );
+		ai_nav.search = 1;
+	}
+
+	Vec3 goal_origin = ai_nav.nodes[ goal ].origin;
+
+	int heap_size = 0;
+	ai_nav.visited[ start ] = ai_nav.search;
+	ai_nav.cost[ start ] = 0.0f;
+	ai_nav.parent[ start ] = -1;
+	AI_HeapPush( &heap_size, Length( goal_origin - ai_nav.nodes[ start ].origin ), start );
+
+	bool found = false;
+	while( heap_size > 0 ) {
+		ai_heapnode_t current = AI_HeapPop( &heap_size );
+		if( current.node == goal ) {
+			found = true;
+			break;
+		}
+
+		const ai_navnode_t * node = &ai_nav.nodes[ current.node ];
+		float h = Length( goal_origin - node->origin );
+		if( current.f > ai_nav.cost[ current.node ] + h + 0.01f ) {
+			continue; // stale entry
+		}
+
+		for( int i = 0; i < node->num_edges; i++ ) {
+			const ai_navedge_t * edge = &ai_nav.edges[ node->first_edge + i ];
+			float cost = ai_nav.cost[ current.node ] + edge->cost;
+
+			if( ai_nav.visited[ edge->node ] == ai_nav.search && cost >= ai_nav.cost[ edge->node ] ) {
+				continue;
+			}
+
+			ai_nav.visited[ edge->node ] = ai_nav.search;
+			ai_nav.cost[ edge->node ] = cost;
+			ai_nav.parent[ edge->node ] = current.node;
+			AI_HeapPush( &heap_size, cost + Length( goal_origin - ai_nav.nodes[ edge->node ].origin ), edge->node );
+		}
+	}
+
+	if( !found ) {
+		return 0;
+	}
+
+	int length = 0;
+	for( int node = goal; node != -1; node = ai_nav.parent[ node ] ) {
+		length++;
+	}
+
+	// keep the start of the path if it's too long, we'll replan when we get there
+	int skip = Max2( 0, length - max_path );
+	int i = length - 1;
+	for( int node = goal; node != -1; node = ai_nav.parent[ node ] ) {
+		if( i < max_path ) {
+			path[ i ] = node;
+		}
+		i--;
+	}
+
+	return length - skip;
+}
+
+static const ai_navedge_t * AI_FindEdge( int from, int to ) {
+	const ai_navnode_t * node = &ai_nav.nodes[ from ];
+	for( int i = 0; i < node->num_edges; i++ ) {
+		if( ai_nav.edges[ node->first_edge + i ].node == to ) {
+			return &ai_nav.edges[ node->first_edge + i ];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * bots
+ */
+
+#define AI_MAX_PATH 128
+#define AI_REPLAN_INTERVAL 3000
+#define AI_STUCK_INTERVAL 1000
+#define AI_ENEMY_INTERVAL 200
+#define AI_MAX_ENEMY_TRACES 3
+#define AI_TURN_SPEED 540.0f // degrees per second
+#define AI_AIM_SPREAD 4.0f // degrees
+#define AI_GOAL_RADIUS 64.0f
+
+struct ai_bot_t {
+	Vec3 angles;
+
+	int path[ AI_MAX_PATH ];
+	int path_length;
+	int path_pos;
+	Vec3 path_goal;
+	int64_t next_replan;
+	int goal_node;
+
+	int site; // which bomb site this bot likes
+
+	Vec3 stuck_origin;
+	int64_t next_stuck_check;
+	int stuck_count;
+
+	edict_t * enemy;
+	int64_t next_enemy_check;
+	Vec3 aim_error;
+
+	float strafe;
+	int64_t next_strafe;
+};
+
+static ai_bot_t ai_bots[ MAX_CLIENTS ];
+
+// what the current gametype wants us to do, found once per frame
+struct ai_objectives_t {
+	int64_t time;
+
+	edict_t * sites[ 8 ];
+	int num_sites;
+
+	edict_t * bomb;
+	bool bomb_visible;
+	bool bomb_carried;
+};
+
+static ai_objectives_t ai_objectives;
+
+static void AI_ResetBot( edict_t * ent ) {
+	ai_bot_t * bot = &ai_bots[ PLAYERNUM( ent ) ];
+	memset( bot, 0, sizeof( *bot ) );
+	bot->angles = ent->s.angles;
+	bot->goal_node = -1;
+	bot->site = random_uniform( &svs.rng, 0, 8 );
+	bot->stuck_origin = ent->s.origin;
+	bot->strafe = random_p( &svs.rng, 0.5f ) ? 1.0f : -1.0f;
+}
+
+static const ai_objectives_t * AI_Objectives() {
+	if( ai_objectives.time == level.time ) {
+		return &ai_objectives;
+	}
+
+	memset( &ai_objectives, 0, sizeof( ai_objectives ) );
+	ai_objectives.time = level.time;
+
+	for( int i = server_gs.maxclients + 1; i < game.numentities; i++ ) {
+		edict_t * ent = &game.edicts[ i ];
+		if( !ent->r.inuse ) {
+			continue;
+		}
+
+		if( ent->s.type == ET_BOMB_SITE && ai_objectives.num_sites < int( ARRAY_COUNT( ai_objectives.sites ) ) ) {
+			ai_objectives.sites[ ai_objectives.num_sites++ ] = ent;
+		}
+		else if( ent->classname != NULL && strcmp( ent->classname, "bomb" ) == 0 ) {
+			ai_objectives.bomb = ent;
+			ai_objectives.bomb_visible = !( ent->r.svflags & SVF_NOCLIENT );
+		}
+	}
+
+	for( int i = 0; i < server_gs.maxclients; i++ ) {
+		const edict_t * ent = &game.edicts[ i + 1 ];
+		if( ent->r.inuse && ( ent->s.effects & EF_CARRIER ) ) {
+			ai_objectives.bomb_carried = true;
+		}
+	}
+
+	return &ai_objectives;
+}
+
+static bool AI_IsEnemy( const edict_t * self, const edict_t * other ) {
+	if( other == self || !other->r.inuse || !other->r.client ) {
+		return false;
+	}
+	if( G_ISGHOSTING( other ) || G_IsDead( other ) || other->s.team == TEAM_SPECTATOR ) {
+		return false;
+	}
+	return !GS_TeamBasedGametype( &server_gs ) || other->s.team != self->s.team;
+}
+
+static Vec3 AI_EyePosition( const edict_t * ent ) {
+	return ent->s.origin + Vec3( 0.0f, 0.0f, ent->viewheight );
+}
+
+static bool AI_CanSee( edict_t * self, edict_t * other ) {
+	trace_t tr;
+	G_Trace( &tr, AI_EyePosition( self ), Vec3( 0.0f ), Vec3( 0.0f ), AI_EyePosition( other ), self, MASK_OPAQUE );
+	return tr.fraction == 1.0f || tr.ent == ENTNUM( other );
+}
+
+static void AI_UpdateEnemy( edict_t * self, ai_bot_t * bot ) {
+	if( bot->enemy != NULL && !AI_IsEnemy( self, bot->enemy ) ) {
+		bot->enemy = NULL;
+	}
+
+	if( level.time < bot->next_enemy_check ) {
+		return;
+	}
+	bot->next_enemy_check = level.time + AI_ENEMY_INTERVAL;
+
+	// only trace to the closest few
+	edict_t * candidates[ AI_MAX_ENEMY_TRACES ] = { };
+	float distances[ AI_MAX_ENEMY_TRACES ];
+	for( int i = 0; i < AI_MAX_ENEMY_TRACES; i++ ) {
+		distances[ i ] = FLT_MAX;
+	}
+
+	for( int i = 0; i < server_gs.maxclients; i++ ) {
+		edict_t * other = &game.edicts[ i + 1 ];
+		if( !AI_IsEnemy( self, other ) ) {
+			continue;
+		}
+
+		float dist = LengthSquared( other->s.origin - self->s.origin );
+		for( int j = 0; j < AI_MAX_ENEMY_TRACES; j++ ) {
+			if( dist < distances[ j ] ) {
+				for( int k = AI_MAX_ENEMY_TRACES - 1; k > j; k-- ) {
+					candidates[ k ] = candidates[ k - 1 ];
+					distances[ k ] = distances[ k - 1 ];
+				}
+				candidates[ j ] = other;
+				distances[ j ] = dist;
+				break;
+			}
+		}
+	}
+
+	bot->enemy = NULL;
+	for( int i = 0; i < AI_MAX_ENEMY_TRACES && candidates[ i ] != NULL; i++ ) {
+		if( AI_CanSee( self, candidates[ i ] ) ) {
+			bot->enemy = candidates[ i ];
+			break;
+		}
+	}
+
+	bot->aim_error = Vec3(
+		random_uniform_float( &svs.rng, -AI_AIM_SPREAD, AI_AIM_SPREAD ),
+		random_uniform_float( &svs.rng, -AI_AIM_SPREAD, AI_AIM_SPREAD ),
+		0.0f
+	);
+}
+
+// works out where the gametype wants us to be. returns false if there's no objective
+static bool AI_ObjectiveGoal( edict_t * self, ai_bot_t * bot, Vec3 * goal, bool * crouch ) {
+	const ai_objectives_t * objectives = AI_Objectives();
+	*crouch = false;
+
+	if( objectives->num_sites == 0 ) {
+		return false;
+	}
+
+	int attacking_team = objectives->bomb != NULL ? objectives->bomb->s.team : TEAM_ALPHA;
+	bool attacking = self->s.team == attacking_team;
+
+	// carrying the bomb, crouch on the nearest site to plant it
+	if( self->s.effects & EF_CARRIER ) {
+		const edict_t * nearest = objectives->sites[ 0 ];
+		for( int i = 1; i < objectives->num_sites; i++ ) {
+			if( LengthSquared( objectives->sites[ i ]->s.origin - self->s.origin ) < LengthSquared( nearest->s.origin - self->s.origin ) ) {
+				nearest = objectives->sites[ i ];
+			}
+		}
+		*goal = nearest->s.origin;
+		*crouch = true;
+		return true;
+	}
+
+	// the bomb is on the ground, either dropped or planted. attackers go to
+	// it, which picks it up if it was dropped. defenders go to it if it's on
+	// a site and crouch next to it so they defuse it
+	if( objectives->bomb_visible && !objectives->bomb_carried ) {
+		bool on_site = false;
+		for( int i = 0; i < objectives->num_sites; i++ ) {
+			if( Length( objectives->sites[ i ]->s.origin - objectives->bomb->s.origin ) < 256.0f ) {
+				on_site = true;
+			}
+		}
+
+		if( attacking || on_site ) {
+			*goal = objectives->bomb->s.origin;
+			*crouch = !attacking;
+			return true;
+		}
+	}
+
+	*goal = objectives->sites[ bot->site % objectives->num_sites ]->s.origin;
+	return true;
+}
+
+static void AI_PickGoal( edict_t * self, ai_bot_t * bot, int start, Vec3 * goal, bool * crouch ) {
+	if( AI_ObjectiveGoal( self, bot, goal, crouch ) ) {
+		return;
+	}
+
+	// no objective, go after the closest enemy
+	edict_t * closest = NULL;
+	float closest_dist = FLT_MAX;
+	for( int i = 0; i < server_gs.maxclients; i++ ) {
+		edict_t * other = &game.edicts[ i + 1 ];
+		float dist = LengthSquared( other->s.origin - self->s.origin );
+		if( AI_IsEnemy( self, other ) && dist < closest_dist ) {
+			closest = other;
+			closest_dist = dist;
+		}
+	}
+
+	if( closest != NULL ) {
+		*goal = closest->s.origin;
+		return;
+	}
+
+	// or wander around. start is -1 while we're off the graph, e.g. falling
+	if( start != -1 && ( bot->goal_node == -1 || bot->path_pos >= bot->path_length ) ) {
+		for( int attempt = 0; attempt < 16; attempt++ ) {
+			int node = random_uniform( &svs.rng, 0, ai_nav.num_nodes );
+			if( ai_nav.nodes[ node ].component == ai_nav.nodes[ start ].component ) {
+				bot->goal_node = node;
+				break;
+			}
+		}
+	}
+
+	*goal = bot->goal_node != -1 ? ai_nav.nodes[ bot->goal_node ].origin : self->s.origin;
+}
+
+static void AI_Replan( edict_t * self, ai_bot_t * bot, int start, Vec3 goal ) {
+	bot->path_length = 0;
+	bot->path_pos = 0;
+	bot->path_goal = goal;
+	bot->next_replan = level.time + AI_REPLAN_INTERVAL + random_uniform( &svs.rng, 0, 1000 );
+
+	int end = AI_NearestNode( goal );
+	if( start == -1 || end == -1 ) {
+		return;
+	}
+
+	bot->path_length = AI_FindPath( start, end, bot->path, AI_MAX_PATH );
+	if( bot->path_length == 0 ) {
+		// unreachable, try somewhere else next time
+		bot->goal_node = -1;
+		bot->site = random_uniform( &svs.rng, 0, 8 );
+	}
+}
+
+// returns the horizontal direction we want to move in
+static Vec3 AI_Navigate( edict_t * self, ai_bot_t * bot, usercmd_t * ucmd ) {
+	int start = AI_NearestNode( self->s.origin );
+
+	Vec3 goal;
+	bool crouch;
+	AI_PickGoal( self, bot, start, &goal, &crouch );
+
+	Vec3 to_goal = goal - self->s.origin;
+	bool at_goal = Length( Vec3( to_goal.x, to_goal.y, 0.0f ) ) < AI_GOAL_RADIUS && Abs( to_goal.z ) < AI_NAV_JUMP_HEIGHT * 2.0f;
+	if( at_goal ) {
+		if( crouch ) {
+			ucmd->upmove = -127;
+			return Vec3( 0.0f );
+		}
+		return SafeNormalize( Vec3( to_goal.x, to_goal.y, 0.0f ) );
+	}
+
+	// unstick ourselves by jumping, then by picking a new route
+	if( level.time >= bot->next_stuck_check ) {
+		bot->next_stuck_check = level.time + AI_STUCK_INTERVAL;
+		if( Length( self->s.origin - bot->stuck_origin ) < 32.0f ) {
+			bot->stuck_count++;
+			ucmd->upmove = 127;
+			if( bot->stuck_count >= 2 ) {
+				bot->next_replan = 0;
+			}
+			if( bot->stuck_count >= 4 ) {
+				bot->goal_node = -1;
+				bot->site = random_uniform( &svs.rng, 0, 8 );
+				bot->stuck_count = 0;
+			}
+		}
+		else {
+			bot->stuck_count = 0;
+		}
+		bot->stuck_origin = self->s.origin;
+	}
+
+	if( level.time >= bot->next_replan || bot->path_pos >= bot->path_length || Length( goal - bot->path_goal ) > 128.0f ) {
+		AI_Replan( self, bot, start, goal );
+	}
+
+	if( bot->path_pos >= bot->path_length ) {
+		return SafeNormalize( Vec3( to_goal.x, to_goal.y, 0.0f ) );
+	}
+
+	// move on to the next node once we're close to this one
+	while( bot->path_pos < bot->path_length ) {
+		Vec3 d = ai_nav.nodes[ bot->path[ bot->path_pos ] ].origin - self->s.origin;
+		if( Length( Vec3( d.x, d.y, 0.0f ) ) > 24.0f || Abs( d.z ) > 48.0f ) {
+			break;
+		}
+		bot->path_pos++;
+	}
+
+	if( bot->path_pos >= bot->path_length ) {
+		return SafeNormalize( Vec3( to_goal.x, to_goal.y, 0.0f ) );
+	}
+
+	int target = bot->path[ bot->path_pos ];
+	if( bot->path_pos > 0 ) {
+		const ai_navedge_t * edge = AI_FindEdge( bot->path[ bot->path_pos - 1 ], target );
+		if( edge != NULL && edge->jump ) {
+			ucmd->upmove = 127;
+		}
+	}
+
+	Vec3 d = ai_nav.nodes[ target ].origin - self->s.origin;
+	return SafeNormalize( Vec3( d.x, d.y, 0.0f ) );
+}
+
+static void AI_TurnTowards( ai_bot_t * bot, Vec3 angles ) {
+	float max_turn = AI_TURN_SPEED * game.frametime * 0.001f;
+	for( int i = 0; i < 2; i++ ) {
+		float delta = AngleDelta( angles[ i ], bot->angles[ i ] );
+		bot->angles[ i ] = AngleNormalize180( bot->angles[ i ] + Clamp( -max_turn, delta, max_turn ) );
+	}
+	bot->angles.z = 0.0f;
+}
+
 void AI_SpawnBot() {
 	if( level.spawnedTimeStamp + 5000 > svs.realtime || !level.canSpawnEntities ) {
 		return;
@@ -70,6 +905,16 @@ void AI_Respawn( edict_t * ent ) {
 	ent->r.client->ps.pmove.delta_angles[ 1 ] = 0;
 	ent->r.client->ps.pmove.delta_angles[ 2 ] = 0;
 	ent->r.client->level.last_activity = level.time;
+
+	AI_ResetBot( ent );
+}
+
+void AI_InitLevel() {
+	memset( &ai_objectives, 0, sizeof( ai_objectives ) );
+}
+
+void AI_Shutdown() {
+	AI_FreeNavGraph();
 }
 
 static void AI_SpecThink( edict_t * self ) {
@@ -107,13 +952,60 @@ static void AI_GameThink( edict_t * self ) {
 		G_Match_Ready( self );
 	}
 
+	ai_bot_t * bot = &ai_bots[ PLAYERNUM( self ) ];
+
 	usercmd_t ucmd;
 	memset( &ucmd, 0, sizeof( usercmd_t ) );
 
+	AI_UpdateEnemy( self, bot );
+
+	Vec3 move = ai_nav.num_nodes > 0 ? AI_Navigate( self, bot, &ucmd ) : Vec3( 0.0f );
+
+	if( bot->enemy != NULL ) {
+		Vec3 target = bot->enemy->s.origin + Vec3( 0.0f, 0.0f, bot->enemy->viewheight * 0.6f );
+		Vec3 angles = VecToAngles( target - AI_EyePosition( self ) ) + bot->aim_error;
+		AI_TurnTowards( bot, angles );
+
+		if( Abs( AngleDelta( angles.x, bot->angles.x ) ) < AI_AIM_SPREAD * 2.0f && Abs( AngleDelta( angles.y, bot->angles.y ) ) < AI_AIM_SPREAD * 2.0f ) {
+			// let go every so often for weapons that don't autofire
+			if( level.time % 500 > 50 ) {
+				ucmd.buttons |= BUTTON_ATTACK;
+			}
+		}
+
+		// strafe around while fighting
+		if( level.time >= bot->next_strafe ) {
+			bot->strafe = -bot->strafe;
+			bot->next_strafe = level.time + random_uniform( &svs.rng, 400, 1200 );
+		}
+
+		Vec3 forward, right;
+		AngleVectors( Vec3( 0.0f, bot->angles.y, 0.0f ), &forward, &right, NULL );
+		move = SafeNormalize( move + right * bot->strafe );
+
+		if( random_p( &svs.rng, 0.02f ) ) {
+			ucmd.upmove = 127;
+		}
+	}
+	else if( move != Vec3( 0.0f ) ) {
+		AI_TurnTowards( bot, Vec3( 0.0f, VecToAngles( move ).y, 0.0f ) );
+	}
+
+	// move is in world space, pmove wants it relative to where we're looking
+	if( move != Vec3( 0.0f ) ) {
+		Vec3 forward, right;
+		AngleVectors( Vec3( 0.0f, bot->angles.y, 0.0f ), &forward, &right, NULL );
+		float f = Dot( move, forward );
+		float r = Dot( move, right );
+		float scale = 127.0f / Max2( Abs( f ), Abs( r ) );
+		ucmd.forwardmove = (s8)( f * scale );
+		ucmd.sidemove = (s8)( r * scale );
+	}
+
 	// set up for pmove
-	ucmd.angles[ 0 ] = (short)ANGLE2SHORT( self->s.angles.x ) - self->r.client->ps.pmove.delta_angles[ 0 ];
-	ucmd.angles[ 1 ] = (short)ANGLE2SHORT( self->s.angles.y ) - self->r.client->ps.pmove.delta_angles[ 1 ];
-	ucmd.angles[ 2 ] = (short)ANGLE2SHORT( self->s.angles.z ) - self->r.client->ps.pmove.delta_angles[ 2 ];
+	ucmd.angles[ 0 ] = (short)ANGLE2SHORT( bot->angles.x ) - self->r.client->ps.pmove.delta_angles[ 0 ];
+	ucmd.angles[ 1 ] = (short)ANGLE2SHORT( bot->angles.y ) - self->r.client->ps.pmove.delta_angles[ 1 ];
+	ucmd.angles[ 2 ] = (short)ANGLE2SHORT( bot->angles.z ) - self->r.client->ps.pmove.delta_angles[ 2 ];
 
 	self->r.client->ps.pmove.delta_angles[ 0 ] = 0;
 	self->r.client->ps.pmove.delta_angles[ 1 ] = 0;
@@ -1,5 +1,8 @@
 #pragma once
 
+void AI_LoadMap();
+void AI_Shutdown();
+void AI_InitLevel();
 void AI_SpawnBot();
 void AI_Respawn( edict_t * ent );
 void AI_Think( edict_t * self );
@@ -20,6 +20,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "game/g_local.h"
 #include "qcommon/cmodel.h"
+#include "qcommon/hash.h"
+#include "qcommon/hashtable.h"
+#include "qcommon/threads.h"
+
+#include <algorithm>
 
 //===============================================================================
 //
@@ -43,16 +48,30 @@ typedef struct
 	Vec3 mins;
 	Vec3 maxs;
 	Vec3 size;
-	int marknumber;
-
-	// since the areagrid can have multiple references to one entity,
-	// we should avoid extensive checking on entities already encountered
-	int entmarknumber[MAX_EDICTS];
 } areagrid_t;
 
 static areagrid_t g_areagrid;
 
-#define CFRAME_UPDATE_BACKUP    64  // copies of SyncEntityState to keep buffered (1 second of backup at 62 fps).
+// bumped every time an entity is linked or unlinked
+static int64_t g_relinks;
+
+static s32 g_tracecache_total_hits;
+static s32 g_tracecache_total_misses;
+static s32 g_tracecache_plotted_hits;
+static s32 g_tracecache_plotted_misses;
+
+// since the areagrid can have multiple references to one entity,
+// we should avoid extensive checking on entities already encountered.
+// the marks are per thread so area queries can run in parallel
+typedef struct
+{
+	int marknumber;
+	int entmarknumber[MAX_EDICTS];
+} areamarks_t;
+
+static thread_local areamarks_t g_areamarks;
+
+#define CFRAME_UPDATE_BACKUP    64  // frames of collision history to keep buffered (1 second of backup at 62 fps).
 #define CFRAME_UPDATE_MASK  ( CFRAME_UPDATE_BACKUP - 1 )
 
 struct c4clipedict_t {
@@ -60,85 +79,118 @@ struct c4clipedict_t {
 	entity_shared_t r;
 };
 
-//backups of all server frames areas and edicts
+// only what antilag needs from the entities it can move back in time, stored
+// structure of arrays and sorted by entity number
 struct c4frame_t {
-	c4clipedict_t clipEdicts[MAX_EDICTS];
+	int64_t timestamp;
 	int numedicts;
 
-	int64_t timestamp;
-	int64_t framenum;
+	u16 entnums[MAX_EDICTS];
+	Vec3 origins[MAX_EDICTS];
+	Vec3 angles[MAX_EDICTS];
+	Vec3 mins[MAX_EDICTS];
+	Vec3 maxs[MAX_EDICTS];
+	Vec3 absmins[MAX_EDICTS];
+	Vec3 absmaxs[MAX_EDICTS];
+};
+
+// the run of consecutive frames an entity has been backed up in with the same solidity
+struct c4history_t {
+	int64_t first_framenum;
+	int64_t last_framenum;
+	solid_t solid;
 };
 
 static c4frame_t sv_collisionframes[CFRAME_UPDATE_BACKUP];
+static c4history_t sv_collisionhistory[MAX_EDICTS];
 static int64_t sv_collisionFrameNum = 0;
 
-void GClip_BackUpCollisionFrame() {
-	c4frame_t *cframe;
-	edict_t *svedict;
-	int i;
-
-	// fixme: should check for any validation here?
+/*
+* GClip_IsLagCompensated
+*
+* Moving world brushes always use their latest position and things that
+* never move have nothing worth remembering, but players do even when they
+* stop moving
+*/
+static bool GClip_IsLagCompensated( const edict_t *ent ) {
+	if( !ent->r.inuse || ent->r.solid == SOLID_NOT ) {
+		return false;
+	}
+	if( ent->r.solid == SOLID_TRIGGER && ent->r.client == NULL ) {
+		return false;
+	}
+	if( ent->movetype == MOVETYPE_PUSH ) {
+		return false;
+	}
+	return ent->movetype != MOVETYPE_NONE || ent->r.client != NULL;
+}
 
-	cframe = &sv_collisionframes[sv_collisionFrameNum & CFRAME_UPDATE_MASK];
+void GClip_BackUpCollisionFrame() {
+	int64_t framenum = sv_collisionFrameNum;
+	c4frame_t *cframe = &sv_collisionframes[framenum & CFRAME_UPDATE_MASK];
 	cframe->timestamp = svs.gametime;
-	cframe->framenum = sv_collisionFrameNum;
+	cframe->numedicts = 0;
 	sv_collisionFrameNum++;
 
-	//memset( cframe->clipEdicts, 0, sizeof(cframe->clipEdicts) );
-
-	//backup edicts
-	for( i = 0; i < game.numentities; i++ ) {
-		svedict = &game.edicts[i];
-
-		cframe->clipEdicts[i].r.inuse = svedict->r.inuse;
-		cframe->clipEdicts[i].r.solid = svedict->r.solid;
-		if( !svedict->r.inuse || svedict->r.solid == SOLID_NOT
-			|| ( svedict->r.solid == SOLID_TRIGGER && !( i >= 1 && i <= server_gs.maxclients ) ) ) {
+	for( int i = 1; i < game.numentities; i++ ) {
+		const edict_t *svedict = &game.edicts[i];
+		if( !GClip_IsLagCompensated( svedict ) ) {
 			continue;
 		}
 
-		cframe->clipEdicts[i].r = svedict->r;
-		cframe->clipEdicts[i].s = svedict->s;
+		c4history_t *history = &sv_collisionhistory[i];
+		if( history->last_framenum != framenum - 1 || history->solid != svedict->r.solid ) {
+			history->first_framenum = framenum;
+			history->solid = svedict->r.solid;
+		}
+		history->last_framenum = framenum;
+
+		int idx = cframe->numedicts;
+		cframe->entnums[idx] = i;
+		cframe->origins[idx] = svedict->s.origin;
+		cframe->angles[idx] = svedict->s.angles;
+		cframe->mins[idx] = svedict->r.mins;
+		cframe->maxs[idx] = svedict->r.maxs;
+		cframe->absmins[idx] = svedict->r.absmin;
+		cframe->absmaxs[idx] = svedict->r.absmax;
+		cframe->numedicts++;
 	}
-	cframe->numedicts = game.numentities;
+}
+
+static int GClip_FindInCollisionFrame( const c4frame_t *cframe, int entNum ) {
+	const u16 *first = cframe->entnums;
+	const u16 *last = cframe->entnums + cframe->numedicts;
+	const u16 *it = std::lower_bound( first, last, entNum );
+	assert( it != last && *it == entNum );
+	return it - first;
 }
 
 static c4clipedict_t *GClip_GetClipEdictForDeltaTime( int entNum, int deltaTime ) {
-	static int index = 0;
-	static c4clipedict_t clipEnts[8];
-	static c4clipedict_t *clipent;
-	static c4clipedict_t clipentNewer; // for interpolation
-	c4frame_t *cframe = NULL;
-	int64_t backTime, cframenum;
-	unsigned bf;
-	edict_t *ent = game.edicts + entNum;
+	static thread_local int index = 0;
+	static thread_local c4clipedict_t clipEnts[8];
+	const edict_t *ent = game.edicts + entNum;
 
 	// pick one of the 8 slots to prevent overwritings
-	clipent = &clipEnts[index];
+	c4clipedict_t *clipent = &clipEnts[index];
 	index = ( index + 1 ) & 7;
 
-	if( !entNum || deltaTime >= 0 ) { // current time entity
-		clipent->r = ent->r;
-		clipent->s = ent->s;
-		return clipent;
-	}
+	// data that is not backed up always comes from the current entity
+	clipent->r = ent->r;
+	clipent->s = ent->s;
 
-	if( !ent->r.inuse || ent->r.solid == SOLID_NOT
-		|| ( ent->r.solid == SOLID_TRIGGER && !( entNum >= 1 && entNum <= server_gs.maxclients ) ) ) {
-		clipent->r = ent->r;
-		clipent->s = ent->s;
+	if( !entNum || deltaTime >= 0 || !GClip_IsLagCompensated( ent ) ) { // current time entity
 		return clipent;
 	}
 
-	// always use the latest information about moving world brushes
-	if( ent->movetype == MOVETYPE_PUSH ) {
-		clipent->r = ent->r;
-		clipent->s = ent->s;
+	// if the solid has changed since the last backup we can't move backwards at all
+	int64_t newest = sv_collisionFrameNum - 1;
+	const c4history_t *history = &sv_collisionhistory[entNum];
+	if( newest < 0 || history->last_framenum != newest || history->solid != ent->r.solid ) {
 		return clipent;
 	}
 
 	// clamp delta time inside the backed up limits
-	backTime = Abs( deltaTime );
+	int64_t backTime = Abs( deltaTime );
 	if( g_antilag_maxtimedelta->integer ) {
 		if( g_antilag_maxtimedelta->integer < 0 ) {
 			Cvar_SetValue( "g_antilag_maxtimedelta", Abs( g_antilag_maxtimedelta->integer ) );
@@ -147,63 +199,62 @@ static c4clipedict_t *GClip_GetClipEdictForDeltaTime( int entNum, int deltaTime
 			backTime = (int64_t)g_antilag_maxtimedelta->integer;
 		}
 	}
-
-	// find the first snap with timestamp < than realtime - backtime
-	cframenum = sv_collisionFrameNum;
-	for( bf = 1; bf < CFRAME_UPDATE_BACKUP && bf < sv_collisionFrameNum; bf++ ) { // never overpass limits
-		cframe = &sv_collisionframes[( cframenum - bf ) & CFRAME_UPDATE_MASK];
-
-		// if solid has changed, we can't keep moving backwards
-		if( ent->r.solid != cframe->clipEdicts[entNum].r.solid
-			|| ent->r.inuse != cframe->clipEdicts[entNum].r.inuse ) {
-			bf--;
-			if( bf == 0 ) {
-				// we can't step back from first
-				cframe = NULL;
-			} else {
-				cframe = &sv_collisionframes[( cframenum - bf ) & CFRAME_UPDATE_MASK];
-			}
-			break;
-		}
-
-		if( svs.gametime >= cframe->timestamp + backTime ) {
-			break;
+	int64_t backTimestamp = svs.gametime - backTime;
+
+	// frame timestamps increase with the frame number, so binary search for
+	// the newest frame at or before the time we want
+	int64_t oldest = Max2( history->first_framenum, sv_collisionFrameNum - ( CFRAME_UPDATE_BACKUP - 1 ) );
+	int64_t lo = oldest;
+	int64_t hi = newest + 1;
+	while( lo < hi ) {
+		int64_t mid = lo + ( hi - lo ) / 2;
+		if( sv_collisionframes[mid & CFRAME_UPDATE_MASK].timestamp <= backTimestamp ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
 	}
 
-	if( !cframe ) {
-		// current time entity
-		clipent->r = ent->r;
-		clipent->s = ent->s;
-		return clipent;
-	}
+	// nothing old enough, use the oldest we have
+	int64_t framenum = Max2( lo - 1, oldest );
+	const c4frame_t *cframe = &sv_collisionframes[framenum & CFRAME_UPDATE_MASK];
+	int idx = GClip_FindInCollisionFrame( cframe, entNum );
 
-	// setup with older for the data that is not interpolated
-	*clipent = cframe->clipEdicts[entNum];
+	clipent->s.origin = cframe->origins[idx];
+	clipent->s.angles = cframe->angles[idx];
+	clipent->r.mins = cframe->mins[idx];
+	clipent->r.maxs = cframe->maxs[idx];
+	clipent->r.absmin = cframe->absmins[idx];
+	clipent->r.absmax = cframe->absmaxs[idx];
 
 	// if we found an older than desired backtime frame, interpolate to find a more precise position.
-	if( svs.gametime > cframe->timestamp + backTime ) {
-		float lerpFrac;
-
-		if( bf == 1 ) {
-			// interpolate from 1st backed up to current
-			lerpFrac = (float)( ( svs.gametime - backTime ) - cframe->timestamp )
-					   / (float)( svs.gametime - cframe->timestamp );
-			clipentNewer.r = ent->r;
-			clipentNewer.s = ent->s;
+	if( cframe->timestamp < backTimestamp ) {
+		int64_t newerTimestamp;
+		Vec3 newerOrigin, newerAngles, newerMins, newerMaxs;
+
+		if( framenum == newest ) {
+			// interpolate from last backed up to current
+			newerTimestamp = svs.gametime;
+			newerOrigin = ent->s.origin;
+			newerAngles = ent->s.angles;
+			newerMins = ent->r.mins;
+			newerMaxs = ent->r.maxs;
 		} else {
 			// interpolate between 2 backed up
-			c4frame_t *cframeNewer = &sv_collisionframes[( cframenum - ( bf - 1 ) ) & CFRAME_UPDATE_MASK];
-			lerpFrac = (float)( ( svs.gametime - backTime ) - cframe->timestamp )
-					   / (float)( cframeNewer->timestamp - cframe->timestamp );
-			clipentNewer = cframeNewer->clipEdicts[entNum];
+			const c4frame_t *cframeNewer = &sv_collisionframes[( framenum + 1 ) & CFRAME_UPDATE_MASK];
+			int newerIdx = GClip_FindInCollisionFrame( cframeNewer, entNum );
+			newerTimestamp = cframeNewer->timestamp;
+			newerOrigin = cframeNewer->origins[newerIdx];
+			newerAngles = cframeNewer->angles[newerIdx];
+			newerMins = cframeNewer->mins[newerIdx];
+			newerMaxs = cframeNewer->maxs[newerIdx];
 		}
 
-		// interpolate
-		clipent->s.origin = Lerp( clipent->s.origin, lerpFrac, clipentNewer.s.origin );
-		clipent->r.mins = Lerp( clipent->r.mins, lerpFrac, clipentNewer.r.mins );
-		clipent->r.maxs = Lerp( clipent->r.maxs, lerpFrac, clipentNewer.r.maxs );
-		clipent->s.angles = LerpAngles( clipent->s.angles, lerpFrac, clipentNewer.s.angles );
+		float lerpFrac = (float)( backTimestamp - cframe->timestamp ) / (float)( newerTimestamp - cframe->timestamp );
+		clipent->s.origin = Lerp( clipent->s.origin, lerpFrac, newerOrigin );
+		clipent->r.mins = Lerp( clipent->r.mins, lerpFrac, newerMins );
+		clipent->r.maxs = Lerp( clipent->r.maxs, lerpFrac, newerMaxs );
+		clipent->s.angles = LerpAngles( clipent->s.angles, lerpFrac, newerAngles );
 	}
 
 	// back time entity
@@ -234,11 +285,6 @@ static void GClip_InsertLinkBefore( link_t *l, link_t *before, int entNum ) {
 * GClip_Init_AreaGrid
 */
 static void GClip_Init_AreaGrid( areagrid_t *areagrid, Vec3 world_mins, Vec3 world_maxs ) {
-	// the areagrid_marknumber is not allowed to be 0
-	if( areagrid->marknumber < 1 ) {
-		areagrid->marknumber = 1;
-	}
-
 	// choose either the world box size, or a larger box to ensure the grid isn't too fine
 	areagrid->size.x = Max2( world_maxs.x - world_mins.x, AREA_GRID * AREA_GRIDMINSIZE );
 	areagrid->size.y = Max2( world_maxs.y - world_mins.y, AREA_GRID * AREA_GRIDMINSIZE );
@@ -261,8 +307,6 @@ static void GClip_Init_AreaGrid( areagrid_t *areagrid, Vec3 world_mins, Vec3 wor
 		GClip_ClearLink( &areagrid->grid[i] );
 	}
 
-	memset( areagrid->entmarknumber, 0, sizeof( areagrid->entmarknumber ) );
-
 	if( developer->integer ) {
 		Com_Printf( "areagrid settings: divisions %ix%ix1 : box %f %f %f "
 					": %f %f %f size %f %f %f grid %f %f %f (mingrid %f)\n",
@@ -343,7 +387,8 @@ static int GClip_EntitiesInBox_AreaGrid( areagrid_t *areagrid, Vec3 mins, Vec3 m
 
 	// FIXME: if areagrid_marknumber wraps, all entities need their
 	// ent->priv.server->areagridmarknumber reset
-	areagrid->marknumber++;
+	areamarks_t *marks = &g_areamarks;
+	marks->marknumber++;
 
 	igridmins[0] = (int) floorf( ( paddedmins.x + areagrid->bias.x ) * areagrid->scale.x );
 	igridmins[1] = (int) floorf( ( paddedmins.y + areagrid->bias.y ) * areagrid->scale.y );
@@ -374,10 +419,10 @@ static int GClip_EntitiesInBox_AreaGrid( areagrid_t *areagrid, Vec3 mins, Vec3 m
 		for( l = grid->next; l != grid; l = l->next ) {
 			clipEnt = GClip_GetClipEdictForDeltaTime( l->entNum, timeDelta );
 
-			if( areagrid->entmarknumber[l->entNum] == areagrid->marknumber ) {
+			if( marks->entmarknumber[l->entNum] == marks->marknumber ) {
 				continue;
 			}
-			areagrid->entmarknumber[l->entNum] = areagrid->marknumber;
+			marks->entmarknumber[l->entNum] = marks->marknumber;
 
 			if( !clipEnt->r.inuse ) {
 				continue; // deactivated
@@ -411,10 +456,10 @@ static int GClip_EntitiesInBox_AreaGrid( areagrid_t *areagrid, Vec3 mins, Vec3 m
 			for( l = grid->next; l != grid; l = l->next ) {
 				clipEnt = GClip_GetClipEdictForDeltaTime( l->entNum, timeDelta );
 
-				if( areagrid->entmarknumber[l->entNum] == areagrid->marknumber ) {
+				if( marks->entmarknumber[l->entNum] == marks->marknumber ) {
 					continue;
 				}
-				areagrid->entmarknumber[l->entNum] = areagrid->marknumber;
+				marks->entmarknumber[l->entNum] = marks->marknumber;
 
 				if( !clipEnt->r.inuse ) {
 					continue; // deactivated
@@ -452,6 +497,19 @@ void GClip_ClearWorld() {
 	CM_InlineModelBounds( svs.cms, world_model, &world_mins, &world_maxs );
 
 	GClip_Init_AreaGrid( &g_areagrid, world_mins, world_maxs );
+
+	// don't let entities of the new map inherit the old map's history
+	for( c4history_t & history : sv_collisionhistory ) {
+		history.last_framenum = -1;
+		history.solid = SOLID_NOT;
+	}
+
+	// or its cached traces
+	g_relinks++;
+	g_tracecache_total_hits = 0;
+	g_tracecache_total_misses = 0;
+	g_tracecache_plotted_hits = 0;
+	g_tracecache_plotted_misses = 0;
 }
 
 /*
@@ -465,6 +523,7 @@ void GClip_UnlinkEntity( edict_t *ent ) {
 	}
 	GClip_UnlinkEntity_AreaGrid( ent );
 	ent->linked = false;
+	g_relinks++;
 }
 
 /*
@@ -577,10 +636,21 @@ void GClip_LinkEntity( edict_t *ent ) {
 	}
 	ent->linkcount++;
 	ent->linked = true;
+	g_relinks++;
 
 	GClip_LinkEntity_AreaGrid( &g_areagrid, ent );
 }
 
+/*
+* GClip_NumRelinks
+*
+* Returns a counter that changes whenever anything is linked or unlinked,
+* so callers can tell when what they know about the world went stale
+*/
+int64_t GClip_NumRelinks() {
+	return g_relinks;
+}
+
 /*
 * GClip_SetAreaPortalState
 *
@@ -773,6 +843,135 @@ static void GClip_TraceBounds( Vec3 start, Vec3 mins, Vec3 maxs, Vec3 end, Vec3
 	}
 }
 
+//===========================================================================
+//
+// TRACE CACHE
+//
+// Game code often traces the exact same move several times in a frame (touch
+// checks, radius damage visibility, bots), so GClip_Trace keeps its results
+// until the next frame or until anything is linked or unlinked. Changing how
+// an entity collides (solid, owner) without relinking it doesn't empty the
+// cache, so code that does that and then traces again in the same frame has
+// to call GClip_FlushTraceCache. G_Killed and KillBox do, but gametype
+// scripts write solid, owner and svflags directly, so it's off by default.
+//
+// The cache is per thread so pmoves running on the thread pool can use it.
+//
+//===========================================================================
+
+#define TRACE_CACHE_ENTRIES 256
+
+typedef struct {
+	Vec3 start, end;
+	Vec3 mins, maxs;
+	int passent;
+	int contentmask;
+	int timeDelta;
+} tracecache_key_t;
+
+typedef struct {
+	tracecache_key_t key;
+	trace_t trace;
+} tracecache_entry_t;
+
+typedef struct {
+	int64_t gametime;
+	int64_t relinks;
+
+	Hashtable< TRACE_CACHE_ENTRIES * 2 > indices;
+	int num_entries;
+	tracecache_entry_t entries[TRACE_CACHE_ENTRIES];
+
+	s32 hits, misses;
+} tracecache_t;
+
+static thread_local tracecache_t g_localtracecache;
+
+/*
+* GClip_AddTraceCacheStats
+*/
+static void GClip_AddTraceCacheStats( tracecache_t *cache ) {
+	if( cache->hits + cache->misses > 0 ) {
+		AtomicAdd( &g_tracecache_total_hits, cache->hits );
+		AtomicAdd( &g_tracecache_total_misses, cache->misses );
+		cache->hits = 0;
+		cache->misses = 0;
+	}
+}
+
+/*
+* GClip_TraceCache
+*
+* Returns this thread's trace cache, emptied if the world changed since it
+* was filled
+*/
+static tracecache_t *GClip_TraceCache() {
+	tracecache_t *cache = &g_localtracecache;
+	if( cache->gametime == svs.gametime && cache->relinks == g_relinks ) {
+		return cache;
+	}
+
+	GClip_AddTraceCacheStats( cache );
+
+	cache->gametime = svs.gametime;
+	cache->relinks = g_relinks;
+	cache->indices.clear();
+	cache->num_entries = 0;
+
+	return cache;
+}
+
+/*
+* GClip_FlushTraceCache
+*
+* Empties every thread's trace cache, for when an entity stops or starts
+* blocking traces without being relinked
+*/
+void GClip_FlushTraceCache() {
+	g_relinks++;
+}
+
+/*
+* GClip_PlotTraceCache
+*
+* Called at the end of every frame. Pool threads add their counts when their
+* cache next empties, so their share shows up a frame late
+*/
+void GClip_PlotTraceCache() {
+	GClip_AddTraceCacheStats( &g_localtracecache );
+
+	s32 hits = AtomicLoad( &g_tracecache_total_hits );
+	s32 misses = AtomicLoad( &g_tracecache_total_misses );
+	s32 frame_hits = hits - g_tracecache_plotted_hits;
+	s32 frame_lookups = frame_hits + misses - g_tracecache_plotted_misses;
+	g_tracecache_plotted_hits = hits;
+	g_tracecache_plotted_misses = misses;
+
+	if( frame_lookups > 0 ) {
+		TracyPlot( "Trace cache hit rate", float( frame_hits ) / float( frame_lookups ) );
+	}
+}
+
+static u64 GClip_TraceCacheHash( const tracecache_key_t *key ) {
+	u64 hash = Hash64( key, sizeof( *key ) );
+	hash &= ~( U64( 1 ) << U64( 63 ) );
+	return hash == 0 ? 1 : hash;
+}
+
+/*
+* GClip_PrintTraceCacheStats
+*/
+void GClip_PrintTraceCacheStats() {
+	s32 hits = g_tracecache_total_hits;
+	s32 lookups = hits + g_tracecache_total_misses;
+	if( lookups == 0 ) {
+		Com_Printf( "No traces cached on this map yet\n" );
+		return;
+	}
+
+	Com_Printf( "Trace cache: %d hits out of %d traces (%.1f%%) on this map\n", hits, lookups, 100.0f * hits / lookups );
+}
+
 /*
 * G_Trace
 *
@@ -829,12 +1028,54 @@ static void GClip_Trace( trace_t *tr, Vec3 start, Vec3 mins, Vec3 maxs,
 	GClip_ClipMoveToEntities( &clip, timeDelta );
 }
 
+/*
+* GClip_CachedTrace
+*
+* GClip_Trace through the trace cache
+*/
+static void GClip_CachedTrace( trace_t *tr, Vec3 start, Vec3 mins, Vec3 maxs,
+							   Vec3 end, edict_t *passedict, int contentmask, int timeDelta ) {
+	if( !tr || !g_tracecache->integer ) {
+		GClip_Trace( tr, start, mins, maxs, end, passedict, contentmask, timeDelta );
+		return;
+	}
+
+	tracecache_key_t key;
+	memset( &key, 0, sizeof( key ) );
+	key.start = start;
+	key.end = end;
+	key.mins = mins;
+	key.maxs = maxs;
+	key.passent = passedict ? ENTNUM( passedict ) : -1;
+	key.contentmask = contentmask;
+	key.timeDelta = timeDelta;
+
+	tracecache_t *cache = GClip_TraceCache();
+	u64 hash = GClip_TraceCacheHash( &key );
+
+	u64 idx;
+	if( cache->indices.get( hash, &idx ) && memcmp( &cache->entries[idx].key, &key, sizeof( key ) ) == 0 ) {
+		*tr = cache->entries[idx].trace;
+		cache->hits++;
+		return;
+	}
+
+	cache->misses++;
+	GClip_Trace( tr, start, mins, maxs, end, passedict, contentmask, timeDelta );
+
+	if( cache->num_entries < TRACE_CACHE_ENTRIES && cache->indices.add( hash, cache->num_entries ) ) {
+		tracecache_entry_t *entry = &cache->entries[cache->num_entries++];
+		entry->key = key;
+		entry->trace = *tr;
+	}
+}
+
 void G_Trace( trace_t *tr, Vec3 start, Vec3 mins, Vec3 maxs, Vec3 end, edict_t *passedict, int contentmask ) {
-	GClip_Trace( tr, start, mins, maxs, end, passedict, contentmask, 0 );
+	GClip_CachedTrace( tr, start, mins, maxs, end, passedict, contentmask, 0 );
 }
 
 void G_Trace4D( trace_t *tr, Vec3 start, Vec3 mins, Vec3 maxs, Vec3 end, edict_t *passedict, int contentmask, int timeDelta ) {
-	GClip_Trace( tr, start, mins, maxs, end, passedict, contentmask, timeDelta );
+	GClip_CachedTrace( tr, start, mins, maxs, end, passedict, contentmask, timeDelta );
 }
 
 bool IsHeadshot( int entNum, Vec3 hit, int timeDelta ) {
@@ -134,6 +134,9 @@ void G_Killed( edict_t *targ, edict_t *inflictor, edict_t *attacker, int assisto
 	G_Gametype_ScoreEvent( attacker ? attacker->r.client : NULL, "kill", va( "%i %i %i %i", targ->s.number, ( inflictor == world ) ? -1 : ENTNUM( inflictor ), ENTNUM( attacker ), mod ) );
 
 	G_CallDie( targ, inflictor, attacker, assistorNo, damage, point );
+
+	// die functions make things non-solid without relinking them
+	GClip_FlushTraceCache();
 }
 
 /*
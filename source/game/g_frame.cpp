@@ -428,6 +428,8 @@ static void G_RunEntities() {
 static void G_RunClients() {
 	ZoneScoped;
 
+	G_PredictClientMoves();
+
 	for( int i = 0; i < server_gs.maxclients; i++ ) {
 		edict_t *ent = game.edicts + 1 + i;
 		if( !ent->r.inuse ) {
@@ -488,6 +490,7 @@ void G_RunFrame( unsigned int msec ) {
 	G_RunEntities();
 	G_RunGametype();
 	GClip_BackUpCollisionFrame();
+	GClip_PlotTraceCache();
 
 	game.prevServerTime = svs.gametime;
 }
@@ -222,6 +222,8 @@ extern cvar_t *g_respawn_delay_max;
 extern cvar_t *g_deadbody_followkiller;
 extern cvar_t *g_antilag_timenudge;
 extern cvar_t *g_antilag_maxtimedelta;
+extern cvar_t *g_parallel_pmove;
+extern cvar_t *g_tracecache;
 
 extern cvar_t *g_teams_maxplayers;
 extern cvar_t *g_teams_allow_uneven;
@@ -487,6 +489,10 @@ void GClip_SetBrushModel( edict_t * ent );
 void GClip_SetAreaPortalState( edict_t *ent, bool open );
 void GClip_LinkEntity( edict_t *ent );
 void GClip_UnlinkEntity( edict_t *ent );
+int64_t GClip_NumRelinks();
+void GClip_FlushTraceCache();
+void GClip_PlotTraceCache();
+void GClip_PrintTraceCacheStats();
 void GClip_TouchTriggers( edict_t *ent );
 void G_PMoveTouchTriggers( pmove_t *pm, Vec3 previous_origin );
 SyncEntityState *G_GetEntityStateForDeltaTime( int entNum, int deltaTime );
@@ -558,6 +564,7 @@ score_stats_t * G_ClientGetStats( edict_t * ent );
 void G_ClientClearStats( edict_t *ent );
 void G_GhostClient( edict_t *self );
 void ClientThink( edict_t *ent, usercmd_t *cmd, int timeDelta );
+void G_PredictClientMoves();
 void G_ClientThink( edict_t *ent );
 void G_CheckClientRespawnClick( edict_t *ent );
 bool ClientConnect( edict_t *ent, char *userinfo, bool fakeClient );
@@ -60,6 +60,8 @@ cvar_t *g_maxtimeouts;
 cvar_t *g_antilag;
 cvar_t *g_antilag_maxtimedelta;
 cvar_t *g_antilag_timenudge;
+cvar_t *g_parallel_pmove;
+cvar_t *g_tracecache;
 cvar_t *g_autorecord;
 cvar_t *g_autorecord_maxdemos;
 
@@ -164,6 +166,8 @@ void G_Init( unsigned int framemsec ) {
 	g_antilag_maxtimedelta->modified = true;
 	g_antilag_timenudge = Cvar_Get( "g_antilag_timenudge", "0", CVAR_ARCHIVE );
 	g_antilag_timenudge->modified = true;
+	g_parallel_pmove = Cvar_Get( "g_parallel_pmove", "1", CVAR_ARCHIVE );
+	g_tracecache = Cvar_Get( "g_tracecache", "0", CVAR_ARCHIVE );
 
 	g_allow_spectator_voting = Cvar_Get( "g_allow_spectator_voting", "1", CVAR_ARCHIVE );
 
@@ -233,6 +237,8 @@ void G_Shutdown() {
 
 	G_LevelFreePool();
 
+	AI_Shutdown();
+
 	for( int i = 0; i < game.numentities; i++ ) {
 		if( game.edicts[i].r.inuse ) {
 			G_FreeEdict( &game.edicts[i] );
@@ -393,6 +393,7 @@ void G_InitLevel( const char *mapname, int64_t levelTime ) {
 	int entstrlen = CM_EntityStringLen( svs.cms );
 	G_LevelInitPool( strlen( mapname ) + 1 + ( entstrlen + 1 ) * 2 + G_LEVELPOOL_BASE_SIZE );
 	G_StringPoolInit();
+	AI_InitLevel();
 
 	level.time = levelTime;
 
@@ -499,6 +500,8 @@ void G_LoadMap( const char * name ) {
 
 	server_gs.gameState.map = StringHash( base_hash );
 	server_gs.gameState.map_checksum = svs.cms->checksum;
+
+	AI_LoadMap();
 }
 
 void G_HotloadMap() {
@@ -514,6 +517,7 @@ void G_Aasdf() {
 	int len = CM_EntityStringLen( svs.cms );
 	G_LevelInitPool( strlen( sv.mapname ) + 1 + ( len + 1 ) * 2 + G_LEVELPOOL_BASE_SIZE );
 	G_StringPoolInit();
+	AI_InitLevel();
 
 	level.mapString = ( char * )G_LevelMalloc( len + 1 );
 	level.mapStrlen = len;
@@ -326,6 +326,13 @@ static void Cmd_WriteIP_f() {
 	SV_WriteIPList();
 }
 
+/*
+* Cmd_TraceCacheStats_f
+*/
+static void Cmd_TraceCacheStats_f() {
+	GClip_PrintTraceCacheStats();
+}
+
 /*
 * G_AddCommands
 */
@@ -343,6 +350,8 @@ void G_AddServerCommands() {
 	Cmd_AddCommand( "removeip", Cmd_RemoveIP_f );
 	Cmd_AddCommand( "listip", Cmd_ListIP_f );
 	Cmd_AddCommand( "writeip", Cmd_WriteIP_f );
+
+	Cmd_AddCommand( "tracecachestats", Cmd_TraceCacheStats_f );
 }
 
 /*
@@ -362,4 +371,6 @@ void G_RemoveCommands() {
 	Cmd_RemoveCommand( "removeip" );
 	Cmd_RemoveCommand( "listip" );
 	Cmd_RemoveCommand( "writeip" );
+
+	Cmd_RemoveCommand( "tracecachestats" );
 }
@@ -999,6 +999,9 @@ bool KillBox( edict_t *ent, int mod, Vec3 knockback ) {
 	trace_t tr;
 	bool telefragged = false;
 
+	// callers can have just made ent solid without relinking it
+	GClip_FlushTraceCache();
+
 	while( 1 ) {
 		G_Trace( &tr, ent->s.origin, ent->r.mins, ent->r.maxs, ent->s.origin, world, MASK_PLAYERSOLID );
 		if( ( tr.fraction == 1.0f && !tr.startsolid ) || tr.ent < 0 ) {
@@ -18,6 +18,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "game/g_local.h"
+#include "qcommon/threadpool.h"
+
+#include <algorithm>
 
 constexpr int PLAYER_MASS = 200;
 
@@ -860,6 +863,403 @@ void G_PredictedFireWeapon( int entNum, u64 weapon_and_entropy ) {
 	event->s.team = ent->s.team;
 }
 
+//==============================================================
+//
+// PARALLEL PLAYER MOVEMENT
+//
+// Pmove only reads the world, so before clients think one by one the
+// usercmds each of them has queued are moved ahead of time on the thread
+// pool. Whatever Pmove would do to the game (predicted events and touching
+// triggers) is recorded instead of run, and touching an actual trigger stops
+// the prediction since the trigger can change the rest of the move.
+//
+// ClientThink then takes a predicted move instead of running Pmove when
+// everything the move read is unchanged, and replays its side effects in
+// order, which leaves the game exactly as running every client serially.
+//
+//==============================================================
+
+#define MAX_PREDICTED_EFFECTS 8
+#define MAX_PREDICTED_REGION_ENTS 64
+#define PREDICTED_REGION_MARGIN 64.0f
+
+struct predicted_effect_t {
+	bool touch_triggers;
+	int ev;
+	u64 parm;
+	Vec3 previous_origin;
+	int groundentity;
+};
+
+struct predicted_move_t {
+	usercmd_t cmd;
+
+	pmove_state_t pmove_in;
+	Vec3 viewangles_in;
+	float viewheight_in;
+
+	pmove_state_t pmove_out;
+	Vec3 viewangles_out;
+	float viewheight_out;
+	pmove_t pm;
+
+	int num_effects;
+	predicted_effect_t effects[MAX_PREDICTED_EFFECTS];
+};
+
+// everything about another entity that can change a player's trace against it
+struct predicted_region_ent_t {
+	int entNum;
+	int linkcount;
+	solid_t solid;
+	unsigned int svflags;
+	int type;
+	int team;
+	StringHash model;
+	Vec3 origin, angles;
+	Vec3 mins, maxs;
+	const edict_t *owner;
+};
+
+struct predicted_moves_t {
+	edict_t *ent;
+
+	int num_moves;
+	int next_move;
+	predicted_move_t moves[CMD_BACKUP];
+
+	// the rest of what the moves read
+	WeaponType weapon;
+	int team;
+	u16 gameflags;
+	RoundState round_state;
+
+	int64_t relinks;
+	Vec3 region_mins, region_maxs;
+	int num_region_ents;
+	predicted_region_ent_t region_ents[MAX_PREDICTED_REGION_ENTS];
+
+	// filled by the gs api hooks while predicting
+	predicted_move_t *current;
+	bool aborted;
+};
+
+static predicted_moves_t predicted_moves[MAX_CLIENTS];
+static gs_state_t predict_gs;
+static thread_local predicted_moves_t *predicting;
+
+/*
+* G_Client_PrepareMove
+*
+* Refresh the player state from the entity before a pmove
+*/
+static void G_Client_PrepareMove( const edict_t *ent, SyncPlayerState *ps ) {
+	// (is this really needed?:only if not cared enough about ps in the rest of the code)
+	// refresh player state position from the entity
+	ps->pmove.origin = ent->s.origin;
+	ps->pmove.velocity = ent->velocity;
+	ps->viewangles = ent->s.angles;
+
+	if( GS_MatchState( &server_gs ) >= MATCH_STATE_POSTMATCH || GS_MatchPaused( &server_gs )
+		|| ( ent->movetype != MOVETYPE_PLAYER && ent->movetype != MOVETYPE_NOCLIP ) ) {
+		ps->pmove.pm_type = PM_FREEZE;
+	} else if( ent->movetype == MOVETYPE_NOCLIP ) {
+		ps->pmove.pm_type = PM_SPECTATOR;
+	} else {
+		ps->pmove.pm_type = PM_NORMAL;
+	}
+}
+
+static void G_PredictEvent( int entNum, int ev, u64 parm ) {
+	predicted_move_t *move = predicting->current;
+	if( move->num_effects == MAX_PREDICTED_EFFECTS ) {
+		predicting->aborted = true;
+		return;
+	}
+
+	predicted_effect_t *effect = &move->effects[move->num_effects++];
+	effect->touch_triggers = false;
+	effect->ev = ev;
+	effect->parm = parm;
+}
+
+static void G_PredictPMoveTouchTriggers( pmove_t *pm, Vec3 previous_origin ) {
+	predicted_move_t *move = predicting->current;
+	if( move->num_effects == MAX_PREDICTED_EFFECTS ) {
+		predicting->aborted = true;
+		return;
+	}
+
+	// covers at least the box G_PMoveTouchTriggers searches
+	Vec3 origin = pm->playerState->pmove.origin;
+	Vec3 mins = Vec3( Min2( origin.x, previous_origin.x ), Min2( origin.y, previous_origin.y ), Min2( origin.z, previous_origin.z ) ) + pm->mins;
+	Vec3 maxs = Vec3( Max2( origin.x, previous_origin.x ), Max2( origin.y, previous_origin.y ), Max2( origin.z, previous_origin.z ) ) + pm->maxs;
+
+	int touch[MAX_EDICTS];
+	int num = GClip_AreaEdicts( mins, maxs, touch, MAX_EDICTS, AREA_TRIGGERS, 0 );
+	for( int i = 0; i < num; i++ ) {
+		const edict_t *hit = &game.edicts[touch[i]];
+		if( hit->r.inuse && ( hit->touch || hit->asTouchFunc ) ) {
+			predicting->aborted = true;
+			return;
+		}
+	}
+
+	predicted_effect_t *effect = &move->effects[move->num_effects++];
+	effect->touch_triggers = true;
+	effect->previous_origin = previous_origin;
+	effect->groundentity = pm->groundentity;
+}
+
+static bool G_SameRegionEnt( const predicted_region_ent_t *a, const predicted_region_ent_t *b ) {
+	return a->entNum == b->entNum && a->linkcount == b->linkcount && a->solid == b->solid
+		&& a->svflags == b->svflags && a->type == b->type && a->team == b->team && a->model == b->model
+		&& a->origin == b->origin && a->angles == b->angles && a->mins == b->mins && a->maxs == b->maxs
+		&& a->owner == b->owner;
+}
+
+/*
+* G_MoveRegionEnts
+*
+* Lists everything other than the player itself that its moves can run into
+* inside the region, sorted by entity number. Returns -1 if there's too much
+*/
+static int G_MoveRegionEnts( const edict_t *ent, Vec3 mins, Vec3 maxs, predicted_region_ent_t *ents ) {
+	int touch[MAX_EDICTS];
+	int num_solid = GClip_AreaEdicts( mins, maxs, touch, MAX_EDICTS, AREA_SOLID, 0 );
+	int num_triggers = GClip_AreaEdicts( mins, maxs, touch + num_solid, MAX_EDICTS - num_solid, AREA_TRIGGERS, 0 );
+	int num = Min2( num_solid + num_triggers, MAX_EDICTS );
+
+	int num_ents = 0;
+	for( int i = 0; i < num; i++ ) {
+		const edict_t *other = &game.edicts[touch[i]];
+
+		// pmove traces never hit the player's own projectiles
+		if( other == ent || ( other->r.owner == ent && ( other->r.svflags & SVF_PROJECTILE ) ) ) {
+			continue;
+		}
+
+		if( num_ents == MAX_PREDICTED_REGION_ENTS ) {
+			return -1;
+		}
+
+		predicted_region_ent_t *region_ent = &ents[num_ents++];
+		region_ent->entNum = touch[i];
+		region_ent->linkcount = other->linkcount;
+		region_ent->solid = other->r.solid;
+		region_ent->svflags = other->r.svflags;
+		region_ent->type = other->s.type;
+		region_ent->team = other->s.team;
+		region_ent->model = other->s.model;
+		region_ent->origin = other->s.origin;
+		region_ent->angles = other->s.angles;
+		region_ent->mins = other->r.mins;
+		region_ent->maxs = other->r.maxs;
+		region_ent->owner = other->r.owner;
+	}
+
+	std::sort( ents, ents + num_ents, []( const predicted_region_ent_t & a, const predicted_region_ent_t & b ) {
+		return a.entNum < b.entNum;
+	} );
+
+	return num_ents;
+}
+
+static bool G_MoveRegionUnchanged( predicted_moves_t *moves ) {
+	if( moves->relinks == GClip_NumRelinks() ) {
+		return true;
+	}
+
+	predicted_region_ent_t ents[MAX_PREDICTED_REGION_ENTS];
+	int num_ents = G_MoveRegionEnts( moves->ent, moves->region_mins, moves->region_maxs, ents );
+	if( num_ents != moves->num_region_ents ) {
+		return false;
+	}
+
+	for( int i = 0; i < num_ents; i++ ) {
+		if( !G_SameRegionEnt( &ents[i], &moves->region_ents[i] ) ) {
+			return false;
+		}
+	}
+
+	moves->relinks = GClip_NumRelinks();
+	return true;
+}
+
+static void G_PredictClientMovesJob( TempAllocator *temp, void *data ) {
+	predicted_moves_t *moves = ( predicted_moves_t * ) data;
+	const edict_t *ent = moves->ent;
+	if( ent == NULL ) {
+		return;
+	}
+
+	usercmd_t ucmds[CMD_BACKUP];
+	int num_ucmds = SV_PendingUserCommands( PLAYERNUM( ent ), ucmds, CMD_BACKUP );
+	if( num_ucmds == 0 ) {
+		return;
+	}
+
+	SyncPlayerState ps = ent->r.client->ps;
+	ps.POVnum = ENTNUM( ent );
+	ps.playerNum = PLAYERNUM( ent );
+	G_Client_PrepareMove( ent, &ps );
+
+	moves->weapon = ps.weapon;
+	moves->team = ent->s.team;
+	moves->gameflags = predict_gs.gameState.flags;
+	moves->round_state = predict_gs.gameState.round_state;
+
+	MinMax3 region = MinMax3::Empty();
+
+	predicting = moves;
+	for( int i = 0; i < num_ucmds; i++ ) {
+		predicted_move_t *move = &moves->moves[i];
+		move->cmd = ucmds[i];
+		move->pmove_in = ps.pmove;
+		move->viewangles_in = ps.viewangles;
+		move->viewheight_in = ps.viewheight;
+		move->num_effects = 0;
+
+		moves->current = move;
+		moves->aborted = false;
+
+		memset( &move->pm, 0, sizeof( pmove_t ) );
+		move->pm.playerState = &ps;
+		move->pm.cmd = ucmds[i];
+
+		SV_BenchPmove( &predict_gs, &move->pm );
+
+		if( moves->aborted ) {
+			break;
+		}
+
+		move->pmove_out = ps.pmove;
+		move->viewangles_out = ps.viewangles;
+		move->viewheight_out = ps.viewheight;
+
+		// how far this move's traces can reach
+		float speed = Max2( Length( move->pmove_in.velocity ), Length( move->pmove_out.velocity ) );
+		float reach = PREDICTED_REGION_MARGIN + speed * ( move->cmd.msec * 0.001f + 0.015f );
+		region = Extend( region, move->pmove_in.origin + playerbox_stand_mins - Vec3( reach ) );
+		region = Extend( region, move->pmove_in.origin + playerbox_stand_maxs + Vec3( reach ) );
+		region = Extend( region, move->pmove_out.origin + playerbox_stand_mins - Vec3( reach ) );
+		region = Extend( region, move->pmove_out.origin + playerbox_stand_maxs + Vec3( reach ) );
+
+		moves->num_moves = i + 1;
+	}
+	predicting = NULL;
+
+	if( moves->num_moves == 0 ) {
+		return;
+	}
+
+	moves->region_mins = region.mins;
+	moves->region_maxs = region.maxs;
+	moves->num_region_ents = G_MoveRegionEnts( ent, region.mins, region.maxs, moves->region_ents );
+	moves->relinks = GClip_NumRelinks();
+	if( moves->num_region_ents < 0 ) {
+		moves->num_moves = 0;
+	}
+}
+
+/*
+* G_PredictClientMoves
+*
+* Runs every client's queued usercmds through Pmove in parallel, for
+* ClientThink to pick up afterwards
+*/
+void G_PredictClientMoves() {
+	ZoneScoped;
+
+	for( int i = 0; i < server_gs.maxclients; i++ ) {
+		predicted_moves_t *moves = &predicted_moves[i];
+		moves->ent = NULL;
+		moves->num_moves = 0;
+		moves->next_move = 0;
+
+		edict_t *ent = game.edicts + 1 + i;
+		if( !g_parallel_pmove->integer || !ent->r.inuse || ent->r.client == NULL ) {
+			continue;
+		}
+		if( ( ent->r.svflags & SVF_FAKECLIENT ) || PF_GetClientState( i ) < CS_SPAWNED ) {
+			continue;
+		}
+
+		moves->ent = ent;
+	}
+
+	if( !g_parallel_pmove->integer ) {
+		return;
+	}
+
+	predict_gs = server_gs;
+	predict_gs.api.PredictedEvent = G_PredictEvent;
+	predict_gs.api.PMoveTouchTriggers = G_PredictPMoveTouchTriggers;
+
+	ParallelFor( Span< predicted_moves_t >( predicted_moves, server_gs.maxclients ), G_PredictClientMovesJob );
+}
+
+/*
+* G_TakePredictedMove
+*
+* Use the predicted result for this pmove if it's still valid
+*/
+static bool G_TakePredictedMove( edict_t *ent, pmove_t *pm ) {
+	predicted_moves_t *moves = &predicted_moves[PLAYERNUM( ent )];
+	if( moves->next_move >= moves->num_moves ) {
+		return false;
+	}
+
+	const predicted_move_t *move = &moves->moves[moves->next_move];
+	SyncPlayerState *ps = pm->playerState;
+
+	bool same = memcmp( &move->cmd, &pm->cmd, sizeof( usercmd_t ) ) == 0
+		&& memcmp( &move->pmove_in, &ps->pmove, sizeof( pmove_state_t ) ) == 0
+		&& move->viewangles_in == ps->viewangles && move->viewheight_in == ps->viewheight
+		&& moves->weapon == ps->weapon && moves->team == ent->s.team
+		&& moves->gameflags == server_gs.gameState.flags && moves->round_state == server_gs.gameState.round_state
+		&& G_MoveRegionUnchanged( moves );
+
+	// later moves were predicted from this one
+	if( !same ) {
+		moves->num_moves = 0;
+		return false;
+	}
+
+	moves->next_move++;
+
+	*pm = move->pm;
+	pm->playerState = ps;
+	ps->pmove = move->pmove_out;
+	ps->viewangles = move->viewangles_out;
+	ps->viewheight = move->viewheight_out;
+
+	for( int i = 0; i < move->num_effects; i++ ) {
+		const predicted_effect_t *effect = &move->effects[i];
+		if( effect->touch_triggers ) {
+			pmove_t touch_pm = *pm;
+			touch_pm.groundentity = effect->groundentity;
+			G_PMoveTouchTriggers( &touch_pm, effect->previous_origin );
+		} else {
+			G_PredictedEvent( ps->POVnum, effect->ev, effect->parm );
+		}
+	}
+
+	return true;
+}
+
+/*
+* G_PredictedMoveLinked
+*
+* The player relinking itself doesn't invalidate its own predictions
+*/
+static void G_PredictedMoveLinked( edict_t *ent ) {
+	predicted_moves_t *moves = &predicted_moves[PLAYERNUM( ent )];
+	if( moves->next_move < moves->num_moves ) {
+		moves->relinks = GClip_NumRelinks();
+	}
+}
+
 void ClientThink( edict_t *ent, usercmd_t *ucmd, int timeDelta ) {
 	ZoneScoped;
 
@@ -916,20 +1316,7 @@ void ClientThink( edict_t *ent, usercmd_t *ucmd, int timeDelta ) {
 
 	client->ucmd = *ucmd;
 
-	// (is this really needed?:only if not cared enough about ps in the rest of the code)
-	// refresh player state position from the entity
-	client->ps.pmove.origin = ent->s.origin;
-	client->ps.pmove.velocity = ent->velocity;
-	client->ps.viewangles = ent->s.angles;
-
-	if( GS_MatchState( &server_gs ) >= MATCH_STATE_POSTMATCH || GS_MatchPaused( &server_gs )
-		|| ( ent->movetype != MOVETYPE_PLAYER && ent->movetype != MOVETYPE_NOCLIP ) ) {
-		client->ps.pmove.pm_type = PM_FREEZE;
-	} else if( ent->movetype == MOVETYPE_NOCLIP ) {
-		client->ps.pmove.pm_type = PM_SPECTATOR;
-	} else {
-		client->ps.pmove.pm_type = PM_NORMAL;
-	}
+	G_Client_PrepareMove( ent, &client->ps );
 
 	// set up for pmove
 	memset( &pm, 0, sizeof( pmove_t ) );
@@ -937,7 +1324,10 @@ void ClientThink( edict_t *ent, usercmd_t *ucmd, int timeDelta ) {
 	pm.cmd = *ucmd;
 
 	// perform a pmove
-	Pmove( &server_gs, &pm );
+	bool predicted = G_TakePredictedMove( ent, &pm );
+	if( !predicted ) {
+		SV_BenchPmove( &server_gs, &pm );
+	}
 
 	// save results of pmove
 	client->old_pmove = client->ps.pmove;
@@ -960,6 +1350,9 @@ void ClientThink( edict_t *ent, usercmd_t *ucmd, int timeDelta ) {
 	}
 
 	GClip_LinkEntity( ent );
+	if( predicted ) {
+		G_PredictedMoveLinked( ent );
+	}
 
 	// fire touch functions
 	if( ent->movetype != MOVETYPE_NOCLIP ) {
@@ -64,9 +64,12 @@ typedef struct {
 	float dashPlayerSpeed;
 } pml_t;
 
-static pmove_t *pm;
-static pml_t pml;
-static const gs_state_t * pmove_gs;
+// everything a single Pmove call works on, so several players can be moved at once
+struct pmove_context_t {
+	pmove_t * pm;
+	pml_t pml;
+	const gs_state_t * gs;
+};
 
 // movement parameters
 
@@ -95,7 +98,8 @@ constexpr float pm_dashupspeed = ( 174.0f * GRAVITY_COMPENSATE );
 constexpr float pm_wjupspeed = ( 350.0f * GRAVITY_COMPENSATE );
 constexpr float pm_wjbouncefactor = 0.4f;
 
-static float pm_wjminspeed() {
+static float pm_wjminspeed( pmove_context_t * ctx ) {
+	pml_t & pml = ctx->pml;
 	return ( pml.maxWalkSpeed + pml.maxPlayerSpeed ) * 0.5f;
 }
 
@@ -111,9 +115,12 @@ static float Normalize2D( Vec3 * v ) {
 // nbTestDir is the number of directions to test around the player
 // maxZnormal is the max Z value of the normal of a poly to consider it a wall
 // normal becomes a pointer to the normal of the most appropriate wall
-static void PlayerTouchWall( int nbTestDir, float maxZnormal, Vec3 * normal ) {
+static void PlayerTouchWall( pmove_context_t * ctx, int nbTestDir, float maxZnormal, Vec3 * normal ) {
 	ZoneScoped;
 
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	float dist = 1.0;
 
 	Vec3 mins = Vec3( pm->mins.xy(), 0.0f );
@@ -167,7 +174,8 @@ static void PlayerTouchWall( int nbTestDir, float maxZnormal, Vec3 * normal ) {
 
 #define MAX_CLIP_PLANES 5
 
-static void PM_AddTouchEnt( int entNum ) {
+static void PM_AddTouchEnt( pmove_context_t * ctx, int entNum ) {
+	pmove_t * pm = ctx->pm;
 	if( pm->numtouch >= MAXTOUCH || entNum < 0 ) {
 		return;
 	}
@@ -185,9 +193,12 @@ static void PM_AddTouchEnt( int entNum ) {
 }
 
 
-static int PM_SlideMove() {
+static int PM_SlideMove( pmove_context_t * ctx ) {
 	ZoneScoped;
 
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	Vec3 planes[MAX_CLIP_PLANES];
 	constexpr int maxmoves = 4;
 	float remainingTime = pml.frametime;
@@ -225,7 +236,7 @@ static int PM_SlideMove() {
 		}
 
 		// save touched entity for return output
-		PM_AddTouchEnt( trace.ent );
+		PM_AddTouchEnt( ctx, trace.ent );
 
 		// at this point we are blocked but not trapped.
 
@@ -323,15 +334,18 @@ static int PM_SlideMove() {
 * Each intersection will try to step over the obstruction instead of
 * sliding along it.
 */
-static void PM_StepSlideMove() {
+static void PM_StepSlideMove( pmove_context_t * ctx ) {
 	ZoneScoped;
 
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	trace_t trace;
 
 	Vec3 start_o = pml.origin;
 	Vec3 start_v = pml.velocity;
 
-	int blocked = PM_SlideMove();
+	int blocked = PM_SlideMove( ctx );
 
 	Vec3 down_o = pml.origin;
 	Vec3 down_v = pml.velocity;
@@ -347,7 +361,7 @@ static void PM_StepSlideMove() {
 	pml.origin = up;
 	pml.velocity = start_v;
 
-	PM_SlideMove();
+	PM_SlideMove( ctx );
 
 	// push down the final amount
 	Vec3 down = pml.origin - Vec3( 0.0f, 0.0f, STEPSIZE );
@@ -396,7 +410,9 @@ static void PM_StepSlideMove() {
 *
 * Handles both ground friction and water friction
 */
-static void PM_Friction() {
+static void PM_Friction( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
 	float speed = LengthSquared( pml.velocity );
 	if( speed < 1 ) {
 		pml.velocity.x = 0.0f;
@@ -426,7 +442,8 @@ static void PM_Friction() {
 *
 * Handles user intended acceleration
 */
-static void PM_Accelerate( Vec3 wishdir, float wishspeed, float accel ) {
+static void PM_Accelerate( pmove_context_t * ctx, Vec3 wishdir, float wishspeed, float accel ) {
+	pml_t & pml = ctx->pml;
 	float currentspeed = Dot( pml.velocity, wishdir );
 	float addspeed = wishspeed - currentspeed;
 	if( addspeed <= 0 ) {
@@ -442,7 +459,8 @@ static void PM_Accelerate( Vec3 wishdir, float wishspeed, float accel ) {
 }
 
 // when using +strafe convert the inertia to forward speed.
-static void PM_Aircontrol( Vec3 wishdir, float wishspeed ) {
+static void PM_Aircontrol( pmove_context_t * ctx, Vec3 wishdir, float wishspeed ) {
+	pml_t & pml = ctx->pml;
 	// accelerate
 	float smove = pml.sidePush;
 
@@ -471,7 +489,9 @@ static void PM_Aircontrol( Vec3 wishdir, float wishspeed ) {
 	pml.velocity.z = zspeed;
 }
 
-static Vec3 PM_LadderMove( Vec3 wishvel ) {
+static Vec3 PM_LadderMove( pmove_context_t * ctx, Vec3 wishvel ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
 	if( pml.ladder && Abs( pml.velocity.z ) <= DEFAULT_LADDERSPEED ) {
 		if( pml.forwardPush > 0 ) {
 			wishvel.z = Lerp( -float( DEFAULT_LADDERSPEED ), Unlerp01( 15.0f, pm->playerState->viewangles[PITCH], -15.0f ), float( DEFAULT_LADDERSPEED ) );
@@ -494,14 +514,15 @@ static Vec3 PM_LadderMove( Vec3 wishvel ) {
 	return wishvel;
 }
 
-static void PM_WaterMove() {
+static void PM_WaterMove( pmove_context_t * ctx ) {
 	ZoneScoped;
 
+	pml_t & pml = ctx->pml;
 	// user intentions
 	Vec3 wishvel = pml.forward * pml.forwardPush + pml.right * pml.sidePush;
 	wishvel.z -= pm_waterfriction;
 
-	wishvel = PM_LadderMove( wishvel );
+	wishvel = PM_LadderMove( ctx, wishvel );
 
 	Vec3 wishdir = wishvel;
 	float wishspeed = Length( wishdir );
@@ -513,23 +534,25 @@ static void PM_WaterMove() {
 		wishspeed = pml.maxPlayerSpeed;
 	}
 
-	PM_Accelerate( wishdir, wishspeed, pm_wateraccelerate );
-	PM_StepSlideMove();
+	PM_Accelerate( ctx, wishdir, wishspeed, pm_wateraccelerate );
+	PM_StepSlideMove( ctx );
 }
 
 /*
 * PM_Move -- Kurim
 */
-static void PM_Move() {
+static void PM_Move( pmove_context_t * ctx ) {
 	ZoneScoped;
 
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
 	float fmove = pml.forwardPush;
 	float smove = pml.sidePush;
 
 	Vec3 wishvel = pml.forward * fmove + pml.right * smove;
 	wishvel.z = 0;
 
-	wishvel = PM_LadderMove( wishvel );
+	wishvel = PM_LadderMove( ctx, wishvel );
 
 	Vec3 wishdir = wishvel;
 	float wishspeed = Length( wishdir );
@@ -553,7 +576,7 @@ static void PM_Move() {
 	}
 
 	if( pml.ladder ) {
-		PM_Accelerate( wishdir, wishspeed, pm_accelerate );
+		PM_Accelerate( ctx, wishdir, wishspeed, pm_accelerate );
 
 		if( wishvel.z == 0.0f ) {
 			float decel = GRAVITY * pml.frametime;
@@ -565,7 +588,7 @@ static void PM_Move() {
 			}
 		}
 
-		PM_StepSlideMove();
+		PM_StepSlideMove( ctx );
 	}
 	else if( pm->groundentity != -1 ) {
 		// walking on ground
@@ -573,7 +596,7 @@ static void PM_Move() {
 			pml.velocity.z = 0; //!!! this is before the accel
 		}
 
-		PM_Accelerate( wishdir, wishspeed, pm_accelerate );
+		PM_Accelerate( ctx, wishdir, wishspeed, pm_accelerate );
 
 		pml.velocity.z = Min2( 0.0f, pml.velocity.z );
 
@@ -581,7 +604,7 @@ static void PM_Move() {
 			return;
 		}
 
-		PM_StepSlideMove();
+		PM_StepSlideMove( ctx );
 	}
 	else {
 		// Air Control
@@ -604,14 +627,14 @@ static void PM_Move() {
 		}
 
 		// Air control
-		PM_Accelerate( wishdir, wishspeed, accel );
+		PM_Accelerate( ctx, wishdir, wishspeed, accel );
 		if( !( pm->playerState->pmove.pm_flags & PMF_WALLJUMPING ) && pm->playerState->pmove.knockback_time <= 0 ) { // no air ctrl while wjing
-			PM_Aircontrol( wishdir, wishspeed2 );
+			PM_Aircontrol( ctx, wishdir, wishspeed2 );
 		}
 
 		// add gravity
 		pml.velocity.z -= GRAVITY * pml.frametime;
-		PM_StepSlideMove();
+		PM_StepSlideMove( ctx );
 	}
 }
 
@@ -620,7 +643,10 @@ static void PM_Move() {
 *
 * If the player hull point one-quarter unit down is solid, the player is on ground
 */
-static void PM_GroundTrace( trace_t *trace ) {
+static void PM_GroundTrace( pmove_context_t * ctx, trace_t *trace ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	Vec3 point = pml.origin - Vec3( 0.0f, 0.0f, 0.25f );
 	pmove_gs->api.Trace( trace, pml.origin, pm->mins, pm->maxs, point, pm->playerState->POVnum, pm->contentmask, 0 );
 }
@@ -628,7 +654,9 @@ static void PM_GroundTrace( trace_t *trace ) {
 /*
 * PM_GoodPosition
 */
-static bool PM_GoodPosition( Vec3 origin, trace_t *trace ) {
+static bool PM_GoodPosition( pmove_context_t * ctx, Vec3 origin, trace_t *trace ) {
+	pmove_t * pm = ctx->pm;
+	const gs_state_t * pmove_gs = ctx->gs;
 	if( pm->playerState->pmove.pm_type == PM_SPECTATOR ) {
 		return true;
 	}
@@ -641,9 +669,10 @@ static bool PM_GoodPosition( Vec3 origin, trace_t *trace ) {
 /*
 * PM_UnstickPosition
 */
-static void PM_UnstickPosition( trace_t *trace ) {
+static void PM_UnstickPosition( pmove_context_t * ctx, trace_t *trace ) {
 	ZoneScoped;
 
+	pml_t & pml = ctx->pml;
 	Vec3 origin = pml.origin;
 
 	// try all combinations
@@ -654,9 +683,9 @@ static void PM_UnstickPosition( trace_t *trace ) {
 		origin.y += ( j & 2 ) ? -1.0f : 1.0f;
 		origin.z += ( j & 4 ) ? -1.0f : 1.0f;
 
-		if( PM_GoodPosition( origin, trace ) ) {
+		if( PM_GoodPosition( ctx, origin, trace ) ) {
 			pml.origin = origin;
-			PM_GroundTrace( trace );
+			PM_GroundTrace( ctx, trace );
 			return;
 		}
 	}
@@ -668,9 +697,12 @@ static void PM_UnstickPosition( trace_t *trace ) {
 /*
 * PM_CategorizePosition
 */
-static void PM_CategorizePosition() {
+static void PM_CategorizePosition( pmove_context_t * ctx ) {
 	ZoneScoped;
 
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	if( pml.velocity.z > 180 ) { // !!ZOID changed from 100 to 180 (ramp accel)
 		pm->playerState->pmove.pm_flags &= ~PMF_ON_GROUND;
 		pm->groundentity = -1;
@@ -679,11 +711,11 @@ static void PM_CategorizePosition() {
 		trace_t trace;
 
 		// see if standing on something solid
-		PM_GroundTrace( &trace );
+		PM_GroundTrace( ctx, &trace );
 
 		if( trace.allsolid ) {
 			// try to unstick position
-			PM_UnstickPosition( &trace );
+			PM_UnstickPosition( ctx, &trace );
 		}
 
 		pml.groundplane = trace.plane;
@@ -743,12 +775,14 @@ static void PM_CategorizePosition() {
 	}
 }
 
-static void PM_ClearDash() {
+static void PM_ClearDash( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
 	pm->playerState->pmove.pm_flags &= ~PMF_DASHING;
 	pm->playerState->pmove.dash_time = 0;
 }
 
-static void PM_ClearWallJump() {
+static void PM_ClearWallJump( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
 	pm->playerState->pmove.pm_flags &= ~PMF_WALLJUMPING;
 	pm->playerState->pmove.pm_flags &= ~PMF_WALLJUMPCOUNT;
 	pm->playerState->pmove.walljump_time = 0;
@@ -757,7 +791,10 @@ static void PM_ClearWallJump() {
 /*
 * PM_CheckJump
 */
-static void PM_CheckJump() {
+static void PM_CheckJump( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	if( pml.upPush < 10 ) {
 		return;
 	}
@@ -789,14 +826,17 @@ static void PM_CheckJump() {
 
 	// remove wj count
 	pm->playerState->pmove.pm_flags &= ~PMF_JUMPPAD_TIME;
-	PM_ClearDash();
-	PM_ClearWallJump();
+	PM_ClearDash( ctx );
+	PM_ClearWallJump( ctx );
 }
 
 /*
 * PM_CheckDash -- by Kurim
 */
-static void PM_CheckDash() {
+static void PM_CheckDash( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	bool pressed = pm->cmd.buttons & BUTTON_SPECIAL;
 
 	if( !pressed ) {
@@ -813,7 +853,7 @@ static void PM_CheckDash() {
 
 	if( pm->groundentity != -1 && pressed && ( pm->playerState->pmove.features & PMFEAT_SPECIAL ) ) {
 		pm->playerState->pmove.pm_flags &= ~PMF_JUMPPAD_TIME;
-		PM_ClearWallJump();
+		PM_ClearWallJump( ctx );
 
 		pm->playerState->pmove.pm_flags |= PMF_DASHING;
 		pm->playerState->pmove.pm_flags |= PMF_SPECIAL_HELD;
@@ -874,9 +914,12 @@ static void PM_CheckDash() {
 /*
 * PM_CheckWallJump -- By Kurim
 */
-static void PM_CheckWallJump() {
+static void PM_CheckWallJump( pmove_context_t * ctx ) {
 	ZoneScoped;
 
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	bool pressed = pm->cmd.buttons & BUTTON_SPECIAL;
 
 	if( !pressed ) {
@@ -925,7 +968,7 @@ static void PM_CheckWallJump() {
 			|| ( hspeed > pm->playerState->pmove.dash_speed && pml.velocity.z > 8 )
 			|| ( trace.fraction == 1 ) || ( !ISWALKABLEPLANE( &trace.plane ) && !trace.startsolid ) ) {
 			Vec3 normal( 0.0f );
-			PlayerTouchWall( 12, 0.3f, &normal );
+			PlayerTouchWall( ctx, 12, 0.3f, &normal );
 			if( !Length( normal ) ) {
 				return;
 			}
@@ -940,8 +983,8 @@ static void PM_CheckWallJump() {
 				pml.velocity = GS_ClipVelocity( pml.velocity, normal, 1.0005f );
 				pml.velocity = pml.velocity + normal * pm_wjbouncefactor;
 
-				if( hspeed < pm_wjminspeed() ) {
-					hspeed = pm_wjminspeed();
+				if( hspeed < pm_wjminspeed( ctx ) ) {
+					hspeed = pm_wjminspeed( ctx );
 				}
 
 				pml.velocity = Normalize( pml.velocity );
@@ -950,7 +993,7 @@ static void PM_CheckWallJump() {
 				pml.velocity.z = ( oldupvelocity > pm_wjupspeed ) ? oldupvelocity : pm_wjupspeed; // jal: if we had a faster upwards speed, keep it
 
 				// set the walljumping state
-				PM_ClearDash();
+				PM_ClearDash( ctx );
 				pm->playerState->pmove.pm_flags &= ~PMF_JUMPPAD_TIME;
 
 				pm->playerState->pmove.pm_flags |= PMF_WALLJUMPING;
@@ -972,7 +1015,10 @@ static void PM_CheckWallJump() {
 /*
 * PM_CheckSpecialMovement
 */
-static void PM_CheckSpecialMovement() {
+static void PM_CheckSpecialMovement( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	int cont;
 
 	pm->ladder = false;
@@ -1020,7 +1066,10 @@ static void PM_CheckSpecialMovement() {
 /*
 * PM_FlyMove
 */
-static void PM_FlyMove( bool doclip ) {
+static void PM_FlyMove( pmove_context_t * ctx, bool doclip ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	trace_t trace;
 
 	float maxspeed = pml.maxPlayerSpeed * 1.5f;
@@ -1096,7 +1145,10 @@ static void PM_FlyMove( bool doclip ) {
 *
 * Sets mins, maxs, and pm->viewheight
 */
-static void PM_AdjustBBox() {
+static void PM_AdjustBBox( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 	float crouchFrac;
 	trace_t trace;
 
@@ -1182,7 +1234,9 @@ static void PM_AdjustBBox() {
 	pm->playerState->viewheight = playerbox_stand_viewheight;
 }
 
-static void PM_UpdateDeltaAngles() {
+static void PM_UpdateDeltaAngles( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	const gs_state_t * pmove_gs = ctx->gs;
 	if( pmove_gs->module != GS_MODULE_GAME ) {
 		return;
 	}
@@ -1196,7 +1250,9 @@ static void PM_UpdateDeltaAngles() {
 * PM_ApplyMouseAnglesClamp
 *
 */
-static void PM_ApplyMouseAnglesClamp() {
+static void PM_ApplyMouseAnglesClamp( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
 	for( int i = 0; i < 3; i++ ) {
 		s16 temp = pm->cmd.angles[i] + pm->playerState->pmove.delta_angles[i];
 		if( i == PITCH ) {
@@ -1221,7 +1277,9 @@ static void PM_ApplyMouseAnglesClamp() {
 /*
 * PM_BeginMove
 */
-static void PM_BeginMove() {
+static void PM_BeginMove( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
 	// clear results
 	pm->numtouch = 0;
 	pm->groundentity = -1;
@@ -1242,7 +1300,9 @@ static void PM_BeginMove() {
 /*
 * PM_EndMove
 */
-static void PM_EndMove() {
+static void PM_EndMove( pmove_context_t * ctx ) {
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
 	pm->playerState->pmove.origin = pml.origin;
 	pm->playerState->pmove.velocity = pml.velocity;
 }
@@ -1259,11 +1319,17 @@ void Pmove( const gs_state_t * gs, pmove_t *pmove ) {
 		return;
 	}
 
-	pm = pmove;
-	pmove_gs = gs;
+	pmove_context_t context;
+	pmove_context_t * ctx = &context;
+	ctx->pm = pmove;
+	ctx->gs = gs;
+
+	pmove_t * pm = ctx->pm;
+	pml_t & pml = ctx->pml;
+	const gs_state_t * pmove_gs = ctx->gs;
 
 	// clear all pmove local vars
-	PM_BeginMove();
+	PM_BeginMove( ctx );
 
 	float fallvelocity = Max2( 0.0f, -pml.velocity.z );
 
@@ -1361,43 +1427,43 @@ void Pmove( const gs_state_t * gs, pmove_t *pmove ) {
 
 	if( pm->playerState->pmove.pm_type != PM_NORMAL ) { // includes dead, freeze, chasecam...
 		if( !GS_MatchPaused( pmove_gs ) ) {
-			PM_ClearDash();
+			PM_ClearDash( ctx );
 
-			PM_ClearWallJump();
+			PM_ClearWallJump( ctx );
 
 			pm->playerState->pmove.knockback_time = 0;
 			pm->playerState->pmove.crouch_time = 0;
 			pm->playerState->pmove.tbag_time = 0;
 			pm->playerState->pmove.pm_flags &= ~( PMF_JUMPPAD_TIME | PMF_DOUBLEJUMPED | PMF_TIME_WATERJUMP | PMF_TIME_LAND | PMF_TIME_TELEPORT | PMF_SPECIAL_HELD );
 
-			PM_AdjustBBox();
+			PM_AdjustBBox( ctx );
 		}
 
 		if( pm->playerState->pmove.pm_type == PM_SPECTATOR ) {
-			PM_ApplyMouseAnglesClamp();
+			PM_ApplyMouseAnglesClamp( ctx );
 
-			PM_FlyMove( false );
+			PM_FlyMove( ctx, false );
 		} else {
 			pml.forwardPush = 0;
 			pml.sidePush = 0;
 			pml.upPush = 0;
 		}
 
-		PM_EndMove();
+		PM_EndMove( ctx );
 		return;
 	}
 
-	PM_ApplyMouseAnglesClamp();
+	PM_ApplyMouseAnglesClamp( ctx );
 
 	// set mins, maxs, viewheight amd fov
-	PM_AdjustBBox();
+	PM_AdjustBBox( ctx );
 
 	// set groundentity, watertype, and waterlevel
-	PM_CategorizePosition();
+	PM_CategorizePosition( ctx );
 
 	int oldGroundEntity = pm->groundentity;
 
-	PM_CheckSpecialMovement();
+	PM_CheckSpecialMovement( ctx );
 
 	if( pm->playerState->pmove.pm_flags & PMF_TIME_TELEPORT ) {
 		// teleport pause stays exactly in place
@@ -1410,21 +1476,21 @@ void Pmove( const gs_state_t * gs, pmove_t *pmove ) {
 			pm->playerState->pmove.pm_time = 0;
 		}
 
-		PM_StepSlideMove();
+		PM_StepSlideMove( ctx );
 	} else {
 		// Kurim
 		// Keep this order !
-		PM_CheckJump();
+		PM_CheckJump( ctx );
 
 		if( GS_GetWeaponDef( pm->playerState->weapon )->zoom_fov == 0 || ( pm->playerState->pmove.features & PMFEAT_SCOPE ) == 0 ) {
-			PM_CheckDash();
-			PM_CheckWallJump();
+			PM_CheckDash( ctx );
+			PM_CheckWallJump( ctx );
 		}
 
-		PM_Friction();
+		PM_Friction( ctx );
 
 		if( pm->waterlevel >= 2 ) {
-			PM_WaterMove();
+			PM_WaterMove( ctx );
 		} else {
 			Vec3 angles = pm->playerState->viewangles;
 			if( angles.x > 180 ) {
@@ -1445,14 +1511,14 @@ void Pmove( const gs_state_t * gs, pmove_t *pmove ) {
 			pml.flatforward.z = 0.0f;
 			pml.flatforward = SafeNormalize( pml.flatforward );
 
-			PM_Move();
+			PM_Move( ctx );
 		}
 	}
 
 	// set groundentity, watertype, and waterlevel for final spot
-	PM_CategorizePosition();
+	PM_CategorizePosition( ctx );
 
-	PM_EndMove();
+	PM_EndMove( ctx );
 
 	// Execute the triggers that are touched.
 	// We check the entire path between the origin before the pmove and the
@@ -1460,7 +1526,7 @@ void Pmove( const gs_state_t * gs, pmove_t *pmove ) {
 	// Note that this method assumes the movement has been linear.
 	pmove_gs->api.PMoveTouchTriggers( pm, pml.previous_origin );
 
-	PM_UpdateDeltaAngles(); // in case some trigger action has moved the view angles (like teleported).
+	PM_UpdateDeltaAngles( ctx ); // in case some trigger action has moved the view angles (like teleported).
 
 	// touching triggers may force groundentity off
 	if( !( pm->playerState->pmove.pm_flags & PMF_ON_GROUND ) && pm->groundentity != -1 ) {
@@ -1475,7 +1541,7 @@ void Pmove( const gs_state_t * gs, pmove_t *pmove ) {
 		}
 
 		if( pm->playerState->pmove.walljump_time < PM_WALLJUMP_TIMEDELAY - 50 ) {
-			PM_ClearWallJump();
+			PM_ClearWallJump( ctx );
 		}
 	}
 
@@ -2,7 +2,7 @@
 
 #include "qcommon/types.h"
 
-#define MAX_CLIENTS                 16
+#define MAX_CLIENTS                 128
 #define MAX_EDICTS                  1024        // must change protocol to increase more
 
 enum MatchState {
@@ -132,7 +132,7 @@ struct SyncScoreboardPlayer {
 };
 
 struct SyncTeamState {
-	int player_indices[ MAX_CLIENTS ];
+	u8 player_indices[ MAX_CLIENTS ]; // entity numbers, only the first num_players are valid
 	u8 num_players;
 	u8 score;
 };
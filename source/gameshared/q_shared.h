@@ -217,6 +217,7 @@ enum com_error_code_t {
 #define FS_APPEND           2
 #define FS_GZ               0x100   // compress on write and decompress on read automatically
 #define FS_UPDATE           0x200
+#define FS_ZSTD             0x400   // like FS_GZ, but seekable. reading falls back to FS_GZ for other files
 
 #define FS_RWA_MASK         ( FS_READ | FS_WRITE | FS_APPEND )
 
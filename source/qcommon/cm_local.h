@@ -23,11 +23,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define CM_SUBDIV_LEVEL 16
 
+extern cvar_t *cm_bvh;
+
 cmodel_t * CM_NewCModel( CModelServerOrClient soc, u64 hash );
 
-void    CM_InitBoxHull( CollisionModel *cms );
-void    CM_InitOctagonHull( CollisionModel *cms );
 
 void    CM_FloodAreaConnections( CollisionModel *cms );
 
+int CM_NumBrushPlaneGroups( int numsides );
+void CM_SetBrushPlanes( cbrush_t *brush, cbrushplanes_t *planes );
+
 void CM_LoadQ3BrushModel( CModelServerOrClient soc, CollisionModel * cms, Span< const u8 > data );
@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon/cm_local.h"
 #include "qcommon/hashmap.h"
 #include "qcommon/string.h"
+#include "qcommon/threadpool.h"
 
 static Hashmap< cmodel_t, 4096 > client_cmodels;
 static Hashmap< cmodel_t, 4096 > server_cmodels;
@@ -31,22 +32,25 @@ static Hashmap< cmodel_t, 4096 > * GetCModels( CModelServerOrClient soc ) {
 }
 
 static void CM_AllocateCheckCounts( CollisionModel *cms ) {
-	cms->checkcount = 0;
-	cms->map_brush_checkcheckouts = ALLOC_MANY( sys_allocator, int, cms->numbrushes );
-	cms->map_face_checkcheckouts = ALLOC_MANY( sys_allocator, int, cms->numfaces );
+	// every thread that traces gets its own counts, see CM_BoxTrace
+	size_t num_brushes = size_t( cms->numbrushes ) * NumThreadPoolThreads();
+	size_t num_faces = size_t( cms->numfaces ) * NumThreadPoolThreads();
+
+	cms->map_brush_checkcounts = ALLOC_MANY( sys_allocator, int, num_brushes );
+	cms->map_face_checkcounts = ALLOC_MANY( sys_allocator, int, num_faces );
+	memset( cms->map_brush_checkcounts, 0, num_brushes * sizeof( int ) );
+	memset( cms->map_face_checkcounts, 0, num_faces * sizeof( int ) );
 }
 
 static void CM_FreeCheckCounts( CollisionModel *cms ) {
-	cms->checkcount = 0;
-
-	if( cms->map_brush_checkcheckouts ) {
-		FREE( sys_allocator, cms->map_brush_checkcheckouts );
-		cms->map_brush_checkcheckouts = NULL;
+	if( cms->map_brush_checkcounts ) {
+		FREE( sys_allocator, cms->map_brush_checkcounts );
+		cms->map_brush_checkcounts = NULL;
 	}
 
-	if( cms->map_face_checkcheckouts ) {
-		FREE( sys_allocator, cms->map_face_checkcheckouts );
-		cms->map_face_checkcheckouts = NULL;
+	if( cms->map_face_checkcounts ) {
+		FREE( sys_allocator, cms->map_face_checkcounts );
+		cms->map_face_checkcounts = NULL;
 	}
 }
 
@@ -128,10 +132,20 @@ static void CM_Clear( CModelServerOrClient soc, CollisionModel * cms ) {
 
 	if( cms->map_brushes ) {
 		FREE( sys_allocator, cms->map_brushes );
+		FREE( sys_allocator, cms->map_brushplanes );
 		cms->map_brushes = NULL;
+		cms->map_brushplanes = NULL;
 		cms->numbrushes = 0;
 	}
 
+	if( cms->map_bvhnodes ) {
+		FREE( sys_allocator, cms->map_bvhnodes );
+		FREE( sys_allocator, cms->map_bvhbrushes );
+		cms->map_bvhnodes = NULL;
+		cms->map_bvhbrushes = NULL;
+		cms->numbvhnodes = 0;
+	}
+
 	if( cms->map_pvs ) {
 		FREE( sys_allocator, cms->map_pvs );
 		cms->map_pvs = NULL;
@@ -155,6 +169,12 @@ MAP LOADING
 ===============================================================================
 */
 
+cvar_t *cm_bvh;
+
+void CM_Init() {
+	cm_bvh = Cvar_Get( "cm_bvh", "0", CVAR_ARCHIVE );
+}
+
 /*
 * CM_LoadMap
 * Loads in the map and all submodels
@@ -170,8 +190,6 @@ CollisionModel * CM_LoadMap( CModelServerOrClient soc, Span< const u8 > data, u6
 	const char * suffix = "*0";
 	cms->world_hash = Hash64( suffix, strlen( suffix ), cms->base_hash );
 
-	CM_InitBoxHull( cms );
-	CM_InitOctagonHull( cms );
 	CM_Clear( soc, cms );
 
 	CM_LoadQ3BrushModel( soc, cms, data );
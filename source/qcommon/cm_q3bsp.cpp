@@ -24,6 +24,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon/cm_local.h"
 #include "qcommon/patch.h"
 
+#include <algorithm>
+
 #define MAX_LIGHTMAPS       4
 #define MAX_FACET_PLANES 32
 
@@ -389,7 +391,16 @@ static void CM_CreatePatch( CollisionModel *cms, cface_t *patch, cshaderref_t *s
 	}
 
 	if( patch->numfacets ) {
-		u8 * fdata = ( u8 * ) ALLOC_SIZE( sys_allocator, patch->numfacets * sizeof( cbrush_t ) + totalsides * ( sizeof( cbrushside_t ) + sizeof( cplane_t ) ), 16 );
+		int numplanegroups = 0;
+		for( int i = 0; i < patch->numfacets; i++ ) {
+			numplanegroups += CM_NumBrushPlaneGroups( facets[ i ].numsides );
+		}
+
+		// plane groups go at the end, aligned for SSE loads
+		size_t planes_offset = AlignPow2( patch->numfacets * sizeof( cbrush_t ) + totalsides * ( sizeof( cbrushside_t ) + sizeof( cplane_t ) ), alignof( cbrushplanes_t ) );
+		u8 * fdata = ( u8 * ) ALLOC_SIZE( sys_allocator, planes_offset + numplanegroups * sizeof( cbrushplanes_t ), 16 );
+
+		cbrushplanes_t * planes = ( cbrushplanes_t * )( fdata + planes_offset );
 
 		patch->facets = ( cbrush_t * )fdata; fdata += patch->numfacets * sizeof( cbrush_t );
 		memcpy( patch->facets, facets, patch->numfacets * sizeof( cbrush_t ) );
@@ -406,6 +417,10 @@ static void CM_CreatePatch( CollisionModel *cms, cface_t *patch, cshaderref_t *s
 				SnapPlane( &s->plane.normal, &s->plane.dist );
 				s->surfFlags = shaderref->flags;
 			}
+
+			facet->planes = planes;
+			CM_SetBrushPlanes( facet, planes );
+			planes += CM_NumBrushPlaneGroups( facet->numsides );
 		}
 
 		patch->contents = shaderref->contents;
@@ -879,12 +894,22 @@ static void CMod_LoadBrushes( CollisionModel *cms, lump_t *l ) {
 	out = cms->map_brushes = ALLOC_MANY( sys_allocator, cbrush_t, count );
 	cms->numbrushes = count;
 
+	int numplanegroups = 0;
+	for( i = 0; i < count; i++ ) {
+		numplanegroups += CM_NumBrushPlaneGroups( LittleLong( in[i].numsides ) );
+	}
+	cbrushplanes_t * planes = cms->map_brushplanes = ALLOC_MANY( sys_allocator, cbrushplanes_t, numplanegroups );
+
 	for( i = 0; i < count; i++, out++, in++ ) {
 		shaderref = LittleLong( in->shadernum );
 		out->contents = cms->map_shaderrefs[shaderref].contents;
 		out->numsides = LittleLong( in->numsides );
 		out->brushsides = cms->map_brushsides + LittleLong( in->firstside );
 		CM_BoundBrush( out );
+
+		out->planes = planes;
+		CM_SetBrushPlanes( out, planes );
+		planes += CM_NumBrushPlaneGroups( out->numsides );
 	}
 }
 
@@ -912,6 +937,199 @@ static void CMod_LoadEntityString( CollisionModel *cms, lump_t *l ) {
 	memcpy( cms->map_entitystring, cms->cmod_base + l->fileofs, l->filelen );
 }
 
+/*
+===============================================================================
+
+BOUNDING VOLUME HIERARCHY
+
+===============================================================================
+*/
+
+#define BVH_LEAF_BRUSHES 4
+#define BVH_BINS 16
+#define BVH_MAX_DEPTH 40 // median splits below this keep the tree under 64 levels deep
+
+struct bvhbuilditem_t {
+	const cbrush_t *brush;
+	Vec3 centroid;
+	int bin;
+};
+
+struct bvhbin_t {
+	MinMax3 bounds;
+	int count;
+};
+
+static MinMax3 Union( MinMax3 a, MinMax3 b ) {
+	return MinMax3( Vec3( Min2( a.mins.x, b.mins.x ), Min2( a.mins.y, b.mins.y ), Min2( a.mins.z, b.mins.z ) ),
+		Vec3( Max2( a.maxs.x, b.maxs.x ), Max2( a.maxs.y, b.maxs.y ), Max2( a.maxs.z, b.maxs.z ) ) );
+}
+
+static float HalfSurfaceArea( MinMax3 bounds ) {
+	Vec3 size = bounds.maxs - bounds.mins;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+/*
+* CM_BuildBVHNode
+*
+* Splits the items along the longest axis of their centroids, picking the
+* split with the lowest surface area cost out of a few evenly spaced ones
+*/
+static void CM_BuildBVHNode( CollisionModel *cms, int nodenum, bvhbuilditem_t *items, int first, int count, int depth ) {
+	cbvhnode_t * node = &cms->map_bvhnodes[ nodenum ];
+
+	MinMax3 bounds = MinMax3::Empty();
+	MinMax3 centroids = MinMax3::Empty();
+	for( int i = first; i < first + count; i++ ) {
+		bounds = Union( bounds, MinMax3( items[ i ].brush->mins, items[ i ].brush->maxs ) );
+		centroids = Extend( centroids, items[ i ].centroid );
+	}
+
+	node->mins = bounds.mins;
+	node->maxs = bounds.maxs;
+
+	if( count <= BVH_LEAF_BRUSHES ) {
+		node->first = first;
+		node->numbrushes = count;
+		return;
+	}
+
+	Vec3 extent = centroids.maxs - centroids.mins;
+	int axis = 0;
+	if( extent.y > extent[ axis ] )
+		axis = 1;
+	if( extent.z > extent[ axis ] )
+		axis = 2;
+
+	int split = -1;
+
+	if( depth < BVH_MAX_DEPTH && extent[ axis ] > 0.0f ) {
+		bvhbin_t bins[ BVH_BINS ];
+		for( bvhbin_t & bin : bins ) {
+			bin.bounds = MinMax3::Empty();
+			bin.count = 0;
+		}
+
+		float scale = BVH_BINS / extent[ axis ];
+		for( int i = first; i < first + count; i++ ) {
+			bvhbuilditem_t * item = &items[ i ];
+			item->bin = Min2( int( ( item->centroid[ axis ] - centroids.mins[ axis ] ) * scale ), BVH_BINS - 1 );
+			bins[ item->bin ].bounds = Union( bins[ item->bin ].bounds, MinMax3( item->brush->mins, item->brush->maxs ) );
+			bins[ item->bin ].count++;
+		}
+
+		// cost of splitting after each bin
+		float costs[ BVH_BINS - 1 ];
+		MinMax3 left = MinMax3::Empty();
+		int left_count = 0;
+		for( int i = 0; i < BVH_BINS - 1; i++ ) {
+			left = Union( left, bins[ i ].bounds );
+			left_count += bins[ i ].count;
+			costs[ i ] = left_count == 0 ? FLT_MAX : left_count * HalfSurfaceArea( left );
+		}
+
+		MinMax3 right = MinMax3::Empty();
+		int right_count = 0;
+		for( int i = BVH_BINS - 1; i > 0; i-- ) {
+			right = Union( right, bins[ i ].bounds );
+			right_count += bins[ i ].count;
+			costs[ i - 1 ] = right_count == 0 ? FLT_MAX : costs[ i - 1 ] + right_count * HalfSurfaceArea( right );
+		}
+
+		int best = 0;
+		for( int i = 1; i < BVH_BINS - 1; i++ ) {
+			if( costs[ i ] < costs[ best ] ) {
+				best = i;
+			}
+		}
+
+		if( costs[ best ] < FLT_MAX ) {
+			bvhbuilditem_t * middle = std::partition( items + first, items + first + count, [ best ]( const bvhbuilditem_t & item ) {
+				return item.bin <= best;
+			} );
+			split = middle - items;
+		}
+	}
+
+	// lots of items in the same place, or too deep. split in the middle
+	if( split <= first || split >= first + count ) {
+		split = first + count / 2;
+		std::nth_element( items + first, items + split, items + first + count, [ axis ]( const bvhbuilditem_t & a, const bvhbuilditem_t & b ) {
+			return a.centroid[ axis ] < b.centroid[ axis ];
+		} );
+	}
+
+	int children = cms->numbvhnodes;
+	cms->numbvhnodes += 2;
+
+	node->first = children;
+	node->numbrushes = 0;
+
+	CM_BuildBVHNode( cms, children, items, first, split - first, depth + 1 );
+	CM_BuildBVHNode( cms, children + 1, items, split, first + count - split, depth + 1 );
+}
+
+/*
+* CM_BuildBVH
+*
+* Builds a bvh over the world's brushes and patch facets
+*/
+static void CM_BuildBVH( CModelServerOrClient soc, CollisionModel *cms ) {
+	ZoneScoped;
+
+	const cmodel_t * world = CM_FindCModel( soc, StringHash( cms->world_hash ) );
+
+	int count = 0;
+	for( int i = 0; i < world->nummarkbrushes; i++ ) {
+		count += cms->map_brushes[ world->markbrushes[ i ] ].numsides > 0 ? 1 : 0;
+	}
+	for( int i = 0; i < world->nummarkfaces; i++ ) {
+		const cface_t * face = &cms->map_faces[ world->markfaces[ i ] ];
+		for( int j = 0; j < face->numfacets; j++ ) {
+			count += face->facets[ j ].numsides > 0 ? 1 : 0;
+		}
+	}
+
+	if( count == 0 ) {
+		return;
+	}
+
+	bvhbuilditem_t * items = ALLOC_MANY( sys_allocator, bvhbuilditem_t, count );
+	defer { FREE( sys_allocator, items ); };
+
+	int num_items = 0;
+	for( int i = 0; i < world->nummarkbrushes; i++ ) {
+		const cbrush_t * brush = &cms->map_brushes[ world->markbrushes[ i ] ];
+		if( brush->numsides > 0 ) {
+			items[ num_items ].brush = brush;
+			items[ num_items ].centroid = ( brush->mins + brush->maxs ) * 0.5f;
+			num_items++;
+		}
+	}
+	for( int i = 0; i < world->nummarkfaces; i++ ) {
+		const cface_t * face = &cms->map_faces[ world->markfaces[ i ] ];
+		for( int j = 0; j < face->numfacets; j++ ) {
+			const cbrush_t * facet = &face->facets[ j ];
+			if( facet->numsides > 0 ) {
+				items[ num_items ].brush = facet;
+				items[ num_items ].centroid = ( facet->mins + facet->maxs ) * 0.5f;
+				num_items++;
+			}
+		}
+	}
+
+	// a binary tree with at least one item per leaf
+	cms->map_bvhnodes = ALLOC_MANY( sys_allocator, cbvhnode_t, 2 * count - 1 );
+	cms->numbvhnodes = 1;
+	CM_BuildBVHNode( cms, 0, items, 0, count, 0 );
+
+	cms->map_bvhbrushes = ALLOC_MANY( sys_allocator, const cbrush_t *, count );
+	for( int i = 0; i < count; i++ ) {
+		cms->map_bvhbrushes[ i ] = items[ i ].brush;
+	}
+}
+
 void CM_LoadQ3BrushModel( CModelServerOrClient soc, CollisionModel * cms, Span< const u8 > data ) {
 	dheader_t header;
 	memcpy( &header, data.ptr, sizeof( header ) );
@@ -947,6 +1165,7 @@ void CM_LoadQ3BrushModel( CModelServerOrClient soc, CollisionModel * cms, Span<
 	CMod_LoadLeafs( cms, &header.lumps[LUMP_LEAFS] );
 	CMod_LoadNodes( cms, &header.lumps[LUMP_NODES] );
 	CMod_LoadSubmodels( soc, cms, &header.lumps[LUMP_MODELS] );
+	CM_BuildBVH( soc, cms );
 	CMod_LoadVisibility( cms, &header.lumps[LUMP_VISIBILITY] );
 	CMod_LoadEntityString( cms, &header.lumps[LUMP_ENTITIES] );
 
@@ -20,6 +20,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qcommon/qcommon.h"
 #include "qcommon/cm_local.h"
+#include "qcommon/rng.h"
+#include "qcommon/threadpool.h"
+
+#include <emmintrin.h>
 
 typedef struct {
 	int leaf_topnode;
@@ -52,32 +56,92 @@ typedef struct {
 	int *face_checkcounts;
 } traceWork_t;
 
+// bounding boxes are turned into these temporary models for tracing. every
+// thread gets its own so the game can trace from several threads at once
+struct cm_hulls_t {
+	bool initialized;
+
+	// only has to be unique among this thread's traces, as the brush and
+	// face checkcounts are per thread too
+	int checkcount;
+
+	cbrushside_t box_brushsides[6];
+	cbrushplanes_t box_planes[2];
+	cbrush_t box_brush[1];
+	int box_markbrushes[1];
+	cmodel_t box_cmodel[1];
+	int box_checkcount;
+
+	cbrushside_t oct_brushsides[10];
+	cbrushplanes_t oct_planes[3];
+	cbrush_t oct_brush[1];
+	int oct_markbrushes[1];
+	cmodel_t oct_cmodel[1];
+	int oct_checkcount;
+	Vec3 oct_bbox_mins, oct_bbox_maxs; // oct_cmodel's bounds are recentered, so keep the originals for cm_trace_recorder
+};
+
+static thread_local cm_hulls_t cm_hulls;
+
+void ( *cm_trace_recorder )( const CMTraceQuery * query, const trace_t * tr );
+
+int CM_NumBrushPlaneGroups( int numsides ) {
+	return ( numsides + 3 ) / 4;
+}
+
+/*
+* CM_SetBrushPlanes
+*
+* Copies the brush's planes into groups of four for the SSE clipping code
+*/
+void CM_SetBrushPlanes( cbrush_t *brush, cbrushplanes_t *planes ) {
+	for( int i = 0; i < CM_NumBrushPlaneGroups( brush->numsides ) * 4; i++ ) {
+		cbrushplanes_t * group = &planes[i / 4];
+		int lane = i % 4;
+
+		if( i < brush->numsides ) {
+			const cplane_t * p = &brush->brushsides[i].plane;
+			group->normal_x[lane] = p->normal.x;
+			group->normal_y[lane] = p->normal.y;
+			group->normal_z[lane] = p->normal.z;
+			group->dist[lane] = p->dist;
+		} else {
+			// everything is behind this so it never clips anything
+			group->normal_x[lane] = 0.0f;
+			group->normal_y[lane] = 0.0f;
+			group->normal_z[lane] = 0.0f;
+			group->dist[lane] = 1.0f;
+		}
+	}
+}
+
 /*
 * CM_InitBoxHull
 *
 * Set up the planes so that the six floats of a bounding box
 * can just be stored out and get a proper clipping hull structure.
 */
-void CM_InitBoxHull( CollisionModel *cms ) {
-	cms->box_brush->numsides = 6;
-	cms->box_brush->brushsides = cms->box_brushsides;
-	cms->box_brush->contents = CONTENTS_BODY;
+static void CM_InitBoxHull( cm_hulls_t *hulls ) {
+	hulls->box_brush->numsides = 6;
+	hulls->box_brush->brushsides = hulls->box_brushsides;
+	hulls->box_brush->planes = hulls->box_planes;
+	hulls->box_brush->contents = CONTENTS_BODY;
 
 	// Make sure CM_CollideBox() will not reject the brush by its bounds
-	ClearBounds( &cms->box_brush->maxs, &cms->box_brush->mins );
+	ClearBounds( &hulls->box_brush->maxs, &hulls->box_brush->mins );
 
-	cms->box_markbrushes[0] = 0;
+	hulls->box_markbrushes[0] = 0;
 
-	cms->box_cmodel->brushes = cms->box_brush;
-	cms->box_cmodel->builtin = true;
-	cms->box_cmodel->nummarkfaces = 0;
-	cms->box_cmodel->markfaces = NULL;
-	cms->box_cmodel->markbrushes = cms->box_markbrushes;
-	cms->box_cmodel->nummarkbrushes = 1;
+	hulls->box_cmodel->brushes = hulls->box_brush;
+	hulls->box_cmodel->builtin = true;
+	hulls->box_cmodel->nummarkfaces = 0;
+	hulls->box_cmodel->markfaces = NULL;
+	hulls->box_cmodel->markbrushes = hulls->box_markbrushes;
+	hulls->box_cmodel->nummarkbrushes = 1;
 
 	for( int i = 0; i < 6; i++ ) {
 		// brush sides
-		cbrushside_t * s = cms->box_brushsides + i;
+		cbrushside_t * s = hulls->box_brushsides + i;
 		s->surfFlags = 0;
 
 		// planes
@@ -98,7 +162,7 @@ void CM_InitBoxHull( CollisionModel *cms ) {
 * Set up the planes so that the six floats of a bounding box
 * can just be stored out and get a proper clipping hull structure.
 */
-void CM_InitOctagonHull( CollisionModel *cms ) {
+static void CM_InitOctagonHull( cm_hulls_t *hulls ) {
 	const Vec3 oct_dirs[4] = {
 		Vec3(  1.0f,  1.0f, 0.0f ),
 		Vec3( -1.0f,  1.0f, 0.0f ),
@@ -106,26 +170,27 @@ void CM_InitOctagonHull( CollisionModel *cms ) {
 		Vec3(  1.0f, -1.0f, 0.0f )
 	};
 
-	cms->oct_brush->numsides = 10;
-	cms->oct_brush->brushsides = cms->oct_brushsides;
-	cms->oct_brush->contents = CONTENTS_BODY;
+	hulls->oct_brush->numsides = 10;
+	hulls->oct_brush->brushsides = hulls->oct_brushsides;
+	hulls->oct_brush->planes = hulls->oct_planes;
+	hulls->oct_brush->contents = CONTENTS_BODY;
 
 	// Make sure CM_CollideBox() will not reject the brush by its bounds
-	ClearBounds( &cms->oct_brush->maxs, &cms->oct_brush->mins );
+	ClearBounds( &hulls->oct_brush->maxs, &hulls->oct_brush->mins );
 
-	cms->oct_markbrushes[0] = 0;
+	hulls->oct_markbrushes[0] = 0;
 
-	cms->oct_cmodel->brushes = cms->oct_brush;
-	cms->oct_cmodel->builtin = true;
-	cms->oct_cmodel->nummarkfaces = 0;
-	cms->oct_cmodel->markfaces = NULL;
-	cms->oct_cmodel->markbrushes = cms->oct_markbrushes;
-	cms->oct_cmodel->nummarkbrushes = 1;
+	hulls->oct_cmodel->brushes = hulls->oct_brush;
+	hulls->oct_cmodel->builtin = true;
+	hulls->oct_cmodel->nummarkfaces = 0;
+	hulls->oct_cmodel->markfaces = NULL;
+	hulls->oct_cmodel->markbrushes = hulls->oct_markbrushes;
+	hulls->oct_cmodel->nummarkbrushes = 1;
 
 	// axial planes
 	for( int i = 0; i < 6; i++ ) {
 		// brush sides
-		cbrushside_t * s = cms->oct_brushsides + i;
+		cbrushside_t * s = hulls->oct_brushsides + i;
 		s->surfFlags = 0;
 
 		// planes
@@ -142,7 +207,7 @@ void CM_InitOctagonHull( CollisionModel *cms ) {
 	// non-axial planes
 	for( int i = 6; i < 10; i++ ) {
 		// brush sides
-		cbrushside_t * s = cms->oct_brushsides + i;
+		cbrushside_t * s = hulls->oct_brushsides + i;
 		s->surfFlags = 0;
 
 		// planes
@@ -151,23 +216,35 @@ void CM_InitOctagonHull( CollisionModel *cms ) {
 	}
 }
 
+static cm_hulls_t *CM_Hulls() {
+	if( !cm_hulls.initialized ) {
+		CM_InitBoxHull( &cm_hulls );
+		CM_InitOctagonHull( &cm_hulls );
+		cm_hulls.initialized = true;
+	}
+	return &cm_hulls;
+}
+
 /*
 * CM_ModelForBBox
 *
 * To keep everything totally uniform, bounding boxes are turned into inline models
 */
 cmodel_t *CM_ModelForBBox( CollisionModel *cms, Vec3 mins, Vec3 maxs ) {
-	cms->box_brushsides[0].plane.dist = maxs.x;
-	cms->box_brushsides[1].plane.dist = -mins.x;
-	cms->box_brushsides[2].plane.dist = maxs.y;
-	cms->box_brushsides[3].plane.dist = -mins.y;
-	cms->box_brushsides[4].plane.dist = maxs.z;
-	cms->box_brushsides[5].plane.dist = -mins.z;
+	cm_hulls_t *hulls = CM_Hulls();
+	hulls->box_brushsides[0].plane.dist = maxs.x;
+	hulls->box_brushsides[1].plane.dist = -mins.x;
+	hulls->box_brushsides[2].plane.dist = maxs.y;
+	hulls->box_brushsides[3].plane.dist = -mins.y;
+	hulls->box_brushsides[4].plane.dist = maxs.z;
+	hulls->box_brushsides[5].plane.dist = -mins.z;
 
-	cms->box_cmodel->mins = mins;
-	cms->box_cmodel->maxs = maxs;
+	hulls->box_cmodel->mins = mins;
+	hulls->box_cmodel->maxs = maxs;
 
-	return cms->box_cmodel;
+	CM_SetBrushPlanes( hulls->box_brush, hulls->box_planes );
+
+	return hulls->box_cmodel;
 }
 
 /*
@@ -177,6 +254,7 @@ cmodel_t *CM_ModelForBBox( CollisionModel *cms, Vec3 mins, Vec3 maxs ) {
 * Internally offset to be symmetric on all sides.
 */
 cmodel_t *CM_OctagonModelForBBox( CollisionModel *cms, Vec3 mins, Vec3 maxs ) {
+	cm_hulls_t *hulls = CM_Hulls();
 	float a, b, d, t;
 	float sina, cosa;
 	Vec3 offset, size[2];
@@ -185,16 +263,18 @@ cmodel_t *CM_OctagonModelForBBox( CollisionModel *cms, Vec3 mins, Vec3 maxs ) {
 	size[0] = mins - offset;
 	size[1] = maxs - offset;
 
-	cms->oct_cmodel->cyl_offset = offset;
-	cms->oct_cmodel->mins = size[0];
-	cms->oct_cmodel->maxs = size[1];
+	hulls->oct_bbox_mins = mins;
+	hulls->oct_bbox_maxs = maxs;
+	hulls->oct_cmodel->cyl_offset = offset;
+	hulls->oct_cmodel->mins = size[0];
+	hulls->oct_cmodel->maxs = size[1];
 
-	cms->oct_brushsides[0].plane.dist = size[1].x;
-	cms->oct_brushsides[1].plane.dist = -size[0].x;
-	cms->oct_brushsides[2].plane.dist = size[1].y;
-	cms->oct_brushsides[3].plane.dist = -size[0].y;
-	cms->oct_brushsides[4].plane.dist = size[1].z;
-	cms->oct_brushsides[5].plane.dist = -size[0].z;
+	hulls->oct_brushsides[0].plane.dist = size[1].x;
+	hulls->oct_brushsides[1].plane.dist = -size[0].x;
+	hulls->oct_brushsides[2].plane.dist = size[1].y;
+	hulls->oct_brushsides[3].plane.dist = -size[0].y;
+	hulls->oct_brushsides[4].plane.dist = size[1].z;
+	hulls->oct_brushsides[5].plane.dist = -size[0].z;
 
 	a = size[1].x; // halfx
 	b = size[1].y; // halfy
@@ -214,19 +294,21 @@ cmodel_t *CM_OctagonModelForBBox( CollisionModel *cms, Vec3 mins, Vec3 maxs ) {
 
 	// the following should match normals set in CM_InitOctagonHull
 
-	cms->oct_brushsides[6].plane.normal = Vec3( cosa, sina, 0 );
-	cms->oct_brushsides[6].plane.dist = d;
+	hulls->oct_brushsides[6].plane.normal = Vec3( cosa, sina, 0 );
+	hulls->oct_brushsides[6].plane.dist = d;
+
+	hulls->oct_brushsides[7].plane.normal = Vec3( -cosa, sina, 0 );
+	hulls->oct_brushsides[7].plane.dist = d;
 
-	cms->oct_brushsides[7].plane.normal = Vec3( -cosa, sina, 0 );
-	cms->oct_brushsides[7].plane.dist = d;
+	hulls->oct_brushsides[8].plane.normal = Vec3( -cosa, -sina, 0 );
+	hulls->oct_brushsides[8].plane.dist = d;
 
-	cms->oct_brushsides[8].plane.normal = Vec3( -cosa, -sina, 0 );
-	cms->oct_brushsides[8].plane.dist = d;
+	hulls->oct_brushsides[9].plane.normal = Vec3( cosa, -sina, 0 );
+	hulls->oct_brushsides[9].plane.dist = d;
 
-	cms->oct_brushsides[9].plane.normal = Vec3( cosa, -sina, 0 );
-	cms->oct_brushsides[9].plane.dist = d;
+	CM_SetBrushPlanes( hulls->oct_brush, hulls->oct_planes );
 
-	return cms->oct_cmodel;
+	return hulls->oct_cmodel;
 }
 
 int CM_PointLeafnum( const CollisionModel *cms, Vec3 p ) {
@@ -320,9 +402,9 @@ int CM_BoxLeafnums( CollisionModel *cms, Vec3 mins, Vec3 maxs, int *list, int li
 	return bw.leaf_count;
 }
 
-static inline int CM_BrushContents( cbrush_t *brush, Vec3 p ) {
+static inline int CM_BrushContents( const cbrush_t *brush, Vec3 p ) {
 	int i;
-	cbrushside_t *brushside;
+	const cbrushside_t *brushside;
 
 	for( i = 0, brushside = brush->brushsides; i < brush->numsides; i++, brushside++ ) {
 		if( PlaneDiff( p, &brushside->plane ) > 0 ) {
@@ -346,9 +428,54 @@ static inline int CM_PatchContents( cface_t *patch, Vec3 p ) {
 	return 0;
 }
 
-static int CM_PointContents( CollisionModel *cms, Vec3 p, cmodel_t *cmodel ) {
+#define CM_BVH_STACK 64
+
+static bool CM_UseBVH( const CollisionModel *cms ) {
+	return cm_bvh->integer != 0 && cms->numbvhnodes > 0;
+}
+
+/*
+* CM_PointContentsBVH
+*
+* CM_PointContents for the world, using the bvh instead of the bsp
+*/
+static int CM_PointContentsBVH( const CollisionModel *cms, Vec3 p ) {
+	int contents = 0;
+
+	int stack[ CM_BVH_STACK ];
+	int stack_size = 0;
+	stack[ stack_size++ ] = 0;
+
+	while( stack_size > 0 ) {
+		const cbvhnode_t * node = &cms->map_bvhnodes[ stack[ --stack_size ] ];
+		if( !BoundsOverlap( p, p, node->mins, node->maxs ) ) {
+			continue;
+		}
+
+		if( node->numbrushes == 0 ) {
+			stack[ stack_size++ ] = node->first;
+			stack[ stack_size++ ] = node->first + 1;
+			continue;
+		}
+
+		for( int i = node->first; i < node->first + node->numbrushes; i++ ) {
+			const cbrush_t * brush = cms->map_bvhbrushes[ i ];
+			if( ( contents & brush->contents ) != brush->contents && BoundsOverlap( p, p, brush->mins, brush->maxs ) ) {
+				contents |= CM_BrushContents( brush, p );
+			}
+		}
+	}
+
+	return contents;
+}
+
+static int CM_PointContents( CollisionModel *cms, Vec3 p, cmodel_t *cmodel, bool bvh ) {
 	ZoneScoped;
 
+	if( bvh && cmodel->hash == cms->world_hash ) {
+		return CM_PointContentsBVH( cms, p );
+	}
+
 	int superContents;
 	int nummarkfaces, nummarkbrushes;
 	int *markface;
@@ -435,7 +562,7 @@ int CM_TransformedPointContents( CModelServerOrClient soc, CollisionModel * cms,
 		Matrix3_TransformVector( axis, temp, &p_l );
 	}
 
-	return CM_PointContents( cms, p_l, cmodel );
+	return CM_PointContents( cms, p_l, cmodel, CM_UseBVH( cms ) );
 }
 
 /*
@@ -449,6 +576,27 @@ BOX TRACING
 // 1/32 epsilon to keep floating point happy
 #define DIST_EPSILON    ( 1.0f / 32.0f )
 
+// picks if_negative in the lanes where x < 0
+static inline __m128 SelectNegative( __m128 x, __m128 if_negative, __m128 otherwise ) {
+	__m128 mask = _mm_cmplt_ps( x, _mm_setzero_ps() );
+	return _mm_or_ps( _mm_and_ps( mask, if_negative ), _mm_andnot_ps( mask, otherwise ) );
+}
+
+/*
+* CM_BoxPlaneDots
+*
+* Dots four plane normals with the box corner nearest to each plane, with the
+* box placed at p
+*/
+static inline __m128 CM_BoxPlaneDots( __m128 normal_x, __m128 normal_y, __m128 normal_z, Vec3 p, Vec3 mins, Vec3 maxs ) {
+	__m128 corner_x = _mm_add_ps( _mm_set1_ps( p.x ), SelectNegative( normal_x, _mm_set1_ps( maxs.x ), _mm_set1_ps( mins.x ) ) );
+	__m128 corner_y = _mm_add_ps( _mm_set1_ps( p.y ), SelectNegative( normal_y, _mm_set1_ps( maxs.y ), _mm_set1_ps( mins.y ) ) );
+	__m128 corner_z = _mm_add_ps( _mm_set1_ps( p.z ), SelectNegative( normal_z, _mm_set1_ps( maxs.z ), _mm_set1_ps( mins.z ) ) );
+
+	__m128 dot = _mm_add_ps( _mm_mul_ps( normal_x, corner_x ), _mm_mul_ps( normal_y, corner_y ) );
+	return _mm_add_ps( dot, _mm_mul_ps( normal_z, corner_z ) );
+}
+
 static void CM_ClipBoxToBrush( traceWork_t *tw, const cbrush_t *brush ) {
 	ZoneScoped;
 
@@ -456,63 +604,67 @@ static void CM_ClipBoxToBrush( traceWork_t *tw, const cbrush_t *brush ) {
 		return;
 	}
 
+	const __m128 zero = _mm_setzero_ps();
+
 	float enterfrac = -1.0f;
 	float leavefrac = 1.0f;
 	float enterfrac2 = -1.0f;
-
-	const cplane_t * clipplane = NULL;
+	int leadside = -1;
 
 	bool getout = false;
 	bool startout = false;
-	const cbrushside_t * leadside = NULL;
-	const cbrushside_t * side = brush->brushsides;
-
-	for( int i = 0; i < brush->numsides; i++, side++ ) {
-		const cplane_t * p = &side->plane;
-
-		Vec3 offset;
-		for( int j = 0; j < 3; j++ ) {
-			offset[ j ] = p->normal[ j ] < 0 ? tw->maxs[ j ] : tw->mins[ j ];
-		}
 
-		Vec3 start_offset, end_offset;
-		start_offset = tw->start + offset;
-		end_offset = tw->end + offset;
+	// four planes at a time
+	for( int i = 0; i < brush->numsides; i += 4 ) {
+		const cbrushplanes_t * planes = &brush->planes[ i / 4 ];
+		__m128 normal_x = _mm_load_ps( planes->normal_x );
+		__m128 normal_y = _mm_load_ps( planes->normal_y );
+		__m128 normal_z = _mm_load_ps( planes->normal_z );
+		__m128 dist = _mm_load_ps( planes->dist );
 
-		float d1 = Dot( p->normal, start_offset ) - p->dist;
-		float d2 = Dot( p->normal, end_offset ) - p->dist;
+		__m128 d1 = _mm_sub_ps( CM_BoxPlaneDots( normal_x, normal_y, normal_z, tw->start, tw->mins, tw->maxs ), dist );
+		__m128 d2 = _mm_sub_ps( CM_BoxPlaneDots( normal_x, normal_y, normal_z, tw->end, tw->mins, tw->maxs ), dist );
 
-		if( d2 > 0 ) {
-			getout = true; // endpoint is not in solid
-		}
-		if( d1 > 0 ) {
-			startout = true;
-		}
+		__m128 start_in_front = _mm_cmpgt_ps( d1, zero );
 
-		// if completely in front of face, no intersection
-		if( d1 > 0 && d2 >= d1 ) {
+		// if completely in front of any face, no intersection
+		if( _mm_movemask_ps( _mm_and_ps( start_in_front, _mm_cmpge_ps( d2, d1 ) ) ) != 0 ) {
 			return;
 		}
 
-		if( d1 <= 0 && d2 <= 0 ) {
+		int starts_out = _mm_movemask_ps( start_in_front );
+		int ends_out = _mm_movemask_ps( _mm_cmpgt_ps( d2, zero ) );
+		startout = startout || starts_out != 0;
+		getout = getout || ends_out != 0;
+
+		// the rest only cares about faces the move crosses
+		int crosses = starts_out | ends_out;
+		if( crosses == 0 ) {
 			continue;
 		}
 
-		// crosses face
-		float f = d1 - d2;
-		if( f > 0 ) {       // enter
-			f = d1 / f;
-			if( f > enterfrac ) {
-				enterfrac = f;
-				clipplane = p;
-				leadside = side;
-				enterfrac2 = ( d1 - DIST_EPSILON ) / ( d1 - d2 ); // nudged fraction
-			}
-		}
-		else if( f < 0 ) {   // leave
-			f = d1 / f;
-			if( f < leavefrac ) {
-				leavefrac = f;
+		__m128 f = _mm_sub_ps( d1, d2 );
+		int enters = _mm_movemask_ps( _mm_cmpgt_ps( f, zero ) ) & crosses;
+		int leaves = _mm_movemask_ps( _mm_cmplt_ps( f, zero ) ) & crosses;
+
+		alignas( 16 ) float d1s[ 4 ];
+		alignas( 16 ) float fs[ 4 ];
+		_mm_store_ps( d1s, d1 );
+		_mm_store_ps( fs, f );
+
+		// in plane order so ties go to the same side as they always have. the
+		// divides are scalar because with -ffast-math GCC turns vector divides
+		// into rcpps, and the fractions have to match the old code exactly
+		for( int j = 0; j < 4; j++ ) {
+			if( enters & ( 1 << j ) ) {
+				float frac = d1s[ j ] / fs[ j ];
+				if( frac > enterfrac ) {
+					enterfrac = frac;
+					enterfrac2 = ( d1s[ j ] - DIST_EPSILON ) / fs[ j ]; // nudged fraction
+					leadside = i + j;
+				}
+			} else if( leaves & ( 1 << j ) ) {
+				leavefrac = Min2( leavefrac, d1s[ j ] / fs[ j ] );
 			}
 		}
 	}
@@ -536,9 +688,10 @@ static void CM_ClipBoxToBrush( traceWork_t *tw, const cbrush_t *brush ) {
 	// check if this will reduce the collision time range
 	if( enterfrac < tw->realfraction ) {
 		if( enterfrac2 < tw->trace->fraction ) {
+			const cbrushside_t * side = &brush->brushsides[ leadside ];
 			tw->realfraction = enterfrac;
-			tw->trace->plane = *clipplane;
-			tw->trace->surfFlags = leadside->surfFlags;
+			tw->trace->plane = side->plane;
+			tw->trace->surfFlags = side->surfFlags;
 			tw->trace->contents = brush->contents;
 			tw->trace->fraction = enterfrac2;
 		}
@@ -552,18 +705,15 @@ static void CM_TestBoxInBrush( traceWork_t *tw, const cbrush_t *brush ) {
 		return;
 	}
 
-	const cbrushside_t * side = brush->brushsides;
-	for( int i = 0; i < brush->numsides; i++, side++ ) {
-		const cplane_t * p = &side->plane;
-
-		Vec3 offset;
-		for( int j = 0; j < 3; j++ ) {
-			offset[ j ] = p->normal[ j ] < 0 ? tw->maxs[ j ] : tw->mins[ j ];
-		}
-
-		Vec3 start_offset = tw->start + offset;
+	for( int i = 0; i < brush->numsides; i += 4 ) {
+		const cbrushplanes_t * planes = &brush->planes[ i / 4 ];
+		__m128 normal_x = _mm_load_ps( planes->normal_x );
+		__m128 normal_y = _mm_load_ps( planes->normal_y );
+		__m128 normal_z = _mm_load_ps( planes->normal_z );
+		__m128 dist = _mm_load_ps( planes->dist );
 
-		if( Dot( p->normal, start_offset ) > p->dist ) {
+		__m128 dots = CM_BoxPlaneDots( normal_x, normal_y, normal_z, tw->start, tw->mins, tw->maxs );
+		if( _mm_movemask_ps( _mm_cmpgt_ps( dots, dist ) ) != 0 ) {
 			return;
 		}
 	}
@@ -645,6 +795,129 @@ static inline void CM_TestBox( traceWork_t *tw, const int *markbrushes, int numm
 	CM_CollideBox( tw, markbrushes, nummarkbrushes, markfaces, nummarkfaces, CM_TestBoxInBrush );
 }
 
+struct bvhmove_t {
+	__m128 near_corner;     // start + maxs, moved out by a unit
+	__m128 far_corner;      // start + mins, moved out by a unit
+	__m128 inv_dir;
+};
+
+/*
+* CM_BVHNodeEnterFraction
+*
+* Returns how far along the move the box first touches the node's bounds,
+* or something above 1 if it never does
+*/
+static inline float CM_BVHNodeEnterFraction( const bvhmove_t *move, const cbvhnode_t *node ) {
+	const __m128 xyz = _mm_castsi128_ps( _mm_set_epi32( 0, -1, -1, -1 ) );
+
+	// mins.xyz, maxs.x and maxs.xyz, mins.z
+	__m128 mins = _mm_loadu_ps( &node->mins.x );
+	__m128 maxs = _mm_loadu_ps( &node->mins.z );
+	maxs = _mm_shuffle_ps( maxs, maxs, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+
+	__m128 t0 = _mm_mul_ps( _mm_sub_ps( mins, move->near_corner ), move->inv_dir );
+	__m128 t1 = _mm_mul_ps( _mm_sub_ps( maxs, move->far_corner ), move->inv_dir );
+
+	// w is junk, replace it with the move's own [0, 1]
+	__m128 enter = _mm_and_ps( xyz, _mm_min_ps( t0, t1 ) );
+	__m128 leave = _mm_or_ps( _mm_and_ps( xyz, _mm_max_ps( t0, t1 ) ), _mm_andnot_ps( xyz, _mm_set1_ps( 1.0f ) ) );
+
+	enter = _mm_max_ps( enter, _mm_shuffle_ps( enter, enter, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	enter = _mm_max_ps( enter, _mm_shuffle_ps( enter, enter, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	leave = _mm_min_ps( leave, _mm_shuffle_ps( leave, leave, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	leave = _mm_min_ps( leave, _mm_shuffle_ps( leave, leave, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+
+	float enter_frac = _mm_cvtss_f32( enter );
+	return enter_frac <= _mm_cvtss_f32( leave ) ? enter_frac : 2.0f;
+}
+
+/*
+* CM_CollideBoxBVH
+*
+* CM_CollideBox against the whole world, walking the bvh front to back and
+* skipping nodes the move can't reach before what it already hit
+*/
+static void CM_CollideBoxBVH( traceWork_t *tw, void ( *func )( traceWork_t *, const cbrush_t *b ) ) {
+	ZoneScoped;
+
+	const CollisionModel * cms = tw->cms;
+
+	// pad by a unit so brushes touching the bounds still get clipped. axes
+	// the move doesn't go along get a huge inv_dir, so they reject the node
+	// when the box is outside it on that axis and are ignored otherwise
+	bvhmove_t move;
+	Vec3 near_corner = tw->start + tw->maxs + Vec3( 1.0f );
+	Vec3 far_corner = tw->start + tw->mins - Vec3( 1.0f );
+	Vec3 inv_dir;
+	for( int i = 0; i < 3; i++ ) {
+		float dir = tw->end[ i ] - tw->start[ i ];
+		inv_dir[ i ] = dir == 0.0f ? 1e30f : 1.0f / dir;
+	}
+	move.near_corner = _mm_setr_ps( near_corner.x, near_corner.y, near_corner.z, 0.0f );
+	move.far_corner = _mm_setr_ps( far_corner.x, far_corner.y, far_corner.z, 0.0f );
+	move.inv_dir = _mm_setr_ps( inv_dir.x, inv_dir.y, inv_dir.z, 0.0f );
+
+	struct {
+		int node;
+		float enter;
+	} stack[ CM_BVH_STACK ];
+	int stack_size = 0;
+
+	float root_enter = CM_BVHNodeEnterFraction( &move, &cms->map_bvhnodes[ 0 ] );
+	if( root_enter <= 1.0f ) {
+		stack[ stack_size ].node = 0;
+		stack[ stack_size ].enter = root_enter;
+		stack_size++;
+	}
+
+	while( stack_size > 0 ) {
+		stack_size--;
+		if( stack[ stack_size ].enter > tw->realfraction ) {
+			continue; // already hit something nearer
+		}
+
+		const cbvhnode_t * node = &cms->map_bvhnodes[ stack[ stack_size ].node ];
+
+		if( node->numbrushes > 0 ) {
+			for( int i = node->first; i < node->first + node->numbrushes; i++ ) {
+				const cbrush_t * brush = cms->map_bvhbrushes[ i ];
+				if( !( brush->contents & tw->contents ) ) {
+					continue;
+				}
+				if( !BoundsOverlap( brush->mins, brush->maxs, tw->absmins, tw->absmaxs ) ) {
+					continue;
+				}
+				func( tw, brush );
+				if( !tw->trace->fraction ) {
+					return;
+				}
+			}
+			continue;
+		}
+
+		int near = node->first;
+		int far = node->first + 1;
+		float near_enter = CM_BVHNodeEnterFraction( &move, &cms->map_bvhnodes[ near ] );
+		float far_enter = CM_BVHNodeEnterFraction( &move, &cms->map_bvhnodes[ far ] );
+		if( far_enter < near_enter ) {
+			Swap2( &near, &far );
+			Swap2( &near_enter, &far_enter );
+		}
+
+		// push the far child first so the near one gets popped first
+		if( far_enter <= tw->realfraction ) {
+			stack[ stack_size ].node = far;
+			stack[ stack_size ].enter = far_enter;
+			stack_size++;
+		}
+		if( near_enter <= tw->realfraction ) {
+			stack[ stack_size ].node = near;
+			stack[ stack_size ].enter = near_enter;
+			stack_size++;
+		}
+	}
+}
+
 static void CM_RecursiveHullCheck( traceWork_t *tw, int num, float p1f, float p2f, Vec3 p1, Vec3 p2 ) {
 	const CollisionModel * cms = tw->cms;
 
@@ -722,7 +995,7 @@ static void CM_RecursiveHullCheck( traceWork_t *tw, int num, float p1f, float p2
 
 static void CM_BoxTrace( traceWork_t *tw, CollisionModel *cms, trace_t *tr,
 	Vec3 start, Vec3 end, Vec3 mins, Vec3 maxs,
-	const cmodel_t *cmodel, Vec3 origin, int brushmask ) {
+	const cmodel_t *cmodel, Vec3 origin, int brushmask, bool bvh ) {
 
 	ZoneScoped;
 
@@ -732,12 +1005,15 @@ static void CM_BoxTrace( traceWork_t *tw, CollisionModel *cms, trace_t *tr,
 	memset( tr, 0, sizeof( *tr ) );
 	tr->fraction = 1;
 
-	cms->checkcount++;  // for multi-check avoidance
+	// for multi-check avoidance
+	cm_hulls_t *hulls = CM_Hulls();
+	hulls->checkcount++;
+	int checkcount = hulls->checkcount;
 
 	memset( tw, 0, sizeof( *tw ) );
 	// the epsilon considers blockers with realfraction == 1 and nudged fraction < 1
 	tw->realfraction = 1 + DIST_EPSILON;
-	tw->checkcount = cms->checkcount;
+	tw->checkcount = checkcount;
 	tw->trace = tr;
 	tw->contents = brushmask;
 	tw->cms = cms;
@@ -761,22 +1037,26 @@ static void CM_BoxTrace( traceWork_t *tw, CollisionModel *cms, trace_t *tr,
 	tw->brushes = cmodel->brushes;
 	tw->faces = cmodel->faces;
 
-	if( cmodel == cms->oct_cmodel ) {
-		tw->brush_checkcounts = &cms->oct_checkcount;
+	if( cmodel == hulls->oct_cmodel ) {
+		tw->brush_checkcounts = &hulls->oct_checkcount;
 		tw->face_checkcounts = NULL;
-	} else if( cmodel == cms->box_cmodel ) {
-		tw->brush_checkcounts = &cms->box_checkcount;
+	} else if( cmodel == hulls->box_cmodel ) {
+		tw->brush_checkcounts = &hulls->box_checkcount;
 		tw->face_checkcounts = NULL;
 	} else {
-		tw->brush_checkcounts = cms->map_brush_checkcheckouts;
-		tw->face_checkcounts = cms->map_face_checkcheckouts;
+		u32 thread = ThreadPoolThreadIndex();
+		tw->brush_checkcounts = cms->map_brush_checkcounts + size_t( cms->numbrushes ) * thread;
+		tw->face_checkcounts = cms->map_face_checkcounts + size_t( cms->numfaces ) * thread;
 	}
 
 	//
 	// check for position test special case
 	//
 	if( start == end ) {
-		if( world ) {
+		if( world && bvh ) {
+			CM_CollideBoxBVH( tw, CM_TestBoxInBrush );
+		}
+		else if( world ) {
 			Vec3 c1 = start + mins - Vec3( 1.0f );
 			Vec3 c2 = start + maxs + Vec3( 1.0f );
 
@@ -813,7 +1093,10 @@ static void CM_BoxTrace( traceWork_t *tw, CollisionModel *cms, trace_t *tr,
 	//
 	// general sweeping through world
 	//
-	if( world ) {
+	if( world && bvh ) {
+		CM_CollideBoxBVH( tw, CM_ClipBoxToBrush );
+	}
+	else if( world ) {
 		CM_RecursiveHullCheck( tw, 0, 0, 1, start, end );
 	}
 	else if( BoundsOverlap( cmodel->mins, cmodel->maxs, tw->absmins, tw->absmaxs ) ) {
@@ -847,7 +1130,7 @@ void CM_TransformedBoxTrace( CModelServerOrClient soc, CollisionModel * cms, tra
 	}
 
 	// cylinder offset
-	if( cmodel == cms->oct_cmodel ) {
+	if( cmodel == cm_hulls.oct_cmodel ) {
 		start_l = start - cmodel->cyl_offset;
 		end_l = end - cmodel->cyl_offset;
 	} else {
@@ -881,7 +1164,7 @@ void CM_TransformedBoxTrace( CModelServerOrClient soc, CollisionModel * cms, tra
 	}
 
 	// sweep the box through the model
-	CM_BoxTrace( &tw, cms, tr, start_l, end_l, mins, maxs, cmodel, origin, brushmask );
+	CM_BoxTrace( &tw, cms, tr, start_l, end_l, mins, maxs, cmodel, origin, brushmask, CM_UseBVH( cms ) );
 
 	if( rotated && tr->fraction != 1.0 ) {
 		a = -angles;
@@ -892,4 +1175,150 @@ void CM_TransformedBoxTrace( CModelServerOrClient soc, CollisionModel * cms, tra
 	}
 
 	tr->endpos = Lerp( start, tr->fraction, end );
+
+	if( cm_trace_recorder != NULL && soc == CM_Server ) {
+		CMTraceQuery query = { };
+		query.start = start;
+		query.end = end;
+		query.mins = mins;
+		query.maxs = maxs;
+		query.origin = origin;
+		query.angles = angles;
+		query.brushmask = brushmask;
+
+		if( cmodel == cm_hulls.box_cmodel ) {
+			query.model_type = CMTraceModel_Box;
+			query.model_mins = cmodel->mins;
+			query.model_maxs = cmodel->maxs;
+		}
+		else if( cmodel == cm_hulls.oct_cmodel ) {
+			query.model_type = CMTraceModel_Octagon;
+			query.model_mins = cm_hulls.oct_bbox_mins;
+			query.model_maxs = cm_hulls.oct_bbox_maxs;
+		}
+		else {
+			query.model_type = CMTraceModel_Inline;
+			query.model_hash = cmodel->hash;
+		}
+
+		cm_trace_recorder( &query, tr );
+	}
+}
+
+/*
+* CM_TraceQueryModel
+*
+* Returns the model a recorded trace was against, or NULL if it isn't in this map
+*/
+cmodel_t * CM_TraceQueryModel( CModelServerOrClient soc, CollisionModel * cms, const CMTraceQuery * query ) {
+	switch( query->model_type ) {
+		case CMTraceModel_Box:
+			return CM_ModelForBBox( cms, query->model_mins, query->model_maxs );
+		case CMTraceModel_Octagon:
+			return CM_OctagonModelForBBox( cms, query->model_mins, query->model_maxs );
+		case CMTraceModel_Inline:
+			return CM_TryFindCModel( soc, StringHash( query->model_hash ) );
+	}
+
+	return NULL;
+}
+
+/*
+* CM_TestBVH
+*
+* Runs random traces and point contents queries through both the bsp and
+* the bvh and reports where they disagree
+*/
+void CM_TestBVH( CModelServerOrClient soc, CollisionModel *cms, int count ) {
+	if( cms->numbvhnodes == 0 ) {
+		Com_Printf( "The map has no bvh\n" );
+		return;
+	}
+
+	cmodel_t * world = CM_FindCModel( soc, StringHash( cms->world_hash ) );
+
+	struct TestTrace {
+		Vec3 start, end;
+		Vec3 size;
+		int mask;
+		trace_t bsp, bvh;
+	};
+
+	TestTrace * traces = ALLOC_MANY( sys_allocator, TestTrace, count );
+	defer { FREE( sys_allocator, traces ); };
+
+	const Vec3 box_sizes[] = { Vec3( 0.0f ), Vec3( 2.0f ), Vec3( 16.0f, 16.0f, 32.0f ) };
+	const int masks[] = { MASK_PLAYERSOLID, MASK_SHOT, MASK_WATER, MASK_ALL };
+
+	RNG rng = new_rng( 1, 1 );
+
+	for( int i = 0; i < count; i++ ) {
+		TestTrace * trace = &traces[ i ];
+		for( int j = 0; j < 3; j++ ) {
+			trace->start[ j ] = random_uniform_float( &rng, cms->world_mins[ j ], cms->world_maxs[ j ] );
+			trace->end[ j ] = random_uniform_float( &rng, cms->world_mins[ j ], cms->world_maxs[ j ] );
+		}
+
+		// mostly short moves like the game does, some position tests and
+		// some moves across the whole map
+		int kind = random_uniform( &rng, 0, 10 );
+		if( kind == 0 ) {
+			trace->end = trace->start;
+		}
+		else if( kind < 9 ) {
+			trace->end = trace->start + Normalize( trace->end - trace->start ) * random_uniform_float( &rng, 0.0f, 256.0f );
+		}
+
+		trace->size = random_select( &rng, box_sizes );
+		trace->mask = random_select( &rng, masks );
+	}
+
+	traceWork_t tw;
+
+	u64 bsp_start = Sys_Microseconds();
+	for( int i = 0; i < count; i++ ) {
+		TestTrace * trace = &traces[ i ];
+		CM_BoxTrace( &tw, cms, &trace->bsp, trace->start, trace->end, -trace->size, trace->size, world, Vec3( 0.0f ), trace->mask, false );
+	}
+
+	u64 bvh_start = Sys_Microseconds();
+	for( int i = 0; i < count; i++ ) {
+		TestTrace * trace = &traces[ i ];
+		CM_BoxTrace( &tw, cms, &trace->bvh, trace->start, trace->end, -trace->size, trace->size, world, Vec3( 0.0f ), trace->mask, true );
+	}
+	u64 bvh_end = Sys_Microseconds();
+
+	int startsolid = 0;
+	int trace_mismatches = 0;
+	int contents_mismatches = 0;
+
+	for( int i = 0; i < count; i++ ) {
+		const TestTrace * trace = &traces[ i ];
+		const trace_t * bsp = &trace->bsp;
+		const trace_t * bvh = &trace->bvh;
+
+		if( CM_PointContents( cms, trace->start, world, false ) != CM_PointContents( cms, trace->start, world, true ) ) {
+			contents_mismatches++;
+		}
+
+		// the bsp doesn't list every brush in leafs outside the map, so
+		// traces starting in solid can legitimately differ
+		if( bsp->startsolid || bvh->startsolid ) {
+			startsolid++;
+			continue;
+		}
+
+		// ties between brushes can pick a different plane, so only compare what the game uses
+		if( bsp->allsolid != bvh->allsolid || Abs( bsp->fraction - bvh->fraction ) > 0.001f ) {
+			if( trace_mismatches < 10 ) {
+				Com_GGPrint( "Trace mismatch: {} -> {} size {} mask {x}: bsp {} bvh {}", trace->start, trace->end, trace->size, trace->mask, bsp->fraction, bvh->fraction );
+			}
+			trace_mismatches++;
+		}
+	}
+
+	Com_Printf( "%d traces, %d started in solid: %d mismatched traces, %d mismatched point contents\n",
+		count, startsolid, trace_mismatches, contents_mismatches );
+	Com_Printf( "bsp: %.3fus per trace, bvh: %.3fus per trace\n",
+		double( bvh_start - bsp_start ) / count, double( bvh_end - bvh_start ) / count );
 }
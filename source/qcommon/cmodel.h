@@ -41,6 +41,15 @@ struct cbrushside_t {
 	cplane_t plane;
 };
 
+// a brush's planes four at a time for the SSE clipping code. the last group
+// is padded with planes that everything is behind
+struct alignas( 16 ) cbrushplanes_t {
+	float normal_x[4];
+	float normal_y[4];
+	float normal_z[4];
+	float dist[4];
+};
+
 struct cbrush_t {
 	int contents;
 	int numsides;
@@ -48,6 +57,7 @@ struct cbrush_t {
 	Vec3 mins, maxs;
 
 	cbrushside_t *brushsides;
+	cbrushplanes_t *planes;
 };
 
 struct cface_t {
@@ -72,6 +82,12 @@ struct cleaf_t {
 	int *markfaces;
 };
 
+struct cbvhnode_t {
+	Vec3 mins, maxs;
+	int first;                  // first child node, or first brush for leafs
+	int numbrushes;             // 0 for interior nodes
+};
+
 struct cmodel_t {
 	u64 hash;
 
@@ -102,7 +118,6 @@ struct CollisionModel {
 	u64 base_hash;
 	u64 world_hash;
 
-	int checkcount;
 	int floodvalid;
 
 	u32 checksum;
@@ -131,6 +146,7 @@ struct CollisionModel {
 
 	int numbrushes;
 	cbrush_t *map_brushes;
+	cbrushplanes_t *map_brushplanes;
 
 	int numfaces;
 	cface_t *map_faces;
@@ -160,21 +176,15 @@ struct CollisionModel {
 
 	const u8 *cmod_base;
 
-	// cm_trace.c
-	cbrushside_t box_brushsides[6];
-	cbrush_t box_brush[1];
-	int box_markbrushes[1];
-	cmodel_t box_cmodel[1];
-	int box_checkcount;
-
-	cbrushside_t oct_brushsides[10];
-	cbrush_t oct_brush[1];
-	int oct_markbrushes[1];
-	cmodel_t oct_cmodel[1];
-	int oct_checkcount;
-
-	int *map_brush_checkcheckouts;
-	int *map_face_checkcheckouts;
+	// world brushes and patch facets in a bounding volume hierarchy,
+	// for tracing without walking the bsp
+	int numbvhnodes;
+	cbvhnode_t *map_bvhnodes;
+	const cbrush_t **map_bvhbrushes;
+
+	// cm_trace.c, numbrushes/numfaces for each thread pool thread
+	int *map_brush_checkcounts;
+	int *map_face_checkcounts;
 };
 
 enum CModelServerOrClient {
@@ -182,6 +192,8 @@ enum CModelServerOrClient {
 	CM_Server,
 };
 
+void CM_Init();
+
 CollisionModel * CM_LoadMap( CModelServerOrClient soc, Span< const u8 > data, u64 base_hash );
 void CM_Free( CModelServerOrClient soc,  CollisionModel * cms );
 
@@ -206,6 +218,33 @@ int CM_TransformedPointContents( CModelServerOrClient soc, CollisionModel * cms,
 void CM_TransformedBoxTrace( CModelServerOrClient soc, CollisionModel * cms, trace_t * tr, Vec3 start, Vec3 end, Vec3 mins, Vec3 maxs,
 							 const cmodel_t *cmodel, int brushmask, Vec3 origin, Vec3 angles );
 
+// checks the bvh trace backend against the bsp
+void CM_TestBVH( CModelServerOrClient soc, CollisionModel *cms, int count );
+
+// everything needed to run a CM_TransformedBoxTrace again later
+enum CMTraceModelType {
+	CMTraceModel_Inline,
+	CMTraceModel_Box,
+	CMTraceModel_Octagon,
+};
+
+struct CMTraceQuery {
+	Vec3 start, end;
+	Vec3 mins, maxs;
+	Vec3 origin, angles;
+	int brushmask;
+
+	CMTraceModelType model_type;
+	u64 model_hash; // CMTraceModel_Inline
+	Vec3 model_mins, model_maxs; // what CM_ModelForBBox/CM_OctagonModelForBBox were called with
+};
+
+// called after every server side trace while it's set. it can be called
+// from several threads at once
+extern void ( *cm_trace_recorder )( const CMTraceQuery * query, const trace_t * tr );
+
+cmodel_t * CM_TraceQueryModel( CModelServerOrClient soc, CollisionModel * cms, const CMTraceQuery * query );
+
 int CM_ClusterRowSize( const CollisionModel *cms );
 int CM_AreaRowSize( const CollisionModel *cms );
 int CM_PointLeafnum( const CollisionModel *cms, Vec3 p );
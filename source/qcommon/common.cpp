@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon/glob.h"
 #include "qcommon/maplist.h"
 #include "qcommon/threads.h"
+#include "qcommon/threadpool.h"
 #include "qcommon/version.h"
 
 #include <setjmp.h>
@@ -602,6 +603,10 @@ void Qcommon_Init( int argc, char **argv ) {
 
 	CSPRNG_Init();
 
+	InitThreadPool();
+
+	CM_Init();
+
 	NET_Init();
 	Netchan_Init();
 
@@ -669,6 +674,8 @@ void Qcommon_Shutdown() {
 	NET_Shutdown();
 	Key_Shutdown();
 
+	ShutdownThreadPool();
+
 	Qcommon_ShutdownCommands();
 	Memory_ShutdownCommands();
 
@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sys_fs.h"
 
 #include "zlib/zlib.h"
+#include "zstd/zstd.h"
 
 /*
 =============================================================================
@@ -39,12 +40,15 @@ QUAKE FILESYSTEM
 
 #define FS_GZ_BUFSIZE               0x00020000
 
+struct zstdfile_t;
+
 typedef struct filehandle_s {
 	FILE *fstream;
 	unsigned uncompressedSize;      // uncompressed size
 	unsigned offset;                // current read/write pos
 	gzFile gzstream;
 	int gzlevel;
+	zstdfile_t *zstd;
 
 	struct filehandle_s *prev, *next;
 } filehandle_t;
@@ -332,21 +336,493 @@ static void FS_FileModeStr( int mode, char *modestr, size_t size ) {
 				 mode & FS_UPDATE ? "+" : "" );
 }
 
+/*
+=============================================================================
+
+CHUNKED ZSTD FILES
+
+FS_ZSTD files are a short header followed by independently compressed chunks,
+so reading can start from any chunk instead of decompressing from the start
+of the file. Each chunk is stored as
+
+	u32 stored size, high bit set if the chunk is stored uncompressed
+	u32 uncompressed size
+	data
+
+When the file is closed a table of { uncompressed offset, file offset } pairs
+is appended for every chunk, followed by the trailer. Files without a trailer
+(e.g. the writer crashed) are still readable, the table is rebuilt by walking
+the chunk headers.
+
+If a write fails (e.g. the disk is full) the file is marked as failed, later
+writes do nothing and return -1, and closing it doesn't write the trailer.
+
+=============================================================================
+*/
+
+#define FS_ZSTD_MAGIC               ( 'C' | ( 'D' << 8 ) | ( 'Z' << 16 ) | ( '1' << 24 ) )
+#define FS_ZSTD_TRAILER_MAGIC       ( 'C' | ( 'D' << 8 ) | ( 'Z' << 16 ) | ( 'T' << 24 ) )
+#define FS_ZSTD_CHUNK_SIZE          0x00020000
+#define FS_ZSTD_RAW_CHUNK           0x80000000u
+#define FS_ZSTD_HEADER_SIZE         8
+#define FS_ZSTD_CHUNK_HEADER_SIZE   8
+#define FS_ZSTD_TRAILER_SIZE        16
+
+struct zstdchunk_t {
+	unsigned uncompressed_offset;
+	unsigned file_offset;           // points at the chunk header
+};
+
+struct zstdfile_t {
+	int level;                      // 0 stores chunks uncompressed
+
+	u8 *chunk;                      // FS_ZSTD_CHUNK_SIZE bytes, pending data when writing
+	u8 *compressed;
+	size_t compressed_size;
+
+	unsigned chunk_offset;          // uncompressed offset of chunk[0]
+	unsigned chunk_size;
+	unsigned chunk_pos;
+	int current_chunk;              // -1 if nothing is loaded
+
+	zstdchunk_t *chunks;
+	int num_chunks;
+	int max_chunks;
+
+	unsigned uncompressed_size;
+	bool failed;                    // a write failed, stop writing
+
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+};
+
+/*
+* FS_Zstd_New
+*/
+static zstdfile_t *FS_Zstd_New() {
+	zstdfile_t *zf = ( zstdfile_t * )FS_Malloc( sizeof( zstdfile_t ) );
+	memset( zf, 0, sizeof( *zf ) );
+	zf->level = ZSTD_CLEVEL_DEFAULT;
+	zf->current_chunk = -1;
+	zf->chunk = ( u8 * )FS_Malloc( FS_ZSTD_CHUNK_SIZE );
+	zf->compressed_size = ZSTD_compressBound( FS_ZSTD_CHUNK_SIZE );
+	zf->compressed = ( u8 * )FS_Malloc( zf->compressed_size );
+	return zf;
+}
+
+/*
+* FS_Zstd_Delete
+*/
+static void FS_Zstd_Delete( zstdfile_t *zf ) {
+	ZSTD_freeCCtx( zf->cctx );
+	ZSTD_freeDCtx( zf->dctx );
+	if( zf->chunks ) {
+		FS_Free( zf->chunks );
+	}
+	FS_Free( zf->compressed );
+	FS_Free( zf->chunk );
+	FS_Free( zf );
+}
+
+/*
+* FS_Zstd_AddChunk
+*/
+static void FS_Zstd_AddChunk( zstdfile_t *zf, unsigned uncompressed_offset, unsigned file_offset ) {
+	if( zf->num_chunks == zf->max_chunks ) {
+		zf->max_chunks = Max2( 64, zf->max_chunks * 2 );
+		zstdchunk_t *chunks = ( zstdchunk_t * )FS_Malloc( zf->max_chunks * sizeof( zstdchunk_t ) );
+		if( zf->chunks ) {
+			memcpy( chunks, zf->chunks, zf->num_chunks * sizeof( zstdchunk_t ) );
+			FS_Free( zf->chunks );
+		}
+		zf->chunks = chunks;
+	}
+
+	zf->chunks[zf->num_chunks].uncompressed_offset = uncompressed_offset;
+	zf->chunks[zf->num_chunks].file_offset = file_offset;
+	zf->num_chunks++;
+}
+
+/*
+* FS_Zstd_OpenWrite
+*/
+static zstdfile_t *FS_Zstd_OpenWrite( FILE *f ) {
+	unsigned header[2] = { LittleLong( FS_ZSTD_MAGIC ), LittleLong( FS_ZSTD_CHUNK_SIZE ) };
+	if( fwrite( header, 1, sizeof( header ), f ) != sizeof( header ) ) {
+		return NULL;
+	}
+
+	zstdfile_t *zf = FS_Zstd_New();
+	zf->cctx = ZSTD_createCCtx();
+	return zf;
+}
+
+/*
+* FS_Zstd_FlushChunk
+*
+* Compresses and writes out whatever is pending
+*/
+static bool FS_Zstd_FlushChunk( zstdfile_t *zf, FILE *f ) {
+	if( zf->failed ) {
+		return false;
+	}
+	if( zf->chunk_size == 0 ) {
+		return true;
+	}
+
+	const void *data = zf->chunk;
+	unsigned stored_size = zf->chunk_size;
+	unsigned flags = FS_ZSTD_RAW_CHUNK;
+
+	if( zf->level != 0 ) {
+		size_t r = ZSTD_compressCCtx( zf->cctx, zf->compressed, zf->compressed_size, zf->chunk, zf->chunk_size, zf->level );
+		if( !ZSTD_isError( r ) && r < zf->chunk_size ) {
+			data = zf->compressed;
+			stored_size = r;
+			flags = 0;
+		}
+	}
+
+	FS_Zstd_AddChunk( zf, zf->uncompressed_size, ftell( f ) );
+
+	unsigned header[2] = { LittleLong( stored_size | flags ), LittleLong( zf->chunk_size ) };
+	if( fwrite( header, 1, sizeof( header ), f ) != sizeof( header ) || fwrite( data, 1, stored_size, f ) != stored_size ) {
+		Com_Printf( S_COLOR_RED "FS_Zstd_FlushChunk: can't write %u bytes\n", stored_size );
+		zf->failed = true;
+		return false;
+	}
+
+	zf->uncompressed_size += zf->chunk_size;
+	zf->chunk_size = 0;
+	return true;
+}
+
+/*
+* FS_Zstd_Write
+*/
+static int FS_Zstd_Write( zstdfile_t *zf, FILE *f, const void *buffer, size_t len ) {
+	const u8 *buf = ( const u8 * )buffer;
+	size_t left = len;
+
+	if( zf->failed ) {
+		return -1;
+	}
+
+	while( left > 0 ) {
+		size_t n = Min2( left, size_t( FS_ZSTD_CHUNK_SIZE - zf->chunk_size ) );
+		memcpy( zf->chunk + zf->chunk_size, buf, n );
+		zf->chunk_size += n;
+		buf += n;
+		left -= n;
+
+		if( zf->chunk_size == FS_ZSTD_CHUNK_SIZE && !FS_Zstd_FlushChunk( zf, f ) ) {
+			return -1;
+		}
+	}
+
+	return len;
+}
+
+/*
+* FS_Zstd_CloseWrite
+*
+* Writes out the chunk table and the trailer. The trailer is only written once
+* everything before it is on disk, so a failed write leaves a file that gets
+* read by walking the chunk headers instead of one with a bad table
+*/
+static bool FS_Zstd_CloseWrite( zstdfile_t *zf, FILE *f ) {
+	if( !FS_Zstd_FlushChunk( zf, f ) ) {
+		return false;
+	}
+
+	unsigned table_offset = ftell( f );
+	for( int i = 0; i < zf->num_chunks; i++ ) {
+		unsigned entry[2] = { LittleLong( zf->chunks[i].uncompressed_offset ), LittleLong( zf->chunks[i].file_offset ) };
+		if( fwrite( entry, 1, sizeof( entry ), f ) != sizeof( entry ) ) {
+			zf->failed = true;
+			break;
+		}
+	}
+
+	if( zf->failed || fflush( f ) != 0 ) {
+		Com_Printf( S_COLOR_RED "FS_Zstd_CloseWrite: can't write the chunk table\n" );
+		zf->failed = true;
+		return false;
+	}
+
+	unsigned trailer[4] = {
+		LittleLong( unsigned( zf->num_chunks ) ),
+		LittleLong( zf->uncompressed_size ),
+		LittleLong( table_offset ),
+		LittleLong( FS_ZSTD_TRAILER_MAGIC ),
+	};
+	if( fwrite( trailer, 1, sizeof( trailer ), f ) != sizeof( trailer ) || fflush( f ) != 0 ) {
+		Com_Printf( S_COLOR_RED "FS_Zstd_CloseWrite: can't write the trailer\n" );
+		zf->failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+* FS_Zstd_ReadTable
+*/
+static bool FS_Zstd_ReadTable( zstdfile_t *zf, FILE *f, int filelen ) {
+	unsigned trailer[4];
+
+	if( filelen < FS_ZSTD_HEADER_SIZE + FS_ZSTD_TRAILER_SIZE ) {
+		return false;
+	}
+	if( fseek( f, filelen - FS_ZSTD_TRAILER_SIZE, SEEK_SET ) != 0 || fread( trailer, 1, sizeof( trailer ), f ) != sizeof( trailer ) ) {
+		return false;
+	}
+	if( LittleLong( trailer[3] ) != FS_ZSTD_TRAILER_MAGIC ) {
+		return false;
+	}
+
+	unsigned num_chunks = LittleLong( trailer[0] );
+	unsigned table_offset = LittleLong( trailer[2] );
+	if( table_offset < FS_ZSTD_HEADER_SIZE || table_offset + num_chunks * sizeof( unsigned[2] ) != unsigned( filelen - FS_ZSTD_TRAILER_SIZE ) ) {
+		return false;
+	}
+
+	if( fseek( f, table_offset, SEEK_SET ) != 0 ) {
+		return false;
+	}
+
+	for( unsigned i = 0; i < num_chunks; i++ ) {
+		unsigned entry[2];
+		if( fread( entry, 1, sizeof( entry ), f ) != sizeof( entry ) ) {
+			return false;
+		}
+		FS_Zstd_AddChunk( zf, LittleLong( entry[0] ), LittleLong( entry[1] ) );
+	}
+
+	zf->uncompressed_size = LittleLong( trailer[1] );
+	return true;
+}
+
+/*
+* FS_Zstd_ScanChunks
+*
+* Rebuilds the chunk table of a file that was never closed properly.
+* A chunk cut off by the end of the file is dropped.
+*/
+static void FS_Zstd_ScanChunks( zstdfile_t *zf, FILE *f, int filelen ) {
+	unsigned file_offset = FS_ZSTD_HEADER_SIZE;
+	unsigned uncompressed_offset = 0;
+
+	zf->num_chunks = 0;
+
+	while( file_offset + FS_ZSTD_CHUNK_HEADER_SIZE <= unsigned( filelen ) ) {
+		unsigned header[2];
+		if( fseek( f, file_offset, SEEK_SET ) != 0 || fread( header, 1, sizeof( header ), f ) != sizeof( header ) ) {
+			break;
+		}
+
+		unsigned stored_size = LittleLong( header[0] ) & ~FS_ZSTD_RAW_CHUNK;
+		unsigned chunk_size = LittleLong( header[1] );
+		if( chunk_size > FS_ZSTD_CHUNK_SIZE || file_offset + FS_ZSTD_CHUNK_HEADER_SIZE + stored_size > unsigned( filelen ) ) {
+			break;
+		}
+
+		FS_Zstd_AddChunk( zf, uncompressed_offset, file_offset );
+		file_offset += FS_ZSTD_CHUNK_HEADER_SIZE + stored_size;
+		uncompressed_offset += chunk_size;
+	}
+
+	zf->uncompressed_size = uncompressed_offset;
+}
+
+/*
+* FS_Zstd_OpenRead
+*
+* Returns NULL and rewinds the file if it isn't a chunked zstd file
+*/
+static zstdfile_t *FS_Zstd_OpenRead( FILE *f ) {
+	unsigned header[2];
+
+	if( fread( header, 1, sizeof( header ), f ) != sizeof( header ) ||
+		LittleLong( header[0] ) != FS_ZSTD_MAGIC || LittleLong( header[1] ) != FS_ZSTD_CHUNK_SIZE ) {
+		rewind( f );
+		return NULL;
+	}
+
+	int filelen = FS_FileLength( f, false );
+
+	zstdfile_t *zf = FS_Zstd_New();
+	zf->dctx = ZSTD_createDCtx();
+
+	if( !FS_Zstd_ReadTable( zf, f, filelen ) ) {
+		FS_Zstd_ScanChunks( zf, f, filelen );
+	}
+
+	return zf;
+}
+
+/*
+* FS_Zstd_LoadChunk
+*/
+static bool FS_Zstd_LoadChunk( zstdfile_t *zf, FILE *f, int chunk ) {
+	if( chunk == zf->current_chunk ) {
+		return true;
+	}
+	if( chunk < 0 || chunk >= zf->num_chunks ) {
+		return false;
+	}
+
+	zf->current_chunk = -1;
+	zf->chunk_size = 0;
+	zf->chunk_pos = 0;
+
+	unsigned header[2];
+	if( fseek( f, zf->chunks[chunk].file_offset, SEEK_SET ) != 0 || fread( header, 1, sizeof( header ), f ) != sizeof( header ) ) {
+		return false;
+	}
+
+	unsigned stored_size = LittleLong( header[0] ) & ~FS_ZSTD_RAW_CHUNK;
+	unsigned chunk_size = LittleLong( header[1] );
+	if( chunk_size > FS_ZSTD_CHUNK_SIZE || stored_size > zf->compressed_size ) {
+		return false;
+	}
+
+	if( LittleLong( header[0] ) & FS_ZSTD_RAW_CHUNK ) {
+		if( stored_size != chunk_size || fread( zf->chunk, 1, stored_size, f ) != stored_size ) {
+			return false;
+		}
+	} else {
+		if( fread( zf->compressed, 1, stored_size, f ) != stored_size ) {
+			return false;
+		}
+
+		size_t r = ZSTD_decompressDCtx( zf->dctx, zf->chunk, FS_ZSTD_CHUNK_SIZE, zf->compressed, stored_size );
+		if( ZSTD_isError( r ) || r != chunk_size ) {
+			Com_Printf( S_COLOR_RED "FS_Zstd_LoadChunk: can't decompress chunk %i\n", chunk );
+			return false;
+		}
+	}
+
+	zf->current_chunk = chunk;
+	zf->chunk_offset = zf->chunks[chunk].uncompressed_offset;
+	zf->chunk_size = chunk_size;
+	return true;
+}
+
+/*
+* FS_Zstd_Read
+*/
+static int FS_Zstd_Read( zstdfile_t *zf, FILE *f, void *buffer, size_t len ) {
+	u8 *buf = ( u8 * )buffer;
+	size_t total = 0;
+
+	while( total < len ) {
+		if( zf->chunk_pos == zf->chunk_size ) {
+			if( !FS_Zstd_LoadChunk( zf, f, zf->current_chunk + 1 ) ) {
+				break;
+			}
+		}
+
+		size_t n = Min2( len - total, size_t( zf->chunk_size - zf->chunk_pos ) );
+		memcpy( buf + total, zf->chunk + zf->chunk_pos, n );
+		zf->chunk_pos += n;
+		total += n;
+	}
+
+	return total;
+}
+
+/*
+* FS_Zstd_Tell
+*/
+static int FS_Zstd_Tell( const zstdfile_t *zf ) {
+	if( zf->cctx != NULL ) {
+		return zf->uncompressed_size + zf->chunk_size;
+	}
+	if( zf->current_chunk == -1 ) {
+		return 0;
+	}
+	return zf->chunk_offset + zf->chunk_pos;
+}
+
+/*
+* FS_Zstd_Seek
+*
+* Only decompresses the chunk containing the new offset
+*/
+static int FS_Zstd_Seek( zstdfile_t *zf, FILE *f, int offset ) {
+	if( offset < 0 || unsigned( offset ) > zf->uncompressed_size ) {
+		return -1;
+	}
+
+	if( zf->num_chunks == 0 ) {
+		return 0;
+	}
+
+	// find the last chunk starting at or before offset
+	int lo = 0;
+	int hi = zf->num_chunks - 1;
+	while( lo < hi ) {
+		int mid = ( lo + hi + 1 ) / 2;
+		if( zf->chunks[mid].uncompressed_offset <= unsigned( offset ) ) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	if( !FS_Zstd_LoadChunk( zf, f, lo ) ) {
+		return -1;
+	}
+
+	zf->chunk_pos = Min2( unsigned( offset ) - zf->chunk_offset, zf->chunk_size );
+	return 0;
+}
+
+/*
+* FS_Zstd_Open
+*
+* Files being read that aren't chunked zstd go through zlib instead, which
+* also handles gz and uncompressed files
+*/
+static bool FS_Zstd_Open( const char *filename, int mode, const char *modestr, FILE **f, gzFile *gzf, zstdfile_t **zf ) {
+	*f = fopen( filename, modestr );
+	if( !*f ) {
+		return false;
+	}
+
+	*zf = mode == FS_READ ? FS_Zstd_OpenRead( *f ) : FS_Zstd_OpenWrite( *f );
+	if( *zf ) {
+		return true;
+	}
+
+	fclose( *f );
+	*f = NULL;
+
+	if( mode == FS_READ ) {
+		*gzf = gzopen( filename, modestr );
+	}
+	return *gzf != NULL;
+}
+
 /*
 * FS_FOpenAbsoluteFile
 */
 int FS_FOpenAbsoluteFile( const char *filename, int *filenum, int mode ) {
 	FILE *f = NULL;
 	gzFile gzf = NULL;
+	zstdfile_t *zf = NULL;
 	filehandle_t *file;
 	int end;
 	bool gz;
+	bool zstd;
 	bool update;
 	int realmode;
 	char modestr[4] = { 0, 0, 0, 0 };
 
 	realmode = mode;
 	gz = mode & FS_GZ ? true : false;
+	zstd = mode & FS_ZSTD ? true : false;
 	update = mode & FS_UPDATE ? true : false;
 	mode = mode & FS_RWA_MASK;
 
@@ -356,6 +832,9 @@ int FS_FOpenAbsoluteFile( const char *filename, int *filenum, int mode ) {
 		return -1; // unsupported
 
 	}
+	if( zstd && ( update || mode == FS_APPEND ) ) {
+		return -1; // unsupported
+	}
 	if( filenum ) {
 		*filenum = 0;
 	}
@@ -377,7 +856,9 @@ int FS_FOpenAbsoluteFile( const char *filename, int *filenum, int mode ) {
 
 	FS_FileModeStr( realmode, modestr, sizeof( modestr ) );
 
-	if( gz ) {
+	if( zstd ) {
+		FS_Zstd_Open( filename, mode, modestr, &f, &gzf, &zf );
+	} else if( gz ) {
 		gzf = gzopen( filename, modestr );
 	} else {
 		f = fopen( filename, modestr );
@@ -387,7 +868,11 @@ int FS_FOpenAbsoluteFile( const char *filename, int *filenum, int mode ) {
 		return -1;
 	}
 
-	end = ( mode == FS_WRITE || gz ? 0 : FS_FileLength( f, false ) );
+	if( zf ) {
+		end = zf->uncompressed_size;
+	} else {
+		end = ( mode == FS_WRITE || gzf ? 0 : FS_FileLength( f, false ) );
+	}
 
 	*filenum = FS_OpenFileHandle();
 	file = &fs_filehandles[*filenum - 1];
@@ -395,6 +880,7 @@ int FS_FOpenAbsoluteFile( const char *filename, int *filenum, int mode ) {
 	file->uncompressedSize = end;
 	file->gzstream = gzf;
 	file->gzlevel = Z_DEFAULT_COMPRESSION;
+	file->zstd = zf;
 
 	if( gzf ) {
 		gzbuffer( gzf, FS_GZ_BUFSIZE );
@@ -412,19 +898,26 @@ static int _FS_FOpenFile( const char *filename, int *filenum, int mode, bool bas
 	searchpath_t *search;
 	filehandle_t *file;
 	bool gz;
+	bool zstd;
 	bool update;
 	gzFile gzf = NULL;
+	zstdfile_t *zf = NULL;
 	int realmode;
 	char tempname[FS_MAX_PATH];
 
 	realmode = mode;
 	gz = mode & FS_GZ ? true : false;
+	zstd = mode & FS_ZSTD ? true : false;
 	update = mode & FS_UPDATE ? true : false;
 	mode = mode & FS_RWA_MASK;
 
 	assert( mode == FS_READ || mode == FS_WRITE || mode == FS_APPEND );
 	assert( filenum || mode == FS_READ );
 
+	if( zstd && ( update || mode == FS_APPEND ) ) {
+		return -1; // unsupported
+	}
+
 	if( filenum ) {
 		*filenum = 0;
 	}
@@ -453,7 +946,9 @@ static int _FS_FOpenFile( const char *filename, int *filenum, int mode, bool bas
 
 		FS_FileModeStr( realmode, modestr, sizeof( modestr ) );
 
-		if( gz ) {
+		if( zstd ) {
+			FS_Zstd_Open( tempname, mode, modestr, &f, &gzf, &zf );
+		} else if( gz ) {
 			gzf = gzopen( tempname, modestr );
 		} else {
 			f = fopen( tempname, modestr );
@@ -473,6 +968,7 @@ static int _FS_FOpenFile( const char *filename, int *filenum, int mode, bool bas
 		file->uncompressedSize = end;
 		file->gzstream = gzf;
 		file->gzlevel = Z_DEFAULT_COMPRESSION;
+		file->zstd = zf;
 
 		if( gzf ) {
 			gzbuffer( gzf, FS_GZ_BUFSIZE );
@@ -499,12 +995,20 @@ static int _FS_FOpenFile( const char *filename, int *filenum, int mode, bool bas
 	}
 
 	f = fopen( tempname, "rb" );
-	end = FS_FileLength( f, gz );
+	if( zstd && f ) {
+		zf = FS_Zstd_OpenRead( f );
+	}
+
+	if( zf ) {
+		end = zf->uncompressed_size;
+	} else {
+		end = FS_FileLength( f, gz || zstd );
 
-	if( gz ) {
-		f = NULL;
-		gzf = gzopen( tempname, "rb" );
-		assert( gzf );
+		if( gz || zstd ) {
+			f = NULL;
+			gzf = gzopen( tempname, "rb" );
+			assert( gzf );
+		}
 	}
 
 	*filenum = FS_OpenFileHandle();
@@ -513,6 +1017,7 @@ static int _FS_FOpenFile( const char *filename, int *filenum, int mode, bool bas
 	file->uncompressedSize = end;
 	file->gzstream = gzf;
 	file->gzlevel = Z_DEFAULT_COMPRESSION;
+	file->zstd = zf;
 
 	Com_DPrintf( "FS_FOpen%sFile: %s\n", ( base ? "Base" : "" ), tempname );
 	return end;
@@ -541,16 +1046,26 @@ int FS_FOpenBaseFile( const char *filename, int *filenum, int mode ) {
 
 /*
 * FS_FCloseFile
+*
+* Returns -1 if writing a compressed file failed at any point
 */
-void FS_FCloseFile( int file ) {
+int FS_FCloseFile( int file ) {
 	filehandle_t *fh;
+	int ret = 0;
 
 	if( !file ) {
-		return; // return silently
+		return 0; // return silently
 
 	}
 	fh = FS_FileHandleForNum( file );
 
+	if( fh->zstd ) {
+		if( fh->zstd->cctx && !FS_Zstd_CloseWrite( fh->zstd, fh->fstream ) ) {
+			ret = -1;
+		}
+		FS_Zstd_Delete( fh->zstd );
+		fh->zstd = NULL;
+	}
 	if( fh->fstream ) {
 		fclose( fh->fstream );
 		fh->fstream = NULL;
@@ -561,6 +1076,8 @@ void FS_FCloseFile( int file ) {
 	}
 
 	FS_CloseFileHandle( fh );
+
+	return ret;
 }
 
 /*
@@ -588,7 +1105,9 @@ int FS_Read( void *buffer, size_t len, int file ) {
 
 	fh = FS_FileHandleForNum( file );
 
-	if( fh->gzstream ) {
+	if( fh->zstd ) {
+		total = fh->zstd->dctx ? FS_Zstd_Read( fh->zstd, fh->fstream, buffer, len ) : 0;
+	} else if( fh->gzstream ) {
 		total = gzread( fh->gzstream, buffer, len );
 	} else if( fh->fstream ) {
 		total = FS_ReadFile( ( uint8_t * )buffer, len, fh );
@@ -634,6 +1153,17 @@ int FS_Write( const void *buffer, size_t len, int file ) {
 
 	fh = FS_FileHandleForNum( file );
 
+	if( fh->zstd ) {
+		if( !fh->zstd->cctx || !buffer ) {
+			return 0;
+		}
+		// -1 once a write has failed, e.g. the disk is full
+		int total = FS_Zstd_Write( fh->zstd, fh->fstream, buffer, len );
+		if( total > 0 ) {
+			fh->offset += total;
+		}
+		return total;
+	}
 	if( fh->gzstream ) {
 		return gzwrite( fh->gzstream, buffer, len );
 	}
@@ -665,6 +1195,9 @@ int FS_Tell( int file ) {
 
 	fh = FS_FileHandleForNum( file );
 
+	if( fh->zstd ) {
+		return FS_Zstd_Tell( fh->zstd );
+	}
 	if( fh->gzstream ) {
 		return gztell( fh->gzstream );
 	}
@@ -687,7 +1220,14 @@ int FS_Seek( int file, int offset, int whence ) {
 						  ( whence == FS_SEEK_SET ? SEEK_SET : -1 ) ) );
 	}
 
-	currentOffset = (int)fh->offset;
+	if( fh->zstd ) {
+		if( fh->zstd->cctx ) {
+			return -1;
+		}
+		currentOffset = FS_Zstd_Tell( fh->zstd );
+	} else {
+		currentOffset = (int)fh->offset;
+	}
 
 	if( whence == FS_SEEK_CUR ) {
 		offset += currentOffset;
@@ -706,6 +1246,10 @@ int FS_Seek( int file, int offset, int whence ) {
 		return 0;
 	}
 
+	if( fh->zstd ) {
+		return FS_Zstd_Seek( fh->zstd, fh->fstream, offset );
+	}
+
 	if( !fh->fstream ) {
 		return -1;
 	}
@@ -724,6 +1268,9 @@ int FS_Flush( int file ) {
 	filehandle_t *fh;
 
 	fh = FS_FileHandleForNum( file );
+	if( fh->zstd && fh->zstd->cctx && !FS_Zstd_FlushChunk( fh->zstd, fh->fstream ) ) {
+		return -1;
+	}
 	if( fh->gzstream ) {
 		return gzflush( fh->gzstream, Z_FINISH );
 	}
@@ -743,7 +1290,7 @@ int FS_FileNo( int file ) {
 	filehandle_t *fh;
 
 	fh = FS_FileHandleForNum( file );
-	if( fh->fstream && !fh->gzstream ) {
+	if( fh->fstream && !fh->gzstream && !fh->zstd ) {
 		return Sys_FS_FileNo( fh->fstream );
 	}
 
@@ -755,6 +1302,12 @@ int FS_FileNo( int file ) {
 */
 void FS_SetCompressionLevel( int file, int level ) {
 	filehandle_t *fh = FS_FileHandleForNum( file );
+	if( fh->zstd && fh->zstd->cctx ) {
+		// chunks are compressed when they're written out, so finish the
+		// current one with the level it was started with
+		FS_Zstd_FlushChunk( fh->zstd, fh->fstream );
+		fh->zstd->level = level < 0 ? ZSTD_CLEVEL_DEFAULT : level;
+	}
 	if( fh->gzstream ) {
 		fh->gzlevel = level;
 		gzsetparams( fh->gzstream, level,  Z_DEFAULT_STRATEGY );
@@ -766,6 +1319,9 @@ void FS_SetCompressionLevel( int file, int level ) {
 */
 int FS_GetCompressionLevel( int file ) {
 	filehandle_t *fh = FS_FileHandleForNum( file );
+	if( fh->zstd ) {
+		return fh->zstd->level;
+	}
 	if( fh->gzstream ) {
 		return fh->gzlevel;
 	}
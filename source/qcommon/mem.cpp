@@ -25,47 +25,99 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define MEMHEADER_SENTINEL1         0xDEADF00D
 #define MEMHEADER_SENTINEL2         0xDF
+#define MEMHEADER_FREED             0xF4EEF4EE
 
 #define MEMALIGNMENT_DEFAULT        16
 
+#define MEM_MAX_POOLS               32
+#define MEM_MAX_SIZE_CLASSES        48
+#define MEM_MAX_SMALL_SIZE          32768 // including the header
+#define MEM_TRACKED_CLASS           0xFF
+#define MEM_SLAB_SIZE               ( 64 * 1024 )
+#define MEM_DEFAULT_SAMPLE_BYTES    ( 1024 * 1024 )
+
+/*
+ * small allocations come out of size class slabs owned by their pool. each
+ * thread keeps a cache of free blocks per pool and size class, so most
+ * allocs and frees don't take any locks. the pool's lock is only taken to
+ * move a batch of blocks between a thread's cache and the pool
+ *
+ * large allocations, allocations with unusual alignment, and a sample of
+ * small allocations (one every mem_sample_bytes bytes per thread) are
+ * tracked instead: they get malloced on their own, remember where they
+ * were allocated, have a trailing sentinel and are linked into their pool
+ * so memlist can list them. set mem_sample_bytes to 1 to track everything
+ */
+
+// precedes every allocation
 struct memheader_t {
-	// address returned by malloc (may be significantly before this header to satisify alignment)
-	void *baseaddress;
+	// MEMHEADER_SENTINEL1 while allocated, MEMHEADER_FREED after
+	unsigned int sentinel1;
 
-	// next and previous memheaders in chain belonging to pool
-	memheader_t *next;
-	memheader_t *prev;
+	// index into mem_pools
+	uint8_t pool;
 
-	// pool this memheader belongs to
-	mempool_t *pool;
+	// MEM_TRACKED_CLASS for tracked allocations
+	uint8_t size_class;
+
+	uint16_t padding;
 
-	// size of the memory after the header (excluding header and sentinel2)
-	size_t size;
+	// size of the memory after the header
+	uint64_t size;
+	// immediately followed by data. free blocks keep a pointer to the next free block in the data
+};
+
+struct memtracked_t {
+	// address returned by malloc (may be significantly before this header to satisify alignment)
+	void *baseaddress;
 
-	// size of the memory including the header, alignment and sentinel2
+	// next and previous tracked allocations belonging to pool
+	memtracked_t *next;
+	memtracked_t *prev;
+
+	// size of the memory including the headers, alignment and sentinel2
 	size_t realsize;
 
 	// file name and line where Mem_Alloc was called
 	const char *filename;
 	int fileline;
 
-	// should always be MEMHEADER_SENTINEL1
-	unsigned int sentinel1;
-	// immediately followed by data, which is followed by a MEMHEADER_SENTINEL2 byte
+	// tracked because it was sampled rather than because it was big
+	bool sampled;
+	// immediately followed by a memheader_t, data, and a MEMHEADER_SENTINEL2 byte
+};
+
+struct memslab_t {
+	memslab_t *next;
 };
 
 struct mempool_t {
 	// should always be MEMHEADER_SENTINEL1
 	unsigned int sentinel1;
 
-	// chain of individual memory allocations
-	memheader_t *chain;
+	// index into mem_pools
+	int index;
+
+	// bumped whenever the pool is emptied so threads know to throw away their cached blocks
+	unsigned int generation;
+
+	// protects everything below except totalsize
+	Mutex *mutex;
+
+	// chain of tracked allocations
+	memtracked_t *tracked;
+
+	// slabs the small allocations were carved from
+	memslab_t *slabs;
+	memheader_t *free_blocks[MEM_MAX_SIZE_CLASSES];
+	uint8_t *slab_cursor[MEM_MAX_SIZE_CLASSES];
+	uint8_t *slab_end[MEM_MAX_SIZE_CLASSES];
 
 	// temporary, etc
 	int flags;
 
-	// total memory allocated in this pool (inside memheaders)
-	int totalsize;
+	// total memory allocated in this pool (inside memheaders), updated atomically
+	s32 totalsize;
 
 	// total memory allocated in this pool (actual malloc total)
 	int realsize;
@@ -91,14 +143,36 @@ struct mempool_t {
 	unsigned int sentinel2;
 };
 
+struct memcachelist_t {
+	memheader_t *head;
+	unsigned int count;
+	unsigned int generation;
+};
+
+// blocks cached by threads that exit stay in their slabs until the pool is emptied
+struct memthreadcache_t {
+	memcachelist_t lists[MEM_MAX_POOLS][MEM_MAX_SIZE_CLASSES];
+	int64_t bytes_until_sample;
+};
+
 // ============================================================================
 
 //#define SHOW_NONFREED
 
 cvar_t *developer_memory;
+static cvar_t *mem_sample_bytes;
 
 static mempool_t *poolChain = NULL;
 
+static mempool_t *mem_pools[MEM_MAX_POOLS];
+static unsigned int mem_pool_generations[MEM_MAX_POOLS];
+
+static size_t mem_class_sizes[MEM_MAX_SIZE_CLASSES];
+static unsigned int mem_class_batch[MEM_MAX_SIZE_CLASSES];
+static uint8_t mem_class_lookup[MEM_MAX_SMALL_SIZE / 16 + 1];
+
+static thread_local memthreadcache_t mem_cache;
+
 // used for temporary memory allocations around the engine, not for longterm
 // storage, if anything in this pool stays allocated during gameplay, it is
 // considered a leak
@@ -107,6 +181,7 @@ mempool_t *tempMemPool;
 // only for zone
 mempool_t *zoneMemPool;
 
+// protects the pool chain and mem_pools
 static Mutex *memMutex;
 
 static bool memory_initialized = false;
@@ -123,10 +198,251 @@ static void _Mem_Error( const char *format, ... ) {
 	Sys_Error( "%s", msg );
 }
 
+static void Mem_InitSizeClasses() {
+	int num_classes = 0;
+	size_t size = 32;
+
+	while( true ) {
+		assert( num_classes < MEM_MAX_SIZE_CLASSES );
+
+		mem_class_sizes[num_classes] = size;
+		mem_class_batch[num_classes] = Clamp( 2, int( 16384 / size ), 32 );
+		num_classes++;
+
+		if( size == MEM_MAX_SMALL_SIZE ) {
+			break;
+		}
+
+		// roughly four classes per power of two so we don't waste more than 25%
+		size_t step = Max2( size / 4, size_t( 16 ) ) & ~size_t( 15 );
+		size = Min2( size + step, size_t( MEM_MAX_SMALL_SIZE ) );
+	}
+
+	int size_class = 0;
+	for( size_t i = 0; i < ARRAY_COUNT( mem_class_lookup ); i++ ) {
+		while( mem_class_sizes[size_class] < i * 16 ) {
+			size_class++;
+		}
+		mem_class_lookup[i] = size_class;
+	}
+}
+
+static memheader_t *Mem_Header( void *data ) {
+	return ( memheader_t * )( (uint8_t *) data - sizeof( memheader_t ) );
+}
+
+static memtracked_t *Mem_Tracked( memheader_t *mem ) {
+	return ( memtracked_t * )( (uint8_t *) mem - sizeof( memtracked_t ) );
+}
+
+static memheader_t **Mem_NextFree( memheader_t *mem ) {
+	return ( memheader_t ** )( mem + 1 );
+}
+
+static void *Mem_AllocTracked( mempool_t *pool, size_t size, size_t alignment, bool sampled, const char *filename, int fileline ) {
+	size_t realsize = sizeof( memtracked_t ) + sizeof( memheader_t ) + size + alignment + 1;
+
+	void *base = malloc( realsize );
+	TracyAlloc( base, realsize );
+	if( base == NULL ) {
+		_Mem_Error( "Mem_Alloc: out of memory (alloc at %s:%i)", filename, fileline );
+	}
+
+	// calculate address that aligns the data to the specified alignment
+	uint8_t *data = ( uint8_t * )( ( (size_t)base + sizeof( memtracked_t ) + sizeof( memheader_t ) + ( alignment - 1 ) ) & ~( alignment - 1 ) );
+	memheader_t *mem = Mem_Header( data );
+	mem->sentinel1 = MEMHEADER_SENTINEL1;
+	mem->pool = pool->index;
+	mem->size_class = MEM_TRACKED_CLASS;
+	mem->size = size;
+
+	// we have to use only a single byte for this sentinel, because it may not be aligned, and some platforms can't use unaligned accesses
+	data[size] = MEMHEADER_SENTINEL2;
+
+	memtracked_t *tracked = Mem_Tracked( mem );
+	tracked->baseaddress = base;
+	tracked->realsize = realsize;
+	tracked->filename = filename;
+	tracked->fileline = fileline;
+	tracked->sampled = sampled;
+
+	Lock( pool->mutex );
+
+	pool->realsize += realsize;
+
+	// append to head of list
+	tracked->next = pool->tracked;
+	tracked->prev = NULL;
+	pool->tracked = tracked;
+	if( tracked->next ) {
+		tracked->next->prev = tracked;
+	}
+
+	Unlock( pool->mutex );
+
+	return data;
+}
+
+static void Mem_FreeTracked( mempool_t *pool, memheader_t *mem, const char *filename, int fileline ) {
+	memtracked_t *tracked = Mem_Tracked( mem );
+
+	Lock( pool->mutex );
+
+	// unlink from doubly linked list
+	if( ( tracked->prev ? tracked->prev->next != tracked : pool->tracked != tracked ) || ( tracked->next && tracked->next->prev != tracked ) ) {
+		_Mem_Error( "Mem_Free: not allocated or double freed (free at %s:%i)", filename, fileline );
+	}
+
+	if( tracked->prev ) {
+		tracked->prev->next = tracked->next;
+	} else {
+		pool->tracked = tracked->next;
+	}
+	if( tracked->next ) {
+		tracked->next->prev = tracked->prev;
+	}
+
+	pool->realsize -= tracked->realsize;
+
+	Unlock( pool->mutex );
+
+	void *base = tracked->baseaddress;
+	free( base );
+	TracyFree( base );
+}
+
+static memcachelist_t *Mem_CacheList( mempool_t *pool, int size_class ) {
+	memcachelist_t *list = &mem_cache.lists[pool->index][size_class];
+
+	// the pool was emptied since we last used it, so these blocks are gone
+	if( list->generation != pool->generation ) {
+		list->head = NULL;
+		list->count = 0;
+		list->generation = pool->generation;
+	}
+
+	return list;
+}
+
+/*
+* Mem_RefillCache
+*
+* Moves a batch of free blocks from the pool to this thread's cache,
+* carving new ones out of a slab if the pool doesn't have enough
+*/
+static void Mem_RefillCache( mempool_t *pool, int size_class, memcachelist_t *list ) {
+	size_t block_size = mem_class_sizes[size_class];
+
+	Lock( pool->mutex );
+
+	for( unsigned int i = 0; i < mem_class_batch[size_class]; i++ ) {
+		memheader_t *mem = pool->free_blocks[size_class];
+		if( mem != NULL ) {
+			pool->free_blocks[size_class] = *Mem_NextFree( mem );
+		} else {
+			if( pool->slab_cursor[size_class] == pool->slab_end[size_class] ) {
+				size_t num_blocks = Max2( size_t( MEM_SLAB_SIZE ), block_size * 8 ) / block_size;
+				size_t realsize = sizeof( memslab_t ) + MEMALIGNMENT_DEFAULT + num_blocks * block_size;
+
+				memslab_t *slab = ( memslab_t * )malloc( realsize );
+				if( slab == NULL ) {
+					_Mem_Error( "Mem_Alloc: out of memory" );
+				}
+
+				slab->next = pool->slabs;
+				pool->slabs = slab;
+				pool->realsize += realsize;
+
+				uint8_t *blocks = ( uint8_t * )( ( (size_t)( slab + 1 ) + ( MEMALIGNMENT_DEFAULT - 1 ) ) & ~size_t( MEMALIGNMENT_DEFAULT - 1 ) );
+				pool->slab_cursor[size_class] = blocks;
+				pool->slab_end[size_class] = blocks + num_blocks * block_size;
+			}
+
+			mem = ( memheader_t * )pool->slab_cursor[size_class];
+			pool->slab_cursor[size_class] += block_size;
+
+			mem->pool = pool->index;
+			mem->size_class = size_class;
+		}
+
+		*Mem_NextFree( mem ) = list->head;
+		list->head = mem;
+		list->count++;
+	}
+
+	Unlock( pool->mutex );
+}
+
+/*
+* Mem_FlushCache
+*
+* Gives a batch of this thread's cached blocks back to the pool
+*/
+static void Mem_FlushCache( mempool_t *pool, int size_class, memcachelist_t *list ) {
+	memheader_t *first = list->head;
+	memheader_t *last = first;
+	for( unsigned int i = 1; i < mem_class_batch[size_class]; i++ ) {
+		last = *Mem_NextFree( last );
+	}
+
+	list->head = *Mem_NextFree( last );
+	list->count -= mem_class_batch[size_class];
+
+	Lock( pool->mutex );
+	*Mem_NextFree( last ) = pool->free_blocks[size_class];
+	pool->free_blocks[size_class] = first;
+	Unlock( pool->mutex );
+}
+
+static void *Mem_AllocSmall( mempool_t *pool, size_t size ) {
+	int size_class = mem_class_lookup[( sizeof( memheader_t ) + size + 15 ) / 16];
+	memcachelist_t *list = Mem_CacheList( pool, size_class );
+
+	if( list->head == NULL ) {
+		Mem_RefillCache( pool, size_class, list );
+	}
+
+	memheader_t *mem = list->head;
+	list->head = *Mem_NextFree( mem );
+	list->count--;
+
+	mem->sentinel1 = MEMHEADER_SENTINEL1;
+	mem->size = size;
+
+	void *data = mem + 1;
+	TracyAlloc( data, size );
+	return data;
+}
+
+static void Mem_FreeSmall( mempool_t *pool, memheader_t *mem ) {
+	TracyFree( mem + 1 );
+
+	mem->sentinel1 = MEMHEADER_FREED;
+
+	memcachelist_t *list = Mem_CacheList( pool, mem->size_class );
+	*Mem_NextFree( mem ) = list->head;
+	list->head = mem;
+	list->count++;
+
+	if( list->count >= mem_class_batch[mem->size_class] * 2 ) {
+		Mem_FlushCache( pool, mem->size_class, list );
+	}
+}
+
+static bool Mem_ShouldSample( size_t size ) {
+	mem_cache.bytes_until_sample -= int64_t( size );
+	if( mem_cache.bytes_until_sample > 0 ) {
+		return false;
+	}
+
+	int interval = mem_sample_bytes != NULL ? mem_sample_bytes->integer : MEM_DEFAULT_SAMPLE_BYTES;
+	mem_cache.bytes_until_sample = interval > 0 ? interval : INT64_MAX;
+
+	return interval > 0;
+}
+
 ATTRIBUTE_MALLOC void *_Mem_AllocExt( mempool_t *pool, size_t size, size_t alignment, int z, int musthave, int canthave, const char *filename, int fileline ) {
-	void *base;
-	size_t realsize;
-	memheader_t *mem;
+	void *data;
 
 	if( size <= 0 ) {
 		return NULL;
@@ -153,47 +469,20 @@ ATTRIBUTE_MALLOC void *_Mem_AllocExt( mempool_t *pool, size_t size, size_t align
 		Com_DPrintf( "Mem_Alloc: pool %s, file %s:%i, size %" PRIuPTR " bytes\n", pool->name, filename, fileline, (uintptr_t)size );
 	}
 
-	Lock( memMutex );
-
-	pool->totalsize += size;
-	realsize = sizeof( memheader_t ) + size + alignment + sizeof( int );
-
-	pool->realsize += realsize;
-
-	base = malloc( realsize );
-	TracyAlloc( base, realsize );
-	if( base == NULL ) {
-		_Mem_Error( "Mem_Alloc: out of memory (alloc at %s:%i)", filename, fileline );
-	}
-
-	// calculate address that aligns the end of the memheader_t to the specified alignment
-	mem = ( memheader_t * )( ( ( (size_t)base + sizeof( memheader_t ) + ( alignment - 1 ) ) & ~( alignment - 1 ) ) - sizeof( memheader_t ) );
-	mem->baseaddress = base;
-	mem->filename = filename;
-	mem->fileline = fileline;
-	mem->size = size;
-	mem->realsize = realsize;
-	mem->pool = pool;
-	mem->sentinel1 = MEMHEADER_SENTINEL1;
-
-	// we have to use only a single byte for this sentinel, because it may not be aligned, and some platforms can't use unaligned accesses
-	*( (uint8_t *) mem + sizeof( memheader_t ) + mem->size ) = MEMHEADER_SENTINEL2;
-
-	// append to head of list
-	mem->next = pool->chain;
-	mem->prev = NULL;
-	pool->chain = mem;
-	if( mem->next ) {
-		mem->next->prev = mem;
+	bool sampled = Mem_ShouldSample( size );
+	if( sampled || alignment > MEMALIGNMENT_DEFAULT || sizeof( memheader_t ) + size > MEM_MAX_SMALL_SIZE ) {
+		data = Mem_AllocTracked( pool, size, alignment, sampled, filename, fileline );
+	} else {
+		data = Mem_AllocSmall( pool, size );
 	}
 
-	Unlock( memMutex );
+	AtomicAdd( &pool->totalsize, s32( size ) );
 
 	if( z ) {
-		memset( (void *)( (uint8_t *) mem + sizeof( memheader_t ) ), 0, mem->size );
+		memset( data, 0, size );
 	}
 
-	return (void *)( (uint8_t *) mem + sizeof( memheader_t ) );
+	return data;
 }
 
 ATTRIBUTE_MALLOC void *_Mem_Alloc( mempool_t *pool, size_t size, int musthave, int canthave, const char *filename, int fileline ) {
@@ -213,25 +502,14 @@ void *_Mem_Realloc( void *data, size_t size, const char *filename, int fileline
 		return NULL;
 	}
 
-	mem = ( memheader_t * )( (uint8_t *) data - sizeof( memheader_t ) );
-
-	assert( mem->sentinel1 == MEMHEADER_SENTINEL1 );
-	assert( *( (uint8_t *) mem + sizeof( memheader_t ) + mem->size ) == MEMHEADER_SENTINEL2 );
-
-	if( mem->sentinel1 != MEMHEADER_SENTINEL1 ) {
-		_Mem_Error( "Mem_Realloc: trashed header sentinel 1 (alloc at %s:%i, free at %s:%i)", 
-			mem->filename, mem->fileline, filename, fileline );
-	}
-	if( *( (uint8_t *)mem + sizeof( memheader_t ) + mem->size ) != MEMHEADER_SENTINEL2 ) {
-		_Mem_Error( "Mem_Realloc: trashed header sentinel 2 (alloc at %s:%i, free at %s:%i)", 
-			mem->filename, mem->fileline, filename, fileline );
-	}
+	_Mem_CheckSentinels( data, filename, fileline );
 
+	mem = Mem_Header( data );
 	if( size <= mem->size ) {
 		return data;
 	}
 
-	newdata = Mem_AllocExt( mem->pool, size, 0 );
+	newdata = Mem_AllocExt( mem_pools[mem->pool], size, 0 );
 	memcpy( newdata, data, mem->size );
 	memset( (uint8_t *)newdata + mem->size, 0, size - mem->size );
 	Mem_Free( data );
@@ -251,7 +529,6 @@ char *_Mem_CopyString( mempool_t *pool, const char *in, const char *filename, in
 }
 
 void _Mem_Free( void *data, int musthave, int canthave, const char *filename, int fileline ) {
-	void *base;
 	memheader_t *mem;
 	mempool_t *pool;
 
@@ -259,21 +536,15 @@ void _Mem_Free( void *data, int musthave, int canthave, const char *filename, in
 		return;
 	}
 
-	mem = ( memheader_t * )( (uint8_t *) data - sizeof( memheader_t ) );
-
-	assert( mem->sentinel1 == MEMHEADER_SENTINEL1 );
-	assert( *( (uint8_t *) mem + sizeof( memheader_t ) + mem->size ) == MEMHEADER_SENTINEL2 );
+	mem = Mem_Header( data );
 
-	if( mem->sentinel1 != MEMHEADER_SENTINEL1 ) {
-		_Mem_Error( "Mem_Free: trashed header sentinel 1 (alloc at %s:%i, free at %s:%i)", 
-			mem->filename, mem->fileline, filename, fileline );
-	}
-	if( *( (uint8_t *)mem + sizeof( memheader_t ) + mem->size ) != MEMHEADER_SENTINEL2 ) {
-		_Mem_Error( "Mem_Free: trashed header sentinel 2 (alloc at %s:%i, free at %s:%i)", 
-			mem->filename, mem->fileline, filename, fileline );
+	if( mem->sentinel1 == MEMHEADER_FREED ) {
+		_Mem_Error( "Mem_Free: double freed (free at %s:%i)", filename, fileline );
 	}
 
-	pool = mem->pool;
+	_Mem_CheckSentinels( data, filename, fileline );
+
+	pool = mem_pools[mem->pool];
 	if( musthave && ( ( pool->flags & musthave ) != musthave ) ) {
 		_Mem_Error( "Mem_Free: bad pool flags (musthave) (alloc at %s:%i)", filename, fileline );
 	}
@@ -282,36 +553,60 @@ void _Mem_Free( void *data, int musthave, int canthave, const char *filename, in
 	}
 
 	if( developer_memory && developer_memory->integer ) {
-		Com_DPrintf( "Mem_Free: pool %s, alloc %s:%i, free %s:%i, size %" PRIuPTR " bytes\n", 
-			pool->name, mem->filename, mem->fileline, filename, fileline, (uintptr_t)mem->size );
+		Com_DPrintf( "Mem_Free: pool %s, free %s:%i, size %" PRIuPTR " bytes\n",
+			pool->name, filename, fileline, (uintptr_t)mem->size );
 	}
 
-	Lock( memMutex );
+	AtomicAdd( &pool->totalsize, -s32( mem->size ) );
 
-	// unlink memheader from doubly linked list
-	if( ( mem->prev ? mem->prev->next != mem : pool->chain != mem ) || ( mem->next && mem->next->prev != mem ) ) {
-		_Mem_Error( "Mem_Free: not allocated or double freed (free at %s:%i)", filename, fileline );
+	if( mem->size_class == MEM_TRACKED_CLASS ) {
+		Mem_FreeTracked( pool, mem, filename, fileline );
+	} else {
+		Mem_FreeSmall( pool, mem );
 	}
+}
 
-	if( mem->prev ) {
-		mem->prev->next = mem->next;
-	} else {
-		pool->chain = mem->next;
+/*
+* Mem_ReleasePoolMemory
+*
+* Frees everything allocated from the pool, including anything threads
+* still have cached
+*/
+static void Mem_ReleasePoolMemory( mempool_t *pool ) {
+	Lock( pool->mutex );
+
+	while( pool->tracked ) {
+		memtracked_t *next = pool->tracked->next;
+		free( pool->tracked->baseaddress );
+		TracyFree( pool->tracked->baseaddress );
+		pool->tracked = next;
 	}
-	if( mem->next ) {
-		mem->next->prev = mem->prev;
+
+	while( pool->slabs ) {
+		memslab_t *next = pool->slabs->next;
+		free( pool->slabs );
+		pool->slabs = next;
 	}
 
-	// memheader has been unlinked, do the actual free now
-	pool->totalsize -= mem->size;
+	memset( pool->free_blocks, 0, sizeof( pool->free_blocks ) );
+	memset( pool->slab_cursor, 0, sizeof( pool->slab_cursor ) );
+	memset( pool->slab_end, 0, sizeof( pool->slab_end ) );
 
-	base = mem->baseaddress;
-	pool->realsize -= mem->realsize;
+	AtomicStore( &pool->totalsize, 0 );
+	pool->realsize = sizeof( mempool_t );
+	pool->generation = ++mem_pool_generations[pool->index];
 
-	Unlock( memMutex );
+	Unlock( pool->mutex );
+}
 
-	free( base );
-	TracyFree( base );
+static void Mem_PrintTracked( mempool_t *pool ) {
+	Lock( pool->mutex );
+	for( memtracked_t *tracked = pool->tracked; tracked; tracked = tracked->next ) {
+		memheader_t *mem = ( memheader_t * )( tracked + 1 );
+		Com_Printf( "%10" PRIuPTR " bytes allocated at %s:%i%s\n", (uintptr_t)mem->size, tracked->filename, tracked->fileline,
+			tracked->sampled ? " (sampled)" : "" );
+	}
+	Unlock( pool->mutex );
 }
 
 mempool_t *_Mem_AllocPool( mempool_t *parent, const char *name, int flags, const char *filename, int fileline ) {
@@ -336,13 +631,32 @@ mempool_t *_Mem_AllocPool( mempool_t *parent, const char *name, int flags, const
 	pool->filename = filename;
 	pool->fileline = fileline;
 	pool->flags = flags;
-	pool->chain = NULL;
+	pool->mutex = NewMutex();
+	pool->tracked = NULL;
+	pool->slabs = NULL;
 	pool->parent = parent;
 	pool->child = NULL;
 	pool->totalsize = 0;
 	pool->realsize = sizeof( mempool_t );
 	Q_strncpyz( pool->name, name, sizeof( pool->name ) );
 
+	Lock( memMutex );
+
+	pool->index = -1;
+	for( int i = 0; i < MEM_MAX_POOLS; i++ ) {
+		if( mem_pools[i] == NULL ) {
+			pool->index = i;
+			break;
+		}
+	}
+
+	if( pool->index == -1 ) {
+		_Mem_Error( "Mem_AllocPool: too many pools (allocpool at %s:%i)", filename, fileline );
+	}
+
+	mem_pools[pool->index] = pool;
+	pool->generation = ++mem_pool_generations[pool->index];
+
 	if( parent ) {
 		pool->next = parent->child;
 		parent->child = pool;
@@ -351,6 +665,8 @@ mempool_t *_Mem_AllocPool( mempool_t *parent, const char *name, int flags, const
 		poolChain = pool;
 	}
 
+	Unlock( memMutex );
+
 	return pool;
 }
 
@@ -365,9 +681,6 @@ mempool_t *_Mem_AllocTempPool( const char *name, const char *filename, int filel
 
 void _Mem_FreePool( mempool_t **pool, int musthave, int canthave, const char *filename, int fileline ) {
 	mempool_t **chainAddress;
-#ifdef SHOW_NONFREED
-	memheader_t *mem;
-#endif
 
 	if( !( *pool ) ) {
 		return;
@@ -398,14 +711,14 @@ void _Mem_FreePool( mempool_t **pool, int musthave, int canthave, const char *fi
 	}
 
 #ifdef SHOW_NONFREED
-	if( ( *pool )->chain ) {
+	if( ( *pool )->totalsize ) {
 		Com_Printf( "Warning: Memory pool %s has resources that weren't freed:\n", ( *pool )->name );
-	}
-	for( mem = ( *pool )->chain; mem; mem = mem->next ) {
-		Com_Printf( "%10i bytes allocated at %s:%i\n", mem->size, mem->filename, mem->fileline );
+		Mem_PrintTracked( *pool );
 	}
 #endif
 
+	Lock( memMutex );
+
 	// unlink pool from chain
 	if( ( *pool )->parent ) {
 		for( chainAddress = &( *pool )->parent->child; *chainAddress && *chainAddress != *pool; chainAddress = &( ( *chainAddress )->next ) ) ;
@@ -417,12 +730,16 @@ void _Mem_FreePool( mempool_t **pool, int musthave, int canthave, const char *fi
 		_Mem_Error( "Mem_FreePool: pool already free (freepool at %s:%i)", filename, fileline );
 	}
 
-	while( ( *pool )->chain )  // free memory owned by the pool
-		Mem_Free( (void *)( (uint8_t *)( *pool )->chain + sizeof( memheader_t ) ) );
-
 	*chainAddress = ( *pool )->next;
+	mem_pools[( *pool )->index] = NULL;
+
+	Unlock( memMutex );
+
+	// free memory owned by the pool
+	Mem_ReleasePoolMemory( *pool );
 
 	// free the pool itself
+	DeleteMutex( ( *pool )->mutex );
 	free( *pool );
 	TracyFree( *pool );
 	*pool = NULL;
@@ -430,9 +747,6 @@ void _Mem_FreePool( mempool_t **pool, int musthave, int canthave, const char *fi
 
 void _Mem_EmptyPool( mempool_t *pool, int musthave, int canthave, const char *filename, int fileline ) {
 	mempool_t *child, *next;
-#ifdef SHOW_NONFREED
-	memheader_t *mem;
-#endif
 
 	if( pool == NULL ) {
 		_Mem_Error( "Mem_EmptyPool: pool == NULL (emptypool at %s:%i)", filename, fileline );
@@ -463,23 +777,27 @@ void _Mem_EmptyPool( mempool_t *pool, int musthave, int canthave, const char *fi
 	}
 
 #ifdef SHOW_NONFREED
-	if( pool->chain ) {
+	if( pool->totalsize ) {
 		Com_Printf( "Warning: Memory pool %s has resources that weren't freed:\n", pool->name );
-	}
-	for( mem = pool->chain; mem; mem = mem->next ) {
-		Com_Printf( "%10i bytes allocated at %s:%i\n", mem->size, mem->filename, mem->fileline );
+		Mem_PrintTracked( pool );
 	}
 #endif
-	while( pool->chain )        // free memory owned by the pool
-		Mem_Free( (void *)( (uint8_t *) pool->chain + sizeof( memheader_t ) ) );
+
+	// free memory owned by the pool
+	Mem_ReleasePoolMemory( pool );
 }
 
 size_t Mem_PoolTotalSize( mempool_t *pool ) {
 	assert( pool != NULL );
 
-	return pool->totalsize;
+	return AtomicLoad( &pool->totalsize );
 }
 
+/*
+* _Mem_CheckSentinels
+*
+* Only tracked allocations have a trailing sentinel
+*/
 void _Mem_CheckSentinels( void *data, const char *filename, int fileline ) {
 	memheader_t *mem;
 
@@ -487,21 +805,26 @@ void _Mem_CheckSentinels( void *data, const char *filename, int fileline ) {
 		_Mem_Error( "Mem_CheckSentinels: data == NULL (sentinel check at %s:%i)", filename, fileline );
 	}
 
-	mem = (memheader_t *)( (uint8_t *) data - sizeof( memheader_t ) );
+	mem = Mem_Header( data );
 
 	assert( mem->sentinel1 == MEMHEADER_SENTINEL1 );
-	assert( *( (uint8_t *) mem + sizeof( memheader_t ) + mem->size ) == MEMHEADER_SENTINEL2 );
 
 	if( mem->sentinel1 != MEMHEADER_SENTINEL1 ) {
-		_Mem_Error( "Mem_CheckSentinels: trashed header sentinel 1 (block allocated at %s:%i, sentinel check at %s:%i)", mem->filename, mem->fileline, filename, fileline );
+		_Mem_Error( "Mem_CheckSentinels: trashed header sentinel 1 (sentinel check at %s:%i)", filename, fileline );
 	}
-	if( *( (uint8_t *) mem + sizeof( memheader_t ) + mem->size ) != MEMHEADER_SENTINEL2 ) {
-		_Mem_Error( "Mem_CheckSentinels: trashed header sentinel 2 (block allocated at %s:%i, sentinel check at %s:%i)", mem->filename, mem->fileline, filename, fileline );
+
+	if( mem->size_class == MEM_TRACKED_CLASS ) {
+		memtracked_t *tracked = Mem_Tracked( mem );
+
+		assert( *( (uint8_t *) data + mem->size ) == MEMHEADER_SENTINEL2 );
+
+		if( *( (uint8_t *) data + mem->size ) != MEMHEADER_SENTINEL2 ) {
+			_Mem_Error( "Mem_CheckSentinels: trashed header sentinel 2 (block allocated at %s:%i, sentinel check at %s:%i)", tracked->filename, tracked->fileline, filename, fileline );
+		}
 	}
 }
 
 static void _Mem_CheckSentinelsPool( mempool_t *pool, const char *filename, int fileline ) {
-	memheader_t *mem;
 	mempool_t *child;
 
 	// recurse into children
@@ -520,8 +843,10 @@ static void _Mem_CheckSentinelsPool( mempool_t *pool, const char *filename, int
 		_Mem_Error( "_Mem_CheckSentinelsPool: trashed pool sentinel 2 (allocpool at %s:%i, sentinel check at %s:%i)", pool->filename, pool->fileline, filename, fileline );
 	}
 
-	for( mem = pool->chain; mem; mem = mem->next )
-		_Mem_CheckSentinels( (void *)( (uint8_t *) mem + sizeof( memheader_t ) ), filename, fileline );
+	Lock( pool->mutex );
+	for( memtracked_t *tracked = pool->tracked; tracked; tracked = tracked->next )
+		_Mem_CheckSentinels( ( memheader_t * )( tracked + 1 ) + 1, filename, fileline );
+	Unlock( pool->mutex );
 }
 
 void _Mem_CheckSentinelsGlobal( const char *filename, int fileline ) {
@@ -544,7 +869,7 @@ static void Mem_CountPoolStats( mempool_t *pool, int *count, int *size, int *rea
 		( *count )++;
 	}
 	if( size ) {
-		( *size ) += pool->totalsize;
+		( *size ) += AtomicLoad( &pool->totalsize );
 	}
 	if( realsize ) {
 		( *realsize ) += pool->realsize;
@@ -555,7 +880,6 @@ static void Mem_PrintStats() {
 	int count, size, real;
 	int total, totalsize, realsize;
 	mempool_t *pool;
-	memheader_t *mem;
 
 	Mem_CheckSentinelsGlobal();
 
@@ -570,20 +894,19 @@ static void Mem_PrintStats() {
 
 	// temporary pools are not nested
 	for( pool = poolChain; pool; pool = pool->next ) {
-		if( ( pool->flags & MEMPOOL_TEMPORARY ) && pool->chain ) {
-			Com_Printf( "%i bytes (%.3fMB) (%i bytes (%.3fMB actual)) of temporary memory still allocated (Leak!)\n", pool->totalsize, pool->totalsize / 1048576.0,
+		s32 poolsize = AtomicLoad( &pool->totalsize );
+		if( ( pool->flags & MEMPOOL_TEMPORARY ) && poolsize != 0 ) {
+			Com_Printf( "%i bytes (%.3fMB) (%i bytes (%.3fMB actual)) of temporary memory still allocated (Leak!)\n", poolsize, poolsize / 1048576.0,
 						pool->realsize, pool->realsize / 1048576.0 );
-			Com_Printf( "listing temporary memory allocations for %s:\n", pool->name );
+			Com_Printf( "listing tracked temporary memory allocations for %s:\n", pool->name );
 
-			for( mem = pool->chain; mem; mem = mem->next )
-				Com_Printf( "%10" PRIuPTR " bytes allocated at %s:%i\n", (uintptr_t)mem->size, mem->filename, mem->fileline );
+			Mem_PrintTracked( pool );
 		}
 	}
 }
 
 static void Mem_PrintPoolStats( mempool_t *pool, int listchildren, int listallocations ) {
 	mempool_t *child;
-	memheader_t *mem;
 	int totalsize = 0, realsize = 0;
 
 	Mem_CountPoolStats( pool, NULL, &totalsize, &realsize );
@@ -605,8 +928,7 @@ static void Mem_PrintPoolStats( mempool_t *pool, int listchildren, int listalloc
 	pool->lastchecksize = totalsize;
 
 	if( listallocations ) {
-		for( mem = pool->chain; mem; mem = mem->next )
-			Com_Printf( "%10" PRIuPTR " bytes allocated at %s:%i\n", (uintptr_t)mem->size, mem->filename, mem->fileline );
+		Mem_PrintTracked( pool );
 	}
 
 	if( listchildren ) {
@@ -675,6 +997,8 @@ void Memory_Init() {
 
 	memMutex = NewMutex();
 
+	Mem_InitSizeClasses();
+
 	zoneMemPool = Mem_AllocPool( NULL, "Zone" );
 	tempMemPool = Mem_AllocTempPool( "Temporary Memory" );
 
@@ -688,6 +1012,7 @@ void Memory_InitCommands() {
 	assert( !commands_initialized );
 
 	developer_memory = Cvar_Get( "developer_memory", "0", 0 );
+	mem_sample_bytes = Cvar_Get( "mem_sample_bytes", va( "%i", MEM_DEFAULT_SAMPLE_BYTES ), 0 );
 
 	Cmd_AddCommand( "memlist", MemList_f );
 	Cmd_AddCommand( "memstats", MemStats_f );
@@ -709,6 +1034,7 @@ void Memory_Shutdown() {
 
 	// set the cvar to NULL so nothing is printed to non-existing console
 	developer_memory = NULL;
+	mem_sample_bytes = NULL;
 
 	Mem_CheckSentinelsGlobal();
 
@@ -50,35 +50,52 @@ void *MSG_GetSpace( msg_t *msg, size_t length ) {
 	return ptr;
 }
 
+/*
+* DeltaBuffer
+*
+* Writers put bits straight into the destination message, past msg->cursize,
+* and only commit them with MSG_FinishWritingDeltaBuffer. Each field sends a
+* changed bit followed by its payload, so there's no header to fill in later.
+*/
 struct DeltaBuffer {
-	static constexpr u32 MAX_FIELDS = 1024;
-
 	u8 * buf;
 	u8 * cursor;
 	u8 * end;
 
-	u8 field_mask[ MAX_FIELDS / 8 ];
-	u32 num_fields;
-	u32 field_mask_read_cursor;
+	// bits that haven't been flushed to/consumed from cursor yet
+	u64 bits;
+	u32 num_bits;
 
+	bool changed;
 	bool serializing;
 	bool error;
 };
 
-static void MSG_WriteDeltaBuffer( msg_t * msg, const DeltaBuffer & delta ) {
-	MSG_WriteUintBase128( msg, delta.num_fields );
-	u8 bytes = ( delta.num_fields + 7 ) / 8;
-	MSG_WriteData( msg, delta.field_mask, bytes );
-	MSG_WriteData( msg, delta.buf, delta.cursor - delta.buf );
-}
+static void FlushBits( DeltaBuffer * buf );
 
-static DeltaBuffer MSG_StartReadingDeltaBuffer( msg_t * msg ) {
+static DeltaBuffer MSG_StartWritingDeltaBuffer( msg_t * msg ) {
 	DeltaBuffer delta = { };
+	delta.buf = msg->data + msg->cursize;
+	delta.cursor = delta.buf;
+	delta.end = msg->data + msg->maxsize;
+	delta.serializing = true;
+
+	return delta;
+}
 
-	delta.num_fields = MSG_ReadUintBase128( msg );
-	u8 bytes = ( delta.num_fields + 7 ) / 8;
-	MSG_ReadData( msg, delta.field_mask, bytes );
+static void MSG_FinishWritingDeltaBuffer( msg_t * msg, DeltaBuffer & delta ) {
+	FlushBits( &delta );
 
+	assert( !delta.error );
+	if( delta.error ) {
+		Com_Error( ERR_FATAL, "MSG_FinishWritingDeltaBuffer: overflowed" );
+	}
+
+	msg->cursize += delta.cursor - delta.buf;
+}
+
+static DeltaBuffer MSG_StartReadingDeltaBuffer( msg_t * msg ) {
+	DeltaBuffer delta = { };
 	delta.buf = msg->data + msg->readcount;
 	delta.cursor = msg->data + msg->readcount;
 	delta.end = msg->data + msg->cursize;
@@ -90,77 +107,191 @@ static void MSG_FinishReadingDeltaBuffer( msg_t * msg, const DeltaBuffer & delta
 	msg->readcount += delta.cursor - delta.buf;
 }
 
-static DeltaBuffer DeltaWriter( u8 * buf, size_t n ) {
-	DeltaBuffer delta = { };
-	delta.buf = buf;
-	delta.cursor = buf;
-	delta.end = delta.buf + n;
-	delta.serializing = true;
-
-	return delta;
+static u64 LowBits( u64 x, u32 n ) {
+	return n == 64 ? x : x & ( ( U64( 1 ) << n ) - 1 );
 }
 
-static void AddBit( DeltaBuffer * buf, bool b ) {
-	if( buf->error || buf->num_fields == DeltaBuffer::MAX_FIELDS ) {
-		buf->error = true;
+static void AddBits( DeltaBuffer * buf, u64 x, u32 n ) {
+	assert( n <= 64 );
+
+	// keep bits + num_bits under 64 bits
+	if( n > 32 ) {
+		AddBits( buf, x, 32 );
+		AddBits( buf, x >> 32, n - 32 );
 		return;
 	}
 
-	if( b ) {
-		u32 byte = buf->num_fields / 8;
-		u32 bit = buf->num_fields % 8;
-		buf->field_mask[ byte ] |= u8( 1 ) << u8( bit );
+	if( buf->error )
+		return;
+
+	buf->bits |= LowBits( x, n ) << buf->num_bits;
+	buf->num_bits += n;
+
+	while( buf->num_bits >= 8 ) {
+		if( buf->cursor == buf->end ) {
+			buf->error = true;
+			return;
+		}
+
+		*buf->cursor = u8( buf->bits );
+		buf->cursor++;
+		buf->bits >>= 8;
+		buf->num_bits -= 8;
 	}
+}
 
-	buf->num_fields++;
+static u64 GetBits( DeltaBuffer * buf, u32 n ) {
+	assert( n <= 64 );
+
+	if( n > 32 ) {
+		u64 lo = GetBits( buf, 32 );
+		u64 hi = GetBits( buf, n - 32 );
+		return lo | ( hi << 32 );
+	}
+
+	while( buf->num_bits < n ) {
+		if( buf->error || buf->cursor == buf->end ) {
+			buf->error = true;
+			return 0;
+		}
+
+		buf->bits |= u64( *buf->cursor ) << buf->num_bits;
+		buf->cursor++;
+		buf->num_bits += 8;
+	}
+
+	u64 x = LowBits( buf->bits, n );
+	buf->bits >>= n;
+	buf->num_bits -= n;
+
+	return x;
 }
 
-static bool GetBit( DeltaBuffer * buf ) {
-	if( buf->error || buf->field_mask_read_cursor == buf->num_fields ) {
-		buf->error = true;
-		return false;
+/*
+* FlushBits
+*
+* Pads the bit stream to a whole byte. Readers discard the padding because
+* they only ever pull in the bytes they need.
+*/
+static void FlushBits( DeltaBuffer * buf ) {
+	if( buf->num_bits > 0 ) {
+		AddBits( buf, 0, 8 - buf->num_bits );
 	}
+}
 
-	u32 byte = buf->field_mask_read_cursor / 8;
-	u32 bit = buf->field_mask_read_cursor % 8;
-	bool b = ( buf->field_mask[ byte ] & ( u8( 1 ) << u8( bit ) ) ) != 0;
-	buf->field_mask_read_cursor++;
+static void AddBit( DeltaBuffer * buf, bool b ) {
+	AddBits( buf, b ? 1 : 0, 1 );
+	buf->changed = buf->changed || b;
+}
+
+static bool GetBit( DeltaBuffer * buf ) {
+	return GetBits( buf, 1 ) != 0;
+}
 
-	return b;
+static constexpr u32 BitLength( u64 x ) {
+	return x == 0 ? 0 : 1 + BitLength( x >> 1 );
 }
 
-static void AddBytes( DeltaBuffer * buf, const void * data, size_t n ) {
-	if( buf->error || size_t( buf->end - buf->cursor ) < n ) {
+/*
+* AddVarBits
+*
+* Writes the bit length of x in length_bits bits, followed by x without its
+* leading 1, so small values stay small
+*/
+static void AddVarBits( DeltaBuffer * buf, u64 x, u32 length_bits ) {
+	u32 n = BitLength( x );
+	AddBits( buf, n, length_bits );
+	if( n > 1 ) {
+		AddBits( buf, x, n - 1 );
+	}
+}
+
+static u64 GetVarBits( DeltaBuffer * buf, u32 length_bits ) {
+	u32 n = GetBits( buf, length_bits );
+	if( n == 0 )
+		return 0;
+
+	if( n > 64 ) {
 		buf->error = true;
-		return;
+		return 0;
 	}
 
-	memcpy( buf->cursor, data, n );
-	buf->cursor += n;
+	return ( U64( 1 ) << ( n - 1 ) ) | GetBits( buf, n - 1 );
 }
 
-static void GetBytes( DeltaBuffer * buf, void * data, size_t n ) {
-	if( buf->error || size_t( buf->end - buf->cursor ) < n ) {
-		buf->error = true;
-		memset( data, 0, n );
-		return;
+template< typename T >
+static void DeltaRaw( DeltaBuffer * buf, T & x, const T & baseline ) {
+	STATIC_ASSERT( sizeof( T ) <= sizeof( u64 ) );
+
+	if( buf->serializing ) {
+		AddBit( buf, x != baseline );
+		if( x != baseline ) {
+			u64 bits = 0;
+			memcpy( &bits, &x, sizeof( x ) );
+			AddBits( buf, bits, sizeof( x ) * 8 );
+		}
 	}
+	else {
+		if( GetBit( buf ) ) {
+			u64 bits = GetBits( buf, sizeof( x ) * 8 );
+			memcpy( &x, &bits, sizeof( x ) );
+		}
+		else {
+			x = baseline;
+		}
+	}
+}
 
-	memcpy( data, buf->cursor, n );
-	buf->cursor += n;
+/*
+* DeltaInteger
+*
+* Sends the zigzagged difference from the baseline, which is small for
+* counters, timestamps and enums
+*/
+template< typename T >
+static void DeltaInteger( DeltaBuffer * buf, T & x, const T & baseline ) {
+	// enough to hold the bit length of any difference between two Ts
+	constexpr u32 length_bits = BitLength( sizeof( T ) * 8 + 1 );
+
+	if( buf->serializing ) {
+		AddBit( buf, x != baseline );
+		if( x != baseline ) {
+			s64 d = s64( u64( s64( x ) ) - u64( s64( baseline ) ) );
+			u64 zigzag = ( u64( d ) << 1 ) ^ u64( d >> 63 );
+			AddVarBits( buf, zigzag, length_bits );
+		}
+	}
+	else {
+		if( GetBit( buf ) ) {
+			u64 zigzag = GetVarBits( buf, length_bits );
+			s64 d = s64( zigzag >> 1 ) ^ -s64( zigzag & 1 );
+			x = T( u64( s64( baseline ) ) + u64( d ) );
+		}
+		else {
+			x = baseline;
+		}
+	}
 }
 
+/*
+* DeltaBounded
+*
+* For fields with a known range, e.g. enums, sends just enough bits to hold max
+*/
 template< typename T >
-static void DeltaFundamental( DeltaBuffer * buf, T & x, const T & baseline ) {
+static void DeltaBounded( DeltaBuffer * buf, T & x, const T & baseline, u64 max ) {
+	u32 bits = BitLength( max );
+
 	if( buf->serializing ) {
+		assert( u64( x ) <= max );
 		AddBit( buf, x != baseline );
 		if( x != baseline ) {
-			AddBytes( buf, &x, sizeof( x ) );
+			AddBits( buf, u64( x ), bits );
 		}
 	}
 	else {
 		if( GetBit( buf ) ) {
-			GetBytes( buf, &x, sizeof( x ) );
+			x = T( GetBits( buf, bits ) );
 		}
 		else {
 			x = baseline;
@@ -168,15 +299,15 @@ static void DeltaFundamental( DeltaBuffer * buf, T & x, const T & baseline ) {
 	}
 }
 
-static void Delta( DeltaBuffer * buf, s8 & x, s8 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, s16 & x, s16 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, s32 & x, s32 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, s64 & x, s64 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, u8 & x, u8 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, u16 & x, u16 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, u32 & x, u32 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, u64 & x, u64 baseline ) { DeltaFundamental( buf, x, baseline ); }
-static void Delta( DeltaBuffer * buf, float & x, float baseline ) { DeltaFundamental( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, s8 & x, s8 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, s16 & x, s16 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, s32 & x, s32 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, s64 & x, s64 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, u8 & x, u8 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, u16 & x, u16 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, u32 & x, u32 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, u64 & x, u64 baseline ) { DeltaInteger( buf, x, baseline ); }
+static void Delta( DeltaBuffer * buf, float & x, float baseline ) { DeltaRaw( buf, x, baseline ); }
 
 static void Delta( DeltaBuffer * buf, bool & b, bool baseline ) {
 	if( buf->serializing ) {
@@ -188,7 +319,7 @@ static void Delta( DeltaBuffer * buf, bool & b, bool baseline ) {
 }
 
 static void Delta( DeltaBuffer * buf, StringHash & hash, StringHash baseline ) {
-	DeltaFundamental( buf, hash.hash, baseline.hash );
+	DeltaRaw( buf, hash.hash, baseline.hash );
 }
 
 template< typename T, size_t N >
@@ -236,6 +367,29 @@ static void DeltaAngle( DeltaBuffer * buf, Vec3 & v, const Vec3 & baseline ) {
 	}
 }
 
+// fixed-point scales for quantized fields. they're powers of two so
+// dequantized values quantize back to the same thing
+static constexpr float ORIGIN_SCALE = 64.0f;
+static constexpr float VELOCITY_SCALE = 16.0f;
+static constexpr float ORIGIN2_SCALE = 1024.0f; // origin2 also carries normals and angles
+
+static void DeltaFixed( DeltaBuffer * buf, float & x, const float & baseline, float scale ) {
+	s32 fixed_x = buf->serializing ? Q_rint( x * scale ) : 0;
+	s32 fixed_baseline = Q_rint( baseline * scale );
+	Delta( buf, fixed_x, fixed_baseline );
+	x = fixed_x / scale;
+}
+
+static void DeltaFixed( DeltaBuffer * buf, Vec3 & v, const Vec3 & baseline, float scale ) {
+	for( int i = 0; i < 3; i++ ) {
+		DeltaFixed( buf, v[ i ], baseline[ i ], scale );
+	}
+}
+
+static void DeltaWeapon( DeltaBuffer * buf, WeaponType & weapon, const WeaponType & baseline ) {
+	DeltaBounded( buf, weapon, baseline, Weapon_Count - 1 );
+}
+
 //==================================================
 // WRITE FUNCTIONS
 //==================================================
@@ -502,7 +656,7 @@ static void Delta( DeltaBuffer * buf, SyncEvent & event, const SyncEvent & basel
 static void Delta( DeltaBuffer * buf, SyncEntityState & ent, const SyncEntityState & baseline ) {
 	Delta( buf, ent.events, baseline.events );
 
-	Delta( buf, ent.origin, baseline.origin );
+	DeltaFixed( buf, ent.origin, baseline.origin, ORIGIN_SCALE );
 	DeltaAngle( buf, ent.angles, baseline.angles );
 
 	Delta( buf, ent.bounds, baseline.bounds );
@@ -523,18 +677,18 @@ static void Delta( DeltaBuffer * buf, SyncEntityState & ent, const SyncEntitySta
 	Delta( buf, ent.animation_time, baseline.animation_time );
 	Delta( buf, ent.counterNum, baseline.counterNum );
 	Delta( buf, ent.channel, baseline.channel );
-	Delta( buf, ent.weapon, baseline.weapon );
+	DeltaWeapon( buf, ent.weapon, baseline.weapon );
 	Delta( buf, ent.radius, baseline.radius );
 	Delta( buf, ent.team, baseline.team );
 
-	Delta( buf, ent.origin2, baseline.origin2 );
+	DeltaFixed( buf, ent.origin2, baseline.origin2, ORIGIN2_SCALE );
 
 	Delta( buf, ent.linearMovementTimeStamp, baseline.linearMovementTimeStamp );
 	Delta( buf, ent.linearMovement, baseline.linearMovement );
 	Delta( buf, ent.linearMovementDuration, baseline.linearMovementDuration );
-	Delta( buf, ent.linearMovementVelocity, baseline.linearMovementVelocity );
-	Delta( buf, ent.linearMovementBegin, baseline.linearMovementBegin );
-	Delta( buf, ent.linearMovementEnd, baseline.linearMovementEnd );
+	DeltaFixed( buf, ent.linearMovementVelocity, baseline.linearMovementVelocity, VELOCITY_SCALE );
+	DeltaFixed( buf, ent.linearMovementBegin, baseline.linearMovementBegin, ORIGIN_SCALE );
+	DeltaFixed( buf, ent.linearMovementEnd, baseline.linearMovementEnd, ORIGIN_SCALE );
 	Delta( buf, ent.linearMovementTimeDelta, baseline.linearMovementTimeDelta );
 
 	Delta( buf, ent.silhouetteColor, baseline.silhouetteColor );
@@ -556,25 +710,18 @@ int MSG_ReadEntityNumber( msg_t *msg, bool *remove ) {
 }
 
 void MSG_WriteDeltaEntity( msg_t * msg, const SyncEntityState * baseline, const SyncEntityState * ent, bool force ) {
-	u8 buf[ MAX_MSGLEN ];
-	DeltaBuffer delta = DeltaWriter( buf, sizeof( buf ) );
+	size_t start = msg->cursize;
+	MSG_WriteEntityNumber( msg, ent->number, false );
 
+	DeltaBuffer delta = MSG_StartWritingDeltaBuffer( msg );
 	Delta( &delta, *const_cast< SyncEntityState * >( ent ), * baseline );
 
-	bool changed = false;
-	for( u8 x : delta.field_mask ) {
-		if( x != 0 ) {
-			changed = true;
-			break;
-		}
-	}
-
-	if( !changed && !force ) {
+	if( !delta.changed && !force ) {
+		msg->cursize = start;
 		return;
 	}
 
-	MSG_WriteEntityNumber( msg, ent->number, false );
-	MSG_WriteDeltaBuffer( msg, delta );
+	MSG_FinishWritingDeltaBuffer( msg, delta );
 }
 
 void MSG_ReadDeltaEntity( msg_t * msg, const SyncEntityState * baseline, SyncEntityState * ent ) {
@@ -593,17 +740,14 @@ static void Delta( DeltaBuffer * buf, usercmd_t & cmd, const usercmd_t & baselin
 	Delta( buf, cmd.sidemove, baseline.sidemove );
 	Delta( buf, cmd.upmove, baseline.upmove );
 	Delta( buf, cmd.buttons, baseline.buttons );
-	Delta( buf, cmd.entropy, baseline.entropy );
-	Delta( buf, cmd.weaponSwitch, baseline.weaponSwitch );
+	DeltaRaw( buf, cmd.entropy, baseline.entropy );
+	DeltaWeapon( buf, cmd.weaponSwitch, baseline.weaponSwitch );
 }
 
 void MSG_WriteDeltaUsercmd( msg_t * msg, const usercmd_t * baseline, const usercmd_t * cmd ) {
-	u8 buf[ MAX_MSGLEN ];
-	DeltaBuffer delta = DeltaWriter( buf, sizeof( buf ) );
-
+	DeltaBuffer delta = MSG_StartWritingDeltaBuffer( msg );
 	Delta( &delta, *const_cast< usercmd_t * >( cmd ), *baseline );
-
-	MSG_WriteDeltaBuffer( msg, delta );
+	MSG_FinishWritingDeltaBuffer( msg, delta );
 	MSG_WriteIntBase128( msg, cmd->serverTimeStamp );
 }
 
@@ -621,8 +765,8 @@ void MSG_ReadDeltaUsercmd( msg_t * msg, const usercmd_t * baseline, usercmd_t *
 static void Delta( DeltaBuffer * buf, pmove_state_t & pmove, const pmove_state_t & baseline ) {
 	Delta( buf, pmove.pm_type, baseline.pm_type );
 
-	Delta( buf, pmove.origin, baseline.origin );
-	Delta( buf, pmove.velocity, baseline.velocity );
+	DeltaFixed( buf, pmove.origin, baseline.origin, ORIGIN_SCALE );
+	DeltaFixed( buf, pmove.velocity, baseline.velocity, VELOCITY_SCALE );
 	Delta( buf, pmove.delta_angles, baseline.delta_angles );
 
 	Delta( buf, pmove.pm_time, baseline.pm_time );
@@ -641,7 +785,7 @@ static void Delta( DeltaBuffer * buf, pmove_state_t & pmove, const pmove_state_t
 }
 
 static void Delta( DeltaBuffer * buf, WeaponSlot & weapon, const WeaponSlot & baseline ) {
-	Delta( buf, weapon.weapon, baseline.weapon );
+	DeltaWeapon( buf, weapon.weapon, baseline.weapon );
 	Delta( buf, weapon.ammo, baseline.ammo );
 }
 
@@ -670,18 +814,18 @@ static void Delta( DeltaBuffer * buf, SyncPlayerState & player, const SyncPlayer
 
 	Delta( buf, player.health, baseline.health );
 
-	Delta( buf, player.weapon_state, baseline.weapon_state );
+	DeltaBounded( buf, player.weapon_state, baseline.weapon_state, WeaponState_Throwing );
 	Delta( buf, player.weapon_state_time, baseline.weapon_state_time );
 
-	Delta( buf, player.weapon, baseline.weapon );
-	Delta( buf, player.pending_weapon, baseline.pending_weapon );
-	Delta( buf, player.last_weapon, baseline.last_weapon );
+	DeltaWeapon( buf, player.weapon, baseline.weapon );
+	DeltaWeapon( buf, player.pending_weapon, baseline.pending_weapon );
+	DeltaWeapon( buf, player.last_weapon, baseline.last_weapon );
 	Delta( buf, player.zoom_time, baseline.zoom_time );
 
 	Delta( buf, player.team, baseline.team );
 	Delta( buf, player.real_team, baseline.real_team );
 
-	Delta( buf, player.progress_type, baseline.progress_type );
+	DeltaBounded( buf, player.progress_type, baseline.progress_type, BombProgress_Defusing );
 	Delta( buf, player.progress, baseline.progress );
 
 	Delta( buf, player.pointed_player, baseline.pointed_player );
@@ -694,12 +838,9 @@ void MSG_WriteDeltaPlayerState( msg_t * msg, const SyncPlayerState * baseline, c
 		baseline = &dummy;
 	}
 
-	u8 buf[ MAX_MSGLEN ];
-	DeltaBuffer delta = DeltaWriter( buf, sizeof( buf ) );
-
+	DeltaBuffer delta = MSG_StartWritingDeltaBuffer( msg );
 	Delta( &delta, *const_cast< SyncPlayerState * >( player ), *baseline );
-
-	MSG_WriteDeltaBuffer( msg, delta );
+	MSG_FinishWritingDeltaBuffer( msg, delta );
 }
 
 void MSG_ReadDeltaPlayerState( msg_t * msg, const SyncPlayerState * baseline, SyncPlayerState * player ) {
@@ -726,10 +867,104 @@ static void Delta( DeltaBuffer * buf, SyncScoreboardPlayer & player, const SyncS
 	Delta( buf, player.alive, baseline.alive );
 }
 
+static bool ScoreboardPlayerChanged( const SyncScoreboardPlayer & player, const SyncScoreboardPlayer & baseline ) {
+	return player.ping != baseline.ping || player.score != baseline.score || player.kills != baseline.kills ||
+		player.ready != baseline.ready || player.carrier != baseline.carrier || player.alive != baseline.alive;
+}
+
+/*
+* DeltaScoreboard
+*
+* Only a few players change between frames, so send a list of the ones that
+* did instead of a changed bit for every field of every player
+*/
+static void DeltaScoreboard( DeltaBuffer * buf, SyncScoreboardPlayer ( &players )[ MAX_CLIENTS ], const SyncScoreboardPlayer ( &baseline )[ MAX_CLIENTS ] ) {
+	constexpr u32 skip_length_bits = BitLength( BitLength( MAX_CLIENTS ) );
+
+	size_t next = 0;
+	if( buf->serializing ) {
+		for( size_t i = 0; i < MAX_CLIENTS; i++ ) {
+			if( !ScoreboardPlayerChanged( players[ i ], baseline[ i ] ) )
+				continue;
+			AddBit( buf, true );
+			AddVarBits( buf, i - next, skip_length_bits );
+			Delta( buf, players[ i ], baseline[ i ] );
+			next = i + 1;
+		}
+		AddBit( buf, false );
+	}
+	else {
+		for( size_t i = 0; i < MAX_CLIENTS; i++ ) {
+			players[ i ] = baseline[ i ];
+		}
+
+		while( GetBit( buf ) ) {
+			size_t i = next + GetVarBits( buf, skip_length_bits );
+			if( i >= MAX_CLIENTS ) {
+				buf->error = true;
+				return;
+			}
+			Delta( buf, players[ i ], baseline[ i ] );
+			next = i + 1;
+		}
+	}
+}
+
+/*
+* DeltaTeamPlayers
+*
+* The list is only sent when it changes, e.g. someone joins or the team gets
+* resorted by score. Entries past num_players are garbage on both ends so
+* they're never used as a baseline.
+*/
+static void DeltaTeamPlayers( DeltaBuffer * buf, SyncTeamState & team, const SyncTeamState & baseline ) {
+	constexpr u32 index_bits = BitLength( MAX_CLIENTS );
+
+	if( buf->serializing ) {
+		assert( team.num_players <= MAX_CLIENTS );
+		bool changed = team.num_players != baseline.num_players ||
+			memcmp( team.player_indices, baseline.player_indices, team.num_players ) != 0;
+		AddBit( buf, changed );
+		if( !changed )
+			return;
+
+		AddBits( buf, team.num_players, index_bits );
+		for( u32 i = 0; i < team.num_players; i++ ) {
+			if( i < baseline.num_players ) {
+				DeltaBounded( buf, team.player_indices[ i ], baseline.player_indices[ i ], MAX_CLIENTS );
+			}
+			else {
+				AddBits( buf, team.player_indices[ i ], index_bits );
+			}
+		}
+	}
+	else {
+		if( !GetBit( buf ) ) {
+			team.num_players = baseline.num_players;
+			memcpy( team.player_indices, baseline.player_indices, sizeof( team.player_indices ) );
+			return;
+		}
+
+		team.num_players = GetBits( buf, index_bits );
+		if( team.num_players > MAX_CLIENTS ) {
+			buf->error = true;
+			return;
+		}
+
+		for( u32 i = 0; i < team.num_players; i++ ) {
+			if( i < baseline.num_players ) {
+				DeltaBounded( buf, team.player_indices[ i ], baseline.player_indices[ i ], MAX_CLIENTS );
+			}
+			else {
+				team.player_indices[ i ] = GetBits( buf, index_bits );
+			}
+		}
+	}
+}
+
 static void Delta( DeltaBuffer * buf, SyncTeamState & team, const SyncTeamState & baseline ) {
-	Delta( buf, team.player_indices, baseline.player_indices );
+	DeltaTeamPlayers( buf, team, baseline );
 	Delta( buf, team.score, baseline.score );
-	Delta( buf, team.num_players, baseline.num_players );
 }
 
 static void Delta( DeltaBuffer * buf, SyncBombGameState & bomb, const SyncBombGameState & baseline ) {
@@ -752,9 +987,9 @@ static void Delta( DeltaBuffer * buf, SyncGameState & state, const SyncGameState
 	Delta( buf, state.round_type, baseline.round_type );
 	Delta( buf, state.max_team_players, baseline.max_team_players );
 	Delta( buf, state.teams, baseline.teams );
-	Delta( buf, state.players, baseline.players );
+	DeltaScoreboard( buf, state.players, baseline.players );
 	Delta( buf, state.map, baseline.map );
-	Delta( buf, state.map_checksum, baseline.map_checksum );
+	DeltaRaw( buf, state.map_checksum, baseline.map_checksum );
 	Delta( buf, state.bomb, baseline.bomb );
 }
 
@@ -764,12 +999,9 @@ void MSG_WriteDeltaGameState( msg_t * msg, const SyncGameState * baseline, const
 		baseline = &dummy;
 	}
 
-	u8 buf[ MAX_MSGLEN ];
-	DeltaBuffer delta = DeltaWriter( buf, sizeof( buf ) );
-
+	DeltaBuffer delta = MSG_StartWritingDeltaBuffer( msg );
 	Delta( &delta, *const_cast< SyncGameState * >( state ), *baseline );
-
-	MSG_WriteDeltaBuffer( msg, delta );
+	MSG_FinishWritingDeltaBuffer( msg, delta );
 }
 
 void MSG_ReadDeltaGameState( msg_t * msg, const SyncGameState * baseline, SyncGameState * state ) {
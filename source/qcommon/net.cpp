@@ -35,10 +35,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <sys/time.h>
 #endif
 
+#if PLATFORM_LINUX
+#include <errno.h>
+#include <sys/epoll.h>
+#endif
+
 #include "qcommon/qcommon.h"
 #include "qcommon/sys_net.h"
 
-#define MAX_LOOPBACK    4
+#define MAX_LOOPBACK    16 // packets queued for each client socket
+#define MAX_LOOPBACK_SERVER 512 // packets queued for a server socket, every client sends to it
+#define MAX_LOOPBACK_SOCKETS ( MAX_CLIENTS + 1 )
+#define NET_SEND_QUEUE_SIZE 256
+#define NET_SLEEP_MAX_SOCKETS 8
+#define NET_POLLER_MAX_EVENTS 64
 
 #if !defined SHUT_RDWR && defined SD_BOTH
 #   define SHUT_RDWR SD_BOTH
@@ -54,17 +64,47 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 
 typedef struct {
-	uint8_t data[MAX_MSGLEN];
+	uint8_t data[MAX_PACKETLEN];
 	int datalen;
+	int from;
 } loopmsg_t;
 
 typedef struct {
 	bool open;
-	loopmsg_t msgs[MAX_LOOPBACK];
+	bool server;
+	loopmsg_t *msgs;
+	int num_msgs;
 	int get, send;
 } loopback_t;
 
-static loopback_t loopbacks[2];
+typedef struct {
+	socket_handle_t handle;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	size_t length;
+	uint8_t data[MAX_PACKETLEN];
+} queued_packet_t;
+
+struct net_poller_t {
+#if PLATFORM_LINUX
+	int epoll_fd;
+#else
+	struct {
+		socket_handle_t handle;
+		bool write;
+		void *user;
+	} sockets[FD_SETSIZE];
+	int num_sockets;
+#endif
+};
+
+static loopback_t loopbacks[MAX_LOOPBACK_SOCKETS];
+static queued_packet_t send_queue[NET_SEND_QUEUE_SIZE];
+static size_t send_queue_length;
+static bool send_queue_active;
+static net_send_error_t send_queue_on_error;
+static net_poller_t *sleep_poller;
+static unsigned udp_sockets_closed; // handles get reused, so NET_Sleep checks this too
 static char errorstring[MAX_PRINTMSG];
 static bool net_initialized = false;
 
@@ -310,6 +350,203 @@ static int NET_UDP_GetPacket( const socket_t *socket, netadr_t *address, msg_t *
 	return 1;
 }
 
+/*
+* NET_UDP_GetPackets
+*
+* Returns the number of datagrams drained from the socket, which can be more
+* than batch->num_packets when some of them had to be dropped.
+*/
+static int NET_UDP_GetPackets( const socket_t *socket, net_packet_batch_t *batch ) {
+	struct sockaddr_storage from[NET_PACKET_BATCH_SIZE];
+	int ret;
+
+	assert( socket && socket->open && socket->type == SOCKET_UDP );
+	assert( batch );
+
+	batch->num_packets = 0;
+
+#if PLATFORM_LINUX
+	struct mmsghdr msgs[NET_PACKET_BATCH_SIZE];
+	struct iovec iovs[NET_PACKET_BATCH_SIZE];
+
+	memset( msgs, 0, sizeof( msgs ) );
+	for( int i = 0; i < NET_PACKET_BATCH_SIZE; i++ ) {
+		iovs[i].iov_base = batch->packets[i].data;
+		iovs[i].iov_len = sizeof( batch->packets[i].data );
+		msgs[i].msg_hdr.msg_name = &from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof( from[i] );
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = recvmmsg( socket->handle, msgs, NET_PACKET_BATCH_SIZE, 0, NULL );
+	if( ret == SOCKET_ERROR ) {
+		net_error_t err;
+
+		NET_SetErrorStringFromLastError( "recvmmsg" );
+
+		err = Sys_NET_GetLastError();
+		if( err == NET_ERR_WOULDBLOCK || err == NET_ERR_CONNRESET ) { // would block
+			return 0;
+		}
+
+		return -1;
+	}
+
+	for( int i = 0; i < ret; i++ ) {
+		net_packet_t *packet = &batch->packets[batch->num_packets];
+
+		if( !SockaddressToAddress( (struct sockaddr*)&from[i], &packet->address ) ) {
+			continue;
+		}
+
+		if( ( msgs[i].msg_hdr.msg_flags & MSG_TRUNC ) || msgs[i].msg_len > MAX_PACKETLEN ) {
+			Com_DPrintf( "Dropped oversized packet from %s\n", NET_AddressToString( &packet->address ) );
+			continue;
+		}
+
+		if( packet != &batch->packets[i] ) {
+			memcpy( packet->data, batch->packets[i].data, msgs[i].msg_len );
+		}
+		packet->length = msgs[i].msg_len;
+		batch->num_packets++;
+	}
+#else
+	for( ret = 0; ret < NET_PACKET_BATCH_SIZE; ret++ ) {
+		net_packet_t *packet = &batch->packets[batch->num_packets];
+		socklen_t fromlen = sizeof( from[0] );
+
+		int len = recvfrom( socket->handle, (char*)packet->data, sizeof( packet->data ), 0, (struct sockaddr *)&from[0], &fromlen );
+		if( len == SOCKET_ERROR ) {
+			net_error_t err;
+
+			NET_SetErrorStringFromLastError( "recvfrom" );
+
+			err = Sys_NET_GetLastError();
+			if( err == NET_ERR_WOULDBLOCK || err == NET_ERR_CONNRESET ) { // would block
+				break;
+			}
+			if( err == NET_ERR_MSGSIZE ) {
+				continue;
+			}
+
+			return ret == 0 ? -1 : ret;
+		}
+
+		if( !SockaddressToAddress( (struct sockaddr*)&from[0], &packet->address ) ) {
+			continue;
+		}
+
+		if( len > MAX_PACKETLEN ) {
+			Com_DPrintf( "Dropped oversized packet from %s\n", NET_AddressToString( &packet->address ) );
+			continue;
+		}
+
+		packet->length = len;
+		batch->num_packets++;
+	}
+#endif
+
+	return ret;
+}
+
+/*
+* NET_UDP_QueuedPacketFailed
+*/
+static void NET_UDP_QueuedPacketFailed( const queued_packet_t *packet, const char *syscall ) {
+	NET_SetErrorStringFromLastError( syscall );
+
+	netadr_t address;
+	if( send_queue_on_error != NULL && SockaddressToAddress( (const struct sockaddr *)&packet->addr, &address ) ) {
+		send_queue_on_error( &address );
+	}
+}
+
+/*
+* NET_UDP_FlushQueuedPackets
+*
+* Sends each run of queued packets that share a socket with as few syscalls
+* as we can. A packet that fails is skipped so one bad address doesn't hold
+* back everybody queued after it, and gets reported to the error callback
+* given to NET_BeginQueueingPackets.
+*/
+static bool NET_UDP_FlushQueuedPackets() {
+	bool ok = true;
+	size_t first = 0;
+
+	while( first < send_queue_length ) {
+		socket_handle_t handle = send_queue[ first ].handle;
+		size_t last = first + 1;
+		while( last < send_queue_length && send_queue[ last ].handle == handle ) {
+			last++;
+		}
+
+#if PLATFORM_LINUX
+		struct mmsghdr msgs[ NET_SEND_QUEUE_SIZE ];
+		struct iovec iovs[ NET_SEND_QUEUE_SIZE ];
+		size_t n = last - first;
+
+		memset( msgs, 0, n * sizeof( msgs[ 0 ] ) );
+		for( size_t i = 0; i < n; i++ ) {
+			queued_packet_t *packet = &send_queue[ first + i ];
+			iovs[ i ].iov_base = packet->data;
+			iovs[ i ].iov_len = packet->length;
+			msgs[ i ].msg_hdr.msg_name = &packet->addr;
+			msgs[ i ].msg_hdr.msg_namelen = packet->addrlen;
+			msgs[ i ].msg_hdr.msg_iov = &iovs[ i ];
+			msgs[ i ].msg_hdr.msg_iovlen = 1;
+		}
+
+		size_t sent = 0;
+		while( sent < n ) {
+			int ret = sendmmsg( handle, msgs + sent, n - sent, 0 );
+			if( ret == SOCKET_ERROR ) {
+				// the first packet of the run failed
+				NET_UDP_QueuedPacketFailed( &send_queue[ first + sent ], "sendmmsg" );
+				ok = false;
+				sent++;
+				continue;
+			}
+			sent += ret;
+		}
+#else
+		for( size_t i = first; i < last; i++ ) {
+			queued_packet_t *packet = &send_queue[ i ];
+			if( sendto( handle, (const char *)packet->data, packet->length, 0, (struct sockaddr *)&packet->addr, packet->addrlen ) == SOCKET_ERROR ) {
+				NET_UDP_QueuedPacketFailed( packet, "sendto" );
+				ok = false;
+			}
+		}
+#endif
+
+		first = last;
+	}
+
+	send_queue_length = 0;
+
+	return ok;
+}
+
+/*
+* NET_UDP_QueuePacket
+*/
+static void NET_UDP_QueuePacket( socket_handle_t handle, const void *data, size_t length, const struct sockaddr_storage *addr, socklen_t addrlen ) {
+	if( send_queue_length == ARRAY_COUNT( send_queue ) ) {
+		if( !NET_UDP_FlushQueuedPackets() ) {
+			Com_Printf( "NET_UDP_QueuePacket: Error: %s\n", NET_ErrorString() );
+		}
+	}
+
+	queued_packet_t *packet = &send_queue[ send_queue_length ];
+	send_queue_length++;
+
+	packet->handle = handle;
+	packet->addr = *addr;
+	packet->addrlen = addrlen;
+	packet->length = length;
+	memcpy( packet->data, data, length );
+}
+
 /*
 * NET_UDP_SendPacket
 */
@@ -327,6 +564,11 @@ static bool NET_UDP_SendPacket( const socket_t *socket, const void *data, size_t
 	}
 
 	addrlen = ( addr.ss_family == AF_INET6 ? sizeof( struct sockaddr_in6 ) : sizeof( struct sockaddr_in ) );
+	if( send_queue_active && length <= MAX_PACKETLEN ) {
+		NET_UDP_QueuePacket( socket->handle, data, length, &addr, addrlen );
+		return true;
+	}
+
 	if( sendto( socket->handle, ( const char * ) data, length, 0, (struct sockaddr *)&addr, addrlen ) == SOCKET_ERROR ) {
 		NET_SetErrorStringFromLastError( "sendto" );
 		return false;
@@ -391,6 +633,8 @@ static void NET_UDP_CloseSocket( socket_t *socket ) {
 	Sys_NET_SocketClose( socket->handle );
 	socket->handle = 0;
 	socket->open = false;
+
+	udp_sockets_closed++;
 }
 
 //=============================================================================
@@ -414,6 +658,11 @@ static int NET_TCP_Get( const socket_t *socket, netadr_t *address, void *data, s
 		return -1;
 	}
 
+	if( ret == 0 ) {
+		NET_SetErrorString( "Connection closed" );
+		return -1;
+	}
+
 	if( address ) {
 		*address = socket->remoteAddress;
 	}
@@ -616,27 +865,33 @@ static int NET_Loopback_GetPacket( const socket_t *socket, netadr_t *address, ms
 
 	loop = &loopbacks[socket->handle];
 
-	if( loop->send - loop->get > ( MAX_LOOPBACK - 1 ) ) { // wsw : jal (from q2pro)
-		loop->get = loop->send - MAX_LOOPBACK + 1; // wsw : jal (from q2pro)
+	if( loop->send - loop->get > ( loop->num_msgs - 1 ) ) { // wsw : jal (from q2pro)
+		loop->get = loop->send - loop->num_msgs + 1; // wsw : jal (from q2pro)
 
 	}
 	if( loop->get >= loop->send ) {
 		return 0;
 	}
 
-	i = loop->get & ( MAX_LOOPBACK - 1 );
+	i = loop->get & ( loop->num_msgs - 1 );
 	loop->get++;
 
 	memcpy( net_message->data, loop->msgs[i].data, loop->msgs[i].datalen );
 	net_message->cursize = loop->msgs[i].datalen;
 	memset( address, 0, sizeof( *address ) );
 	address->type = NA_LOOPBACK;
+	// clients only hear from and send to the server socket, so only servers
+	// need to tell senders apart
+	address->address.loopback = socket->server ? loop->msgs[i].from : 0;
 
 	return 1;
 }
 
 /*
 * NET_SendLoopbackPacket
+*
+* Clients always send to the server socket. Servers send to whichever
+* socket the address says the packet came from
 */
 static bool NET_Loopback_SendPacket( const socket_t *socket, const void *data, size_t length,
 									 const netadr_t *address ) {
@@ -653,13 +908,37 @@ static bool NET_Loopback_SendPacket( const socket_t *socket, const void *data, s
 		return false;
 	}
 
-	loop = &loopbacks[socket->handle ^ 1];
+	if( length > MAX_PACKETLEN ) {
+		NET_SetErrorString( "Packet too large" );
+		return false;
+	}
+
+	int to = -1;
+	if( socket->server ) {
+		to = address->address.loopback;
+	}
+	else {
+		for( int j = 0; j < MAX_LOOPBACK_SOCKETS; j++ ) {
+			if( loopbacks[j].open && loopbacks[j].server ) {
+				to = j;
+				break;
+			}
+		}
+	}
+
+	// like UDP, sending to nobody isn't an error
+	if( to < 0 || to >= MAX_LOOPBACK_SOCKETS || !loopbacks[to].open || to == socket->handle ) {
+		return true;
+	}
+
+	loop = &loopbacks[to];
 
-	i = loop->send & ( MAX_LOOPBACK - 1 );
+	i = loop->send & ( loop->num_msgs - 1 );
 	loop->send++;
 
 	memcpy( loop->msgs[i].data, data, length );
 	loop->msgs[i].datalen = length;
+	loop->msgs[i].from = socket->handle;
 
 	return true;
 }
@@ -677,18 +956,30 @@ static bool NET_Loopback_OpenSocket( socket_t *socket, const netadr_t *address,
 		return false;
 	}
 
-	for( i = 0; i < 2; i++ ) {
+	if( server ) {
+		for( i = 0; i < MAX_LOOPBACK_SOCKETS; i++ ) {
+			if( loopbacks[i].open && loopbacks[i].server ) {
+				NET_SetErrorString( "Loopback server socket already open" );
+				return false;
+			}
+		}
+	}
+
+	for( i = 0; i < MAX_LOOPBACK_SOCKETS; i++ ) {
 		if( !loopbacks[i].open ) {
 			break;
 		}
 	}
-	if( i == 2 ) {
-		NET_SetErrorString( "Both loopback sockets already open" );
+	if( i == MAX_LOOPBACK_SOCKETS ) {
+		NET_SetErrorString( "All loopback sockets already open" );
 		return false;
 	}
 
 	memset( &loopbacks[i], 0, sizeof( loopbacks[i] ) );
 	loopbacks[i].open = true;
+	loopbacks[i].server = server;
+	loopbacks[i].num_msgs = server ? MAX_LOOPBACK_SERVER : MAX_LOOPBACK;
+	loopbacks[i].msgs = ALLOC_MANY( sys_allocator, loopmsg_t, loopbacks[i].num_msgs );
 
 	socket->open = true;
 	socket->handle = i;
@@ -710,8 +1001,10 @@ static void NET_Loopback_CloseSocket( socket_t *socket ) {
 		return;
 	}
 
-	assert( socket->handle >= 0 && socket->handle < 2 );
+	assert( socket->handle >= 0 && socket->handle < MAX_LOOPBACK_SOCKETS );
 
+	FREE( sys_allocator, loopbacks[socket->handle].msgs );
+	loopbacks[socket->handle].msgs = NULL;
 	loopbacks[socket->handle].open = false;
 	socket->open = false;
 	socket->handle = 0;
@@ -776,6 +1069,40 @@ int NET_GetPacket( const socket_t *socket, netadr_t *address, msg_t *message ) {
 	}
 }
 
+/*
+* NET_GetPackets
+*
+* Drains up to NET_PACKET_BATCH_SIZE datagrams from a UDP socket in one go.
+*
+* >0	number of datagrams read, see batch->num_packets for how many were kept
+* 0	not ready
+* -1	error
+*/
+int NET_GetPackets( const socket_t *socket, net_packet_batch_t *batch ) {
+	assert( socket->open );
+
+	batch->num_packets = 0;
+
+	if( !socket->open ) {
+		return -1;
+	}
+
+	switch( socket->type ) {
+		case SOCKET_UDP:
+			return NET_UDP_GetPackets( socket, batch );
+
+		case SOCKET_LOOPBACK:
+		case SOCKET_TCP:
+			NET_SetErrorString( "Operation not supported by the socket type" );
+			return -1;
+
+		default:
+			assert( false );
+			NET_SetErrorString( "Unknown socket type" );
+			return -1;
+	}
+}
+
 /*
 * NET_Get
 *
@@ -837,6 +1164,30 @@ bool NET_SendPacket( const socket_t *socket, const void *data, size_t length, co
 	}
 }
 
+/*
+* NET_BeginQueueingPackets
+*
+* UDP packets sent after this are copied into a queue instead of going out
+* straight away, and NET_FlushQueuedPackets sends them all at once. Sending
+* them can happen after NET_SendPacket returned true, so on_error gets
+* called with the destination of every queued packet that fails, with
+* NET_ErrorString saying why.
+*/
+void NET_BeginQueueingPackets( net_send_error_t on_error ) {
+	send_queue_active = true;
+	send_queue_on_error = on_error;
+}
+
+/*
+* NET_FlushQueuedPackets
+*/
+bool NET_FlushQueuedPackets() {
+	send_queue_active = false;
+	bool ok = NET_UDP_FlushQueuedPackets();
+	send_queue_on_error = NULL;
+	return ok;
+}
+
 /*
 * NET_Send
 */
@@ -991,7 +1342,7 @@ bool NET_CompareAddress( const netadr_t *a, const netadr_t *b ) {
 
 	switch( a->type ) {
 		case NA_LOOPBACK:
-			return true;
+			return a->address.loopback == b->address.loopback;
 
 		case NA_IP:
 		{
@@ -1409,124 +1760,222 @@ void NET_CloseSocket( socket_t *socket ) {
 }
 
 /*
-* NET_Sleep
+* NET_NewPoller
+*
+* Sockets stay registered with a poller until they're removed, and readiness
+* is edge-triggered: a socket is only reported again once it has been read or
+* written until it would block.
 */
-void NET_Sleep( int msec, socket_t *sockets[] ) {
-	struct timeval timeout;
-	fd_set fdset;
-	int i;
+net_poller_t *NET_NewPoller() {
+	net_poller_t *poller = ALLOC( sys_allocator, net_poller_t );
 
-	if( !sockets || !sockets[0] ) {
+#if PLATFORM_LINUX
+	poller->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+	if( poller->epoll_fd == -1 ) {
+		NET_SetErrorStringFromLastError( "epoll_create1" );
+		FREE( sys_allocator, poller );
+		return NULL;
+	}
+#else
+	poller->num_sockets = 0;
+#endif
+
+	return poller;
+}
+
+/*
+* NET_DeletePoller
+*/
+void NET_DeletePoller( net_poller_t *poller ) {
+	if( poller == NULL ) {
 		return;
 	}
 
-	FD_ZERO( &fdset );
+#if PLATFORM_LINUX
+	close( poller->epoll_fd );
+#endif
 
-	for( i = 0; sockets[i]; i++ ) {
-		assert( sockets[i]->open );
+	FREE( sys_allocator, poller );
+}
 
-		switch( sockets[i]->type ) {
-			case SOCKET_UDP:
-			case SOCKET_TCP:
-				assert( sockets[i]->handle > 0 );
-				FD_SET( (unsigned)sockets[i]->handle, &fdset ); // network socket
-				break;
+/*
+* NET_PollerAdd
+*
+* Registers a UDP or TCP socket for reads, and for writes when write is set.
+* user is handed back in the events for this socket.
+*/
+bool NET_PollerAdd( net_poller_t *poller, const socket_t *socket, bool write, void *user ) {
+	assert( socket->open );
 
-			default:
-				Com_Printf( "Warning: Invalid socket type on Sys_NET_Sleep\n" );
-				return;
-		}
+	if( socket->type != SOCKET_UDP && socket->type != SOCKET_TCP ) {
+		NET_SetErrorString( "Operation not supported by the socket type" );
+		return false;
 	}
 
-	timeout.tv_sec = msec / 1000;
-	timeout.tv_usec = ( msec % 1000 ) * 1000;
-	select( FD_SETSIZE, &fdset, NULL, NULL, &timeout );
+#if PLATFORM_LINUX
+	struct epoll_event ev = { };
+	ev.events = EPOLLIN | EPOLLET;
+	if( write ) {
+		ev.events |= EPOLLOUT;
+	}
+	ev.data.ptr = user;
+	if( epoll_ctl( poller->epoll_fd, EPOLL_CTL_ADD, socket->handle, &ev ) == -1 ) {
+		NET_SetErrorStringFromLastError( "epoll_ctl" );
+		return false;
+	}
+#else
+	if( poller->num_sockets == ARRAY_COUNT( poller->sockets ) ) {
+		NET_SetErrorString( "Too many sockets" );
+		return false;
+	}
+
+	poller->sockets[poller->num_sockets].handle = socket->handle;
+	poller->sockets[poller->num_sockets].write = write;
+	poller->sockets[poller->num_sockets].user = user;
+	poller->num_sockets++;
+#endif
+
+	return true;
 }
 
 /*
-* NET_Monitor
-* Monitors the given sockets with the given timeout in milliseconds
-* It ignores closed and loopback sockets.
-* Calls the callback function read_cb(socket_t *) with the socket as parameter when incoming data was detected on it
-* Calls the callback function write_cb(socket_t *) with the socket as parameter when the socket is ready to accept outgoing data
-* Calls the callback function exception_cb(socket_t *) with the socket as parameter when a socket exception was detected on that socket
-* For both callbacks, NULL can be passed. When NULL is passed for the exception_cb, no exception detection is performed
-* Incoming data is always detected, even if the 'read_cb' callback was NULL.
+* NET_PollerRemove
 */
-int NET_Monitor( int msec, socket_t *sockets[], void ( *read_cb )( socket_t *, void* ), void ( *write_cb )( socket_t *, void* ), void ( *exception_cb )( socket_t *, void* ), void *privatep[] ) {
-	struct timeval timeout;
-	fd_set fdsetr, fdsetw, fdsete;
-	fd_set *p_fdsetw = NULL, *p_fdsete = NULL;
-	int i, ret;
-	int fdmax = 0;
+void NET_PollerRemove( net_poller_t *poller, const socket_t *socket ) {
+#if PLATFORM_LINUX
+	struct epoll_event ev = { };
+	epoll_ctl( poller->epoll_fd, EPOLL_CTL_DEL, socket->handle, &ev );
+#else
+	for( int i = 0; i < poller->num_sockets; i++ ) {
+		if( poller->sockets[i].handle == socket->handle ) {
+			poller->num_sockets--;
+			poller->sockets[i] = poller->sockets[poller->num_sockets];
+			break;
+		}
+	}
+#endif
+}
 
-	if( !sockets || !sockets[0] ) {
-		return 0;
+/*
+* NET_PollerWait
+*
+* Waits up to msec milliseconds for any registered socket to become ready and
+* returns the number of events written, or -1 on error.
+*/
+int NET_PollerWait( net_poller_t *poller, int msec, net_poll_event_t *events, int max_events ) {
+#if PLATFORM_LINUX
+	struct epoll_event evs[NET_POLLER_MAX_EVENTS];
+
+	int ret = epoll_wait( poller->epoll_fd, evs, Min2( max_events, NET_POLLER_MAX_EVENTS ), msec );
+	if( ret == -1 ) {
+		if( errno == EINTR ) {
+			return 0;
+		}
+		NET_SetErrorStringFromLastError( "epoll_wait" );
+		return -1;
+	}
+
+	for( int i = 0; i < ret; i++ ) {
+		// let errors and hangups surface through the next read or write
+		bool error = ( evs[i].events & ( EPOLLERR | EPOLLHUP ) ) != 0;
+		events[i].user = evs[i].data.ptr;
+		events[i].readable = error || ( evs[i].events & EPOLLIN ) != 0;
+		events[i].writable = error || ( evs[i].events & EPOLLOUT ) != 0;
 	}
 
+	return ret;
+#else
+	struct timeval timeout;
+	fd_set fdsetr, fdsetw;
+	int fdmax = 0;
+
 	FD_ZERO( &fdsetr );
-	if( write_cb ) {
-		FD_ZERO( &fdsetw );
-		p_fdsetw = &fdsetw;
+	FD_ZERO( &fdsetw );
+
+	for( int i = 0; i < poller->num_sockets; i++ ) {
+		fdmax = Max2( (int)poller->sockets[i].handle, fdmax );
+		FD_SET( poller->sockets[i].handle, &fdsetr );
+		if( poller->sockets[i].write ) {
+			FD_SET( poller->sockets[i].handle, &fdsetw );
+		}
 	}
-	if( exception_cb ) {
-		FD_ZERO( &fdsete );
-		p_fdsete = &fdsete;
+
+	timeout.tv_sec = msec / 1000;
+	timeout.tv_usec = ( msec % 1000 ) * 1000;
+	int ret = select( fdmax + 1, &fdsetr, &fdsetw, NULL, &timeout );
+	if( ret == SOCKET_ERROR ) {
+		NET_SetErrorStringFromLastError( "select" );
+		return -1;
 	}
 
-	for( i = 0; sockets[i]; i++ ) {
-		if( !sockets[i]->open ) {
-			continue;
+	int num_events = 0;
+	for( int i = 0; i < poller->num_sockets && num_events < max_events; i++ ) {
+		bool readable = FD_ISSET( poller->sockets[i].handle, &fdsetr ) != 0;
+		bool writable = FD_ISSET( poller->sockets[i].handle, &fdsetw ) != 0;
+		if( readable || writable ) {
+			events[num_events].user = poller->sockets[i].user;
+			events[num_events].readable = readable;
+			events[num_events].writable = writable;
+			num_events++;
 		}
-		switch( sockets[i]->type ) {
-			case SOCKET_UDP:
-			case SOCKET_TCP:
-				assert( sockets[i]->handle > 0 );
-				fdmax = Max2( (int)sockets[i]->handle, fdmax );
-				FD_SET( sockets[i]->handle, &fdsetr ); // network socket
-				if( p_fdsetw ) {
-					FD_SET( sockets[i]->handle, p_fdsetw );
-				}
-				if( p_fdsete ) {
-					FD_SET( sockets[i]->handle, p_fdsete );
-				}
-				break;
-			case SOCKET_LOOPBACK:
-			default:
-				continue;
+	}
+
+	return num_events;
+#endif
+}
+
+/*
+* NET_Sleep
+*
+* The game sockets rarely change, so they stay registered with a poller
+* between calls and only get registered again when the set changes.
+*/
+void NET_Sleep( int msec, socket_t *sockets[] ) {
+	static socket_handle_t registered[NET_SLEEP_MAX_SOCKETS];
+	static int num_registered;
+	static unsigned registered_closed;
+
+	if( !sockets || !sockets[0] ) {
+		return;
+	}
+
+	int num_sockets = 0;
+	bool changed = false;
+	for( ; sockets[num_sockets]; num_sockets++ ) {
+		assert( sockets[num_sockets]->open );
+		if( num_sockets == NET_SLEEP_MAX_SOCKETS ) {
+			Com_Printf( "Warning: Too many sockets on NET_Sleep\n" );
+			return;
 		}
+		changed = changed || num_sockets >= num_registered || registered[num_sockets] != sockets[num_sockets]->handle;
 	}
+	changed = changed || num_sockets != num_registered || registered_closed != udp_sockets_closed;
 
-	timeout.tv_sec = msec / 1000;
-	timeout.tv_usec = ( msec % 1000 ) * 1000;
-	ret = select( fdmax + 1, &fdsetr, p_fdsetw, p_fdsete, &timeout );
-	if( ( ret > 0 ) && ( read_cb || write_cb || exception_cb ) ) {
-		// Launch callbacks
-		for( i = 0; sockets[i]; i++ ) {
-			if( !sockets[i]->open ) {
-				continue;
-			}
+	if( changed || sleep_poller == NULL ) {
+		NET_DeletePoller( sleep_poller );
+		num_registered = 0;
+
+		sleep_poller = NET_NewPoller();
+		if( sleep_poller == NULL ) {
+			Com_Printf( "NET_NewPoller: Error: %s\n", NET_ErrorString() );
+			return;
+		}
 
-			switch( sockets[i]->type ) {
-				case SOCKET_UDP:
-				case SOCKET_TCP:
-					if( ( exception_cb ) && ( FD_ISSET( sockets[i]->handle, p_fdsete ) ) ) {
-						exception_cb( sockets[i], privatep ? privatep[i] : NULL );
-					}
-					if( ( read_cb ) && ( FD_ISSET( sockets[i]->handle, &fdsetr ) ) ) {
-						read_cb( sockets[i], privatep ? privatep[i] : NULL );
-					}
-					if( ( write_cb ) && ( FD_ISSET( sockets[i]->handle, p_fdsetw ) ) ) {
-						write_cb( sockets[i], privatep ? privatep[i] : NULL );
-					}
-					break;
-				case SOCKET_LOOPBACK:
-				default:
-					continue;
+		for( int i = 0; i < num_sockets; i++ ) {
+			if( !NET_PollerAdd( sleep_poller, sockets[i], false, NULL ) ) {
+				Com_Printf( "Warning: Invalid socket on NET_Sleep: %s\n", NET_ErrorString() );
+				NET_DeletePoller( sleep_poller );
+				sleep_poller = NULL;
+				return;
 			}
+			registered[i] = sockets[i]->handle;
 		}
+		num_registered = num_sockets;
+		registered_closed = udp_sockets_closed;
 	}
-	return ret;
+
+	net_poll_event_t events[NET_SLEEP_MAX_SOCKETS];
+	NET_PollerWait( sleep_poller, msec, events, ARRAY_COUNT( events ) );
 }
 
 /*
@@ -1585,6 +2034,9 @@ void NET_Shutdown() {
 
 	errorstring[0] = '\0';
 
+	NET_DeletePoller( sleep_poller );
+	sleep_poller = NULL;
+
 	Sys_NET_Shutdown();
 
 	net_initialized = false;
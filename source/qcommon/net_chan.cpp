@@ -19,7 +19,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "qcommon/qcommon.h"
+#include "qcommon/array.h"
 #include "qcommon/csprng.h"
+#include "qcommon/fs.h"
+#include "qcommon/string.h"
 
 #if defined ( __MACOSX__ )
 #include <arpa/inet.h>
@@ -206,23 +209,224 @@ static int Netchan_ZLibDecompressChunk( const uint8_t *source, unsigned long sou
 	return result;
 }
 
+//=============================================================
+// Zstd compression
+//=============================================================
+
+#define ZSTD_STATIC_LINKING_ONLY
+#include "zstd/zstd.h"
+#define ZDICT_STATIC_LINKING_ONLY
+#include "zstd/zdict.h"
+
+#define NETCHAN_ZSTD_LEVEL 3
+#define NETCHAN_DICTIONARY_PATH "base/netchan.dict"
+#define NETCHAN_DICTIONARY_SIZE ( 32 * 1024 )
+
+static Span< u8 > zstd_dictionary;
+static u32 zstd_dictionary_id;
+static ZSTD_CDict * zstd_cdict;
+static ZSTD_DDict * zstd_ddict;
+
+// for channels that don't have their own context. main thread only
+static ZSTD_CCtx * zstd_shared_cctx;
+static ZSTD_DCtx * zstd_dctx;
+
+ZSTD_CCtx * Netchan_NewCompressionContext() {
+	ZSTD_CCtx * ctx = ZSTD_createCCtx();
+
+	ZSTD_CCtx_setParameter( ctx, ZSTD_c_compressionLevel, NETCHAN_ZSTD_LEVEL );
+
+	// packets are small so frame headers are a big chunk of them
+	ZSTD_CCtx_setParameter( ctx, ZSTD_c_format, ZSTD_f_zstd1_magicless );
+	ZSTD_CCtx_setParameter( ctx, ZSTD_c_contentSizeFlag, 0 );
+	ZSTD_CCtx_setParameter( ctx, ZSTD_c_dictIDFlag, 0 );
+
+	if( zstd_cdict != NULL ) {
+		ZSTD_CCtx_refCDict( ctx, zstd_cdict );
+	}
+
+	return ctx;
+}
+
+void Netchan_DeleteCompressionContext( ZSTD_CCtx * ctx ) {
+	ZSTD_freeCCtx( ctx );
+}
+
+static int Netchan_ZstdCompressChunk( ZSTD_CCtx * ctx, const uint8_t *source, size_t sourceLen, uint8_t *dest, size_t destLen ) {
+	size_t r = ZSTD_compress2( ctx, dest, destLen, source, sourceLen );
+	if( ZSTD_isError( r ) ) {
+		Com_DPrintf( "Zstd data error! %s on compress.\n", ZSTD_getErrorName( r ) );
+		return -1;
+	}
+
+	return int( r );
+}
+
+static int Netchan_ZstdDecompressChunk( const uint8_t *source, size_t sourceLen, uint8_t *dest, size_t destLen ) {
+	size_t r = ZSTD_decompressDCtx( zstd_dctx, dest, destLen, source, sourceLen );
+	if( ZSTD_isError( r ) ) {
+		Com_DPrintf( "Zstd data error! %s on decompress.\n", ZSTD_getErrorName( r ) );
+		return -1;
+	}
+
+	return int( r );
+}
+
+/*
+* Netchan_CompressionOffer
+*
+* Sent by the client when connecting. Both sides need the same dictionary to use zstd
+*/
+const char *Netchan_CompressionOffer() {
+	static char offer[ 32 ];
+	snprintf( offer, sizeof( offer ), "zstd:%u", zstd_dictionary_id );
+	return offer;
+}
+
+/*
+* Netchan_NegotiateCompression
+*
+* Picks the compression for a client that sent the given offer, which
+* can be empty
+*/
+NetchanCompression Netchan_NegotiateCompression( const char *offer ) {
+	if( strcmp( offer, Netchan_CompressionOffer() ) == 0 ) {
+		return NetchanCompression_Zstd;
+	}
+
+	return NetchanCompression_Zlib;
+}
+
+/*
+* Netchan_TrainDictionary_f
+*
+* Trains a new netchan dictionary from the messages in the given demos
+*/
+static void Netchan_TrainDictionary_f() {
+	if( Cmd_Argc() < 2 ) {
+		Com_Printf( "Usage: %s <demo> [demo ...]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	DynamicArray< u8 > samples( sys_allocator );
+	DynamicArray< size_t > sample_sizes( sys_allocator );
+
+	msg_t msg;
+	static uint8_t msg_buffer[MAX_MSGLEN];
+	MSG_Init( &msg, msg_buffer, sizeof( msg_buffer ) );
+
+	for( int i = 1; i < Cmd_Argc(); i++ ) {
+		// client demos live in the game directory, server demos in the base directory
+		const char * name = Cmd_Argv( i );
+		int demofile;
+		if( FS_FOpenFile( name, &demofile, FS_READ | SNAP_DEMO_COMPRESSION ) == -1 &&
+			FS_FOpenBaseFile( name, &demofile, FS_READ | SNAP_DEMO_COMPRESSION ) == -1 &&
+			FS_FOpenAbsoluteFile( name, &demofile, FS_READ | SNAP_DEMO_COMPRESSION ) == -1 ) {
+			Com_Printf( "Couldn't open %s\n", name );
+			continue;
+		}
+
+		while( SNAP_ReadDemoMessage( demofile, &msg ) > 0 ) {
+			size_t offset = samples.extend( msg.cursize );
+			memcpy( &samples[ offset ], msg.data, msg.cursize );
+			sample_sizes.add( msg.cursize );
+		}
+
+		FS_FCloseFile( demofile );
+	}
+
+	if( sample_sizes.size() == 0 ) {
+		Com_Printf( "No messages to train from\n" );
+		return;
+	}
+
+	Span< u8 > dictionary = ALLOC_SPAN( sys_allocator, u8, NETCHAN_DICTIONARY_SIZE );
+	defer { FREE( sys_allocator, dictionary.ptr ); };
+
+	size_t dictionary_size = ZDICT_trainFromBuffer( dictionary.ptr, dictionary.n, samples.ptr(), sample_sizes.ptr(), sample_sizes.size() );
+	if( ZDICT_isError( dictionary_size ) ) {
+		Com_Printf( S_COLOR_RED "Couldn't train dictionary: %s\n", ZDICT_getErrorName( dictionary_size ) );
+		return;
+	}
+
+	DynamicString path( sys_allocator, "{}/{}", RootDirPath(), NETCHAN_DICTIONARY_PATH );
+	FILE * file = OpenFile( sys_allocator, path.c_str(), "wb" );
+	if( file == NULL ) {
+		Com_Printf( S_COLOR_RED "Couldn't open %s\n", path.c_str() );
+		return;
+	}
+
+	size_t written = fwrite( dictionary.ptr, 1, dictionary_size, file );
+	fclose( file );
+
+	if( written != dictionary_size ) {
+		Com_Printf( S_COLOR_RED "Couldn't write %s\n", path.c_str() );
+		return;
+	}
+
+	Com_Printf( "Trained a %zu byte dictionary from %zu messages, restart to use it\n", dictionary_size, sample_sizes.size() );
+}
+
+static void Netchan_InitZstd() {
+	DynamicString path( sys_allocator, "{}/{}", RootDirPath(), NETCHAN_DICTIONARY_PATH );
+	zstd_dictionary = ReadFileBinary( sys_allocator, path.c_str() );
+
+	if( zstd_dictionary.ptr != NULL ) {
+		zstd_dictionary_id = ZSTD_getDictID_fromDict( zstd_dictionary.ptr, zstd_dictionary.n );
+		zstd_cdict = ZSTD_createCDict( zstd_dictionary.ptr, zstd_dictionary.n, NETCHAN_ZSTD_LEVEL );
+		zstd_ddict = ZSTD_createDDict( zstd_dictionary.ptr, zstd_dictionary.n );
+	}
+	else {
+		Com_Printf( "Couldn't load %s, compressing without a dictionary\n", path.c_str() );
+	}
+
+	zstd_shared_cctx = Netchan_NewCompressionContext();
+
+	zstd_dctx = ZSTD_createDCtx();
+	ZSTD_DCtx_setParameter( zstd_dctx, ZSTD_d_format, ZSTD_f_zstd1_magicless );
+	if( zstd_ddict != NULL ) {
+		ZSTD_DCtx_refDDict( zstd_dctx, zstd_ddict );
+	}
+}
+
+static void Netchan_ShutdownZstd() {
+	ZSTD_freeDCtx( zstd_dctx );
+	ZSTD_freeCCtx( zstd_shared_cctx );
+	ZSTD_freeDDict( zstd_ddict );
+	ZSTD_freeCDict( zstd_cdict );
+	FREE( sys_allocator, zstd_dictionary.ptr );
+
+	zstd_dctx = NULL;
+	zstd_shared_cctx = NULL;
+	zstd_ddict = NULL;
+	zstd_cdict = NULL;
+	zstd_dictionary = Span< u8 >();
+	zstd_dictionary_id = 0;
+}
+
 /*
 * Netchan_CompressMessage
+*
+* Compresses through the caller's scratch buffer, so it can be used from
+* several threads at once as long as each has its own buffer and each
+* channel has its own zstd context
 */
-int Netchan_CompressMessage( msg_t *msg ) {
+int Netchan_CompressMessage( const netchan_t *chan, msg_t *msg, uint8_t *scratch, size_t scratch_size ) {
 	int length;
 
 	if( msg == NULL || !msg->data ) {
 		return 0;
 	}
 
-	// zero-fill our buffer
-	length = 0;
-	memset( msg_process_data, 0, sizeof( msg_process_data ) );
-
 	//compress the message
-	length = Netchan_ZLibCompressChunk( msg->data, msg->cursize,
-										msg_process_data, sizeof( msg_process_data ), Z_BEST_COMPRESSION, -MAX_WBITS );
+	if( chan->compression == NetchanCompression_Zstd ) {
+		ZSTD_CCtx * ctx = chan->zstd != NULL ? chan->zstd : zstd_shared_cctx;
+		length = Netchan_ZstdCompressChunk( ctx, msg->data, msg->cursize, scratch, scratch_size );
+	}
+	else {
+		length = Netchan_ZLibCompressChunk( msg->data, msg->cursize,
+											scratch, scratch_size, Z_BEST_COMPRESSION, -MAX_WBITS );
+	}
 	if( length < 0 ) { // failed to compress, return the error
 		return length;
 	}
@@ -233,16 +437,20 @@ int Netchan_CompressMessage( msg_t *msg ) {
 
 	//write it back into the original container
 	MSG_Clear( msg );
-	MSG_CopyData( msg, msg_process_data, length );
+	MSG_CopyData( msg, scratch, length );
 	msg->compressed = true;
 
 	return length; // return the new size
 }
 
+int Netchan_CompressMessage( const netchan_t *chan, msg_t *msg ) {
+	return Netchan_CompressMessage( chan, msg, msg_process_data, sizeof( msg_process_data ) );
+}
+
 /*
 * Netchan_DecompressMessage
 */
-int Netchan_DecompressMessage( msg_t *msg ) {
+int Netchan_DecompressMessage( const netchan_t *chan, msg_t *msg ) {
 	int length;
 
 	if( msg == NULL || !msg->data ) {
@@ -253,7 +461,12 @@ int Netchan_DecompressMessage( msg_t *msg ) {
 		return 0;
 	}
 
-	length = Netchan_ZLibDecompressChunk( msg->data + msg->readcount, msg->cursize - msg->readcount, msg_process_data, ( sizeof( msg_process_data ) - msg->readcount ), -MAX_WBITS );
+	if( chan->compression == NetchanCompression_Zstd ) {
+		length = Netchan_ZstdDecompressChunk( msg->data + msg->readcount, msg->cursize - msg->readcount, msg_process_data, ( sizeof( msg_process_data ) - msg->readcount ) );
+	}
+	else {
+		length = Netchan_ZLibDecompressChunk( msg->data + msg->readcount, msg->cursize - msg->readcount, msg_process_data, ( sizeof( msg_process_data ) - msg->readcount ), -MAX_WBITS );
+	}
 	if( length < 0 ) {
 		return length;
 	}
@@ -313,7 +526,7 @@ bool Netchan_TransmitNextFragment( netchan_t *chan ) {
 
 	// send the game port if we are a client
 	if( !chan->socket->server ) {
-		MSG_WriteUint64( &send, client_session_id );
+		MSG_WriteUint64( &send, chan->session_id );
 	}
 
 	// copy the reliable message to the packet first
@@ -619,10 +832,17 @@ void Netchan_Init() {
 	showpackets = Cvar_Get( "showpackets", "0", 0 );
 	showdrop = Cvar_Get( "showdrop", "0", 0 );
 	net_showfragments = Cvar_Get( "net_showfragments", "0", 0 );
+
+	Netchan_InitZstd();
+
+	Cmd_AddCommand( "net_traindict", Netchan_TrainDictionary_f );
 }
 
 /*
 * Netchan_Shutdown
 */
 void Netchan_Shutdown() {
+	Cmd_RemoveCommand( "net_traindict" );
+
+	Netchan_ShutdownZstd();
 }
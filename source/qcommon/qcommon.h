@@ -119,10 +119,16 @@ void MSG_ReadData( msg_t *sb, void *buffer, size_t length );
 #define SNAP_MAX_DEMO_META_DATA_SIZE    16 * 1024
 
 // define this 0 to disable compression of demo files
-#define SNAP_DEMO_GZ                    FS_GZ
+// older gz demos are still read with FS_ZSTD
+#define SNAP_DEMO_COMPRESSION           FS_ZSTD
 
-void SNAP_RecordDemoMessage( int demofile, msg_t *msg, int offset );
+// demos get a non-delta frame at least this often (in msecs), so playback
+// can seek to them without reading from the start
+#define SNAP_DEMO_KEYFRAME_INTERVAL     10000
+
+bool SNAP_RecordDemoMessage( int demofile, msg_t *msg, int offset );
 int SNAP_ReadDemoMessage( int demofile, msg_t *msg );
+int SNAP_TryReadDemoMessage( int demofile, msg_t *msg, const char **error );
 void SNAP_BeginDemoRecording( int demofile, unsigned int spawncount, unsigned int snapFrameTime,
 	unsigned int sv_bitflags, char *configstrings, SyncEntityState *baselines );
 void SNAP_StopDemoRecording( int demofile );
@@ -131,6 +137,11 @@ size_t SNAP_ClearDemoMeta( char *meta_data, size_t meta_data_max_size );
 size_t SNAP_SetDemoMetaKeyValue( char *meta_data, size_t meta_data_max_size, size_t meta_data_realsize,
 								 const char *key, const char *value );
 size_t SNAP_ReadDemoMetaData( int demofile, char *meta_data, size_t meta_data_size );
+void SNAP_BenchmarkDemo( const char *name, int iterations );
+
+struct snapshot_t;
+void SNAP_ParseBaseline( msg_t *msg, SyncEntityState *baselines );
+snapshot_t *SNAP_ParseFrame( msg_t *msg, snapshot_t *lastFrame, snapshot_t *backup, SyncEntityState *baselines, int showNet );
 
 //============================================================================
 
@@ -341,6 +352,7 @@ struct netadr_t {
 	union {
 		netadr_ipv4_t ipv4;
 		netadr_ipv6_t ipv6;
+		int loopback; // index of the socket a loopback packet came from
 	} address;
 };
 
@@ -380,6 +392,19 @@ enum net_error_t {
 	NET_ERR_UNSUPPORTED,
 };
 
+#define NET_PACKET_BATCH_SIZE 64
+
+struct net_packet_t {
+	netadr_t address;
+	size_t length;
+	uint8_t data[MAX_PACKETLEN + 4]; // room to spot oversized packets
+};
+
+struct net_packet_batch_t {
+	int num_packets;
+	net_packet_t packets[NET_PACKET_BATCH_SIZE];
+};
+
 void        NET_Init();
 void        NET_Shutdown();
 
@@ -392,15 +417,32 @@ int         NET_Accept( const socket_t *socket, socket_t *newsocket, netadr_t *a
 int         NET_GetPacket( const socket_t *socket, netadr_t *address, msg_t *message );
 bool        NET_SendPacket( const socket_t *socket, const void *data, size_t length, const netadr_t *address );
 
+int         NET_GetPackets( const socket_t *socket, net_packet_batch_t *batch );
+typedef void ( *net_send_error_t )( const netadr_t *address );
+
+void        NET_BeginQueueingPackets( net_send_error_t on_error );
+bool        NET_FlushQueuedPackets();
+
 int         NET_Get( const socket_t *socket, netadr_t *address, void *data, size_t length );
 int         NET_Send( const socket_t *socket, const void *data, size_t length, const netadr_t *address );
 int64_t     NET_SendFile( const socket_t *socket, int file, size_t offset, size_t count, const netadr_t *address );
 
 void        NET_Sleep( int msec, socket_t *sockets[] );
-int         NET_Monitor( int msec, socket_t *sockets[],
-						 void ( *read_cb )( socket_t *socket, void* ),
-						 void ( *write_cb )( socket_t *socket, void* ),
-						 void ( *exception_cb )( socket_t *socket, void* ), void *privatep[] );
+
+struct net_poller_t;
+
+struct net_poll_event_t {
+	void *user;
+	bool readable;
+	bool writable;
+};
+
+net_poller_t *NET_NewPoller();
+void        NET_DeletePoller( net_poller_t *poller );
+bool        NET_PollerAdd( net_poller_t *poller, const socket_t *socket, bool write, void *user );
+void        NET_PollerRemove( net_poller_t *poller, const socket_t *socket );
+int         NET_PollerWait( net_poller_t *poller, int msec, net_poll_event_t *events, int max_events );
+
 const char *NET_ErrorString();
 
 #ifndef _MSC_VER
@@ -428,6 +470,13 @@ void    NET_BroadcastAddress( netadr_t *address, int port );
 
 //============================================================================
 
+enum NetchanCompression {
+	NetchanCompression_Zlib,
+	NetchanCompression_Zstd,
+};
+
+struct ZSTD_CCtx_s;
+
 struct netchan_t {
 	const socket_t *socket;
 
@@ -453,6 +502,10 @@ struct netchan_t {
 	size_t unsentLength;
 	uint8_t unsentBuffer[MAX_MSGLEN];
 	bool unsentIsCompressed;
+
+	// negotiated at connect
+	NetchanCompression compression;
+	ZSTD_CCtx_s *zstd;          // not owned by the channel, NULL to use a shared context
 };
 
 extern netadr_t net_from;
@@ -465,8 +518,13 @@ bool Netchan_Process( netchan_t *chan, msg_t *msg );
 bool Netchan_Transmit( netchan_t *chan, msg_t *msg );
 bool Netchan_PushAllFragments( netchan_t *chan );
 bool Netchan_TransmitNextFragment( netchan_t *chan );
-int Netchan_CompressMessage( msg_t *msg );
-int Netchan_DecompressMessage( msg_t *msg );
+int Netchan_CompressMessage( const netchan_t *chan, msg_t *msg );
+int Netchan_CompressMessage( const netchan_t *chan, msg_t *msg, uint8_t *scratch, size_t scratch_size );
+int Netchan_DecompressMessage( const netchan_t *chan, msg_t *msg );
+ZSTD_CCtx_s *Netchan_NewCompressionContext();
+void Netchan_DeleteCompressionContext( ZSTD_CCtx_s *ctx );
+const char *Netchan_CompressionOffer();
+NetchanCompression Netchan_NegotiateCompression( const char *offer );
 void Netchan_OutOfBand( const socket_t *socket, const netadr_t *address, size_t length, const uint8_t *data );
 
 #ifndef _MSC_VER
@@ -502,7 +560,7 @@ const char *FS_AbsoluteNameForBaseFile( const char *filename );
 int     FS_FOpenFile( const char *filename, int *filenum, int mode );
 int     FS_FOpenBaseFile( const char *filename, int *filenum, int mode );
 int     FS_FOpenAbsoluteFile( const char *filename, int *filenum, int mode );
-void    FS_FCloseFile( int file );
+int     FS_FCloseFile( int file );
 
 int     FS_Read( void *buffer, size_t len, int file );
 
@@ -691,6 +749,7 @@ void Sys_ShowErrorMessage( const char * msg );
 
 int64_t Sys_Milliseconds();
 uint64_t Sys_Microseconds();
+uint64_t Sys_Nanoseconds(); // for timing short things, not relative to anything
 void Sys_Sleep( unsigned int millis );
 bool Sys_FormatTime( char * buf, size_t buf_size, const char * fmt );
 
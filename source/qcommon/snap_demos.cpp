@@ -33,31 +33,37 @@ static char dummy_meta_data[SNAP_MAX_DEMO_META_DATA_SIZE];
 /*
 * SNAP_RecordDemoMessage
 *
-* Writes given message to demofile
+* Writes given message to demofile, returns false if writing failed
 */
-void SNAP_RecordDemoMessage( int demofile, msg_t *msg, int offset ) {
+bool SNAP_RecordDemoMessage( int demofile, msg_t *msg, int offset ) {
 	int len;
 
 	if( !demofile ) {
-		return;
+		return true;
 	}
 
 	// now write the entire message to the file, prefixed by length
 	len = LittleLong( msg->cursize ) - offset;
 	if( len <= 0 ) {
-		return;
+		return true;
 	}
 
-	FS_Write( &len, 4, demofile );
-	FS_Write( msg->data + offset, len, demofile );
+	if( FS_Write( &len, 4, demofile ) != 4 ) {
+		return false;
+	}
+	return FS_Write( msg->data + offset, len, demofile ) == len;
 }
 
 /*
-* SNAP_ReadDemoMessage
+* SNAP_TryReadDemoMessage
+*
+* Returns -1 at the end of the demo, or with error set if the demo is broken
 */
-int SNAP_ReadDemoMessage( int demofile, msg_t *msg ) {
+int SNAP_TryReadDemoMessage( int demofile, msg_t *msg, const char **error ) {
 	int read = 0, msglen = -1;
 
+	*error = NULL;
+
 	read += FS_Read( &msglen, 4, demofile );
 
 	msglen = LittleLong( msglen );
@@ -66,15 +72,18 @@ int SNAP_ReadDemoMessage( int demofile, msg_t *msg ) {
 	}
 
 	if( msglen > MAX_MSGLEN ) {
-		Com_Error( ERR_DROP, "Error reading demo file: msglen > MAX_MSGLEN" );
+		*error = "msglen > MAX_MSGLEN";
+		return -1;
 	}
 	if( (size_t )msglen > msg->maxsize ) {
-		Com_Error( ERR_DROP, "Error reading demo file: msglen > msg->maxsize" );
+		*error = "msglen > msg->maxsize";
+		return -1;
 	}
 
 	read = FS_Read( msg->data, msglen, demofile );
 	if( read != msglen ) {
-		Com_Error( ERR_DROP, "Error reading demo file: End of file" );
+		*error = "End of file";
+		return -1;
 	}
 
 	msg->cursize = msglen;
@@ -83,6 +92,19 @@ int SNAP_ReadDemoMessage( int demofile, msg_t *msg ) {
 	return read;
 }
 
+/*
+* SNAP_ReadDemoMessage
+*/
+int SNAP_ReadDemoMessage( int demofile, msg_t *msg ) {
+	const char *error;
+	int read = SNAP_TryReadDemoMessage( demofile, msg, &error );
+	if( error != NULL ) {
+		Com_Error( ERR_DROP, "Error reading demo file: %s", error );
+	}
+
+	return read;
+}
+
 /*
 * SNAP_DemoMetaDataMessage
 */
@@ -312,7 +334,7 @@ void SNAP_WriteDemoMetaData( const char *filename, const char *meta_data, size_t
 	}
 	snprintf( tmpn, sizeof( tmpn ), "%u.tmp", v );
 
-	if( FS_FOpenFile( tmpn, &filenum, FS_WRITE | SNAP_DEMO_GZ ) == -1 ) {
+	if( FS_FOpenFile( tmpn, &filenum, FS_WRITE | SNAP_DEMO_COMPRESSION ) == -1 ) {
 		return;
 	}
 
@@ -322,8 +344,8 @@ void SNAP_WriteDemoMetaData( const char *filename, const char *meta_data, size_t
 	// now open the original file in update mode and overwrite metadata
 
 	// important note: we need to the load the temp file before closing it
-	// because in the case of gz compression, closing the file may actually
-	// write some data we don't want to copy
+	// because closing a compressed file writes out trailing data we don't
+	// want to copy
 	filelen = FS_LoadFile( tmpn, &compressed_msg, NULL, 0 );
 
 	if( compressed_msg ) {
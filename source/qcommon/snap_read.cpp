@@ -18,7 +18,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <algorithm>
+
 #include "qcommon/qcommon.h"
+#include "qcommon/array.h"
 #include "cgame/cg_public.h"
 
 /*
@@ -57,6 +60,32 @@ FRAME PARSING
 =========================================================================
 */
 
+// set by SNAP_BenchmarkDemo to time entity decoding separately, and so a
+// bad demo fails the benchmark instead of taking the server down with it
+static bool snap_benchmarking;
+static u64 snap_packetentities_nsec;
+static bool snap_parse_failed;
+static char snap_parse_error[MAX_PRINTMSG];
+
+/*
+* SNAP_ParseError
+*
+* Com_Error, except while benchmarking where it returns and the caller has
+* to stop parsing
+*/
+static void SNAP_ParseError( const char *format, ... ) {
+	va_list argptr;
+	va_start( argptr, format );
+	vsnprintf( snap_parse_error, sizeof( snap_parse_error ), format, argptr );
+	va_end( argptr );
+
+	if( !snap_benchmarking ) {
+		Com_Error( ERR_DROP, "%s", snap_parse_error );
+	}
+
+	snap_parse_failed = true;
+}
+
 /*
 * SNAP_ParseDeltaGameState
 */
@@ -91,6 +120,11 @@ void SNAP_ParseBaseline( msg_t *msg, SyncEntityState *baselines ) {
 	int newnum = MSG_ReadEntityNumber( msg, &remove );
 	assert( !remove );
 
+	if( newnum < 0 || newnum >= MAX_EDICTS ) {
+		SNAP_ParseError( "SNAP_ParseBaseline: bad number:%i", newnum );
+		return;
+	}
+
 	if( !remove ) {
 		SyncEntityState nullstate = { };
 		MSG_ReadDeltaEntity( msg, &nullstate, &baselines[newnum] );
@@ -126,10 +160,12 @@ static void SNAP_ParsePacketEntities( msg_t *msg, snapshot_t *oldframe, snapshot
 	while( true ) {
 		newnum = MSG_ReadEntityNumber( msg, &remove );
 		if( newnum >= MAX_EDICTS ) {
-			Com_Error( ERR_DROP, "CL_ParsePacketEntities: bad number:%i", newnum );
+			SNAP_ParseError( "CL_ParsePacketEntities: bad number:%i", newnum );
+			return;
 		}
 		if( msg->readcount > msg->cursize ) {
-			Com_Error( ERR_DROP, "CL_ParsePacketEntities: end of message" );
+			SNAP_ParseError( "CL_ParsePacketEntities: end of message" );
+			return;
 		}
 
 		if( !newnum ) {
@@ -315,7 +351,9 @@ snapshot_t *SNAP_ParseFrame( msg_t *msg, snapshot_t *lastFrame, snapshot_t *back
 	// read game commands
 	int cmd = MSG_ReadUint8( msg );
 	if( cmd != svc_gamecommands ) {
-		Com_Error( ERR_DROP, "SNAP_ParseFrame: not gamecommands" );
+		SNAP_ParseError( "SNAP_ParseFrame: not gamecommands" );
+		newframe->valid = false;
+		return newframe;
 	}
 
 	size_t numtargets = 0;
@@ -327,10 +365,14 @@ snapshot_t *SNAP_ParseFrame( msg_t *msg, snapshot_t *lastFrame, snapshot_t *back
 			( !lastFrame || !lastFrame->valid || newframe->serverFrame > lastFrame->serverFrame + framediff ) ) {
 			newframe->numgamecommands++;
 			if( newframe->numgamecommands > MAX_PARSE_GAMECOMMANDS ) {
-				Com_Error( ERR_DROP, "SNAP_ParseFrame: too many gamecommands" );
+				SNAP_ParseError( "SNAP_ParseFrame: too many gamecommands" );
+				newframe->valid = false;
+				return newframe;
 			}
 			if( newframe->gamecommandsDataHead + strlen( text ) >= sizeof( newframe->gamecommandsData ) ) {
-				Com_Error( ERR_DROP, "SNAP_ParseFrame: too much gamecommands" );
+				SNAP_ParseError( "SNAP_ParseFrame: too much gamecommands" );
+				newframe->valid = false;
+				return newframe;
 			}
 
 			gcmd = &newframe->gamecommands[newframe->numgamecommands - 1];
@@ -345,7 +387,9 @@ snapshot_t *SNAP_ParseFrame( msg_t *msg, snapshot_t *lastFrame, snapshot_t *back
 				numtargets = MSG_ReadUint8( msg );
 				if( numtargets ) {
 					if( numtargets > sizeof( gcmd->targets ) ) {
-						Com_Error( ERR_DROP, "SNAP_ParseFrame: too many gamecommand targets" );
+						SNAP_ParseError( "SNAP_ParseFrame: too many gamecommand targets" );
+						newframe->valid = false;
+						return newframe;
 					}
 					gcmd->all = false;
 					MSG_ReadData( msg, gcmd->targets, numtargets );
@@ -361,7 +405,9 @@ snapshot_t *SNAP_ParseFrame( msg_t *msg, snapshot_t *lastFrame, snapshot_t *back
 	cmd = MSG_ReadUint8( msg );
 	_SHOWNET( msg, svc_strings[cmd], showNet );
 	if( cmd != svc_match ) {
-		Com_Error( ERR_DROP, "SNAP_ParseFrame: not match info" );
+		SNAP_ParseError( "SNAP_ParseFrame: not match info" );
+		newframe->valid = false;
+		return newframe;
 	}
 	SNAP_ParseDeltaGameState( msg, deltaframe, newframe );
 
@@ -370,7 +416,14 @@ snapshot_t *SNAP_ParseFrame( msg_t *msg, snapshot_t *lastFrame, snapshot_t *back
 	while( ( cmd = MSG_ReadUint8( msg ) ) ) {
 		_SHOWNET( msg, svc_strings[cmd], showNet );
 		if( cmd != svc_playerinfo ) {
-			Com_Error( ERR_DROP, "SNAP_ParseFrame: not playerinfo" );
+			SNAP_ParseError( "SNAP_ParseFrame: not playerinfo" );
+			newframe->valid = false;
+			return newframe;
+		}
+		if( numplayers == MAX_CLIENTS ) {
+			SNAP_ParseError( "SNAP_ParseFrame: too many playerinfos" );
+			newframe->valid = false;
+			return newframe;
 		}
 		if( deltaframe && deltaframe->numplayers >= numplayers ) {
 			SNAP_ParsePlayerstate( msg, &deltaframe->playerStates[numplayers], &newframe->playerStates[numplayers] );
@@ -386,9 +439,309 @@ snapshot_t *SNAP_ParseFrame( msg_t *msg, snapshot_t *lastFrame, snapshot_t *back
 	cmd = MSG_ReadUint8( msg );
 	_SHOWNET( msg, svc_strings[cmd], showNet );
 	if( cmd != svc_packetentities ) {
-		Com_Error( ERR_DROP, "SNAP_ParseFrame: not packetentities" );
+		SNAP_ParseError( "SNAP_ParseFrame: not packetentities" );
+		newframe->valid = false;
+		return newframe;
 	}
+	u64 packetentities_start = snap_benchmarking ? Sys_Nanoseconds() : 0;
 	SNAP_ParsePacketEntities( msg, deltaframe, newframe, baselines, showNet );
+	if( snap_benchmarking ) {
+		snap_packetentities_nsec += Sys_Nanoseconds() - packetentities_start;
+		if( snap_parse_failed ) {
+			newframe->valid = false;
+		}
+	}
 
 	return newframe;
 }
+
+/*
+=========================================================================
+
+DEMO BENCHMARK
+
+=========================================================================
+*/
+
+#define SNAP_BENCH_HISTOGRAM_BUCKETS 12 // < 1us, < 2us, < 4us, ... >= 1024us
+
+struct snapbench_t {
+	snapshot_t *snaps;
+	SyncEntityState *baselines;
+	int64_t received_snap;
+	bool reliable;
+
+	DynamicArray< u64 > *frame_nsec;
+	DynamicArray< size_t > *frame_sizes;
+	size_t frames;
+	size_t keyframes;
+	size_t invalid_frames;
+	size_t entities;
+};
+
+/*
+* SNAP_BenchmarkMessage
+*
+* Parses a demo message the way the client would, minus everything
+* that isn't the snapshot parser
+*/
+static bool SNAP_BenchmarkMessage( msg_t *msg, snapbench_t *bench ) {
+	while( msg->readcount < msg->cursize ) {
+		int cmd = MSG_ReadUint8( msg );
+
+		switch( cmd ) {
+			default:
+				Com_Printf( "SNAP_BenchmarkDemo: unexpected command %i\n", cmd );
+				return false;
+
+			case svc_servercmd:
+				if( !bench->reliable ) {
+					MSG_ReadInt32( msg );
+				}
+				MSG_ReadString( msg );
+				break;
+
+			case svc_servercs:
+				MSG_ReadString( msg );
+				break;
+
+			case svc_serverdata: {
+				MSG_ReadInt32( msg ); // protocol
+				MSG_ReadInt32( msg ); // spawncount
+				MSG_ReadInt16( msg ); // snapFrameTime
+				MSG_ReadInt16( msg ); // playernum
+				int sv_bitflags = MSG_ReadUint8( msg );
+				if( sv_bitflags & SV_BITFLAGS_HTTP ) {
+					if( sv_bitflags & SV_BITFLAGS_HTTP_BASEURL ) {
+						MSG_ReadString( msg );
+					} else {
+						MSG_ReadInt16( msg );
+					}
+				}
+
+				bench->reliable = ( sv_bitflags & SV_BITFLAGS_RELIABLE ) != 0;
+				bench->received_snap = 0;
+				memset( bench->snaps, 0, UPDATE_BACKUP * sizeof( snapshot_t ) );
+			} break;
+
+			case svc_spawnbaseline:
+				SNAP_ParseBaseline( msg, bench->baselines );
+				if( snap_parse_failed ) {
+					Com_Printf( "SNAP_BenchmarkDemo: %s\n", snap_parse_error );
+					return false;
+				}
+				break;
+
+			case svc_clcack:
+				MSG_ReadUintBase128( msg );
+				MSG_ReadUintBase128( msg );
+				break;
+
+			case svc_frame: {
+				snapshot_t *last = bench->received_snap > 0 ? &bench->snaps[bench->received_snap & UPDATE_MASK] : NULL;
+				size_t start = msg->readcount;
+
+				u64 parse_start = Sys_Nanoseconds();
+				snapshot_t *snap = SNAP_ParseFrame( msg, last, bench->snaps, bench->baselines, 0 );
+				u64 parse_nsec = Sys_Nanoseconds() - parse_start;
+				if( snap_parse_failed ) {
+					Com_Printf( "SNAP_BenchmarkDemo: %s\n", snap_parse_error );
+					return false;
+				}
+
+				bench->frame_nsec->add( parse_nsec );
+				bench->frame_sizes->add( msg->readcount - start );
+				bench->frames++;
+				bench->entities += snap->numEntities;
+				if( !snap->delta ) {
+					bench->keyframes++;
+				}
+				if( snap->valid ) {
+					bench->received_snap = snap->serverFrame;
+				} else {
+					bench->invalid_frames++;
+				}
+			} break;
+
+			case svc_demoinfo: {
+				MSG_ReadInt32( msg ); // length
+				MSG_ReadInt32( msg ); // meta data offset
+				MSG_ReadInt32( msg ); // meta data size
+				int meta_data_maxsize = MSG_ReadInt32( msg );
+				MSG_SkipData( msg, meta_data_maxsize );
+			} break;
+		}
+	}
+
+	return msg->readcount == msg->cursize;
+}
+
+/*
+* SNAP_PrintSizeStats
+*/
+static void SNAP_PrintSizeStats( const char *label, DynamicArray< size_t > *sizes ) {
+	if( sizes->size() == 0 ) {
+		return;
+	}
+
+	size_t total = 0;
+	for( size_t size : *sizes ) {
+		total += size;
+	}
+
+	std::sort( sizes->begin(), sizes->end() );
+
+	size_t n = sizes->size();
+	Com_Printf( "%s: %zu total, avg %zu, p50 %zu, p95 %zu, max %zu bytes\n", label,
+		total, total / n, ( *sizes )[n / 2], ( *sizes )[n * 95 / 100], ( *sizes )[n - 1] );
+}
+
+/*
+* SNAP_BenchmarkDemo
+*
+* Replays a demo through the snapshot parser as fast as possible, to
+* measure netcode changes on real match data without a client
+*/
+void SNAP_BenchmarkDemo( const char *name, int iterations ) {
+	int demofile;
+	if( FS_FOpenFile( name, &demofile, FS_READ | SNAP_DEMO_COMPRESSION ) == -1 &&
+		FS_FOpenBaseFile( name, &demofile, FS_READ | SNAP_DEMO_COMPRESSION ) == -1 &&
+		FS_FOpenAbsoluteFile( name, &demofile, FS_READ | SNAP_DEMO_COMPRESSION ) == -1 ) {
+		Com_Printf( "Couldn't open %s\n", name );
+		return;
+	}
+
+	// read everything up front so decompression and disk reads aren't timed
+	DynamicArray< u8 > data( sys_allocator );
+	DynamicArray< size_t > message_sizes( sys_allocator );
+
+	msg_t msg;
+	static uint8_t msg_buffer[MAX_MSGLEN];
+	MSG_Init( &msg, msg_buffer, sizeof( msg_buffer ) );
+
+	u64 load_start = Sys_Nanoseconds();
+	while( true ) {
+		const char *error;
+		if( SNAP_TryReadDemoMessage( demofile, &msg, &error ) <= 0 ) {
+			if( error != NULL ) {
+				Com_Printf( "Error reading %s after %zu messages: %s\n", name, message_sizes.size(), error );
+			}
+			break;
+		}
+
+		size_t offset = data.extend( msg.cursize );
+		memcpy( &data[offset], msg.data, msg.cursize );
+		message_sizes.add( msg.cursize );
+	}
+	u64 load_nsec = Sys_Nanoseconds() - load_start;
+
+	FS_FCloseFile( demofile );
+
+	if( message_sizes.size() == 0 ) {
+		Com_Printf( "No messages in %s\n", name );
+		return;
+	}
+
+	snapbench_t bench = { };
+	bench.snaps = ALLOC_MANY( sys_allocator, snapshot_t, UPDATE_BACKUP );
+	bench.baselines = ALLOC_MANY( sys_allocator, SyncEntityState, MAX_EDICTS );
+	defer { FREE( sys_allocator, bench.snaps ); };
+	defer { FREE( sys_allocator, bench.baselines ); };
+
+	DynamicArray< u64 > frame_nsec( sys_allocator );
+	DynamicArray< size_t > frame_sizes( sys_allocator );
+	bench.frame_nsec = &frame_nsec;
+	bench.frame_sizes = &frame_sizes;
+
+	snap_benchmarking = true;
+	snap_parse_failed = false;
+	snap_packetentities_nsec = 0;
+	defer { snap_benchmarking = false; };
+
+	u64 parse_start = Sys_Nanoseconds();
+
+	for( int i = 0; i < iterations; i++ ) {
+		memset( bench.baselines, 0, MAX_EDICTS * sizeof( SyncEntityState ) );
+		memset( bench.snaps, 0, UPDATE_BACKUP * sizeof( snapshot_t ) );
+		bench.received_snap = 0;
+		bench.reliable = true;
+
+		size_t offset = 0;
+		for( size_t size : message_sizes ) {
+			msg_t message;
+			MSG_Init( &message, &data[offset], size );
+			message.cursize = size;
+			offset += size;
+
+			if( !SNAP_BenchmarkMessage( &message, &bench ) ) {
+				Com_Printf( "Bad message at offset %zu, stopping\n", offset - size );
+				return;
+			}
+		}
+	}
+
+	u64 parse_nsec = Sys_Nanoseconds() - parse_start;
+
+	if( bench.frames == 0 ) {
+		Com_Printf( "No frames in %s\n", name );
+		return;
+	}
+
+	double parse_sec = parse_nsec / 1e9;
+	double frames_parse_sec = 0;
+	size_t histogram[SNAP_BENCH_HISTOGRAM_BUCKETS] = { };
+	for( u64 nsec : frame_nsec ) {
+		frames_parse_sec += nsec / 1e9;
+
+		int bucket = 0;
+		for( u64 us = nsec / 1000; us > 0 && bucket < SNAP_BENCH_HISTOGRAM_BUCKETS - 1; us >>= 1 ) {
+			bucket++;
+		}
+		histogram[bucket]++;
+	}
+
+	size_t frame_bytes = 0;
+	for( size_t size : frame_sizes ) {
+		frame_bytes += size;
+	}
+
+	Com_Printf( "%s: %zu messages, %zu bytes, loaded in %.2fms\n", name, message_sizes.size(), data.size(), load_nsec / 1e6 );
+	Com_Printf( "%zu frames (%zu keyframes, %zu invalid) over %d iterations in %.2fms\n",
+		bench.frames, bench.keyframes, bench.invalid_frames, iterations, parse_nsec / 1e6 );
+	Com_Printf( "Messages: %.0f/s, %.2f MB/s\n", message_sizes.size() * iterations / parse_sec, data.size() * iterations / parse_sec / ( 1024 * 1024 ) );
+	Com_Printf( "Frames: %.0f/s, %.2f MB/s\n", bench.frames / frames_parse_sec, frame_bytes / frames_parse_sec / ( 1024 * 1024 ) );
+	Com_Printf( "Entities: %zu decoded, %.0f/s, %.1f%% of frame parse time\n",
+		bench.entities, bench.entities / ( snap_packetentities_nsec / 1e9 ), 100.0 * snap_packetentities_nsec / ( frames_parse_sec * 1e9 ) );
+
+	std::sort( frame_nsec.begin(), frame_nsec.end() );
+	size_t n = frame_nsec.size();
+	Com_Printf( "Frame parse time: p50 %.2fus, p95 %.2fus, p99 %.2fus, max %.2fus\n",
+		frame_nsec[n / 2] / 1e3, frame_nsec[n * 95 / 100] / 1e3, frame_nsec[n * 99 / 100] / 1e3, frame_nsec[n - 1] / 1e3 );
+
+	int first = 0;
+	int last = SNAP_BENCH_HISTOGRAM_BUCKETS - 1;
+	while( histogram[first] == 0 ) {
+		first++;
+	}
+	while( histogram[last] == 0 ) {
+		last--;
+	}
+
+	for( int i = first; i <= last; i++ ) {
+		char bar[41] = { };
+		memset( bar, '#', histogram[i] * ( sizeof( bar ) - 1 ) / n );
+
+		int lower = i == 0 ? 0 : 1 << ( i - 1 );
+		char upper[16];
+		if( i == SNAP_BENCH_HISTOGRAM_BUCKETS - 1 ) {
+			Q_strncpyz( upper, "", sizeof( upper ) );
+		} else {
+			snprintf( upper, sizeof( upper ), "%dus", 1 << i );
+		}
+
+		Com_Printf( "  %6dus - %6s: %8zu %s\n", lower, upper, histogram[i], bar );
+	}
+
+	SNAP_PrintSizeStats( "Message sizes", &message_sizes );
+	SNAP_PrintSizeStats( "Frame sizes", &frame_sizes );
+}
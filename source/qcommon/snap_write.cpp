@@ -19,7 +19,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "qcommon/qcommon.h"
+#include "qcommon/base.h"
 #include "qcommon/cmodel.h"
+#include "qcommon/hash.h"
+#include "qcommon/hashtable.h"
+#include "qcommon/threads.h"
 #include "server/server.h"
 
 /*
@@ -31,40 +35,183 @@ Encode a client frame onto the network channel
 */
 
 /*
-* SNAP_EmitPacketEntities
+=========================================================================
+
+Entity delta cache
+
+Every client that acked the same frame has an identical copy of each entity
+from that frame, so (entity number, acked frame) identifies the delta base and
+the current frame identifies the target. Clients with matching delta bases can
+then share the encoded bytes instead of encoding the same delta again.
+
+The cache is sharded by entity number so the snapshot jobs rarely contend.
+
+=========================================================================
+*/
+
+#define DELTA_CACHE_SHARDS 16
+#define DELTA_CACHE_SHARD_ENTRIES 1024
+#define DELTA_CACHE_SHARD_BYTES ( 128 * 1024 )
+
+struct EntityDeltaCacheEntry {
+	u64 id; // SNAP_EntityDeltaCacheId, not its hash, so colliding hashes can't match
+	SyncEntityState state; // MSG_WriteDeltaEntity quantizes the target's fields
+	u32 size;
+};
+
+struct EntityDeltaCacheShard {
+	Mutex * mutex;
+	Hashtable< DELTA_CACHE_SHARD_ENTRIES * 2 > offsets;
+	size_t data_used;
+	u32 hits, misses;
+	alignas( 16 ) u8 data[ DELTA_CACHE_SHARD_BYTES ];
+};
+
+struct EntityDeltaCache {
+	EntityDeltaCacheShard shards[ DELTA_CACHE_SHARDS ];
+};
+
+EntityDeltaCache * SNAP_NewEntityDeltaCache( Allocator * a ) {
+	EntityDeltaCache * cache = ALLOC( a, EntityDeltaCache );
+	for( EntityDeltaCacheShard & shard : cache->shards ) {
+		shard.mutex = NewMutex();
+	}
+	SNAP_ClearEntityDeltaCache( cache );
+	return cache;
+}
+
+void SNAP_DeleteEntityDeltaCache( Allocator * a, EntityDeltaCache * cache ) {
+	if( cache == NULL )
+		return;
+
+	for( EntityDeltaCacheShard & shard : cache->shards ) {
+		DeleteMutex( shard.mutex );
+	}
+	FREE( a, cache );
+}
+
+/*
+* SNAP_ClearEntityDeltaCache
 *
-* Writes a delta update of an SyncEntityState list to the message.
+* Must be called whenever entity states may have changed, and never while
+* snapshots are being written
 */
-static void SNAP_EmitPacketEntities( ginfo_t *gi, client_snapshot_t *from, client_snapshot_t *to, msg_t *msg, SyncEntityState *baselines, SyncEntityState *client_entities, int num_client_entities ) {
+void SNAP_ClearEntityDeltaCache( EntityDeltaCache * cache ) {
+	u32 hits = 0;
+	u32 lookups = 0;
+
+	for( EntityDeltaCacheShard & shard : cache->shards ) {
+		hits += shard.hits;
+		lookups += shard.hits + shard.misses;
+
+		shard.offsets.clear();
+		shard.data_used = 0;
+		shard.hits = 0;
+		shard.misses = 0;
+	}
+
+	if( lookups > 0 ) {
+		TracyPlot( "Entity delta cache hit rate", float( hits ) / float( lookups ) );
+	}
+}
+
+static u64 SNAP_EntityDeltaCacheId( int entnum, int64_t from_frame ) {
+	// from_frame is 0 for deltas from the baseline
+	return ( u64( from_frame ) << 16 ) | u64( entnum );
+}
+
+static u64 SNAP_EntityDeltaCacheKey( u64 id ) {
+	u64 key = Hash64( id );
+	key &= ~( U64( 1 ) << U64( 63 ) );
+	return key == 0 ? 1 : key;
+}
+
+/*
+* SNAP_WriteCachedDeltaEntity
+*
+* MSG_WriteDeltaEntity, but reuses the bytes written for other clients where possible
+*/
+static void SNAP_WriteCachedDeltaEntity( EntityDeltaCache * cache, msg_t *msg, int64_t from_frame,
+										 const SyncEntityState *baseline, SyncEntityState *ent, bool force ) {
+	if( cache == NULL ) {
+		MSG_WriteDeltaEntity( msg, baseline, ent, force );
+		return;
+	}
+
+	u64 id = SNAP_EntityDeltaCacheId( ent->number, from_frame );
+	u64 key = SNAP_EntityDeltaCacheKey( id );
+	EntityDeltaCacheShard * shard = &cache->shards[ ent->number % DELTA_CACHE_SHARDS ];
+
+	const EntityDeltaCacheEntry * entry = NULL;
+	{
+		u64 offset;
+		Lock( shard->mutex );
+		if( shard->offsets.get( key, &offset ) ) {
+			entry = ( const EntityDeltaCacheEntry * ) ( shard->data + offset );
+			shard->hits++;
+		}
+		else {
+			shard->misses++;
+		}
+		Unlock( shard->mutex );
+	}
+
+	// entries are never moved or freed until the cache is cleared, so we can read it unlocked
+	if( entry != NULL && entry->id == id ) {
+		MSG_WriteData( msg, entry + 1, entry->size );
+		*ent = entry->state;
+		return;
+	}
+
+	size_t start = msg->cursize;
+	MSG_WriteDeltaEntity( msg, baseline, ent, force );
+	u32 size = msg->cursize - start;
+
+	size_t entry_size = AlignPow2( sizeof( EntityDeltaCacheEntry ) + size, alignof( EntityDeltaCacheEntry ) );
+
+	Lock( shard->mutex );
+	if( shard->data_used + entry_size <= sizeof( shard->data ) && shard->offsets.add( key, shard->data_used ) ) {
+		EntityDeltaCacheEntry * new_entry = ( EntityDeltaCacheEntry * ) ( shard->data + shard->data_used );
+		new_entry->id = id;
+		new_entry->state = *ent;
+		new_entry->size = size;
+		memcpy( new_entry + 1, msg->data + start, size );
+		shard->data_used += entry_size;
+	}
+	Unlock( shard->mutex );
+}
+
+/*
+* SNAP_WriteDeltaEntities
+*
+* Writes a delta update of an SyncEntityState list to the message. Both
+* frames' entities live in the circular ring, from_num is 0 to send
+* everything from the baselines
+*/
+void SNAP_WriteDeltaEntities( msg_t *msg, client_entities_t *ring, int from_first, int from_num, int to_first, int to_num,
+	int64_t from_frame, const SyncEntityState *baselines, EntityDeltaCache *delta_cache ) {
 	SyncEntityState *oldent, *newent;
 	int oldindex, newindex;
 	int oldnum, newnum;
-	int from_num_entities;
 
 	MSG_WriteUint8( msg, svc_packetentities );
 
-	if( !from ) {
-		from_num_entities = 0;
-	} else {
-		from_num_entities = from->num_entities;
-	}
-
 	newindex = 0;
 	oldindex = 0;
-	while( newindex < to->num_entities || oldindex < from_num_entities ) {
-		if( newindex >= to->num_entities ) {
+	while( newindex < to_num || oldindex < from_num ) {
+		if( newindex >= to_num ) {
 			newent = NULL;
 			newnum = 9999;
 		} else {
-			newent = &client_entities[( to->first_entity + newindex ) % num_client_entities];
+			newent = &ring->entities[( to_first + newindex ) % ring->num_entities];
 			newnum = newent->number;
 		}
 
-		if( oldindex >= from_num_entities ) {
+		if( oldindex >= from_num ) {
 			oldent = NULL;
 			oldnum = 9999;
 		} else {
-			oldent = &client_entities[( from->first_entity + oldindex ) % num_client_entities];
+			oldent = &ring->entities[( from_first + oldindex ) % ring->num_entities];
 			oldnum = oldent->number;
 		}
 
@@ -74,7 +221,7 @@ static void SNAP_EmitPacketEntities( ginfo_t *gi, client_snapshot_t *from, clien
 			// in any bytes being emited if the entity has not changed at all
 			// note that players are always 'newentities', this updates their oldorigin always
 			// and prevents warping ( wsw : jal : I removed it from the players )
-			MSG_WriteDeltaEntity( msg, oldent, newent, false );
+			SNAP_WriteCachedDeltaEntity( delta_cache, msg, from_frame, oldent, newent, false );
 			oldindex++;
 			newindex++;
 			continue;
@@ -82,7 +229,7 @@ static void SNAP_EmitPacketEntities( ginfo_t *gi, client_snapshot_t *from, clien
 
 		if( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity( msg, &baselines[newnum], newent, true );
+			SNAP_WriteCachedDeltaEntity( delta_cache, msg, 0, &baselines[newnum], newent, true );
 			newindex++;
 			continue;
 		}
@@ -99,19 +246,25 @@ static void SNAP_EmitPacketEntities( ginfo_t *gi, client_snapshot_t *from, clien
 }
 
 /*
-* SNAP_WriteDeltaGameStateToClient
+* SNAP_WriteDeltaGameState
 */
-static void SNAP_WriteDeltaGameStateToClient( client_snapshot_t *from, client_snapshot_t *to, msg_t *msg ) {
+void SNAP_WriteDeltaGameState( msg_t *msg, const SyncGameState *from, const SyncGameState *to ) {
 	MSG_WriteUint8( msg, svc_match );
-	MSG_WriteDeltaGameState( msg, from ? &from->gameState : NULL, &to->gameState );
+	MSG_WriteDeltaGameState( msg, from, to );
 }
 
 /*
-* SNAP_WritePlayerstateToClient
+* SNAP_WriteDeltaPlayerStates
+*
+* Delta encodes each playerstate against the one at the same index in the
+* old frame, if it had that many
 */
-static void SNAP_WritePlayerstateToClient( msg_t *msg, const SyncPlayerState *ops, SyncPlayerState *ps ) {
-	MSG_WriteUint8( msg, svc_playerinfo );
-	MSG_WriteDeltaPlayerState( msg, ops, ps );
+void SNAP_WriteDeltaPlayerStates( msg_t *msg, const SyncPlayerState *from, int from_num, const SyncPlayerState *to, int to_num ) {
+	for( int i = 0; i < to_num; i++ ) {
+		MSG_WriteUint8( msg, svc_playerinfo );
+		MSG_WriteDeltaPlayerState( msg, i < from_num ? &from[i] : NULL, &to[i] );
+	}
+	MSG_WriteUint8( msg, 0 );
 }
 
 /*
@@ -225,7 +378,8 @@ static void SNAP_WriteMultiPOVCommands( ginfo_t *gi, client_t *client, msg_t *ms
 * SNAP_WriteFrameSnapToClient
 */
 void SNAP_WriteFrameSnapToClient( ginfo_t *gi, client_t *client, msg_t *msg, int64_t frameNum, int64_t gameTime,
-								  SyncEntityState *baselines, client_entities_t *client_entities ) {
+								  SyncEntityState *baselines, client_entities_t *client_entities,
+								  EntityDeltaCache *delta_cache ) {
 	client_snapshot_t *frame, *oldframe;
 	int flags, i, index;
 
@@ -308,20 +462,10 @@ void SNAP_WriteFrameSnapToClient( ginfo_t *gi, client_t *client, msg_t *msg, int
 	}
 	MSG_WriteInt16( msg, -1 );
 
-	SNAP_WriteDeltaGameStateToClient( oldframe, frame, msg );
-
-	// delta encode the playerstate
-	for( i = 0; i < frame->numplayers; i++ ) {
-		if( oldframe && oldframe->numplayers > i ) {
-			SNAP_WritePlayerstateToClient( msg, &oldframe->ps[i], &frame->ps[i] );
-		} else {
-			SNAP_WritePlayerstateToClient( msg, NULL, &frame->ps[i] );
-		}
-	}
-	MSG_WriteUint8( msg, 0 );
-
-	// delta encode the entities
-	SNAP_EmitPacketEntities( gi, oldframe, frame, msg, baselines, client_entities->entities, client_entities->num_entities );
+	SNAP_WriteDeltaGameState( msg, oldframe ? oldframe->gameState : NULL, frame->gameState );
+	SNAP_WriteDeltaPlayerStates( msg, oldframe ? oldframe->ps : NULL, oldframe ? oldframe->numplayers : 0, frame->ps, frame->numplayers );
+	SNAP_WriteDeltaEntities( msg, client_entities, oldframe ? oldframe->first_entity : 0, oldframe ? oldframe->num_entities : 0,
+		frame->first_entity, frame->num_entities, client->lastframe, baselines, delta_cache );
 
 	client->lastSentFrameNum = frameNum;
 }
@@ -370,13 +514,6 @@ static bool SNAP_PVSCullEntity( CollisionModel *cms, edict_t *ent, uint8_t *bits
 
 //=====================================================================
 
-#define MAX_SNAPSHOT_ENTITIES   1024
-typedef struct {
-	int numSnapshotEntities;
-	int snapshotEntities[MAX_SNAPSHOT_ENTITIES];
-	uint8_t entityAddedToSnapList[MAX_EDICTS / 8];
-} snapshotEntityNumbers_t;
-
 /*
 * SNAP_AddEntNumToSnapList
 */
@@ -423,14 +560,27 @@ static float SNAP_GainForAttenuation( float dist ) {
 	return S_DEFAULT_ATTENUATION_REFDISTANCE / ( S_DEFAULT_ATTENUATION_REFDISTANCE + ATTN_DISTANT * ( dist - S_DEFAULT_ATTENUATION_REFDISTANCE ) );
 }
 
+#define SNAP_SOUND_CULL_GAIN 0.05f
+#define SNAP_SOUND_CULL_PADDING 128.0f
+
 /*
 * SNAP_SnapCullSoundEntity
 */
 static bool SNAP_SnapCullSoundEntity( CollisionModel *cms, edict_t *ent, Vec3 listener_origin ) {
 	// extend the influence sphere cause the player could be moving
-	float dist = Length( listener_origin - ent->s.origin ) - 128;
+	float dist = Length( listener_origin - ent->s.origin ) - SNAP_SOUND_CULL_PADDING;
 	float gain = SNAP_GainForAttenuation( dist < 0 ? 0 : dist );
-	return gain <= 0.05f;
+	return gain <= SNAP_SOUND_CULL_GAIN;
+}
+
+/*
+* SNAP_CanCullSounds
+*
+* Whether SNAP_SnapCullSoundEntity can cull anything within the attenuation
+* max distance, which is as far as sounds are ever heard
+*/
+static bool SNAP_CanCullSounds() {
+	return SNAP_GainForAttenuation( S_DEFAULT_ATTENUATION_MAXDISTANCE ) <= SNAP_SOUND_CULL_GAIN;
 }
 
 /*
@@ -521,14 +671,115 @@ static bool SNAP_SnapCullEntity( CollisionModel *cms, edict_t *ent, edict_t *cle
 }
 
 /*
-* SNAP_AddEntitiesVisibleAtOrigin
+=============================================================================
+
+Per frame entity bitsets
+
+Everything about an entity that culling looks at and that doesn't depend on
+the client is gathered into bitsets once per frame, so each client can work
+out most of its visible set with word-wide ORs over its fat PVS and areas.
+Entities whose visibility depends on who's looking go through
+SNAP_SnapCullEntity one at a time.
+
+=============================================================================
 */
-static void SNAP_AddEntitiesVisibleAtOrigin( CollisionModel *cms, ginfo_t *gi, edict_t *clent, Vec3 vieworg,
-											int viewarea, client_snapshot_t *frame, snapshotEntityNumbers_t *entList ) {
-	uint8_t * pvs = ( uint8_t * ) alloca( CM_ClusterRowSize( cms ) );
-	SNAP_FatPVS( cms, vieworg, pvs );
 
-	// add the entities to the list
+#define SNAP_ENTITY_WORDS ( MAX_EDICTS / 64 )
+
+struct SnapEntityBits {
+	Allocator *a;
+	int num_words;                          // enough to cover gi->num_edicts
+
+	u64 noclient[ SNAP_ENTITY_WORDS ];
+	u64 filtered[ SNAP_ENTITY_WORDS ];      // team/owner filters or culled by headnode
+	u64 broadcast[ SNAP_ENTITY_WORDS ];
+	u64 has_area[ SNAP_ENTITY_WORDS ];
+	u64 sound[ SNAP_ENTITY_WORDS ];         // needs the attenuation check
+	u64 sound_only[ SNAP_ENTITY_WORDS ];    // only the attenuation check
+	u64 has_clusters[ SNAP_ENTITY_WORDS ];
+
+	int num_clusters;                       // 0 if the map has no vis
+	int num_areas;
+	size_t clusters_capacity;
+	size_t areas_capacity;
+	u64 *cluster_ents;                      // [num_clusters * num_words]
+	u64 *area_ents;                         // [num_areas * num_words]
+};
+
+SnapEntityBits * SNAP_NewSnapEntityBits( Allocator * a ) {
+	SnapEntityBits * bits = ALLOC( a, SnapEntityBits );
+	memset( bits, 0, sizeof( *bits ) );
+	bits->a = a;
+	return bits;
+}
+
+void SNAP_DeleteSnapEntityBits( Allocator * a, SnapEntityBits * bits ) {
+	if( bits == NULL )
+		return;
+
+	FREE( a, bits->cluster_ents );
+	FREE( a, bits->area_ents );
+	FREE( a, bits );
+}
+
+static int SNAP_LowestBit( u64 x ) {
+#if defined( _MSC_VER )
+	unsigned long index;
+	_BitScanForward64( &index, x );
+	return int( index );
+#else
+	return __builtin_ctzll( x );
+#endif
+}
+
+static void SNAP_OrEntityBits( u64 *dst, const u64 *src, int num_words ) {
+	for( int i = 0; i < num_words; i++ ) {
+		dst[i] |= src[i];
+	}
+}
+
+/*
+* SNAP_GatherSnapEntities
+*
+* Must be called after the game frame and before any snapshots are culled
+*/
+void SNAP_GatherSnapEntities( CollisionModel *cms, ginfo_t *gi, SnapEntityBits *bits ) {
+	ZoneScoped;
+
+	int num_words = ( gi->num_edicts + 63 ) / 64;
+	int num_clusters = CM_NumClusters( cms );
+	int num_areas = CM_NumAreas( cms );
+
+	bits->num_words = num_words;
+	bits->num_clusters = num_clusters;
+	bits->num_areas = num_areas;
+
+	memset( bits->noclient, 0, sizeof( bits->noclient ) );
+	memset( bits->filtered, 0, sizeof( bits->filtered ) );
+	memset( bits->broadcast, 0, sizeof( bits->broadcast ) );
+	memset( bits->has_area, 0, sizeof( bits->has_area ) );
+	memset( bits->sound, 0, sizeof( bits->sound ) );
+	memset( bits->sound_only, 0, sizeof( bits->sound_only ) );
+	memset( bits->has_clusters, 0, sizeof( bits->has_clusters ) );
+
+	size_t clusters_size = size_t( num_clusters ) * num_words;
+	if( clusters_size > bits->clusters_capacity ) {
+		FREE( bits->a, bits->cluster_ents );
+		bits->cluster_ents = ALLOC_MANY( bits->a, u64, clusters_size );
+		bits->clusters_capacity = clusters_size;
+	}
+	memset( bits->cluster_ents, 0, clusters_size * sizeof( u64 ) );
+
+	size_t areas_size = size_t( num_areas ) * num_words;
+	if( areas_size > bits->areas_capacity ) {
+		FREE( bits->a, bits->area_ents );
+		bits->area_ents = ALLOC_MANY( bits->a, u64, areas_size );
+		bits->areas_capacity = areas_size;
+	}
+	memset( bits->area_ents, 0, areas_size * sizeof( u64 ) );
+
+	const unsigned int filter_flags = SVF_ONLYTEAM | SVF_ONLYOWNER | SVF_OWNERANDCHASERS | SVF_NEVEROWNER | SVF_FORCETEAM;
+
 	for( int entNum = 1; entNum < gi->num_edicts; entNum++ ) {
 		edict_t * ent = EDICT_NUM( entNum );
 
@@ -538,23 +789,174 @@ static void SNAP_AddEntitiesVisibleAtOrigin( CollisionModel *cms, ginfo_t *gi, e
 			ent->s.number = entNum;
 		}
 
-		// always add the client entity, even if SVF_NOCLIENT
-		if( ent != clent && SNAP_SnapCullEntity( cms, ent, clent, frame, vieworg, viewarea, pvs ) ) {
+		int word = entNum >> 6;
+		u64 bit = u64( 1 ) << ( entNum & 63 );
+
+		if( ent->r.svflags & SVF_NOCLIENT ) {
+			bits->noclient[word] |= bit;
 			continue;
 		}
 
-		// add it
-		if( !SNAP_AddEntNumToSnapList( entNum, entList ) ) {
+		// fix the owner here too, the culling jobs add it along with ent and can't write to it
+		if( ( ent->r.svflags & SVF_FORCEOWNER ) && !( ent->s.ownerNum > 0 && ent->s.ownerNum < gi->num_edicts ) ) {
+			Com_Printf( "FIXING ENT->S.OWNERNUM: %i %i!!!\n", ent->s.type, ent->s.ownerNum );
+			ent->s.ownerNum = 0;
+		}
+
+		if( ( ent->r.svflags & filter_flags ) || ent->r.num_clusters == -1 ) {
+			bits->filtered[word] |= bit;
+			continue;
+		}
+
+		// clusters the vis data doesn't know about go the slow way too
+		bool out_of_range = false;
+		for( int i = 0; i < ent->r.num_clusters; i++ ) {
+			out_of_range |= num_clusters > 0 && ent->r.clusternums[i] >= num_clusters;
+		}
+		if( out_of_range ) {
+			bits->filtered[word] |= bit;
+			continue;
+		}
+
+		if( ent->r.svflags & SVF_BROADCAST ) {
+			bits->broadcast[word] |= bit;
+			continue;
+		}
+
+		if( ent->r.areanum < 0 ) {
 			continue;
 		}
 
-		if( ent->r.svflags & SVF_FORCEOWNER ) {
-			// make sure owner number is valid too
-			if( ent->s.ownerNum > 0 && ent->s.ownerNum < gi->num_edicts ) {
+		bits->has_area[word] |= bit;
+		bits->area_ents[ent->r.areanum * num_words + word] |= bit;
+		if( ent->r.areanum2 >= 0 ) {
+			bits->area_ents[ent->r.areanum2 * num_words + word] |= bit;
+		}
+
+		// see SNAP_SnapCullEntity
+		bool snd_cull_only = ( ent->r.svflags & SVF_SOUNDCULL ) ||
+			( ent->s.model == EMPTY_HASH && !ent->s.events[0].type && !ent->s.effects && ent->s.sound != EMPTY_HASH );
+		if( snd_cull_only ) {
+			bits->sound_only[word] |= bit;
+		}
+		if( snd_cull_only || ent->s.events[0].type || ent->s.sound != EMPTY_HASH ) {
+			bits->sound[word] |= bit;
+		}
+
+		if( ent->r.num_clusters > 0 ) {
+			bits->has_clusters[word] |= bit;
+		}
+		if( num_clusters > 0 ) {
+			for( int i = 0; i < ent->r.num_clusters; i++ ) {
+				bits->cluster_ents[ent->r.clusternums[i] * num_words + word] |= bit;
+			}
+		}
+	}
+}
+
+/*
+* SNAP_AddEntitiesVisibleAtOrigin
+*/
+static void SNAP_AddEntitiesVisibleAtOrigin( CollisionModel *cms, ginfo_t *gi, const SnapEntityBits *bits, edict_t *clent, Vec3 vieworg,
+											int viewarea, client_snapshot_t *frame, snapshotEntityNumbers_t *entList ) {
+	int num_words = bits->num_words;
+	u64 visible[ SNAP_ENTITY_WORDS ] = { };
+
+	if( frame->allentities ) {
+		for( int i = 0; i < num_words; i++ ) {
+			visible[i] = ~bits->noclient[i];
+		}
+		visible[0] &= ~u64( 1 ); // never the world
+	} else {
+		uint8_t * pvs = ( uint8_t * ) alloca( CM_ClusterRowSize( cms ) );
+		SNAP_FatPVS( cms, vieworg, pvs );
+
+		// entities touching a cluster in the fat PVS. without vis everything
+		// is in the PVS, but entities outside the map still aren't
+		u64 in_pvs[ SNAP_ENTITY_WORDS ] = { };
+		if( bits->num_clusters == 0 ) {
+			SNAP_OrEntityBits( in_pvs, bits->has_clusters, num_words );
+		}
+		for( int i = 0; i < bits->num_clusters; i += 8 ) {
+			uint8_t b = pvs[i >> 3];
+			for( ; b != 0; b &= b - 1 ) {
+				int cluster = i + SNAP_LowestBit( b );
+				if( cluster < bits->num_clusters ) {
+					SNAP_OrEntityBits( in_pvs, bits->cluster_ents + cluster * num_words, num_words );
+				}
+			}
+		}
+
+		// entities in an area connected to the client's
+		u64 in_area[ SNAP_ENTITY_WORDS ] = { };
+		if( viewarea >= 0 ) {
+			// this is the same as CM_AreasConnected but portal's visibility included
+			const uint8_t * areabits = frame->areabits + viewarea * CM_AreaRowSize( cms );
+			for( int i = 0; i < bits->num_areas; i++ ) {
+				if( areabits[i >> 3] & ( 1 << ( i & 7 ) ) ) {
+					SNAP_OrEntityBits( in_area, bits->area_ents + i * num_words, num_words );
+				}
+			}
+		} else {
+			SNAP_OrEntityBits( in_area, bits->has_area, num_words );
+		}
+
+		for( int i = 0; i < num_words; i++ ) {
+			visible[i] = bits->broadcast[i] | ( in_area[i] & in_pvs[i] & ~bits->sound_only[i] );
+		}
+
+		// sounds can be heard through walls, check whatever PVS didn't let through.
+		// with the current attenuation nothing in range gets culled, so skip the distances
+		if( !SNAP_CanCullSounds() ) {
+			for( int i = 0; i < num_words; i++ ) {
+				visible[i] |= bits->sound[i] & in_area[i];
+			}
+		} else {
+			for( int i = 0; i < num_words; i++ ) {
+				for( u64 w = bits->sound[i] & in_area[i] & ~visible[i]; w != 0; w &= w - 1 ) {
+					int entNum = i * 64 + SNAP_LowestBit( w );
+					if( !SNAP_SnapCullSoundEntity( cms, EDICT_NUM( entNum ), vieworg ) ) {
+						visible[i] |= u64( 1 ) << ( entNum & 63 );
+					}
+				}
+			}
+		}
+
+		// and the ones that depend on who's looking
+		for( int i = 0; i < num_words; i++ ) {
+			for( u64 w = bits->filtered[i]; w != 0; w &= w - 1 ) {
+				int entNum = i * 64 + SNAP_LowestBit( w );
+				if( !SNAP_SnapCullEntity( cms, EDICT_NUM( entNum ), clent, frame, vieworg, viewarea, pvs ) ) {
+					visible[i] |= u64( 1 ) << ( entNum & 63 );
+				}
+			}
+		}
+	}
+
+	// always add the client entity, even if SVF_NOCLIENT
+	if( clent ) {
+		int clentNum = NUM_FOR_EDICT( clent );
+		visible[clentNum >> 6] |= u64( 1 ) << ( clentNum & 63 );
+	}
+
+	// add the entities to the list
+	for( int i = 0; i < num_words; i++ ) {
+		for( u64 w = visible[i]; w != 0; w &= w - 1 ) {
+			int entNum = i * 64 + SNAP_LowestBit( w );
+			if( entNum >= gi->num_edicts ) {
+				break;
+			}
+
+			edict_t * ent = EDICT_NUM( entNum );
+
+			// add it
+			if( !SNAP_AddEntNumToSnapList( entNum, entList ) ) {
+				continue;
+			}
+
+			// SNAP_GatherSnapEntities zeroed invalid owners
+			if( ( ent->r.svflags & SVF_FORCEOWNER ) && ent->s.ownerNum > 0 && ent->s.ownerNum < gi->num_edicts ) {
 				SNAP_AddEntNumToSnapList( ent->s.ownerNum, entList );
-			} else {
-				Com_Printf( "FIXING ENT->S.OWNERNUM: %i %i!!!\n", ent->s.type, ent->s.ownerNum );
-				ent->s.ownerNum = 0;
 			}
 		}
 	}
@@ -563,7 +965,7 @@ static void SNAP_AddEntitiesVisibleAtOrigin( CollisionModel *cms, ginfo_t *gi, e
 /*
 * SNAP_BuildSnapEntitiesList
 */
-static void SNAP_BuildSnapEntitiesList( CollisionModel *cms, ginfo_t *gi, edict_t *clent, Vec3 vieworg,
+static void SNAP_BuildSnapEntitiesList( CollisionModel *cms, ginfo_t *gi, const SnapEntityBits *bits, edict_t *clent, Vec3 vieworg,
 										client_snapshot_t *frame, snapshotEntityNumbers_t *entList ) {
 	int entNum;
 	int leafnum, clientarea;
@@ -589,34 +991,32 @@ static void SNAP_BuildSnapEntitiesList( CollisionModel *cms, ginfo_t *gi, edict_
 		SNAP_AddEntNumToSnapList( entNum, entList );
 	}
 
-	SNAP_AddEntitiesVisibleAtOrigin( cms, gi, clent, vieworg, clientarea, frame, entList );
+	SNAP_AddEntitiesVisibleAtOrigin( cms, gi, bits, clent, vieworg, clientarea, frame, entList );
 
 	SNAP_SortSnapList( entList );
 }
 
 /*
-* SNAP_BuildClientFrameSnap
+* SNAP_CullClientFrameSnap
 *
 * Decides which entities are going to be visible to the client, and
-* copies off the playerstat and areabits.
+* copies off the playerstat and areabits. Only touches the client's own
+* frame, so it's safe to run for several clients at once.
 */
-void SNAP_BuildClientFrameSnap( CollisionModel *cms, ginfo_t *gi, int64_t frameNum, int64_t timeStamp,
-								client_t *client,
-								SyncGameState *gameState, client_entities_t *client_entities,
-								mempool_t *mempool ) {
-	int e, i, ne;
+bool SNAP_CullClientFrameSnap( CollisionModel *cms, ginfo_t *gi, const SnapEntityBits *bits, int64_t frameNum, int64_t timeStamp,
+							   client_t *client, const SyncGameState *gameState, mempool_t *mempool,
+							   snapshotEntityNumbers_t *entsList ) {
+	int i;
 	Vec3 org;
 	edict_t *ent, *clent;
 	client_snapshot_t *frame;
-	SyncEntityState *state;
 	int numplayers, numareas;
-	snapshotEntityNumbers_t entsList;
 
 	assert( gameState );
 
 	clent = client->edict;
 	if( clent && !clent->r.client ) {   // allow NULL ent for server record
-		return;     // not in game yet
+		return false;     // not in game yet
 
 	}
 	if( clent ) {
@@ -693,22 +1093,33 @@ void SNAP_BuildClientFrameSnap( CollisionModel *cms, ginfo_t *gi, int64_t frameN
 
 	// build up the list of visible entities
 	//=============================
-	SNAP_BuildSnapEntitiesList( cms, gi, clent, org, frame, &entsList );
+	SNAP_BuildSnapEntitiesList( cms, gi, bits, clent, org, frame, entsList );
 
 	// store current match state information
-	frame->gameState = *gameState;
+	frame->gameState = gameState;
 
-	//=============================
+	return true;
+}
+
+/*
+* SNAP_StoreClientFrameEntities
+*
+* Copies the culled entities into the shared circular client_entities array.
+* This claims space in the array so it must be called for one client at a time.
+*/
+void SNAP_StoreClientFrameEntities( ginfo_t *gi, client_t *client, int64_t frameNum,
+									client_entities_t *client_entities, const snapshotEntityNumbers_t *entsList ) {
+	client_snapshot_t *frame = &client->snapShots[frameNum & UPDATE_MASK];
 
 	// dump the entities list
-	ne = client_entities->next_entities;
+	int ne = client_entities->next_entities;
 	frame->num_entities = 0;
 	frame->first_entity = ne;
 
-	for( e = 0; e < entsList.numSnapshotEntities; e++ ) {
+	for( int e = 0; e < entsList->numSnapshotEntities; e++ ) {
 		// add it to the circular client_entities array
-		ent = EDICT_NUM( entsList.snapshotEntities[e] );
-		state = &client_entities->entities[ne % client_entities->num_entities];
+		const edict_t *ent = EDICT_NUM( entsList->snapshotEntities[e] );
+		SyncEntityState *state = &client_entities->entities[ne % client_entities->num_entities];
 
 		*state = ent->s;
 		state->svflags = ent->r.svflags;
@@ -720,6 +1131,22 @@ void SNAP_BuildClientFrameSnap( CollisionModel *cms, ginfo_t *gi, int64_t frameN
 	client_entities->next_entities = ne;
 }
 
+/*
+* SNAP_BuildClientFrameSnap
+*/
+void SNAP_BuildClientFrameSnap( CollisionModel *cms, ginfo_t *gi, const SnapEntityBits *bits, int64_t frameNum, int64_t timeStamp,
+								client_t *client,
+								const SyncGameState *gameState, client_entities_t *client_entities,
+								mempool_t *mempool ) {
+	snapshotEntityNumbers_t entsList;
+
+	if( !SNAP_CullClientFrameSnap( cms, gi, bits, frameNum, timeStamp, client, gameState, mempool, &entsList ) ) {
+		return;
+	}
+
+	SNAP_StoreClientFrameEntities( gi, client, frameNum, client_entities, &entsList );
+}
+
 /*
 * SNAP_FreeClientFrame
 *
@@ -749,3 +1176,4 @@ void SNAP_FreeClientFrames( client_t *client ) {
 		SNAP_FreeClientFrame( frame );
 	}
 }
+
@@ -0,0 +1,403 @@
+#include "qcommon/base.h"
+#include "qcommon/threads.h"
+#include "qcommon/threadpool.h"
+
+/*
+ * every thread in the pool (the thread that called InitThreadPool is thread
+ * 0) has its own job queue. threads push and pop jobs at the bottom of their
+ * own queue, and when that's empty they steal from the top of everyone
+ * else's, so submitting and running jobs doesn't go through a shared lock
+ */
+
+constexpr size_t JOB_QUEUE_SIZE = 4096;
+constexpr size_t JOBS_PER_THREAD = 4096;
+
+struct Job {
+	JobCallback callback;
+	void * data;
+	Job * parent;
+	s32 unfinished; // the callback plus unfinished children
+};
+
+// Chase-Lev deque, holds indices into all_jobs. top is written by thieves
+// and bottom by the owner so keep them on separate cache lines
+struct JobQueue {
+	alignas( 64 ) s64 top;
+	alignas( 64 ) s64 bottom;
+	alignas( 64 ) s64 jobs[ JOB_QUEUE_SIZE ];
+};
+
+struct alignas( 64 ) PoolThread {
+	Thread * thread;
+	ArenaAllocator arena;
+	JobQueue queue;
+	Job * jobs;
+	size_t next_job;
+	u32 next_victim;
+};
+
+static PoolThread threads[ 33 ];
+static u32 num_threads;
+
+static Job * all_jobs;
+
+static s32 jobs_outstanding; // queued or running, for ThreadPoolFinish
+static s32 shutting_down;
+
+static s32 sleeping_workers;
+static Semaphore * wake_sem;
+
+// threads waiting on a job that have nothing to help with sleep here
+static s32 waiting_threads;
+static Semaphore * finished_sem;
+
+static thread_local s32 thread_index = -1;
+
+static bool PushJob( JobQueue * queue, s64 job ) {
+	s64 bottom = AtomicLoad( &queue->bottom );
+	s64 top = AtomicLoad( &queue->top );
+	if( bottom - top >= s64( JOB_QUEUE_SIZE ) ) {
+		return false;
+	}
+
+	AtomicStore( &queue->jobs[ bottom % JOB_QUEUE_SIZE ], job );
+	AtomicStore( &queue->bottom, bottom + 1 );
+
+	return true;
+}
+
+static s64 PopJob( JobQueue * queue ) {
+	s64 bottom = AtomicLoad( &queue->bottom ) - 1;
+	AtomicStore( &queue->bottom, bottom );
+	s64 top = AtomicLoad( &queue->top );
+
+	if( top > bottom ) {
+		AtomicStore( &queue->bottom, bottom + 1 );
+		return -1;
+	}
+
+	s64 job = AtomicLoad( &queue->jobs[ bottom % JOB_QUEUE_SIZE ] );
+	if( top == bottom ) {
+		// last job in the queue, race any thieves for it
+		if( !AtomicCompareExchange( &queue->top, top, top + 1 ) ) {
+			job = -1;
+		}
+		AtomicStore( &queue->bottom, bottom + 1 );
+	}
+
+	return job;
+}
+
+static s64 StealJob( JobQueue * queue ) {
+	s64 top = AtomicLoad( &queue->top );
+	s64 bottom = AtomicLoad( &queue->bottom );
+	if( top >= bottom ) {
+		return -1;
+	}
+
+	s64 job = AtomicLoad( &queue->jobs[ top % JOB_QUEUE_SIZE ] );
+	if( !AtomicCompareExchange( &queue->top, top, top + 1 ) ) {
+		return -1;
+	}
+
+	return job;
+}
+
+static bool AnyQueuedJobs() {
+	for( u32 i = 0; i < num_threads; i++ ) {
+		if( AtomicLoad( &threads[ i ].queue.bottom ) > AtomicLoad( &threads[ i ].queue.top ) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static s64 FindJob( s32 self ) {
+	PoolThread * thread = &threads[ self ];
+
+	s64 job = PopJob( &thread->queue );
+	if( job != -1 ) {
+		return job;
+	}
+
+	for( u32 i = 0; i < num_threads; i++ ) {
+		u32 victim = ( thread->next_victim + i ) % num_threads;
+		if( victim == u32( self ) )
+			continue;
+
+		job = StealJob( &threads[ victim ].queue );
+		if( job != -1 ) {
+			thread->next_victim = victim;
+			return job;
+		}
+	}
+
+	return -1;
+}
+
+static void FinishJob( Job * job ) {
+	while( job != NULL ) {
+		// once unfinished hits 0 the job can be reused, so read parent first
+		Job * parent = job->parent;
+		if( AtomicAdd( &job->unfinished, -1 ) != 0 )
+			break;
+		job = parent;
+	}
+}
+
+static void ExecuteJob( s32 self, s64 idx ) {
+	Job * job = &all_jobs[ idx ];
+
+	if( job->callback != NULL ) {
+		TempAllocator temp = threads[ self ].arena.temp();
+		job->callback( &temp, job->data );
+	}
+
+	FinishJob( job );
+	AtomicAdd( &jobs_outstanding, -1 );
+
+	s32 waiting = AtomicLoad( &waiting_threads );
+	if( waiting > 0 ) {
+		Signal( finished_sem, waiting );
+	}
+}
+
+/*
+ * runs jobs until done() returns true, and sleeps until something finishes
+ * when there's nothing left to help with
+ */
+template< typename F >
+static void RunJobsUntil( F done ) {
+	s32 self = thread_index;
+	assert( self >= 0 );
+
+	while( !done() ) {
+		s64 job = FindJob( self );
+		if( job != -1 ) {
+			ExecuteJob( self, job );
+			continue;
+		}
+
+		AtomicAdd( &waiting_threads, 1 );
+		if( !done() && !AnyQueuedJobs() ) {
+			Wait( finished_sem );
+		}
+		AtomicAdd( &waiting_threads, -1 );
+	}
+}
+
+static bool HasFreeJob( const PoolThread * thread ) {
+	for( size_t i = 0; i < JOBS_PER_THREAD; i++ ) {
+		if( AtomicLoad( &thread->jobs[ i ].unfinished ) == 0 ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static Job * AllocJob() {
+	PoolThread * thread = &threads[ thread_index ];
+
+	while( true ) {
+		// skip over jobs that are still going, e.g. the parent of a big ParallelFor
+		for( size_t i = 0; i < JOBS_PER_THREAD; i++ ) {
+			Job * job = &thread->jobs[ thread->next_job % JOBS_PER_THREAD ];
+			thread->next_job++;
+			if( AtomicLoad( &job->unfinished ) == 0 ) {
+				return job;
+			}
+		}
+
+		RunJobsUntil( [ thread ]() { return HasFreeJob( thread ); } );
+	}
+}
+
+static void ThreadPoolWorker( void * data ) {
+#if TRACY_ENABLE
+	tracy::SetThreadName( "Thread pool worker" );
+#endif
+
+	thread_index = s32( uintptr_t( data ) );
+
+	while( AtomicLoad( &shutting_down ) == 0 ) {
+		s64 job = FindJob( thread_index );
+		if( job != -1 ) {
+			ExecuteJob( thread_index, job );
+			continue;
+		}
+
+		AtomicAdd( &sleeping_workers, 1 );
+		if( !AnyQueuedJobs() && AtomicLoad( &shutting_down ) == 0 ) {
+			Wait( wake_sem );
+		}
+		AtomicAdd( &sleeping_workers, -1 );
+	}
+}
+
+void InitThreadPool() {
+	ZoneScoped;
+
+	shutting_down = 0;
+	jobs_outstanding = 0;
+	sleeping_workers = 0;
+	waiting_threads = 0;
+	wake_sem = NewSemaphore();
+	finished_sem = NewSemaphore();
+
+	u32 num_workers = Min2( GetCoreCount() - 1, u32( ARRAY_COUNT( threads ) - 1 ) );
+	num_threads = num_workers + 1;
+
+	all_jobs = ALLOC_MANY( sys_allocator, Job, num_threads * JOBS_PER_THREAD );
+	memset( all_jobs, 0, num_threads * JOBS_PER_THREAD * sizeof( Job ) );
+
+	constexpr size_t arena_size = 1024 * 1024; // 1MB
+
+	for( u32 i = 0; i < num_threads; i++ ) {
+		PoolThread * thread = &threads[ i ];
+		thread->thread = NULL;
+		thread->arena = ArenaAllocator( ALLOC_SIZE( sys_allocator, arena_size, 16 ), arena_size );
+		thread->queue.top = 0;
+		thread->queue.bottom = 0;
+		thread->jobs = all_jobs + i * JOBS_PER_THREAD;
+		thread->next_job = 0;
+		thread->next_victim = i + 1;
+	}
+
+	thread_index = 0;
+
+	for( u32 i = 1; i < num_threads; i++ ) {
+		threads[ i ].thread = NewThread( ThreadPoolWorker, ( void * ) uintptr_t( i ) );
+	}
+}
+
+void ShutdownThreadPool() {
+	ZoneScoped;
+
+	AtomicStore( &shutting_down, 1 );
+	Signal( wake_sem, checked_cast< int >( num_threads - 1 ) );
+
+	for( u32 i = 0; i < num_threads; i++ ) {
+		if( threads[ i ].thread != NULL ) {
+			JoinThread( threads[ i ].thread );
+		}
+		FREE( sys_allocator, threads[ i ].arena.get_memory() );
+	}
+
+	FREE( sys_allocator, all_jobs );
+
+	DeleteSemaphore( finished_sem );
+	DeleteSemaphore( wake_sem );
+}
+
+Job * NewJob( JobCallback callback, void * data ) {
+	assert( thread_index >= 0 );
+
+	Job * job = AllocJob();
+	job->callback = callback;
+	job->data = data;
+	job->parent = NULL;
+	AtomicStore( &job->unfinished, 1 );
+
+	return job;
+}
+
+Job * NewChildJob( Job * parent, JobCallback callback, void * data ) {
+	// the parent can't finish between here and the child finishing
+	AtomicAdd( &parent->unfinished, 1 );
+
+	Job * job = NewJob( callback, data );
+	job->parent = parent;
+
+	return job;
+}
+
+void RunJob( Job * job ) {
+	assert( thread_index >= 0 );
+
+	AtomicAdd( &jobs_outstanding, 1 );
+
+	s64 idx = job - all_jobs;
+	if( !PushJob( &threads[ thread_index ].queue, idx ) ) {
+		// our queue is full so just do it now
+		ExecuteJob( thread_index, idx );
+		return;
+	}
+
+	if( AtomicLoad( &sleeping_workers ) > 0 ) {
+		Signal( wake_sem );
+	}
+}
+
+void WaitForJob( Job * job ) {
+	ZoneScoped;
+
+	RunJobsUntil( [ job ]() { return AtomicLoad( &job->unfinished ) == 0; } );
+}
+
+void ThreadPoolDo( JobCallback callback, void * data ) {
+	ZoneScoped;
+
+	RunJob( NewJob( callback, data ) );
+}
+
+struct ParallelForChunk {
+	JobCallback callback;
+	char * datum;
+	size_t stride;
+	size_t n;
+};
+
+static void ParallelForJob( TempAllocator * temp, void * data ) {
+	const ParallelForChunk * chunk = ( const ParallelForChunk * ) data;
+
+	for( size_t i = 0; i < chunk->n; i++ ) {
+		// copies rewind to where the original started, so every item gets the whole arena
+		TempAllocator item_temp( *temp );
+		chunk->callback( &item_temp, chunk->datum + chunk->stride * i );
+	}
+}
+
+void ParallelFor( void * datum, size_t n, size_t stride, JobCallback callback ) {
+	ZoneScoped;
+
+	// a few chunks per thread so stealing can even out uneven items
+	ParallelForChunk chunks[ ARRAY_COUNT( threads ) * 4 ];
+	size_t num_chunks = Min2( n, size_t( num_threads * 4 ) );
+
+	Job * parent = NewJob( NULL );
+
+	size_t begin = 0;
+	for( size_t i = 0; i < num_chunks; i++ ) {
+		size_t end = n * ( i + 1 ) / num_chunks;
+
+		ParallelForChunk * chunk = &chunks[ i ];
+		chunk->callback = callback;
+		chunk->datum = ( ( char * ) datum ) + stride * begin;
+		chunk->stride = stride;
+		chunk->n = end - begin;
+
+		RunJob( NewChildJob( parent, ParallelForJob, chunk ) );
+
+		begin = end;
+	}
+
+	RunJob( parent );
+	WaitForJob( parent );
+}
+
+u32 NumThreadPoolThreads() {
+	return num_threads;
+}
+
+u32 ThreadPoolThreadIndex() {
+	assert( thread_index >= 0 );
+	return u32( thread_index );
+}
+
+void ThreadPoolFinish() {
+	ZoneScoped;
+
+	RunJobsUntil( []() { return AtomicLoad( &jobs_outstanding ) == 0; } );
+}
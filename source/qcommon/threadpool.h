@@ -0,0 +1,44 @@
+#pragma once
+
+#include "qcommon/types.h"
+
+using JobCallback = void ( * )( TempAllocator * temp, void * data );
+
+void InitThreadPool();
+void ShutdownThreadPool();
+
+void ThreadPoolDo( JobCallback callback, void * data = NULL );
+void ParallelFor( void * datum, size_t n, size_t stride, JobCallback callback );
+void ThreadPoolFinish();
+
+// the thread that called InitThreadPool is 0, the workers count up from 1
+u32 NumThreadPoolThreads();
+u32 ThreadPoolThreadIndex();
+
+template< typename T >
+void ParallelFor( Span< T > datum, JobCallback callback ) {
+	ParallelFor( datum.ptr, datum.n, sizeof( T ), callback );
+}
+
+/*
+ * jobs with dependencies
+ *
+ * a job isn't done until its callback and all of its children are done, so
+ * you can fan out from inside a job and let the caller wait on the parent.
+ * NewJob/NewChildJob only set the job up, RunJob queues it. children have to
+ * be added before the parent is run or from inside its callback. jobs belong to
+ * the pool and get reused once they're done, so don't hold on to them after
+ * waiting
+ *
+ * can be called from the thread that called InitThreadPool or from inside
+ * jobs
+ */
+
+struct Job;
+
+Job * NewJob( JobCallback callback, void * data = NULL );
+Job * NewChildJob( Job * parent, JobCallback callback, void * data = NULL );
+void RunJob( Job * job );
+
+// runs other jobs while it waits
+void WaitForJob( Job * job );
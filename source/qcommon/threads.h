@@ -17,4 +17,14 @@ void DeleteSemaphore( Semaphore * sem );
 void Wait( Semaphore * sem );
 void Signal( Semaphore * sem, int n = 1 );
 
+// all atomics are sequentially consistent
+// returns the new value
+s32 AtomicAdd( s32 * x, s32 n );
+s32 AtomicLoad( const s32 * x );
+s64 AtomicLoad( const s64 * x );
+void AtomicStore( s32 * x, s32 value );
+void AtomicStore( s64 * x, s64 value );
+// returns true if x was expected and is now desired
+bool AtomicCompareExchange( s64 * x, s64 expected, s64 desired );
+
 u32 GetCoreCount();
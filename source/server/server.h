@@ -22,6 +22,7 @@
 
 #include "qcommon/qcommon.h"
 #include "qcommon/rng.h"
+#include "qcommon/hashtable.h"
 #include "game/g_local.h"
 
 //=============================================================================
@@ -55,6 +56,13 @@ struct server_t {
 	char configstrings[MAX_CONFIGSTRINGS][MAX_CONFIGSTRING_CHARS];
 	SyncEntityState baselines[MAX_EDICTS];
 
+	// the match state of the last UPDATE_BACKUP snapshots, shared by every
+	// client's frame instead of each client keeping its own copies
+	SyncGameState gamestates[UPDATE_BACKUP];
+	int64_t gamestate_framenums[UPDATE_BACKUP];
+
+	int64_t snap_entities_framenum;     // frame svs.snap_entity_bits was gathered for
+
 	//
 	// global variables shared between game and server
 	//
@@ -76,7 +84,7 @@ struct client_snapshot_t {
 	int first_entity;                   // into the circular sv.client_entities[]
 	int64_t sentTimeStamp;         // time at what this frame snap was sent to the clients
 	unsigned int UcmdExecuted;
-	SyncGameState gameState;
+	const SyncGameState *gameState;     // into sv.gamestates
 };
 
 struct game_command_t {
@@ -168,17 +176,52 @@ struct server_static_demo_t {
 	char *tempname;
 	time_t localtime;
 	int64_t basetime, duration;
+	int64_t last_keyframe;          // gametime of the last non-delta frame
 	client_t client;                // special client for writing the messages
 	char meta_data[SNAP_MAX_DEMO_META_DATA_SIZE];
 	size_t meta_data_realsize;
 };
 
+#define MAX_SNAPSHOT_ENTITIES   1024
+struct snapshotEntityNumbers_t {
+	int numSnapshotEntities;
+	int snapshotEntities[MAX_SNAPSHOT_ENTITIES];
+	uint8_t entityAddedToSnapList[MAX_EDICTS / 8];
+};
+
+struct EntityDeltaCache;
+struct SnapEntityBits;
+
+// per-client state for building snapshots on the thread pool
+struct client_snapjob_t {
+	client_t *client;
+	bool culled;
+	snapshotEntityNumbers_t entities;
+	msg_t msg;
+	uint8_t msgData[MAX_MSGLEN];
+};
+
 struct client_entities_t {
 	unsigned num_entities;              // maxclients->integer*UPDATE_BACKUP*MAX_PACKET_ENTITIES
 	unsigned next_entities;             // next client_entity to use
 	SyncEntityState *entities;           // [num_entities]
 };
 
+// where SV_Frame spends its time, only measured while svs.frame_timings is set
+enum sv_frame_stage_t {
+	SV_FRAME_READ_PACKETS,
+	SV_FRAME_GAME,
+	SV_FRAME_SNAPSHOTS,
+	SV_FRAME_DEMO,
+	SV_FRAME_OTHER,
+
+	SV_FRAME_NUM_STAGES
+};
+
+struct sv_frame_timings_t {
+	u64 nsec[SV_FRAME_NUM_STAGES];
+};
+
 struct server_static_t {
 	bool initialized;               // sv_init has completed
 	int64_t realtime;               // real world time - always increasing, no clamping, etc
@@ -197,14 +240,23 @@ struct server_static_t {
 
 	client_t *clients;                  // [sv_maxclients->integer];
 	client_entities_t client_entities;
+	client_snapjob_t *snapjobs;         // [sv_maxclients->integer];
+	ZSTD_CCtx_s **zstd_contexts;        // [sv_maxclients->integer], netchan compression contexts by client slot
+	EntityDeltaCache *entity_delta_cache;
+	SnapEntityBits *snap_entity_bits;
+
+	Hashtable< MAX_CLIENTS * 4 > client_sessions;   // netchan session id -> client slot
 
 	challenge_t challenges[MAX_CHALLENGES]; // to prevent invalid IPs from connecting
+	Hashtable< MAX_CHALLENGES * 2 > challenge_addresses; // base address -> challenges index
 
 	server_static_demo_t demo;
 
 	CollisionModel *cms;                // passed to CM-functions
 
 	u64 ent_string_checksum;
+
+	sv_frame_timings_t *frame_timings;  // SV_Frame adds to this if it's set
 };
 
 struct server_constant_t {
@@ -335,12 +387,14 @@ bool SV_ClientConnect( const socket_t *socket, const netadr_t *address, client_t
 	u64 session_id, int challenge, bool fakeClient );
 
 #ifndef _MSC_VER
+client_t *SV_FindClientBySession( u64 session_id );
 void SV_DropClient( client_t *drop, int type, const char *format, ... ) __attribute__( ( format( printf, 3, 4 ) ) );
 #else
 void SV_DropClient( client_t *drop, int type, _Printf_format_string_ const char *format, ... );
 #endif
 
 void SV_ExecuteClientThinks( int clientNum );
+int SV_PendingUserCommands( int clientNum, usercmd_t *ucmds, int maxcmds );
 void SV_ClientResetCommandBuffers( client_t *client );
 void SV_ClientCloseDownload( client_t *client );
 
@@ -349,11 +403,25 @@ void SV_ClientCloseDownload( client_t *client );
 //
 void SV_Status_f();
 
+//
+// sv_bench.c
+//
+void SV_LoadBench_f();
+
+//
+// sv_replaybench.c
+//
+void SV_BenchRecord_f();
+void SV_BenchReplay_f();
+void SV_BenchRecordFrame();
+void SV_BenchPmove( const gs_state_t *gs, pmove_t *pm ); // Pmove, recorded while benchrecord is running
+
 //
 // sv_ents.c
 //
 void SV_WriteFrameSnapToClient( client_t *client, msg_t *msg );
 void SV_BuildClientFrameSnap( client_t *client );
+void SV_InvalidateSnapEntities();
 
 
 //
@@ -402,10 +470,28 @@ void SV_Web_RemoveGameClient( const char *session );
 // snap_write
 //
 void SNAP_WriteFrameSnapToClient( ginfo_t *gi, client_t *client, msg_t *msg, int64_t frameNum, int64_t gameTime,
-	SyncEntityState *baselines, client_entities_t *client_entities );
+	SyncEntityState *baselines, client_entities_t *client_entities, EntityDeltaCache *delta_cache );
+
+void SNAP_WriteDeltaGameState( msg_t *msg, const SyncGameState *from, const SyncGameState *to );
+void SNAP_WriteDeltaPlayerStates( msg_t *msg, const SyncPlayerState *from, int from_num, const SyncPlayerState *to, int to_num );
+void SNAP_WriteDeltaEntities( msg_t *msg, client_entities_t *ring, int from_first, int from_num, int to_first, int to_num,
+	int64_t from_frame, const SyncEntityState *baselines, EntityDeltaCache *delta_cache );
+
+EntityDeltaCache *SNAP_NewEntityDeltaCache( Allocator *a );
+void SNAP_DeleteEntityDeltaCache( Allocator *a, EntityDeltaCache *cache );
+void SNAP_ClearEntityDeltaCache( EntityDeltaCache *cache );
+
+SnapEntityBits *SNAP_NewSnapEntityBits( Allocator *a );
+void SNAP_DeleteSnapEntityBits( Allocator *a, SnapEntityBits *bits );
+void SNAP_GatherSnapEntities( CollisionModel *cms, ginfo_t *gi, SnapEntityBits *bits );
 
-void SNAP_BuildClientFrameSnap( CollisionModel *cms, ginfo_t *gi, int64_t frameNum, int64_t timeStamp,
+void SNAP_BuildClientFrameSnap( CollisionModel *cms, ginfo_t *gi, const SnapEntityBits *bits, int64_t frameNum, int64_t timeStamp,
 	client_t *client,
-	SyncGameState *gameState, client_entities_t *client_entities,
+	const SyncGameState *gameState, client_entities_t *client_entities,
 	mempool_t *mempool );
+bool SNAP_CullClientFrameSnap( CollisionModel *cms, ginfo_t *gi, const SnapEntityBits *bits, int64_t frameNum, int64_t timeStamp,
+	client_t *client, const SyncGameState *gameState, mempool_t *mempool,
+	snapshotEntityNumbers_t *entsList );
+void SNAP_StoreClientFrameEntities( ginfo_t *gi, client_t *client, int64_t frameNum,
+	client_entities_t *client_entities, const snapshotEntityNumbers_t *entsList );
 void SNAP_FreeClientFrames( client_t * client );
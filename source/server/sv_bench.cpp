@@ -0,0 +1,649 @@
+#include <algorithm>
+
+#include "server/server.h"
+#include "qcommon/csprng.h"
+#include "qcommon/version.h"
+#include "cgame/cg_public.h"
+
+/*
+ * load benchmark
+ *
+ * runs the server flat out with a bunch of in-process clients connected
+ * over loopback. the clients speak the real protocol, so connecting,
+ * delta compressed snapshots, usercmds and reliable commands all go
+ * through the same code a remote client would hit
+ */
+
+#define BENCH_MAX_CONNECT_TIME 30000 // msecs of game time
+#define BENCH_RESEND_TIME 100
+#define BENCH_UCMD_RESEND 3
+
+enum benchclient_state_t {
+	BENCHCLIENT_CHALLENGING,
+	BENCHCLIENT_CONNECTING,
+	BENCHCLIENT_HANDSHAKE,
+	BENCHCLIENT_CONNECTED,
+	BENCHCLIENT_ACTIVE,
+	BENCHCLIENT_DROPPED,
+};
+
+struct benchclient_t {
+	benchclient_state_t state;
+	int num;
+
+	socket_t socket;
+	netchan_t netchan;
+	u64 session_id;
+	int challenge;
+	int64_t last_send;
+
+	char reliable_commands[MAX_RELIABLE_COMMANDS][MAX_STRING_CHARS];
+	int64_t reliable_sequence;
+	int64_t reliable_acknowledge;
+	int64_t last_executed_server_command;
+
+	usercmd_t cmds[CMD_BACKUP];
+	unsigned int cmd_num;
+	unsigned int ucmd_acknowledged;
+
+	snapshot_t *snaps;
+	SyncEntityState *baselines;
+	int64_t received_snap;
+	int64_t server_time;
+
+	// scripted input
+	RNG rng;
+	int64_t next_input;
+	s8 forwardmove, sidemove;
+	float yaw, yaw_speed;
+	u32 buttons;
+
+	size_t bytes_in, bytes_out;
+	size_t packets_in, packets_out;
+	size_t frames, invalid_frames;
+	bool measured;
+};
+
+static netadr_t bench_server_address;
+
+/*
+* SV_Bench_AddReliableCommand
+*/
+static void SV_Bench_AddReliableCommand( benchclient_t *cl, const char *cmd ) {
+	if( cl->reliable_sequence - cl->reliable_acknowledge >= MAX_RELIABLE_COMMANDS - 1 ) {
+		Com_Printf( "loadbench: client %d reliable command overflow\n", cl->num );
+		cl->state = BENCHCLIENT_DROPPED;
+		return;
+	}
+
+	cl->reliable_sequence++;
+	Q_strncpyz( cl->reliable_commands[cl->reliable_sequence & ( MAX_RELIABLE_COMMANDS - 1 )], cmd, MAX_STRING_CHARS );
+}
+
+/*
+* SV_Bench_ClearState
+*
+* Like CL_ClearState, the server resets its command buffers when it sends
+* serverdata so we have to start counting from zero too
+*/
+static void SV_Bench_ClearState( benchclient_t *cl ) {
+	cl->reliable_sequence = 0;
+	cl->reliable_acknowledge = 0;
+	cl->last_executed_server_command = 0;
+	cl->cmd_num = 0;
+	cl->ucmd_acknowledged = 0;
+	cl->received_snap = 0;
+	memset( cl->cmds, 0, sizeof( cl->cmds ) );
+	memset( cl->baselines, 0, MAX_EDICTS * sizeof( SyncEntityState ) );
+}
+
+/*
+* SV_Bench_Reset
+*
+* Forget everything about the server, for connecting and reconnecting
+*/
+static void SV_Bench_Reset( benchclient_t *cl ) {
+	SV_Bench_ClearState( cl );
+	cl->state = BENCHCLIENT_CHALLENGING;
+	cl->last_send = 0;
+	cl->server_time = 0;
+}
+
+/*
+* SV_Bench_Connect
+*/
+static void SV_Bench_Connect( benchclient_t *cl ) {
+	char userinfo[MAX_INFO_STRING] = "";
+	Info_SetValueForKey( userinfo, "name", va( "loadbench%d", cl->num ) );
+
+	Netchan_OutOfBandPrint( &cl->socket, &bench_server_address, "connect %i %" PRIu64 " %i \"%s\" %s\n",
+		APP_PROTOCOL_VERSION, cl->session_id, cl->challenge, userinfo, Netchan_CompressionOffer() );
+}
+
+/*
+* SV_Bench_ConnectionlessPacket
+*/
+static void SV_Bench_ConnectionlessPacket( benchclient_t *cl, const netadr_t *address, msg_t *msg ) {
+	MSG_BeginReading( msg );
+	MSG_ReadInt32( msg ); // skip the -1
+
+	char line[MAX_STRING_CHARS];
+	Q_strncpyz( line, MSG_ReadStringLine( msg ), sizeof( line ) );
+
+	if( strncmp( line, "challenge ", 10 ) == 0 && cl->state == BENCHCLIENT_CHALLENGING ) {
+		cl->challenge = atoi( line + 10 );
+		cl->state = BENCHCLIENT_CONNECTING;
+		cl->last_send = svs.gametime;
+		SV_Bench_Connect( cl );
+		return;
+	}
+
+	if( strcmp( line, "client_connect" ) == 0 && cl->state == BENCHCLIENT_CONNECTING ) {
+		MSG_ReadStringLine( msg ); // http session
+		NetchanCompression compression = NetchanCompression( atoi( MSG_ReadStringLine( msg ) ) );
+
+		Netchan_Setup( &cl->netchan, &cl->socket, address, cl->session_id );
+		cl->netchan.compression = compression;
+		cl->state = BENCHCLIENT_HANDSHAKE;
+		cl->last_send = 0;
+		SV_Bench_AddReliableCommand( cl, "new" );
+		return;
+	}
+}
+
+/*
+* SV_Bench_ServerCommand
+*/
+static void SV_Bench_ServerCommand( benchclient_t *cl, const char *text ) {
+	char cmd[MAX_STRING_CHARS];
+	Q_strncpyz( cmd, text, sizeof( cmd ) );
+
+	char *args = strchr( cmd, ' ' );
+	if( args != NULL ) {
+		*args = '\0';
+		args++;
+	}
+	else {
+		args = cmd + strlen( cmd );
+	}
+
+	if( strcmp( cmd, "cmd" ) == 0 ) {
+		SV_Bench_AddReliableCommand( cl, args );
+	}
+	else if( strcmp( cmd, "precache" ) == 0 && cl->state == BENCHCLIENT_CONNECTED ) {
+		// we don't load anything, so go straight in and join the game
+		SV_Bench_AddReliableCommand( cl, va( "begin %i", atoi( args ) ) );
+		SV_Bench_AddReliableCommand( cl, "join" );
+		SV_Bench_AddReliableCommand( cl, "ready" );
+		cl->state = BENCHCLIENT_ACTIVE;
+	}
+	else if( strcmp( cmd, "reconnect" ) == 0 || strcmp( cmd, "forcereconnect" ) == 0 ) {
+		SV_Bench_Reset( cl );
+	}
+	else if( strcmp( cmd, "disconnect" ) == 0 ) {
+		Com_Printf( "loadbench: client %d was disconnected: %s\n", cl->num, args );
+		cl->state = BENCHCLIENT_DROPPED;
+	}
+}
+
+/*
+* SV_Bench_ParseServerMessage
+*
+* Handles a server message the way CL_ParseServerMessage would
+*/
+static bool SV_Bench_ParseServerMessage( benchclient_t *cl, msg_t *msg ) {
+	while( msg->readcount < msg->cursize && cl->state != BENCHCLIENT_DROPPED ) {
+		int cmd = MSG_ReadUint8( msg );
+
+		switch( cmd ) {
+			default:
+				Com_Printf( "loadbench: client %d got bad command %i\n", cl->num, cmd );
+				return false;
+
+			case svc_servercmd: {
+				int64_t num = MSG_ReadInt32( msg );
+				const char *text = MSG_ReadString( msg );
+				if( num > cl->last_executed_server_command ) {
+					cl->last_executed_server_command = num;
+					SV_Bench_ServerCommand( cl, text );
+				}
+			} break;
+
+			case svc_serverdata: {
+				// the server resends this until we ack it, and it's always sent alone
+				if( cl->state != BENCHCLIENT_HANDSHAKE ) {
+					return true;
+				}
+
+				MSG_ReadInt32( msg ); // protocol
+				int spawncount = MSG_ReadInt32( msg );
+				MSG_ReadInt16( msg ); // snapFrameTime
+				MSG_ReadInt16( msg ); // playernum
+				int sv_bitflags = MSG_ReadUint8( msg );
+				if( sv_bitflags & SV_BITFLAGS_HTTP ) {
+					if( sv_bitflags & SV_BITFLAGS_HTTP_BASEURL ) {
+						MSG_ReadString( msg );
+					} else {
+						MSG_ReadInt16( msg );
+					}
+				}
+
+				SV_Bench_ClearState( cl );
+				cl->state = BENCHCLIENT_CONNECTED;
+				SV_Bench_AddReliableCommand( cl, va( "configstrings %i 0", spawncount ) );
+			} break;
+
+			case svc_spawnbaseline:
+				SNAP_ParseBaseline( msg, cl->baselines );
+				break;
+
+			case svc_clcack:
+				cl->reliable_acknowledge = MSG_ReadUintBase128( msg );
+				cl->ucmd_acknowledged = MSG_ReadUintBase128( msg );
+				break;
+
+			case svc_frame: {
+				snapshot_t *last = cl->received_snap > 0 ? &cl->snaps[cl->received_snap & UPDATE_MASK] : NULL;
+				snapshot_t *snap = SNAP_ParseFrame( msg, last, cl->snaps, cl->baselines, 0 );
+				cl->frames++;
+				if( snap->valid ) {
+					cl->received_snap = snap->serverFrame;
+					cl->server_time = Max2( cl->server_time, snap->serverTime );
+				} else {
+					cl->invalid_frames++;
+				}
+			} break;
+		}
+	}
+
+	return msg->readcount <= msg->cursize;
+}
+
+/*
+* SV_Bench_ReadPackets
+*/
+static void SV_Bench_ReadPackets( benchclient_t *cl ) {
+	static msg_t msg;
+	static uint8_t msg_data[MAX_MSGLEN];
+
+	MSG_Init( &msg, msg_data, sizeof( msg_data ) );
+
+	netadr_t address;
+	while( NET_GetPacket( &cl->socket, &address, &msg ) > 0 ) {
+		cl->bytes_in += msg.cursize;
+		cl->packets_in++;
+
+		if( *( int * ) msg.data == -1 ) {
+			SV_Bench_ConnectionlessPacket( cl, &address, &msg );
+			continue;
+		}
+
+		if( cl->state < BENCHCLIENT_HANDSHAKE || cl->state == BENCHCLIENT_DROPPED ) {
+			continue;
+		}
+
+		if( !Netchan_Process( &cl->netchan, &msg ) ) {
+			continue;
+		}
+
+		MSG_BeginReading( &msg );
+		MSG_ReadInt32( &msg ); // sequence
+		MSG_ReadInt32( &msg ); // sequence_ack
+		if( msg.compressed && Netchan_DecompressMessage( &cl->netchan, &msg ) < 0 ) {
+			continue;
+		}
+
+		if( !SV_Bench_ParseServerMessage( cl, &msg ) ) {
+			cl->state = BENCHCLIENT_DROPPED;
+		}
+	}
+}
+
+/*
+* SV_Bench_CreateUserCommand
+*
+* Runs around, turns, jumps and shoots at random
+*/
+static void SV_Bench_CreateUserCommand( benchclient_t *cl, int msec ) {
+	if( svs.gametime >= cl->next_input ) {
+		// bias towards running forwards like a real player would
+		s8 forwardmoves[] = { -127, 0, 127, 127 };
+		s8 sidemoves[] = { -127, 0, 127 };
+		cl->forwardmove = random_select( &cl->rng, forwardmoves );
+		cl->sidemove = random_select( &cl->rng, sidemoves );
+		cl->yaw_speed = random_uniform_float( &cl->rng, -180.0f, 180.0f );
+		cl->buttons = random_p( &cl->rng, 0.3f ) ? BUTTON_ATTACK : 0;
+		cl->next_input = svs.gametime + random_uniform( &cl->rng, 300, 1500 );
+	}
+
+	cl->yaw = AngleNormalize180( cl->yaw + cl->yaw_speed * msec * 0.001f );
+	cl->server_time += msec;
+
+	cl->cmd_num++;
+	usercmd_t *cmd = &cl->cmds[cl->cmd_num & CMD_MASK];
+	memset( cmd, 0, sizeof( *cmd ) );
+	cmd->msec = msec;
+	cmd->buttons = cl->buttons;
+	cmd->entropy = random_u32( &cl->rng );
+	cmd->serverTimeStamp = cl->server_time;
+	cmd->angles[YAW] = ANGLE2SHORT( cl->yaw );
+	cmd->forwardmove = cl->forwardmove;
+	cmd->sidemove = cl->sidemove;
+	cmd->upmove = random_p( &cl->rng, 0.02f ) ? 127 : 0;
+}
+
+/*
+* SV_Bench_Transmit
+*/
+static void SV_Bench_Transmit( benchclient_t *cl, msg_t *msg ) {
+	Netchan_PushAllFragments( &cl->netchan );
+
+	if( msg->cursize > 60 ) {
+		Netchan_CompressMessage( &cl->netchan, msg );
+	}
+
+	size_t outgoing = cl->netchan.outgoingSequence;
+	Netchan_Transmit( &cl->netchan, msg );
+
+	// the netchan header isn't in msg, so count it here
+	cl->bytes_out += msg->cursize + PACKET_HEADER;
+	cl->packets_out += cl->netchan.outgoingSequence - outgoing;
+}
+
+/*
+* SV_Bench_SendPackets
+*/
+static void SV_Bench_SendPackets( benchclient_t *cl, int msec ) {
+	switch( cl->state ) {
+		case BENCHCLIENT_CHALLENGING:
+			if( cl->last_send == 0 || svs.gametime - cl->last_send >= BENCH_RESEND_TIME ) {
+				Netchan_OutOfBandPrint( &cl->socket, &bench_server_address, "getchallenge\n" );
+				cl->last_send = svs.gametime;
+			}
+			return;
+
+		case BENCHCLIENT_CONNECTING:
+			if( svs.gametime - cl->last_send >= BENCH_RESEND_TIME ) {
+				SV_Bench_Connect( cl );
+				cl->last_send = svs.gametime;
+			}
+			return;
+
+		case BENCHCLIENT_DROPPED:
+			return;
+
+		case BENCHCLIENT_HANDSHAKE:
+		case BENCHCLIENT_CONNECTED:
+		case BENCHCLIENT_ACTIVE:
+			break;
+	}
+
+	// like the client, only send reliable commands while connecting
+	if( cl->state != BENCHCLIENT_ACTIVE && cl->last_send != 0 && svs.gametime - cl->last_send < BENCH_RESEND_TIME ) {
+		return;
+	}
+	cl->last_send = svs.gametime;
+
+	msg_t msg;
+	uint8_t msg_data[MAX_MSGLEN];
+	MSG_Init( &msg, msg_data, sizeof( msg_data ) );
+
+	MSG_WriteUint8( &msg, clc_svcack );
+	MSG_WriteIntBase128( &msg, cl->last_executed_server_command );
+
+	for( int64_t i = cl->reliable_acknowledge + 1; i <= cl->reliable_sequence; i++ ) {
+		MSG_WriteUint8( &msg, clc_clientcommand );
+		MSG_WriteIntBase128( &msg, i );
+		MSG_WriteString( &msg, cl->reliable_commands[i & ( MAX_RELIABLE_COMMANDS - 1 )] );
+	}
+
+	if( cl->state == BENCHCLIENT_ACTIVE ) {
+		SV_Bench_CreateUserCommand( cl, msec );
+
+		unsigned int head = cl->cmd_num + 1;
+		unsigned int first = Max2( cl->ucmd_acknowledged + 1, head > BENCH_UCMD_RESEND ? head - BENCH_UCMD_RESEND : 1u );
+
+		MSG_WriteUint8( &msg, clc_move );
+		MSG_WriteInt32( &msg, cl->received_snap > 0 ? cl->snaps[cl->received_snap & UPDATE_MASK].serverFrame : -1 );
+		MSG_WriteInt32( &msg, head );
+		MSG_WriteUint8( &msg, head - first );
+
+		usercmd_t nullcmd = { };
+		const usercmd_t *oldcmd = &nullcmd;
+		for( unsigned int i = first; i < head; i++ ) {
+			const usercmd_t *cmd = &cl->cmds[i & CMD_MASK];
+			MSG_WriteDeltaUsercmd( &msg, oldcmd, cmd );
+			oldcmd = cmd;
+		}
+	}
+
+	SV_Bench_Transmit( cl, &msg );
+}
+
+/*
+* SV_Bench_Disconnect
+*/
+static void SV_Bench_Disconnect( benchclient_t *cl ) {
+	if( cl->state >= BENCHCLIENT_HANDSHAKE && cl->state <= BENCHCLIENT_ACTIVE ) {
+		msg_t msg;
+		uint8_t msg_data[MAX_STRING_CHARS];
+		MSG_Init( &msg, msg_data, sizeof( msg_data ) );
+
+		MSG_WriteUint8( &msg, clc_clientcommand );
+		MSG_WriteIntBase128( &msg, cl->reliable_sequence + 1 );
+		MSG_WriteString( &msg, "disconnect" );
+		SV_Bench_Transmit( cl, &msg );
+	}
+
+	NET_CloseSocket( &cl->socket );
+	FREE( sys_allocator, cl->snaps );
+	FREE( sys_allocator, cl->baselines );
+}
+
+/*
+* SV_Bench_PrintTimes
+*/
+static void SV_Bench_PrintTimes( const char *label, Span< u64 > nsec ) {
+	u64 total = 0;
+	for( u64 t : nsec ) {
+		total += t;
+	}
+
+	std::sort( nsec.begin(), nsec.end() );
+
+	size_t n = nsec.n;
+	Com_Printf( "  %-14s avg %8.1fus  p50 %8.1fus  p95 %8.1fus  p99 %8.1fus  max %8.1fus\n", label,
+		total / 1e3 / n, nsec[n / 2] / 1e3, nsec[n * 95 / 100] / 1e3, nsec[n * 99 / 100] / 1e3, nsec[n - 1] / 1e3 );
+}
+
+/*
+* SV_LoadBench_f
+*
+* loadbench <clients> [seconds] [seed]
+*/
+void SV_LoadBench_f() {
+	if( Cmd_Argc() < 2 ) {
+		Com_Printf( "Usage: %s <clients> [seconds] [seed]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if( !svs.initialized || sv.state != ss_game ) {
+		Com_Printf( "No map loaded\n" );
+		return;
+	}
+
+	int num_clients = Clamp( 1, atoi( Cmd_Argv( 1 ) ), sv_maxclients->integer );
+	int seconds = Cmd_Argc() > 2 ? Max2( atoi( Cmd_Argv( 2 ) ), 1 ) : 30;
+	u64 seed = Cmd_Argc() > 3 ? StringToU64( Cmd_Argv( 3 ), 0 ) : 0;
+
+	// dedicated servers don't normally listen on loopback
+	bool opened_loopback = false;
+	if( !svs.socket_loopback.open ) {
+		netadr_t address;
+		NET_InitAddress( &address, NA_LOOPBACK );
+		if( !NET_OpenSocket( &svs.socket_loopback, SOCKET_LOOPBACK, &address, true ) ) {
+			Com_Printf( "Couldn't open loopback socket: %s\n", NET_ErrorString() );
+			return;
+		}
+		opened_loopback = true;
+	}
+
+	defer {
+		if( opened_loopback ) {
+			NET_CloseSocket( &svs.socket_loopback );
+		}
+	};
+
+	NET_InitAddress( &bench_server_address, NA_LOOPBACK );
+
+	benchclient_t *clients = ALLOC_MANY( sys_allocator, benchclient_t, num_clients );
+	defer { FREE( sys_allocator, clients ); };
+
+	int opened = 0;
+	for( int i = 0; i < num_clients; i++ ) {
+		benchclient_t *cl = &clients[i];
+		memset( cl, 0, sizeof( *cl ) );
+		cl->num = i;
+		cl->rng = new_rng( seed, i );
+		CSPRNG_Bytes( &cl->session_id, sizeof( cl->session_id ) );
+		cl->snaps = ALLOC_MANY( sys_allocator, snapshot_t, UPDATE_BACKUP );
+		cl->baselines = ALLOC_MANY( sys_allocator, SyncEntityState, MAX_EDICTS );
+		SV_Bench_Reset( cl );
+
+		if( !NET_OpenSocket( &cl->socket, SOCKET_LOOPBACK, &bench_server_address, false ) ) {
+			Com_Printf( "Couldn't open loopback socket: %s\n", NET_ErrorString() );
+			FREE( sys_allocator, cl->snaps );
+			FREE( sys_allocator, cl->baselines );
+			break;
+		}
+		opened++;
+	}
+
+	defer {
+		for( int i = 0; i < opened; i++ ) {
+			SV_Bench_Disconnect( &clients[i] );
+		}
+
+		// let the server see the disconnects
+		SV_Frame( svc.gameFrameTime, svc.gameFrameTime );
+	};
+
+	int msec = svc.gameFrameTime;
+
+	// connect everyone before we start timing
+	int64_t connect_start = svs.gametime;
+	while( svs.gametime - connect_start < BENCH_MAX_CONNECT_TIME ) {
+		int active = 0;
+		for( int i = 0; i < opened; i++ ) {
+			SV_Bench_SendPackets( &clients[i], msec );
+			if( clients[i].state == BENCHCLIENT_ACTIVE && clients[i].received_snap > 0 ) {
+				active++;
+			}
+		}
+
+		if( active == opened ) {
+			break;
+		}
+
+		SV_Frame( msec, msec );
+
+		for( int i = 0; i < opened; i++ ) {
+			SV_Bench_ReadPackets( &clients[i] );
+		}
+	}
+
+	int connected = 0;
+	for( int i = 0; i < opened; i++ ) {
+		benchclient_t *cl = &clients[i];
+		cl->measured = cl->state == BENCHCLIENT_ACTIVE;
+		if( cl->measured ) {
+			connected++;
+		}
+		cl->bytes_in = cl->bytes_out = 0;
+		cl->packets_in = cl->packets_out = 0;
+		cl->frames = cl->invalid_frames = 0;
+	}
+
+	Com_Printf( "loadbench: %d/%d clients connected in %" PRIi64 "ms of game time\n", connected, num_clients, svs.gametime - connect_start );
+
+	size_t num_frames = seconds * 1000 / msec;
+	Span< u64 > frame_nsec = ALLOC_SPAN( sys_allocator, u64, num_frames );
+	defer { FREE( sys_allocator, frame_nsec.ptr ); };
+
+	Span< u64 > stage_nsec[SV_FRAME_NUM_STAGES];
+	for( int i = 0; i < SV_FRAME_NUM_STAGES; i++ ) {
+		stage_nsec[i] = ALLOC_SPAN( sys_allocator, u64, num_frames );
+	}
+	defer {
+		for( int i = 0; i < SV_FRAME_NUM_STAGES; i++ ) {
+			FREE( sys_allocator, stage_nsec[i].ptr );
+		}
+	};
+
+	sv_frame_timings_t timings;
+	svs.frame_timings = &timings;
+	defer { svs.frame_timings = NULL; };
+
+	u64 bench_start = Sys_Nanoseconds();
+
+	for( size_t frame = 0; frame < num_frames; frame++ ) {
+		for( int i = 0; i < opened; i++ ) {
+			SV_Bench_SendPackets( &clients[i], msec );
+		}
+
+		memset( &timings, 0, sizeof( timings ) );
+		u64 frame_start = Sys_Nanoseconds();
+		SV_Frame( msec, msec );
+		frame_nsec[frame] = Sys_Nanoseconds() - frame_start;
+
+		for( int i = 0; i < SV_FRAME_NUM_STAGES; i++ ) {
+			stage_nsec[i][frame] = timings.nsec[i];
+		}
+
+		for( int i = 0; i < opened; i++ ) {
+			SV_Bench_ReadPackets( &clients[i] );
+		}
+	}
+
+	u64 bench_nsec = Sys_Nanoseconds() - bench_start;
+
+	size_t bytes_in = 0, bytes_out = 0;
+	size_t packets_in = 0, packets_out = 0;
+	size_t frames = 0, invalid_frames = 0;
+	int dropped = 0;
+	for( int i = 0; i < opened; i++ ) {
+		const benchclient_t *cl = &clients[i];
+		if( !cl->measured ) {
+			continue;
+		}
+
+		bytes_in += cl->bytes_in;
+		bytes_out += cl->bytes_out;
+		packets_in += cl->packets_in;
+		packets_out += cl->packets_out;
+		frames += cl->frames;
+		invalid_frames += cl->invalid_frames;
+		if( cl->state == BENCHCLIENT_DROPPED ) {
+			dropped++;
+		}
+	}
+
+	double game_seconds = num_frames * msec / 1000.0;
+	connected = Max2( connected, 1 );
+
+	Com_Printf( "loadbench: %zu frames, %.1fs of game time in %.2fs (%.1fx realtime), %d clients dropped\n",
+		num_frames, game_seconds, bench_nsec / 1e9, game_seconds / ( bench_nsec / 1e9 ), dropped );
+
+	const char *stage_names[] = { "read packets", "game", "snapshots", "demo", "other" };
+	STATIC_ASSERT( ARRAY_COUNT( stage_names ) == SV_FRAME_NUM_STAGES );
+
+	SV_Bench_PrintTimes( "SV_Frame", frame_nsec );
+	for( int i = 0; i < SV_FRAME_NUM_STAGES; i++ ) {
+		SV_Bench_PrintTimes( stage_names[i], stage_nsec[i] );
+	}
+
+	Com_Printf( "Per client: %.0f bytes/s down in %.1f packets/s, %.0f bytes/s up in %.1f packets/s\n",
+		bytes_in / game_seconds / connected, packets_in / game_seconds / connected,
+		bytes_out / game_seconds / connected, packets_out / game_seconds / connected );
+	Com_Printf( "Per client: %.1f snapshots/s, %zu invalid\n", frames / game_seconds / connected, invalid_frames );
+}
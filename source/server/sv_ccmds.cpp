@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "server/server.h"
+#include "qcommon/cmodel.h"
 #include "qcommon/fs.h"
 #include "qcommon/maplist.h"
 
@@ -219,6 +220,34 @@ static void SV_KillServer_f() {
 	SV_ShutdownGame( "Server was killed", false );
 }
 
+/*
+* SV_TestBVH_f
+* Check the bvh collision backend against the bsp on the current map
+*/
+static void SV_TestBVH_f() {
+	if( svs.cms == NULL ) {
+		Com_Printf( "No map loaded\n" );
+		return;
+	}
+
+	int count = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 100000;
+	CM_TestBVH( CM_Server, svs.cms, Max2( count, 1 ) );
+}
+
+/*
+* SV_DemoBench_f
+* Replay a demo through the snapshot parser and report how long it took
+*/
+static void SV_DemoBench_f() {
+	if( Cmd_Argc() < 2 ) {
+		Com_Printf( "Usage: %s <demo> [iterations]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	int iterations = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 1;
+	SNAP_BenchmarkDemo( Cmd_Argv( 1 ), Max2( iterations, 1 ) );
+}
+
 //===========================================================
 
 /*
@@ -234,6 +263,11 @@ void SV_InitOperatorCommands() {
 	Cmd_AddCommand( "devmap", SV_Map_f );
 	Cmd_AddCommand( "gamemap", SV_Map_f );
 	Cmd_AddCommand( "killserver", SV_KillServer_f );
+	Cmd_AddCommand( "cm_bvhtest", SV_TestBVH_f );
+	Cmd_AddCommand( "demobench", SV_DemoBench_f );
+	Cmd_AddCommand( "loadbench", SV_LoadBench_f );
+	Cmd_AddCommand( "benchrecord", SV_BenchRecord_f );
+	Cmd_AddCommand( "benchreplay", SV_BenchReplay_f );
 
 	Cmd_AddCommand( "serverrecord", SV_Demo_Start_f );
 	Cmd_AddCommand( "serverrecordstop", SV_Demo_Stop_f );
@@ -261,6 +295,11 @@ void SV_ShutdownOperatorCommands() {
 	Cmd_RemoveCommand( "devmap" );
 	Cmd_RemoveCommand( "gamemap" );
 	Cmd_RemoveCommand( "killserver" );
+	Cmd_RemoveCommand( "cm_bvhtest" );
+	Cmd_RemoveCommand( "demobench" );
+	Cmd_RemoveCommand( "loadbench" );
+	Cmd_RemoveCommand( "benchrecord" );
+	Cmd_RemoveCommand( "benchreplay" );
 
 	Cmd_RemoveCommand( "serverrecord" );
 	Cmd_RemoveCommand( "serverrecordstop" );
@@ -46,6 +46,59 @@ void SV_ClientResetCommandBuffers( client_t *client ) {
 	client->lastSentFrameNum = 0;
 }
 
+/*
+* SV_ClientSessionKey
+*/
+static u64 SV_ClientSessionKey( u64 session_id ) {
+	// the top bit is reserved by Hashtable and 0 is the empty key
+	u64 key = session_id & ~( U64( 1 ) << U64( 63 ) );
+	return key == 0 ? 1 : key;
+}
+
+/*
+* SV_AddClientSession
+*
+* A client that reconnects before its old slot timed out comes back with the
+* same session id, so the newest connection takes over the lookup.
+*/
+static void SV_AddClientSession( client_t *client ) {
+	u64 key = SV_ClientSessionKey( client->netchan.session_id );
+	u64 slot = client - svs.clients;
+	if( !svs.client_sessions.add( key, slot ) ) {
+		svs.client_sessions.update( key, slot );
+	}
+}
+
+/*
+* SV_RemoveClientSession
+*/
+static void SV_RemoveClientSession( client_t *client ) {
+	u64 key = SV_ClientSessionKey( client->netchan.session_id );
+	u64 slot;
+	if( svs.client_sessions.get( key, &slot ) && slot == u64( client - svs.clients ) ) {
+		svs.client_sessions.remove( key );
+	}
+}
+
+/*
+* SV_FindClientBySession
+*
+* Returns the connected client that owns a netchan session, or NULL.
+*/
+client_t *SV_FindClientBySession( u64 session_id ) {
+	u64 slot;
+	if( !svs.client_sessions.get( SV_ClientSessionKey( session_id ), &slot ) ) {
+		return NULL;
+	}
+
+	client_t *client = &svs.clients[slot];
+	if( client->state == CS_FREE || client->state == CS_ZOMBIE || client->netchan.session_id != session_id ) {
+		return NULL;
+	}
+
+	return client;
+}
+
 /*
 * SV_ClientConnect
 * accept the new client
@@ -106,6 +159,7 @@ bool SV_ClientConnect( const socket_t *socket, const netadr_t *address, client_t
 		} else {
 			Netchan_Setup( &client->netchan, socket, address, session_id );
 		}
+		SV_AddClientSession( client );
 	}
 
 	// parse some info from the info strings
@@ -177,6 +231,10 @@ void SV_DropClient( client_t *drop, int type, const char *format, ... ) {
 		NET_CloseSocket( &drop->socket );
 	}
 
+	if( drop->state != CS_FREE && drop->state != CS_ZOMBIE ) {
+		SV_RemoveClientSession( drop );
+	}
+
 	drop->state = CS_ZOMBIE;    // become free in a few seconds
 	drop->name[0] = 0;
 }
@@ -624,7 +682,7 @@ USER CMD EXECUTION
 /*
 * SV_FindNextUserCommand - Returns the next valid usercmd_t in execution list
 */
-usercmd_t *SV_FindNextUserCommand( client_t *client ) {
+static usercmd_t *SV_FindNextUserCommand( client_t *client, int64_t ucmdTime ) {
 	usercmd_t *ucmd;
 	int64_t higherTime = 0;
 	unsigned int i;
@@ -634,7 +692,7 @@ usercmd_t *SV_FindNextUserCommand( client_t *client ) {
 	if( client ) {
 		for( i = client->UcmdExecuted + 1; i <= client->UcmdReceived; i++ ) {
 			// skip backups if already executed
-			if( client->UcmdTime >= client->ucmds[i & CMD_MASK].serverTimeStamp ) {
+			if( ucmdTime >= client->ucmds[i & CMD_MASK].serverTimeStamp ) {
 				continue;
 			}
 
@@ -649,37 +707,85 @@ usercmd_t *SV_FindNextUserCommand( client_t *client ) {
 }
 
 /*
-* SV_ExecuteClientThinks - Execute all pending usercmd_t
+* SV_ThinkingClient
+*
+* Returns the client if it has usercmds for SV_ExecuteClientThinks to run
 */
-void SV_ExecuteClientThinks( int clientNum ) {
-	unsigned int msec;
-	int64_t minUcmdTime;
-	int timeDelta;
-	client_t *client;
-	usercmd_t *ucmd;
-
+static client_t *SV_ThinkingClient( int clientNum ) {
 	if( clientNum >= sv_maxclients->integer || clientNum < 0 ) {
-		return;
+		return NULL;
 	}
 
-	client = svs.clients + clientNum;
+	client_t *client = svs.clients + clientNum;
 	if( client->state < CS_SPAWNED ) {
-		return;
+		return NULL;
 	}
 
 	if( client->edict->r.svflags & SVF_FAKECLIENT ) {
-		return;
+		return NULL;
 	}
 
+	return client;
+}
+
+/*
+* SV_FirstUserCommandTime
+*/
+static int64_t SV_FirstUserCommandTime( const client_t *client ) {
 	// don't let client command time delay too far away in the past
-	minUcmdTime = ( svs.gametime > 999 ) ? ( svs.gametime - 999 ) : 0;
-	if( client->UcmdTime < minUcmdTime ) {
-		client->UcmdTime = minUcmdTime;
+	int64_t minUcmdTime = ( svs.gametime > 999 ) ? ( svs.gametime - 999 ) : 0;
+	return Max2( client->UcmdTime, minUcmdTime );
+}
+
+/*
+* SV_UserCommandMsec
+*/
+static unsigned int SV_UserCommandMsec( const usercmd_t *ucmd, int64_t ucmdTime ) {
+	return Clamp( int64_t( 1 ), ucmd->serverTimeStamp - ucmdTime, int64_t( 200 ) );
+}
+
+/*
+* SV_PendingUserCommands
+*
+* Copies out the usercmds the next SV_ExecuteClientThinks will run, in
+* order and with msec filled in, without running them
+*/
+int SV_PendingUserCommands( int clientNum, usercmd_t *ucmds, int maxcmds ) {
+	client_t *client = SV_ThinkingClient( clientNum );
+	if( client == NULL ) {
+		return 0;
 	}
 
-	while( ( ucmd = SV_FindNextUserCommand( client ) ) != NULL ) {
-		msec = Clamp( int64_t( 1 ), ucmd->serverTimeStamp - client->UcmdTime, int64_t( 200 ) );
-		ucmd->msec = msec;
+	int numcmds = 0;
+	int64_t ucmdTime = SV_FirstUserCommandTime( client );
+	usercmd_t *ucmd;
+	while( numcmds < maxcmds && ( ucmd = SV_FindNextUserCommand( client, ucmdTime ) ) != NULL ) {
+		ucmds[numcmds] = *ucmd;
+		ucmds[numcmds].msec = SV_UserCommandMsec( ucmd, ucmdTime );
+		ucmdTime = ucmd->serverTimeStamp;
+		numcmds++;
+	}
+
+	return numcmds;
+}
+
+/*
+* SV_ExecuteClientThinks - Execute all pending usercmd_t
+*/
+void SV_ExecuteClientThinks( int clientNum ) {
+	int timeDelta;
+	client_t *client;
+	usercmd_t *ucmd;
+
+	client = SV_ThinkingClient( clientNum );
+	if( client == NULL ) {
+		return;
+	}
+
+	client->UcmdTime = SV_FirstUserCommandTime( client );
+
+	while( ( ucmd = SV_FindNextUserCommand( client, client->UcmdTime ) ) != NULL ) {
+		ucmd->msec = SV_UserCommandMsec( ucmd, client->UcmdTime );
 		timeDelta = 0;
 		if( client->lastframe > 0 ) {
 			timeDelta = -(int)( svs.gametime - ucmd->serverTimeStamp );
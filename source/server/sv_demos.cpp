@@ -27,16 +27,147 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcommon/array.h"
 #include "qcommon/fs.h"
 #include "qcommon/string.h"
+#include "qcommon/threads.h"
 
 #define SV_DEMO_DIR va( "demos/server%s%s", sv_demodir->string[0] ? "/" : "", sv_demodir->string[0] ? sv_demodir->string : "" )
 
+// snapshots are handed to a writer thread, so compressing them and slow
+// disks don't hold up the server frame. when the queue is full we wait for
+// the writer rather than drop messages
+#define SV_DEMO_QUEUE_SIZE 128
+
+struct demo_queued_message_t {
+	size_t len;
+	uint8_t data[MAX_MSGLEN];
+};
+
+static demo_queued_message_t *demo_queue;
+static size_t demo_queue_head;
+static size_t demo_queue_length;
+static bool demo_writer_quit;
+static bool demo_write_failed; // e.g. the disk is full, the main thread stops recording
+static Mutex *demo_queue_mutex;
+static Semaphore *demo_queued_sem;
+static Semaphore *demo_free_sem;
+static Thread *demo_writer_thread;
+
+static void SV_Demo_WriterThread( void *data ) {
+#if TRACY_ENABLE
+	tracy::SetThreadName( "Demo writer" );
+#endif
+
+	int demofile = *( int * )data;
+
+	while( true ) {
+		Wait( demo_queued_sem );
+
+		Lock( demo_queue_mutex );
+		if( demo_queue_length == 0 ) {
+			bool quit = demo_writer_quit;
+			Unlock( demo_queue_mutex );
+			if( quit ) {
+				break;
+			}
+			continue;
+		}
+		demo_queued_message_t *queued = &demo_queue[demo_queue_head % SV_DEMO_QUEUE_SIZE];
+		Unlock( demo_queue_mutex );
+
+		{
+			ZoneScopedN( "Write demo message" );
+
+			msg_t msg;
+			MSG_Init( &msg, queued->data, sizeof( queued->data ) );
+			msg.cursize = queued->len;
+			if( !SNAP_RecordDemoMessage( demofile, &msg, 0 ) ) {
+				Lock( demo_queue_mutex );
+				demo_write_failed = true;
+				Unlock( demo_queue_mutex );
+			}
+		}
+
+		Lock( demo_queue_mutex );
+		demo_queue_head++;
+		demo_queue_length--;
+		Unlock( demo_queue_mutex );
+
+		Signal( demo_free_sem );
+	}
+}
+
+static void SV_Demo_StartWriter() {
+	demo_queue = ALLOC_MANY( sys_allocator, demo_queued_message_t, SV_DEMO_QUEUE_SIZE );
+	demo_queue_head = 0;
+	demo_queue_length = 0;
+	demo_writer_quit = false;
+	demo_write_failed = false;
+
+	demo_queue_mutex = NewMutex();
+	demo_queued_sem = NewSemaphore();
+	demo_free_sem = NewSemaphore();
+	Signal( demo_free_sem, SV_DEMO_QUEUE_SIZE );
+
+	demo_writer_thread = NewThread( SV_Demo_WriterThread, &svs.demo.file );
+}
+
+/*
+* SV_Demo_StopWriter
+*
+* Blocks until everything queued has been written
+*/
+static void SV_Demo_StopWriter() {
+	ZoneScoped;
+
+	Lock( demo_queue_mutex );
+	demo_writer_quit = true;
+	Unlock( demo_queue_mutex );
+	Signal( demo_queued_sem );
+
+	JoinThread( demo_writer_thread );
+	demo_writer_thread = NULL;
+
+	DeleteSemaphore( demo_free_sem );
+	DeleteSemaphore( demo_queued_sem );
+	DeleteMutex( demo_queue_mutex );
+
+	FREE( sys_allocator, demo_queue );
+	demo_queue = NULL;
+}
+
 static void SV_Demo_WriteMessage( msg_t *msg ) {
+	ZoneScoped;
+
 	assert( svs.demo.file );
 	if( !svs.demo.file ) {
 		return;
 	}
 
-	SNAP_RecordDemoMessage( svs.demo.file, msg, 0 );
+	if( msg->cursize == 0 ) {
+		return;
+	}
+
+	Lock( demo_queue_mutex );
+	bool full = demo_queue_length == SV_DEMO_QUEUE_SIZE;
+	Unlock( demo_queue_mutex );
+
+	if( full ) {
+		Com_DPrintf( "Server demo writer can't keep up, waiting for it\n" );
+	}
+	Wait( demo_free_sem );
+
+	// only the writer thread removes messages, so the slot past the end stays ours
+	Lock( demo_queue_mutex );
+	demo_queued_message_t *queued = &demo_queue[( demo_queue_head + demo_queue_length ) % SV_DEMO_QUEUE_SIZE];
+	Unlock( demo_queue_mutex );
+
+	queued->len = msg->cursize;
+	memcpy( queued->data, msg->data, msg->cursize );
+
+	Lock( demo_queue_mutex );
+	demo_queue_length++;
+	Unlock( demo_queue_mutex );
+
+	Signal( demo_queued_sem );
 }
 
 static void SV_Demo_WriteStartMessages() {
@@ -46,6 +177,8 @@ static void SV_Demo_WriteStartMessages() {
 	SNAP_BeginDemoRecording( svs.demo.file, svs.spawncount, svc.snapFrameTime, SV_BITFLAGS_RELIABLE, sv.configstrings[0], sv.baselines );
 }
 
+static void SV_Demo_Stop( bool cancel, bool silent );
+
 void SV_Demo_WriteSnap() {
 	ZoneScoped;
 
@@ -57,6 +190,15 @@ void SV_Demo_WriteSnap() {
 		return;
 	}
 
+	Lock( demo_queue_mutex );
+	bool failed = demo_write_failed;
+	Unlock( demo_queue_mutex );
+	if( failed ) {
+		Com_Printf( "Error: Couldn't write the server demo, stopping recording\n" );
+		SV_Demo_Stop( false, true );
+		return;
+	}
+
 	for( i = 0; i < sv_maxclients->integer; i++ ) {
 		if( svs.clients[i].state >= CS_SPAWNED && svs.clients[i].edict &&
 			!( svs.clients[i].edict->r.svflags & SVF_NOCLIENT ) ) {
@@ -71,6 +213,14 @@ void SV_Demo_WriteSnap() {
 
 	MSG_Init( &msg, msg_buffer, sizeof( msg_buffer ) );
 
+	// write a full frame every so often so playback can seek to it
+	if( svs.gametime - svs.demo.last_keyframe >= SNAP_DEMO_KEYFRAME_INTERVAL ) {
+		svs.demo.client.nodelta = true;
+	}
+	if( svs.demo.client.nodelta ) {
+		svs.demo.last_keyframe = svs.gametime;
+	}
+
 	SV_BuildClientFrameSnap( &svs.demo.client );
 
 	SV_WriteFrameSnapToClient( &svs.demo.client, &msg );
@@ -155,7 +305,7 @@ void SV_Demo_Start_f() {
 	snprintf( svs.demo.tempname, demofilename_size, "%s.rec", svs.demo.filename );
 
 	// open it
-	if( FS_FOpenBaseFile( svs.demo.tempname, &svs.demo.file, FS_WRITE | SNAP_DEMO_GZ ) == -1 ) {
+	if( FS_FOpenBaseFile( svs.demo.tempname, &svs.demo.file, FS_WRITE | SNAP_DEMO_COMPRESSION ) == -1 ) {
 		Com_Printf( "Error: Couldn't open file: %s\n", svs.demo.tempname );
 		Mem_ZoneFree( svs.demo.filename );
 		svs.demo.filename = NULL;
@@ -174,6 +324,8 @@ void SV_Demo_Start_f() {
 	svs.demo.localtime = time( NULL );
 	SV_Demo_WriteStartMessages();
 
+	SV_Demo_StartWriter();
+
 	// write one nodelta frame
 	svs.demo.client.nodelta = true;
 	SV_Demo_WriteSnap();
@@ -188,6 +340,8 @@ static void SV_Demo_Stop( bool cancel, bool silent ) {
 		return;
 	}
 
+	SV_Demo_StopWriter();
+
 	if( cancel ) {
 		Com_Printf( "Canceled server demo recording: %s\n", svs.demo.filename );
 	} else {
@@ -196,13 +350,23 @@ static void SV_Demo_Stop( bool cancel, bool silent ) {
 		Com_Printf( "Stopped server demo recording: %s\n", svs.demo.filename );
 	}
 
-	FS_FCloseFile( svs.demo.file );
+	bool failed = demo_write_failed;
+	if( FS_FCloseFile( svs.demo.file ) != 0 ) {
+		failed = true;
+	}
 	svs.demo.file = 0;
 
 	if( cancel ) {
 		if( !FS_RemoveFile( svs.demo.tempname ) ) {
 			Com_Printf( "Error: Failed to delete the temporary server demo file\n" );
 		}
+	} else if( failed ) {
+		// keep what made it to disk, it's readable without the chunk table.
+		// don't try to write the meta data to a disk that's probably full
+		Com_Printf( "Error: The server demo is incomplete, writing it failed\n" );
+		if( !FS_MoveFile( svs.demo.tempname, svs.demo.filename ) ) {
+			Com_Printf( "Error: Failed to rename the server demo file\n" );
+		}
 	} else {
 		// write some meta information about the match/demo
 		SV_SetDemoMetaKeyValue( "hostname", sv.configstrings[CS_HOSTNAME] );
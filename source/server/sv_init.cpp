@@ -71,6 +71,10 @@ static void SV_SpawnServer( const char *mapname, bool devmap ) {
 
 	// wipe the entire per-level structure
 	memset( &sv, 0, sizeof( sv ) );
+	for( int64_t & framenum : sv.gamestate_framenums ) {
+		framenum = -1;
+	}
+	sv.snap_entities_framenum = -1;
 
 	SV_ResetClientFrameCounters();
 	svs.realtime = Sys_Milliseconds();
@@ -150,6 +154,15 @@ void SV_InitGame() {
 	svs.client_entities.num_entities = sv_maxclients->integer * UPDATE_BACKUP * MAX_SNAP_ENTITIES;
 	svs.client_entities.entities = ( SyncEntityState * ) Mem_Alloc( sv_mempool, sizeof( SyncEntityState ) * svs.client_entities.num_entities );
 
+	svs.client_sessions.clear();
+
+	svs.snapjobs = ( client_snapjob_t * ) Mem_Alloc( sv_mempool, sizeof( client_snapjob_t ) * sv_maxclients->integer );
+
+	svs.zstd_contexts = ( ZSTD_CCtx_s ** ) Mem_Alloc( sv_mempool, sizeof( ZSTD_CCtx_s * ) * sv_maxclients->integer );
+	for( int i = 0; i < sv_maxclients->integer; i++ ) {
+		svs.zstd_contexts[i] = Netchan_NewCompressionContext();
+	}
+
 	// init network stuff
 
 	address.type = NA_NOTRANSMIT;
@@ -269,6 +282,19 @@ void SV_ShutdownGame( const char *finalmsg, bool reconnect ) {
 		memset( &svs.client_entities, 0, sizeof( svs.client_entities ) );
 	}
 
+	if( svs.snapjobs ) {
+		Mem_Free( svs.snapjobs );
+		svs.snapjobs = NULL;
+	}
+
+	if( svs.zstd_contexts ) {
+		for( int i = 0; i < sv_maxclients->integer; i++ ) {
+			Netchan_DeleteCompressionContext( svs.zstd_contexts[i] );
+		}
+		Mem_Free( svs.zstd_contexts );
+		svs.zstd_contexts = NULL;
+	}
+
 	if( svs.cms ) {
 		CM_Free( CM_Server, svs.cms );
 		svs.cms = NULL;
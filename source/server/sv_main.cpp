@@ -130,7 +130,7 @@ static bool SV_ProcessPacket( netchan_t *netchan, msg_t *msg ) {
 	MSG_ReadInt32( msg ); // sequence_ack
 	MSG_ReadUint64( msg ); // session_id
 	if( msg->compressed ) {
-		int zerror = Netchan_DecompressMessage( msg );
+		int zerror = Netchan_DecompressMessage( netchan, msg );
 		if( zerror < 0 ) {
 			// compression error. Drop the packet
 			Com_DPrintf( "SV_ProcessPacket: Compression error %i. Dropping packet\n", zerror );
@@ -141,23 +141,69 @@ static bool SV_ProcessPacket( netchan_t *netchan, msg_t *msg ) {
 	return true;
 }
 
+/*
+* SV_ReadPacket
+*/
+static void SV_ReadPacket( const socket_t *socket, const netadr_t *address, msg_t *msg ) {
+	// check for connectionless packet (0xffffffff) first
+	if( *(int *)msg->data == -1 ) {
+		SV_ConnectionlessPacket( socket, address, msg );
+		return;
+	}
+
+	MSG_BeginReading( msg );
+	MSG_ReadInt32( msg ); // sequence number
+	MSG_ReadInt32( msg ); // sequence number
+	u64 session_id = MSG_ReadUint64( msg );
+
+	client_t * cl = SV_FindClientBySession( session_id );
+	if( cl == NULL ) {
+		return;
+	}
+
+	// the session id identifies the client, so follow it across address changes
+	cl->netchan.remoteAddress = *address;
+
+	if( SV_ProcessPacket( &cl->netchan, msg ) ) { // this is a valid, sequenced packet, so process it
+		cl->lastPacketReceivedTime = svs.realtime;
+		SV_ParseClientMessage( cl, msg );
+	}
+}
+
 /*
 * SV_ReadPackets
+*
+* UDP sockets are drained a batch of datagrams per syscall. Each datagram is
+* copied into a full sized message before it's processed because reassembling
+* fragments and decompressing grow the message in place.
 */
 static void SV_ReadPackets() {
 	ZoneScoped;
 
 	static msg_t msg;
 	static uint8_t msgData[MAX_MSGLEN];
+	static net_packet_batch_t batch;
+
+	MSG_Init( &msg, msgData, sizeof( msgData ) );
+
+	if( svs.socket_loopback.open ) {
+		int ret;
+		netadr_t address;
+		while( ( ret = NET_GetPacket( &svs.socket_loopback, &address, &msg ) ) != 0 ) {
+			if( ret == -1 ) {
+				Com_Printf( "NET_GetPacket: Error: %s\n", NET_ErrorString() );
+				continue;
+			}
+
+			SV_ReadPacket( &svs.socket_loopback, &address, &msg );
+		}
+	}
 
 	socket_t * sockets[] = {
-		&svs.socket_loopback,
 		&svs.socket_udp,
 		&svs.socket_udp6,
 	};
 
-	MSG_Init( &msg, msgData, sizeof( msgData ) );
-
 	for( size_t socketind = 0; socketind < ARRAY_COUNT( sockets ); socketind++ ) {
 		socket_t * socket = sockets[socketind];
 
@@ -166,45 +212,24 @@ static void SV_ReadPackets() {
 		}
 
 		int ret;
-		netadr_t address;
-		while( ( ret = NET_GetPacket( socket, &address, &msg ) ) != 0 ) {
+		while( ( ret = NET_GetPackets( socket, &batch ) ) != 0 ) {
 			if( ret == -1 ) {
-				Com_Printf( "NET_GetPacket: Error: %s\n", NET_ErrorString() );
+				Com_Printf( "NET_GetPackets: Error: %s\n", NET_ErrorString() );
 				continue;
 			}
 
-			// check for connectionless packet (0xffffffff) first
-			if( *(int *)msg.data == -1 ) {
-				SV_ConnectionlessPacket( socket, &address, &msg );
-				continue;
-			}
-
-			MSG_BeginReading( &msg );
-			MSG_ReadInt32( &msg ); // sequence number
-			MSG_ReadInt32( &msg ); // sequence number
-			u64 session_id = MSG_ReadUint64( &msg );
-
-			for( int i = 0; i < sv_maxclients->integer; i++ ) {
-				client_t * cl = &svs.clients[ i ];
+			for( int i = 0; i < batch.num_packets; i++ ) {
+				const net_packet_t * packet = &batch.packets[ i ];
 
-				if( cl->state == CS_FREE || cl->state == CS_ZOMBIE ) {
-					continue;
-				}
-				if( cl->edict && ( cl->edict->r.svflags & SVF_FAKECLIENT ) ) {
-					continue;
-				}
-
-				if( cl->netchan.session_id != session_id ) {
-					continue;
-				}
+				memcpy( msg.data, packet->data, packet->length );
+				msg.cursize = packet->length;
+				msg.readcount = 0;
 
-				cl->netchan.remoteAddress = address;
-
-				if( SV_ProcessPacket( &cl->netchan, &msg ) ) { // this is a valid, sequenced packet, so process it
-					cl->lastPacketReceivedTime = svs.realtime;
-					SV_ParseClientMessage( cl, &msg );
-				}
+				SV_ReadPacket( socket, &packet->address, &msg );
+			}
 
+			// a short batch means the socket is empty
+			if( ret < NET_PACKET_BATCH_SIZE ) {
 				break;
 			}
 		}
@@ -430,6 +455,22 @@ static void SV_CheckDefaultMap() {
 	}
 }
 
+/*
+* SV_EndFrameStage
+*
+* Charges the time since start to a stage of SV_Frame and returns
+* when the next stage starts
+*/
+static u64 SV_EndFrameStage( sv_frame_stage_t stage, u64 start ) {
+	if( svs.frame_timings == NULL ) {
+		return 0;
+	}
+
+	u64 now = Sys_Nanoseconds();
+	svs.frame_timings->nsec[stage] += now - start;
+	return now;
+}
+
 /*
 * SV_Frame
 */
@@ -452,6 +493,8 @@ void SV_Frame( unsigned realmsec, unsigned gamemsec ) {
 	svs.realtime += realmsec;
 	svs.gametime += gamemsec;
 
+	u64 stage_start = svs.frame_timings != NULL ? Sys_Nanoseconds() : 0;
+
 	// check timeouts
 	SV_CheckTimeouts();
 
@@ -461,19 +504,30 @@ void SV_Frame( unsigned realmsec, unsigned gamemsec ) {
 	// apply latched userinfo changes
 	SV_CheckLatchedUserinfoChanges();
 
+	stage_start = SV_EndFrameStage( SV_FRAME_READ_PACKETS, stage_start );
+
 	// let everything in the world think and move
-	if( SV_RunGameFrame( gamemsec ) ) {
+	bool snapshot = SV_RunGameFrame( gamemsec );
+	stage_start = SV_EndFrameStage( SV_FRAME_GAME, stage_start );
+
+	if( snapshot ) {
+		SV_BenchRecordFrame();
+
 		// send messages back to the clients that had packets read this frame
 		SV_SendClientMessages();
+		stage_start = SV_EndFrameStage( SV_FRAME_SNAPSHOTS, stage_start );
 
 		// write snap to server demo file
 		SV_Demo_WriteSnap();
+		stage_start = SV_EndFrameStage( SV_FRAME_DEMO, stage_start );
 
 		// send a heartbeat to the master if needed
 		SV_MasterHeartbeat();
 
 		// clear teleport flags, etc for next frame
 		G_ClearSnap();
+		SV_InvalidateSnapEntities();
+		SV_EndFrameStage( SV_FRAME_OTHER, stage_start );
 	}
 }
 
@@ -540,6 +594,9 @@ void SV_Init() {
 	void * frame_arena_memory = ALLOC_SIZE( sys_allocator, frame_arena_size, 16 );
 	svs.frame_arena = ArenaAllocator( frame_arena_memory, frame_arena_size );
 
+	svs.entity_delta_cache = SNAP_NewEntityDeltaCache( sys_allocator );
+	svs.snap_entity_bits = SNAP_NewSnapEntityBits( sys_allocator );
+
 	u64 entropy[ 2 ];
 	CSPRNG_Bytes( entropy, sizeof( entropy ) );
 	svs.rng = new_rng( entropy[ 0 ], entropy[ 1 ] );
@@ -647,4 +704,6 @@ void SV_Shutdown( const char *finalmsg ) {
 	Mem_FreePool( &sv_mempool );
 
 	FREE( sys_allocator, svs.frame_arena.get_memory() );
+	SNAP_DeleteEntityDeltaCache( sys_allocator, svs.entity_delta_cache );
+	SNAP_DeleteSnapEntityBits( sys_allocator, svs.snap_entity_bits );
 }
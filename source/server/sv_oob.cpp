@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "server/server.h"
 #include "qcommon/version.h"
+#include "qcommon/hash.h"
 
 static netadr_t sv_masters[ ARRAY_COUNT( MASTER_SERVERS ) ];
 
@@ -369,6 +370,64 @@ static void SVC_GetStatusResponse( const socket_t *socket, const netadr_t *addre
 }
 
 
+/*
+* SV_ChallengeKey
+*/
+static u64 SV_ChallengeKey( const netadr_t *address ) {
+	u64 hash = Hash64( u64( address->type ) );
+	if( address->type == NA_IP ) {
+		hash = Hash64( address->address.ipv4.ip, sizeof( address->address.ipv4.ip ), hash );
+	} else if( address->type == NA_IP6 ) {
+		hash = Hash64( address->address.ipv6.ip, sizeof( address->address.ipv6.ip ), hash );
+		hash = Hash64( &address->address.ipv6.scope_id, sizeof( address->address.ipv6.scope_id ), hash );
+	} else if( address->type == NA_LOOPBACK ) {
+		hash = Hash64( &address->address.loopback, sizeof( address->address.loopback ), hash );
+	}
+
+	// the top bit is reserved by Hashtable and 0 is the empty key
+	hash &= ~( U64( 1 ) << U64( 63 ) );
+	return hash == 0 ? 1 : hash;
+}
+
+/*
+* SV_FindChallenge
+*
+* Returns the challenges index for the base address, or -1.
+*/
+static int SV_FindChallenge( const netadr_t *address ) {
+	u64 idx;
+	if( !svs.challenge_addresses.get( SV_ChallengeKey( address ), &idx ) ) {
+		return -1;
+	}
+	if( !NET_CompareBaseAddress( address, &svs.challenges[idx].adr ) ) {
+		return -1;
+	}
+	// every loopback socket is the same host, but they each get their own challenge
+	if( address->type == NA_LOOPBACK && address->address.loopback != svs.challenges[idx].adr.address.loopback ) {
+		return -1;
+	}
+	return int( idx );
+}
+
+/*
+* SV_ClearChallenge
+*/
+static void SV_ClearChallenge( int idx ) {
+	challenge_t *challenge = &svs.challenges[idx];
+
+	if( challenge->adr.type != NA_NOTRANSMIT ) {
+		u64 key = SV_ChallengeKey( &challenge->adr );
+		u64 owner;
+		if( svs.challenge_addresses.get( key, &owner ) && owner == u64( idx ) ) {
+			svs.challenge_addresses.remove( key );
+		}
+	}
+
+	challenge->challenge = 0;
+	challenge->time = 0;
+	NET_InitAddress( &challenge->adr, NA_NOTRANSMIT );
+}
+
 /*
 * SVC_GetChallenge
 *
@@ -379,33 +438,34 @@ static void SVC_GetStatusResponse( const socket_t *socket, const netadr_t *addre
 * challenge, they must give a valid IP address.
 */
 static void SVC_GetChallenge( const socket_t *socket, const netadr_t *address ) {
-	int i;
-	int oldest;
-	int oldestTime;
-
-	oldest = 0;
-	oldestTime = 0x7fffffff;
-
 	if( sv_showChallenge->integer ) {
 		Com_Printf( "Challenge Packet %s\n", NET_AddressToString( address ) );
 	}
 
 	// see if we already have a challenge for this ip
-	for( i = 0; i < MAX_CHALLENGES; i++ ) {
-		if( NET_CompareBaseAddress( address, &svs.challenges[i].adr ) ) {
-			break;
-		}
-		if( svs.challenges[i].time < oldestTime ) {
-			oldestTime = svs.challenges[i].time;
-			oldest = i;
+	int i = SV_FindChallenge( address );
+
+	if( i == -1 ) {
+		int oldest = 0;
+		int oldestTime = 0x7fffffff;
+		for( int j = 0; j < MAX_CHALLENGES; j++ ) {
+			if( svs.challenges[j].time < oldestTime ) {
+				oldestTime = svs.challenges[j].time;
+				oldest = j;
+			}
 		}
-	}
 
-	if( i == MAX_CHALLENGES ) {
 		// overwrite the oldest
+		SV_ClearChallenge( oldest );
 		svs.challenges[oldest].challenge = random_uniform( &svs.rng, 0, S16_MAX );
 		svs.challenges[oldest].adr = *address;
 		svs.challenges[oldest].time = Sys_Milliseconds();
+
+		u64 key = SV_ChallengeKey( address );
+		if( !svs.challenge_addresses.add( key, oldest ) ) {
+			svs.challenge_addresses.update( key, oldest );
+		}
+
 		i = oldest;
 	}
 
@@ -454,29 +514,23 @@ static void SVC_DirectConnect( const socket_t *socket, const netadr_t *address )
 
 	// see if the challenge is valid
 	{
-		int i;
-		for( i = 0; i < MAX_CHALLENGES; i++ ) {
-			if( NET_CompareBaseAddress( address, &svs.challenges[i].adr ) ) {
-				if( challenge == svs.challenges[i].challenge ) {
-					svs.challenges[i].challenge = 0; // wsw : r1q2 : reset challenge
-					svs.challenges[i].time = 0;
-					NET_InitAddress( &svs.challenges[i].adr, NA_NOTRANSMIT );
-					break; // good
-				}
-				Netchan_OutOfBandPrint( socket, address, "reject\n%i\n%i\nBad challenge\n",
-										DROP_TYPE_GENERAL, DROP_FLAG_AUTORECONNECT );
-				return;
-			}
-		}
-		if( i == MAX_CHALLENGES ) {
+		int i = SV_FindChallenge( address );
+		if( i == -1 ) {
 			Netchan_OutOfBandPrint( socket, address, "reject\n%i\n%i\nNo challenge for address\n",
 									DROP_TYPE_GENERAL, DROP_FLAG_AUTORECONNECT );
 			return;
 		}
+		if( challenge != svs.challenges[i].challenge ) {
+			Netchan_OutOfBandPrint( socket, address, "reject\n%i\n%i\nBad challenge\n",
+									DROP_TYPE_GENERAL, DROP_FLAG_AUTORECONNECT );
+			return;
+		}
+		SV_ClearChallenge( i ); // wsw : r1q2 : reset challenge
 	}
 
 	//r1: limit connections from a single IP
-	if( sv_iplimit->integer ) {
+	// loopback connections come from inside the process, so don't count them
+	if( sv_iplimit->integer && address->type != NA_LOOPBACK ) {
 		int previousclients = 0;
 		for( int i = 0; i < sv_maxclients->integer; i++ ) {
 			client_t * cl = &svs.clients[ i ];
@@ -551,8 +605,11 @@ static void SVC_DirectConnect( const socket_t *socket, const netadr_t *address )
 		return;
 	}
 
+	newcl->netchan.compression = Netchan_NegotiateCompression( Cmd_Argv( 5 ) );
+	newcl->netchan.zstd = svs.zstd_contexts[ newcl - svs.clients ];
+
 	// send the connect packet to the client
-	Netchan_OutOfBandPrint( socket, address, "client_connect\n%s", newcl->session );
+	Netchan_OutOfBandPrint( socket, address, "client_connect\n%s\n%i", newcl->session, newcl->netchan.compression );
 }
 
 /*
@@ -0,0 +1,975 @@
+#include "server/server.h"
+#include "qcommon/cmodel.h"
+#include "qcommon/array.h"
+#include "qcommon/threads.h"
+#include "qcommon/hash.h"
+
+/*
+ * replay benchmarks
+ *
+ * benchrecord captures pmoves, traces and entity states from a live server
+ * along with what they produced. benchreplay runs them back through Pmove,
+ * CM_TransformedBoxTrace and the delta encoders, checks the results match
+ * bit for bit and reports how long each op took
+ *
+ * pmoves are replayed without the game: whatever the gs api returned while
+ * recording is handed back in the same order, and if Pmove asks for
+ * something different it has diverged
+ */
+
+#define REPLAYBENCH_MAGIC "FSREPLAY"
+#define REPLAYBENCH_VERSION 2
+#define REPLAYBENCH_ENCODE_BUFFER_SIZE ( 1024 * 1024 )
+
+enum PmoveCallbackType : u8 {
+	PmoveCallback_Trace,
+	PmoveCallback_GetEntityState,
+	PmoveCallback_PointContents,
+	PmoveCallback_PredictedEvent,
+	PmoveCallback_PredictedFireWeapon,
+	PmoveCallback_TouchTriggers,
+};
+
+// callback arguments are memset before they're filled in so they can be memcmped
+struct PmoveTraceArgs {
+	Vec3 start, mins, maxs, end;
+	int ignore, contentmask, timeDelta;
+};
+
+struct PmoveEntityStateArgs {
+	int entNum, deltaTime;
+};
+
+struct PmoveEntityStateResult {
+	SyncEntityState state;
+	bool valid;
+};
+
+struct PmovePointContentsArgs {
+	Vec3 point;
+	int timeDelta;
+};
+
+struct PmoveEventArgs {
+	int entNum, ev;
+	u64 parm;
+};
+
+struct PmoveFireWeaponArgs {
+	int entNum;
+	u64 weapon_and_entropy;
+};
+
+struct PmoveTouchTriggersArgs {
+	Vec3 previous_origin;
+	Vec3 origin, velocity;
+};
+
+struct BenchPmove {
+	SyncPlayerState ps_in, ps_out;
+	usercmd_t cmd;
+	pmove_t out; // playerState is cleared
+	int maxclients;
+	u64 game_state;
+	u64 callbacks_offset, callbacks_size;
+};
+
+struct BenchTrace {
+	CMTraceQuery query;
+	trace_t result;
+};
+
+struct BenchFrame {
+	u64 game_state;
+	u64 first_entity, num_entities;
+	u64 first_player, num_players;
+};
+
+struct BenchFrameResult {
+	u64 hash;
+	u64 size;
+};
+
+struct ReplayBench {
+	NonRAIIDynamicArray< SyncGameState > game_states;
+	NonRAIIDynamicArray< BenchPmove > pmoves;
+	NonRAIIDynamicArray< u8 > pmove_callbacks;
+	NonRAIIDynamicArray< BenchTrace > traces;
+	NonRAIIDynamicArray< BenchFrame > frames;
+	NonRAIIDynamicArray< SyncEntityState > entities;
+	NonRAIIDynamicArray< SyncPlayerState > players;
+	NonRAIIDynamicArray< BenchFrameResult > frame_results;
+	SyncEntityState * baselines;
+};
+
+struct ReplayBenchHeader {
+	char magic[ 8 ];
+	u32 version;
+	u32 struct_sizes[ 8 ]; // files from builds with different layouts can't be replayed
+	char map[ MAX_QPATH ];
+	u32 map_checksum;
+	u64 counts[ 8 ];
+};
+
+struct BenchRecording {
+	bool active;
+	char path[ MAX_QPATH ];
+	int spawncount;
+	int64_t frames_left;
+	Mutex * mutex;
+	ReplayBench bench;
+};
+
+struct PmoveRecorder {
+	const gs_state_t * gs;
+	DynamicArray< u8 > * callbacks;
+};
+
+struct PmoveReplayer {
+	const u8 * cursor;
+	const u8 * end;
+	bool diverged;
+	SyncEntityState entity;
+};
+
+static BenchRecording bench_recording;
+static thread_local PmoveRecorder * pmove_recorder;
+static PmoveReplayer * pmove_replayer;
+
+static void SV_Bench_InitReplayBench( ReplayBench * bench ) {
+	bench->game_states.init( sys_allocator );
+	bench->pmoves.init( sys_allocator );
+	bench->pmove_callbacks.init( sys_allocator );
+	bench->traces.init( sys_allocator );
+	bench->frames.init( sys_allocator );
+	bench->entities.init( sys_allocator );
+	bench->players.init( sys_allocator );
+	bench->frame_results.init( sys_allocator );
+	bench->baselines = ALLOC_MANY( sys_allocator, SyncEntityState, MAX_EDICTS );
+	memset( bench->baselines, 0, MAX_EDICTS * sizeof( SyncEntityState ) );
+}
+
+static void SV_Bench_ShutdownReplayBench( ReplayBench * bench ) {
+	bench->game_states.shutdown();
+	bench->pmoves.shutdown();
+	bench->pmove_callbacks.shutdown();
+	bench->traces.shutdown();
+	bench->frames.shutdown();
+	bench->entities.shutdown();
+	bench->players.shutdown();
+	bench->frame_results.shutdown();
+	FREE( sys_allocator, bench->baselines );
+}
+
+/*
+* SV_Bench_SameTrace
+*/
+static bool SV_Bench_SameTrace( const trace_t * a, const trace_t * b ) {
+	return a->allsolid == b->allsolid && a->startsolid == b->startsolid
+		&& memcmp( &a->fraction, &b->fraction, sizeof( a->fraction ) ) == 0
+		&& memcmp( &a->endpos, &b->endpos, sizeof( a->endpos ) ) == 0
+		&& memcmp( &a->plane.normal, &b->plane.normal, sizeof( a->plane.normal ) ) == 0
+		&& memcmp( &a->plane.dist, &b->plane.dist, sizeof( a->plane.dist ) ) == 0
+		&& a->surfFlags == b->surfFlags && a->contents == b->contents && a->ent == b->ent;
+}
+
+/*
+* SV_Bench_SamePmoveResults
+*/
+static bool SV_Bench_SamePmoveResults( const pmove_t * a, const pmove_t * b ) {
+	if( a->numtouch != b->numtouch || memcmp( a->touchents, b->touchents, a->numtouch * sizeof( a->touchents[ 0 ] ) ) != 0 ) {
+		return false;
+	}
+
+	return memcmp( &a->step, &b->step, sizeof( a->step ) ) == 0
+		&& memcmp( &a->mins, &b->mins, sizeof( a->mins ) ) == 0
+		&& memcmp( &a->maxs, &b->maxs, sizeof( a->maxs ) ) == 0
+		&& a->groundentity == b->groundentity && a->watertype == b->watertype && a->waterlevel == b->waterlevel
+		&& a->contentmask == b->contentmask && a->ladder == b->ladder;
+}
+
+//=============================================================================
+// recording
+
+/*
+* SV_Bench_RecordCallback
+*/
+static void SV_Bench_RecordCallback( PmoveCallbackType type, const void * args, size_t args_size, const void * result, size_t result_size ) {
+	DynamicArray< u8 > * callbacks = pmove_recorder->callbacks;
+	size_t offset = callbacks->extend( 1 + args_size + result_size );
+	( *callbacks )[ offset ] = type;
+	memcpy( &( *callbacks )[ offset + 1 ], args, args_size );
+	if( result_size > 0 ) {
+		memcpy( &( *callbacks )[ offset + 1 + args_size ], result, result_size );
+	}
+}
+
+static void SV_Bench_RecordTrace( trace_t * t, Vec3 start, Vec3 mins, Vec3 maxs, Vec3 end, int ignore, int contentmask, int timeDelta ) {
+	pmove_recorder->gs->api.Trace( t, start, mins, maxs, end, ignore, contentmask, timeDelta );
+
+	PmoveTraceArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.start = start;
+	args.mins = mins;
+	args.maxs = maxs;
+	args.end = end;
+	args.ignore = ignore;
+	args.contentmask = contentmask;
+	args.timeDelta = timeDelta;
+
+	SV_Bench_RecordCallback( PmoveCallback_Trace, &args, sizeof( args ), t, sizeof( *t ) );
+}
+
+static SyncEntityState * SV_Bench_RecordGetEntityState( int entNum, int deltaTime ) {
+	SyncEntityState * state = pmove_recorder->gs->api.GetEntityState( entNum, deltaTime );
+
+	PmoveEntityStateArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.entNum = entNum;
+	args.deltaTime = deltaTime;
+
+	PmoveEntityStateResult result;
+	memset( &result, 0, sizeof( result ) );
+	if( state != NULL ) {
+		result.state = *state;
+		result.valid = true;
+	}
+
+	SV_Bench_RecordCallback( PmoveCallback_GetEntityState, &args, sizeof( args ), &result, sizeof( result ) );
+
+	return state;
+}
+
+static int SV_Bench_RecordPointContents( Vec3 point, int timeDelta ) {
+	int contents = pmove_recorder->gs->api.PointContents( point, timeDelta );
+
+	PmovePointContentsArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.point = point;
+	args.timeDelta = timeDelta;
+
+	SV_Bench_RecordCallback( PmoveCallback_PointContents, &args, sizeof( args ), &contents, sizeof( contents ) );
+
+	return contents;
+}
+
+static void SV_Bench_RecordPredictedEvent( int entNum, int ev, u64 parm ) {
+	pmove_recorder->gs->api.PredictedEvent( entNum, ev, parm );
+
+	PmoveEventArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.entNum = entNum;
+	args.ev = ev;
+	args.parm = parm;
+
+	SV_Bench_RecordCallback( PmoveCallback_PredictedEvent, &args, sizeof( args ), NULL, 0 );
+}
+
+static void SV_Bench_RecordPredictedFireWeapon( int entNum, u64 weapon_and_entropy ) {
+	pmove_recorder->gs->api.PredictedFireWeapon( entNum, weapon_and_entropy );
+
+	PmoveFireWeaponArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.entNum = entNum;
+	args.weapon_and_entropy = weapon_and_entropy;
+
+	SV_Bench_RecordCallback( PmoveCallback_PredictedFireWeapon, &args, sizeof( args ), NULL, 0 );
+}
+
+static void SV_Bench_RecordTouchTriggers( pmove_t * pm, Vec3 previous_origin ) {
+	PmoveTouchTriggersArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.previous_origin = previous_origin;
+	args.origin = pm->playerState->pmove.origin;
+	args.velocity = pm->playerState->pmove.velocity;
+
+	// triggers can change the player, e.g. jumppads and teleporters
+	pmove_recorder->gs->api.PMoveTouchTriggers( pm, previous_origin );
+
+	SV_Bench_RecordCallback( PmoveCallback_TouchTriggers, &args, sizeof( args ), pm->playerState, sizeof( *pm->playerState ) );
+}
+
+/*
+* SV_Bench_AddGameState
+*
+* Must be called with the recording mutex held
+*/
+static u64 SV_Bench_AddGameState( const SyncGameState * game_state ) {
+	NonRAIIDynamicArray< SyncGameState > & game_states = bench_recording.bench.game_states;
+	if( game_states.size() == 0 || memcmp( &game_states.top(), game_state, sizeof( *game_state ) ) != 0 ) {
+		game_states.add( *game_state );
+	}
+	return game_states.size() - 1;
+}
+
+/*
+* SV_BenchPmove
+*
+* Pmove, which also records the move while benchrecord is running. The game
+* runs some pmoves in parallel so this can be called from several threads
+*/
+void SV_BenchPmove( const gs_state_t *gs, pmove_t *pm ) {
+	if( !bench_recording.active ) {
+		Pmove( gs, pm );
+		return;
+	}
+
+	BenchPmove move;
+	memset( &move, 0, sizeof( move ) );
+	move.ps_in = *pm->playerState;
+	move.cmd = pm->cmd;
+	move.maxclients = gs->maxclients;
+
+	gs_state_t recording_gs = *gs;
+	recording_gs.api.Trace = SV_Bench_RecordTrace;
+	recording_gs.api.GetEntityState = SV_Bench_RecordGetEntityState;
+	recording_gs.api.PointContents = SV_Bench_RecordPointContents;
+	recording_gs.api.PredictedEvent = SV_Bench_RecordPredictedEvent;
+	recording_gs.api.PredictedFireWeapon = SV_Bench_RecordPredictedFireWeapon;
+	recording_gs.api.PMoveTouchTriggers = SV_Bench_RecordTouchTriggers;
+
+	DynamicArray< u8 > callbacks( sys_allocator );
+	PmoveRecorder recorder = { gs, &callbacks };
+	pmove_recorder = &recorder;
+	Pmove( &recording_gs, pm );
+	pmove_recorder = NULL;
+
+	move.ps_out = *pm->playerState;
+	move.out = *pm;
+	move.out.playerState = NULL;
+
+	Lock( bench_recording.mutex );
+	ReplayBench * bench = &bench_recording.bench;
+	move.game_state = SV_Bench_AddGameState( &gs->gameState );
+	move.callbacks_offset = bench->pmove_callbacks.extend( callbacks.size() );
+	move.callbacks_size = callbacks.size();
+	memcpy( &bench->pmove_callbacks[ move.callbacks_offset ], callbacks.ptr(), callbacks.size() );
+	bench->pmoves.add( move );
+	Unlock( bench_recording.mutex );
+}
+
+static void SV_Bench_RecordTraceQuery( const CMTraceQuery * query, const trace_t * tr ) {
+	BenchTrace trace;
+	memset( &trace, 0, sizeof( trace ) );
+	trace.query = *query;
+	trace.result = *tr;
+
+	Lock( bench_recording.mutex );
+	bench_recording.bench.traces.add( trace );
+	Unlock( bench_recording.mutex );
+}
+
+/*
+* SV_Bench_WriteFrame
+*
+* Writes the parts of a frame SNAP_WriteFrameSnapToClient would for a client
+* that sees everything and acked the previous frame
+*/
+static void SV_Bench_WriteFrame( ReplayBench * bench, msg_t * msg, const BenchFrame * from, const BenchFrame * to ) {
+	SNAP_WriteDeltaGameState( msg, from != NULL ? &bench->game_states[ from->game_state ] : NULL, &bench->game_states[ to->game_state ] );
+
+	const SyncPlayerState * from_players = from != NULL ? bench->players.ptr() + from->first_player : NULL;
+	SNAP_WriteDeltaPlayerStates( msg, from_players, from != NULL ? int( from->num_players ) : 0,
+		bench->players.ptr() + to->first_player, int( to->num_players ) );
+
+	client_entities_t ring;
+	ring.num_entities = bench->entities.size();
+	ring.next_entities = 0;
+	ring.entities = bench->entities.ptr();
+	SNAP_WriteDeltaEntities( msg, &ring, from != NULL ? int( from->first_entity ) : 0, from != NULL ? int( from->num_entities ) : 0,
+		int( to->first_entity ), int( to->num_entities ), 0, bench->baselines, NULL );
+}
+
+template< typename T >
+static void SV_Bench_WriteSection( int file, const NonRAIIDynamicArray< T > & arr ) {
+	FS_Write( arr.ptr(), arr.num_bytes(), file );
+}
+
+static void SV_Bench_FillStructSizes( u32 * sizes ) {
+	sizes[ 0 ] = sizeof( SyncGameState );
+	sizes[ 1 ] = sizeof( BenchPmove );
+	sizes[ 2 ] = sizeof( BenchTrace );
+	sizes[ 3 ] = sizeof( BenchFrame );
+	sizes[ 4 ] = sizeof( SyncEntityState );
+	sizes[ 5 ] = sizeof( SyncPlayerState );
+	sizes[ 6 ] = sizeof( BenchFrameResult );
+	sizes[ 7 ] = sizeof( trace_t );
+}
+
+/*
+* SV_Bench_StopRecording
+*/
+static void SV_Bench_StopRecording( bool save ) {
+	cm_trace_recorder = NULL;
+	bench_recording.active = false;
+
+	ReplayBench * bench = &bench_recording.bench;
+	defer {
+		SV_Bench_ShutdownReplayBench( bench );
+		DeleteMutex( bench_recording.mutex );
+		bench_recording.mutex = NULL;
+	};
+
+	if( !save ) {
+		return;
+	}
+
+	// encode the frames now so replays have something to compare against
+	static uint8_t msg_buffer[ REPLAYBENCH_ENCODE_BUFFER_SIZE ];
+	for( u64 i = 0; i < bench->frames.size(); i++ ) {
+		msg_t msg;
+		MSG_Init( &msg, msg_buffer, sizeof( msg_buffer ) );
+		SV_Bench_WriteFrame( bench, &msg, i > 0 ? &bench->frames[ i - 1 ] : NULL, &bench->frames[ i ] );
+
+		BenchFrameResult result;
+		result.hash = Hash64( msg.data, msg.cursize );
+		result.size = msg.cursize;
+		bench->frame_results.add( result );
+	}
+
+	ReplayBenchHeader header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, REPLAYBENCH_MAGIC, sizeof( header.magic ) );
+	header.version = REPLAYBENCH_VERSION;
+	SV_Bench_FillStructSizes( header.struct_sizes );
+	Q_strncpyz( header.map, sv.mapname, sizeof( header.map ) );
+	header.map_checksum = svs.cms->checksum;
+	header.counts[ 0 ] = bench->game_states.size();
+	header.counts[ 1 ] = bench->pmoves.size();
+	header.counts[ 2 ] = bench->pmove_callbacks.size();
+	header.counts[ 3 ] = bench->traces.size();
+	header.counts[ 4 ] = bench->frames.size();
+	header.counts[ 5 ] = bench->entities.size();
+	header.counts[ 6 ] = bench->players.size();
+	header.counts[ 7 ] = bench->frame_results.size();
+
+	int file;
+	if( FS_FOpenFile( bench_recording.path, &file, FS_WRITE ) == -1 ) {
+		Com_Printf( "Couldn't open %s for writing\n", bench_recording.path );
+		return;
+	}
+
+	FS_Write( &header, sizeof( header ), file );
+	SV_Bench_WriteSection( file, bench->game_states );
+	SV_Bench_WriteSection( file, bench->pmoves );
+	SV_Bench_WriteSection( file, bench->pmove_callbacks );
+	SV_Bench_WriteSection( file, bench->traces );
+	SV_Bench_WriteSection( file, bench->frames );
+	SV_Bench_WriteSection( file, bench->entities );
+	SV_Bench_WriteSection( file, bench->players );
+	SV_Bench_WriteSection( file, bench->frame_results );
+	FS_Write( bench->baselines, MAX_EDICTS * sizeof( SyncEntityState ), file );
+	FS_FCloseFile( file );
+
+	Com_Printf( "Wrote %s: %zu pmoves, %zu traces, %zu frames\n", bench_recording.path,
+		bench->pmoves.size(), bench->traces.size(), bench->frames.size() );
+}
+
+/*
+* SV_BenchRecordFrame
+*
+* Records the entities and players a snapshot would be built from
+*/
+void SV_BenchRecordFrame() {
+	if( !bench_recording.active ) {
+		return;
+	}
+
+	if( svs.spawncount != bench_recording.spawncount ) {
+		Com_Printf( "benchrecord: the map changed, cancelling\n" );
+		SV_Bench_StopRecording( false );
+		return;
+	}
+
+	ReplayBench * bench = &bench_recording.bench;
+
+	BenchFrame frame;
+	memset( &frame, 0, sizeof( frame ) );
+
+	Lock( bench_recording.mutex );
+	frame.game_state = SV_Bench_AddGameState( &server_gs.gameState );
+	Unlock( bench_recording.mutex );
+
+	frame.first_entity = bench->entities.size();
+	for( int i = 1; i < sv.gi.num_edicts; i++ ) {
+		const edict_t * ent = EDICT_NUM( i );
+		if( ent->r.svflags & SVF_NOCLIENT ) {
+			continue;
+		}
+
+		SyncEntityState state = ent->s;
+		state.number = i;
+		bench->entities.add( state );
+	}
+	frame.num_entities = bench->entities.size() - frame.first_entity;
+
+	frame.first_player = bench->players.size();
+	for( int i = 0; i < sv.gi.max_clients; i++ ) {
+		const edict_t * ent = EDICT_NUM( i + 1 );
+		if( svs.clients[ i ].state < CS_SPAWNED || ent->r.client == NULL ) {
+			continue;
+		}
+
+		bench->players.add( ent->r.client->ps );
+	}
+	frame.num_players = bench->players.size() - frame.first_player;
+
+	bench->frames.add( frame );
+
+	bench_recording.frames_left--;
+	if( bench_recording.frames_left <= 0 ) {
+		SV_Bench_StopRecording( true );
+	}
+}
+
+/*
+* SV_BenchRecord_f
+*
+* benchrecord <name> [seconds]
+*/
+void SV_BenchRecord_f() {
+	if( Cmd_Argc() < 2 ) {
+		Com_Printf( "Usage: %s <name> [seconds]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if( sv.state != ss_game ) {
+		Com_Printf( "No map loaded\n" );
+		return;
+	}
+
+	if( bench_recording.active ) {
+		Com_Printf( "Already recording %s\n", bench_recording.path );
+		return;
+	}
+
+	int seconds = Cmd_Argc() > 2 ? Max2( atoi( Cmd_Argv( 2 ) ), 1 ) : 10;
+
+	snprintf( bench_recording.path, sizeof( bench_recording.path ), "benchmarks/%s.replay", Cmd_Argv( 1 ) );
+	bench_recording.spawncount = svs.spawncount;
+	bench_recording.frames_left = seconds * 1000 / svc.snapFrameTime;
+	bench_recording.mutex = NewMutex();
+	SV_Bench_InitReplayBench( &bench_recording.bench );
+	memcpy( bench_recording.bench.baselines, sv.baselines, sizeof( sv.baselines ) );
+
+	cm_trace_recorder = SV_Bench_RecordTraceQuery;
+	bench_recording.active = true;
+
+	Com_Printf( "Recording %s for %d seconds\n", bench_recording.path, seconds );
+}
+
+//=============================================================================
+// replaying
+
+/*
+* SV_Bench_ReplayCallback
+*
+* Checks Pmove asked for the same thing it did while recording and hands
+* back what it got then
+*/
+static bool SV_Bench_ReplayCallback( PmoveCallbackType type, const void * args, size_t args_size, void * result, size_t result_size ) {
+	PmoveReplayer * replayer = pmove_replayer;
+	if( replayer->diverged ) {
+		return false;
+	}
+
+	if( size_t( replayer->end - replayer->cursor ) < 1 + args_size + result_size || replayer->cursor[ 0 ] != type ||
+		memcmp( replayer->cursor + 1, args, args_size ) != 0 ) {
+		replayer->diverged = true;
+		return false;
+	}
+
+	if( result_size > 0 ) {
+		memcpy( result, replayer->cursor + 1 + args_size, result_size );
+	}
+	replayer->cursor += 1 + args_size + result_size;
+
+	return true;
+}
+
+static void SV_Bench_ReplayTrace( trace_t * t, Vec3 start, Vec3 mins, Vec3 maxs, Vec3 end, int ignore, int contentmask, int timeDelta ) {
+	PmoveTraceArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.start = start;
+	args.mins = mins;
+	args.maxs = maxs;
+	args.end = end;
+	args.ignore = ignore;
+	args.contentmask = contentmask;
+	args.timeDelta = timeDelta;
+
+	if( !SV_Bench_ReplayCallback( PmoveCallback_Trace, &args, sizeof( args ), t, sizeof( *t ) ) ) {
+		memset( t, 0, sizeof( *t ) );
+		t->fraction = 1.0f;
+		t->endpos = end;
+		t->ent = -1;
+	}
+}
+
+static SyncEntityState * SV_Bench_ReplayGetEntityState( int entNum, int deltaTime ) {
+	PmoveEntityStateArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.entNum = entNum;
+	args.deltaTime = deltaTime;
+
+	PmoveEntityStateResult result;
+	if( !SV_Bench_ReplayCallback( PmoveCallback_GetEntityState, &args, sizeof( args ), &result, sizeof( result ) ) ) {
+		memset( &pmove_replayer->entity, 0, sizeof( pmove_replayer->entity ) );
+		return &pmove_replayer->entity;
+	}
+
+	if( !result.valid ) {
+		return NULL;
+	}
+
+	pmove_replayer->entity = result.state;
+	return &pmove_replayer->entity;
+}
+
+static int SV_Bench_ReplayPointContents( Vec3 point, int timeDelta ) {
+	PmovePointContentsArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.point = point;
+	args.timeDelta = timeDelta;
+
+	int contents = 0;
+	SV_Bench_ReplayCallback( PmoveCallback_PointContents, &args, sizeof( args ), &contents, sizeof( contents ) );
+	return contents;
+}
+
+static void SV_Bench_ReplayPredictedEvent( int entNum, int ev, u64 parm ) {
+	PmoveEventArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.entNum = entNum;
+	args.ev = ev;
+	args.parm = parm;
+
+	SV_Bench_ReplayCallback( PmoveCallback_PredictedEvent, &args, sizeof( args ), NULL, 0 );
+}
+
+static void SV_Bench_ReplayPredictedFireWeapon( int entNum, u64 weapon_and_entropy ) {
+	PmoveFireWeaponArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.entNum = entNum;
+	args.weapon_and_entropy = weapon_and_entropy;
+
+	SV_Bench_ReplayCallback( PmoveCallback_PredictedFireWeapon, &args, sizeof( args ), NULL, 0 );
+}
+
+static void SV_Bench_ReplayTouchTriggers( pmove_t * pm, Vec3 previous_origin ) {
+	PmoveTouchTriggersArgs args;
+	memset( &args, 0, sizeof( args ) );
+	args.previous_origin = previous_origin;
+	args.origin = pm->playerState->pmove.origin;
+	args.velocity = pm->playerState->pmove.velocity;
+
+	SV_Bench_ReplayCallback( PmoveCallback_TouchTriggers, &args, sizeof( args ), pm->playerState, sizeof( *pm->playerState ) );
+}
+
+template< typename T >
+static bool SV_Bench_ReadSection( const u8 ** cursor, const u8 * end, NonRAIIDynamicArray< T > * arr, u64 count ) {
+	if( u64( end - *cursor ) / sizeof( T ) < count ) {
+		return false;
+	}
+
+	arr->resize( count );
+	memcpy( arr->ptr(), *cursor, count * sizeof( T ) );
+	*cursor += count * sizeof( T );
+	return true;
+}
+
+/*
+* SV_Bench_LoadReplay
+*/
+static bool SV_Bench_LoadReplay( const char * path, ReplayBench * bench, ReplayBenchHeader * header ) {
+	void * data;
+	int len = FS_LoadFile( path, &data, NULL, 0 );
+	if( data == NULL ) {
+		Com_Printf( "Couldn't open %s\n", path );
+		return false;
+	}
+	defer { FS_FreeFile( data ); };
+
+	if( size_t( len ) < sizeof( *header ) ) {
+		Com_Printf( "%s is too short\n", path );
+		return false;
+	}
+
+	memcpy( header, data, sizeof( *header ) );
+
+	u32 struct_sizes[ ARRAY_COUNT( &ReplayBenchHeader::struct_sizes ) ];
+	SV_Bench_FillStructSizes( struct_sizes );
+
+	if( memcmp( header->magic, REPLAYBENCH_MAGIC, sizeof( header->magic ) ) != 0 || header->version != REPLAYBENCH_VERSION ) {
+		Com_Printf( "%s isn't a replay\n", path );
+		return false;
+	}
+
+	if( memcmp( header->struct_sizes, struct_sizes, sizeof( struct_sizes ) ) != 0 ) {
+		Com_Printf( "%s was recorded by a build with different structs, record it again\n", path );
+		return false;
+	}
+
+	const u8 * cursor = ( const u8 * ) data + sizeof( *header );
+	const u8 * end = ( const u8 * ) data + len;
+
+	bool ok = true;
+	ok = ok && SV_Bench_ReadSection( &cursor, end, &bench->game_states, header->counts[ 0 ] );
+	ok = ok && SV_Bench_ReadSection( &cursor, end, &bench->pmoves, header->counts[ 1 ] );
+	ok = ok && SV_Bench_ReadSection( &cursor, end, &bench->pmove_callbacks, header->counts[ 2 ] );
+	ok = ok && SV_Bench_ReadSection( &cursor, end, &bench->traces, header->counts[ 3 ] );
+	ok = ok && SV_Bench_ReadSection( &cursor, end, &bench->frames, header->counts[ 4 ] );
+	ok = ok && SV_Bench_ReadSection( &cursor, end, &bench->entities, header->counts[ 5 ] );
+	ok = ok && SV_Bench_ReadSection( &cursor, end, &bench->players, header->counts[ 6 ] );
+	ok = ok && SV_Bench_ReadSection( &cursor, end, &bench->frame_results, header->counts[ 7 ] );
+	ok = ok && size_t( end - cursor ) == MAX_EDICTS * sizeof( SyncEntityState );
+	if( !ok ) {
+		Com_Printf( "%s is truncated\n", path );
+		return false;
+	}
+
+	memcpy( bench->baselines, cursor, MAX_EDICTS * sizeof( SyncEntityState ) );
+
+	// check the indices so a bad file can't make us read out of bounds
+	for( const BenchPmove & move : bench->pmoves ) {
+		if( move.game_state >= bench->game_states.size() || move.callbacks_offset + move.callbacks_size > bench->pmove_callbacks.size() ) {
+			Com_Printf( "%s is corrupt\n", path );
+			return false;
+		}
+	}
+
+	for( const BenchFrame & frame : bench->frames ) {
+		if( frame.game_state >= bench->game_states.size() || frame.first_entity + frame.num_entities > bench->entities.size() ||
+			frame.first_player + frame.num_players > bench->players.size() ) {
+			Com_Printf( "%s is corrupt\n", path );
+			return false;
+		}
+	}
+
+	for( const SyncEntityState & ent : bench->entities ) {
+		if( ent.number <= 0 || ent.number >= MAX_EDICTS ) {
+			Com_Printf( "%s is corrupt\n", path );
+			return false;
+		}
+	}
+
+	return bench->frame_results.size() == bench->frames.size();
+}
+
+static void SV_Bench_PrintResult( const char * label, size_t ops, int iterations, u64 total_nsec, u64 best_nsec, size_t mismatches, size_t first_mismatch ) {
+	if( ops == 0 ) {
+		Com_Printf( "  %-10s nothing recorded\n", label );
+		return;
+	}
+
+	Com_Printf( "  %-10s %8zu ops  %9.1f ns/op  best %9.1f ns/op  ", label, ops,
+		double( total_nsec ) / ( double( ops ) * iterations ), double( best_nsec ) / ops );
+	if( mismatches == 0 ) {
+		Com_Printf( "all match\n" );
+	}
+	else {
+		Com_Printf( S_COLOR_RED "%zu MISMATCHED" S_COLOR_WHITE ", first at %zu\n", mismatches, first_mismatch );
+	}
+}
+
+/*
+* SV_Bench_ReplayPmoves
+*/
+static void SV_Bench_ReplayPmoves( const ReplayBench * bench, int iterations ) {
+	gs_state_t * states = ALLOC_MANY( sys_allocator, gs_state_t, bench->game_states.size() );
+	defer { FREE( sys_allocator, states ); };
+
+	for( size_t i = 0; i < bench->game_states.size(); i++ ) {
+		memset( &states[ i ], 0, sizeof( states[ i ] ) );
+		states[ i ].module = GS_MODULE_GAME;
+		states[ i ].gameState = bench->game_states[ i ];
+		states[ i ].api.Trace = SV_Bench_ReplayTrace;
+		states[ i ].api.GetEntityState = SV_Bench_ReplayGetEntityState;
+		states[ i ].api.PointContents = SV_Bench_ReplayPointContents;
+		states[ i ].api.PredictedEvent = SV_Bench_ReplayPredictedEvent;
+		states[ i ].api.PredictedFireWeapon = SV_Bench_ReplayPredictedFireWeapon;
+		states[ i ].api.PMoveTouchTriggers = SV_Bench_ReplayTouchTriggers;
+	}
+
+	PmoveReplayer replayer;
+	pmove_replayer = &replayer;
+	defer { pmove_replayer = NULL; };
+
+	u64 total_nsec = 0;
+	u64 best_nsec = U64_MAX;
+	size_t mismatches = 0;
+	size_t first_mismatch = 0;
+
+	for( int iteration = 0; iteration < iterations; iteration++ ) {
+		u64 start = Sys_Nanoseconds();
+
+		for( size_t i = 0; i < bench->pmoves.size(); i++ ) {
+			const BenchPmove * move = &bench->pmoves[ i ];
+
+			SyncPlayerState ps = move->ps_in;
+			pmove_t pm;
+			memset( &pm, 0, sizeof( pm ) );
+			pm.playerState = &ps;
+			pm.cmd = move->cmd;
+
+			gs_state_t * gs = &states[ move->game_state ];
+			gs->maxclients = move->maxclients;
+
+			replayer.cursor = &bench->pmove_callbacks[ 0 ] + move->callbacks_offset;
+			replayer.end = replayer.cursor + move->callbacks_size;
+			replayer.diverged = false;
+
+			Pmove( gs, &pm );
+
+			if( iteration == 0 ) {
+				bool match = !replayer.diverged && replayer.cursor == replayer.end
+					&& memcmp( &ps, &move->ps_out, sizeof( ps ) ) == 0 && SV_Bench_SamePmoveResults( &pm, &move->out );
+				if( !match ) {
+					if( mismatches == 0 ) {
+						first_mismatch = i;
+					}
+					mismatches++;
+				}
+			}
+		}
+
+		u64 nsec = Sys_Nanoseconds() - start;
+		total_nsec += nsec;
+		best_nsec = Min2( best_nsec, nsec );
+	}
+
+	SV_Bench_PrintResult( "pmove", bench->pmoves.size(), iterations, total_nsec, best_nsec, mismatches, first_mismatch );
+}
+
+/*
+* SV_Bench_ReplayTraces
+*/
+static void SV_Bench_ReplayTraces( const ReplayBench * bench, const ReplayBenchHeader * header, int iterations ) {
+	if( strcmp( header->map, sv.mapname ) != 0 || svs.cms == NULL || svs.cms->checksum != header->map_checksum ) {
+		Com_Printf( "  %-10s skipped, recorded on %s\n", "traces", header->map );
+		return;
+	}
+
+	u64 total_nsec = 0;
+	u64 best_nsec = U64_MAX;
+	size_t mismatches = 0;
+	size_t first_mismatch = 0;
+
+	for( int iteration = 0; iteration < iterations; iteration++ ) {
+		u64 start = Sys_Nanoseconds();
+
+		for( size_t i = 0; i < bench->traces.size(); i++ ) {
+			const CMTraceQuery * query = &bench->traces[ i ].query;
+
+			trace_t tr;
+			memset( &tr, 0, sizeof( tr ) );
+
+			const cmodel_t * cmodel = CM_TraceQueryModel( CM_Server, svs.cms, query );
+			if( cmodel != NULL ) {
+				CM_TransformedBoxTrace( CM_Server, svs.cms, &tr, query->start, query->end, query->mins, query->maxs,
+					cmodel, query->brushmask, query->origin, query->angles );
+			}
+
+			if( iteration == 0 ) {
+				// trace_t::ent isn't set by CM_TransformedBoxTrace, the game fills it in after
+				tr.ent = bench->traces[ i ].result.ent;
+				if( cmodel == NULL || !SV_Bench_SameTrace( &tr, &bench->traces[ i ].result ) ) {
+					if( mismatches == 0 ) {
+						first_mismatch = i;
+					}
+					mismatches++;
+				}
+			}
+		}
+
+		u64 nsec = Sys_Nanoseconds() - start;
+		total_nsec += nsec;
+		best_nsec = Min2( best_nsec, nsec );
+	}
+
+	SV_Bench_PrintResult( "traces", bench->traces.size(), iterations, total_nsec, best_nsec, mismatches, first_mismatch );
+}
+
+/*
+* SV_Bench_ReplaySnapshots
+*/
+static void SV_Bench_ReplaySnapshots( ReplayBench * bench, int iterations ) {
+	static uint8_t msg_buffer[ REPLAYBENCH_ENCODE_BUFFER_SIZE ];
+
+	u64 total_nsec = 0;
+	u64 best_nsec = U64_MAX;
+	size_t mismatches = 0;
+	size_t first_mismatch = 0;
+	size_t total_bytes = 0;
+
+	for( int iteration = 0; iteration < iterations; iteration++ ) {
+		u64 start = Sys_Nanoseconds();
+
+		for( size_t i = 0; i < bench->frames.size(); i++ ) {
+			msg_t msg;
+			MSG_Init( &msg, msg_buffer, sizeof( msg_buffer ) );
+			SV_Bench_WriteFrame( bench, &msg, i > 0 ? &bench->frames[ i - 1 ] : NULL, &bench->frames[ i ] );
+
+			if( iteration == 0 ) {
+				total_bytes += msg.cursize;
+
+				const BenchFrameResult * expected = &bench->frame_results[ i ];
+				if( msg.cursize != expected->size || Hash64( msg.data, msg.cursize ) != expected->hash ) {
+					if( mismatches == 0 ) {
+						first_mismatch = i;
+					}
+					mismatches++;
+				}
+			}
+		}
+
+		u64 nsec = Sys_Nanoseconds() - start;
+		total_nsec += nsec;
+		best_nsec = Min2( best_nsec, nsec );
+	}
+
+	SV_Bench_PrintResult( "snapshots", bench->frames.size(), iterations, total_nsec, best_nsec, mismatches, first_mismatch );
+
+	if( bench->frames.size() > 0 ) {
+		Com_Printf( "             %.1f entities and %.1f players per frame, %.0f bytes per frame, %.1f ns per entity\n",
+			double( bench->entities.size() ) / bench->frames.size(), double( bench->players.size() ) / bench->frames.size(),
+			double( total_bytes ) / bench->frames.size(), double( total_nsec ) / ( double( bench->entities.size() ) * iterations ) );
+	}
+}
+
+/*
+* SV_BenchReplay_f
+*
+* benchreplay <name> [iterations]
+*/
+void SV_BenchReplay_f() {
+	if( Cmd_Argc() < 2 ) {
+		Com_Printf( "Usage: %s <name> [iterations]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if( bench_recording.active ) {
+		Com_Printf( "Can't replay while recording\n" );
+		return;
+	}
+
+	int iterations = Cmd_Argc() > 2 ? Max2( atoi( Cmd_Argv( 2 ) ), 1 ) : 10;
+
+	char path[ MAX_QPATH ];
+	snprintf( path, sizeof( path ), "benchmarks/%s.replay", Cmd_Argv( 1 ) );
+
+	ReplayBench bench;
+	SV_Bench_InitReplayBench( &bench );
+	defer { SV_Bench_ShutdownReplayBench( &bench ); };
+
+	ReplayBenchHeader header;
+	if( !SV_Bench_LoadReplay( path, &bench, &header ) ) {
+		return;
+	}
+
+	Com_Printf( "Replaying %s, recorded on %s, %d iterations\n", path, header.map, iterations );
+
+	SV_Bench_ReplayPmoves( &bench, iterations );
+	SV_Bench_ReplayTraces( &bench, &header, iterations );
+	SV_Bench_ReplaySnapshots( &bench, iterations );
+}
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // sv_main.c -- server main program
 
 #include "server.h"
+#include "qcommon/threadpool.h"
 
 // shared message buffer to be used for occasional messages
 msg_t tmpMessage;
@@ -249,6 +250,34 @@ void SV_BroadcastCommand( const char *format, ... ) {
 //
 //===============================================================================
 
+/*
+* SV_SendClientError
+*/
+static void SV_SendClientError( client_t *client ) {
+	Com_Printf( "Error sending message to %s: %s\n", client->name, NET_ErrorString() );
+	if( client->reliable ) {
+		SV_DropClient( client, DROP_TYPE_GENERAL, "Error sending message: %s\n", NET_ErrorString() );
+	}
+}
+
+/*
+* SV_QueuedSendError
+*
+* A packet NET_FlushQueuedPackets sent on after we thought it had gone out
+* failed, so treat it like any other send to that client failing
+*/
+static void SV_QueuedSendError( const netadr_t *address ) {
+	for( int i = 0; i < sv_maxclients->integer; i++ ) {
+		client_t *client = &svs.clients[i];
+		if( client->state != CS_FREE && NET_CompareAddress( &client->netchan.remoteAddress, address ) ) {
+			SV_SendClientError( client );
+			return;
+		}
+	}
+
+	Com_Printf( "Error sending message to %s: %s\n", NET_AddressToString( address ), NET_ErrorString() );
+}
+
 /*
 * SV_SendClientsFragments
 */
@@ -257,6 +286,13 @@ bool SV_SendClientsFragments() {
 	int i;
 	bool sent = false;
 
+	NET_BeginQueueingPackets( SV_QueuedSendError );
+	defer {
+		if( !NET_FlushQueuedPackets() ) {
+			Com_Printf( "NET_FlushQueuedPackets: Error: %s\n", NET_ErrorString() );
+		}
+	};
+
 	// send a message to each connected client
 	for( i = 0, client = svs.clients; i < sv_maxclients->integer; i++, client++ ) {
 		if( client->state == CS_FREE || client->state == CS_ZOMBIE ) {
@@ -285,20 +321,29 @@ bool SV_SendClientsFragments() {
 }
 
 /*
-* SV_Netchan_Transmit
+* SV_Netchan_TransmitCompressed
+*
+* Transmits a message that has already been through Netchan_CompressMessage
 */
-bool SV_Netchan_Transmit( netchan_t *netchan, msg_t *msg ) {
+static bool SV_Netchan_TransmitCompressed( netchan_t *netchan, msg_t *msg ) {
 	// if we got here with unsent fragments, fire them all now
 	if( !Netchan_PushAllFragments( netchan ) ) {
 		return false;
 	}
 
-	int zerror = Netchan_CompressMessage( msg );
+	return Netchan_Transmit( netchan, msg );
+}
+
+/*
+* SV_Netchan_Transmit
+*/
+bool SV_Netchan_Transmit( netchan_t *netchan, msg_t *msg ) {
+	int zerror = Netchan_CompressMessage( netchan, msg );
 	if( zerror < 0 ) { // it's compression error, just send uncompressed
 		Com_DPrintf( "SV_Netchan_Transmit (ignoring compression): Compression error %i\n", zerror );
 	}
 
-	return Netchan_Transmit( netchan, msg );
+	return SV_Netchan_TransmitCompressed( netchan, msg );
 }
 
 /*
@@ -360,46 +405,107 @@ void SV_ResetClientFrameCounters() {
 * SV_WriteFrameSnapToClient
 */
 void SV_WriteFrameSnapToClient( client_t *client, msg_t *msg ) {
-	SNAP_WriteFrameSnapToClient( &sv.gi, client, msg, sv.framenum, svs.gametime, sv.baselines, &svs.client_entities );
+	SNAP_WriteFrameSnapToClient( &sv.gi, client, msg, sv.framenum, svs.gametime, sv.baselines, &svs.client_entities, NULL );
 }
 
 /*
-* SV_BuildClientFrameSnap
+* SV_FrameGameState
+*
+* Every snapshot built for a frame has to carry the same match state, because
+* clients delta against it later, so it's stored the first time it's asked
+* for and stays put until the slot is reused UPDATE_BACKUP frames later.
 */
-void SV_BuildClientFrameSnap( client_t *client ) {
-	SNAP_BuildClientFrameSnap( svs.cms, &sv.gi, sv.framenum, svs.gametime,
-		client, &server_gs.gameState, &svs.client_entities, sv_mempool );
+static const SyncGameState *SV_FrameGameState() {
+	size_t slot = sv.framenum & UPDATE_MASK;
+	if( sv.gamestate_framenums[slot] != sv.framenum ) {
+		sv.gamestates[slot] = server_gs.gameState;
+		sv.gamestate_framenums[slot] = sv.framenum;
+	}
+	return &sv.gamestates[slot];
 }
 
 /*
-* SV_SendClientDatagram
+* SV_GatherSnapEntities
+*
+* the clients and the server demo all share one gather per frame
 */
-static bool SV_SendClientDatagram( client_t *client ) {
-	if( client->edict && ( client->edict->r.svflags & SVF_FAKECLIENT ) ) {
-		return true;
+static void SV_GatherSnapEntities() {
+	if( sv.snap_entities_framenum != sv.framenum ) {
+		SNAP_GatherSnapEntities( svs.cms, &sv.gi, svs.snap_entity_bits );
+		sv.snap_entities_framenum = sv.framenum;
 	}
+}
+
+/*
+* SV_InvalidateSnapEntities
+*
+* call after changing entities without advancing sv.framenum
+*/
+void SV_InvalidateSnapEntities() {
+	sv.snap_entities_framenum = -1;
+}
 
-	SV_InitClientMessage( client, &tmpMessage, NULL, 0 );
+/*
+* SV_BuildClientFrameSnap
+*/
+void SV_BuildClientFrameSnap( client_t *client ) {
+	SV_GatherSnapEntities();
+	SNAP_BuildClientFrameSnap( svs.cms, &sv.gi, svs.snap_entity_bits, sv.framenum, svs.gametime,
+		client, SV_FrameGameState(), &svs.client_entities, sv_mempool );
+}
 
-	SV_AddReliableCommandsToMessage( client, &tmpMessage );
+/*
+* SV_CullClientSnapJob
+*/
+static void SV_CullClientSnapJob( TempAllocator * temp, void * data ) {
+	client_snapjob_t * job = ( client_snapjob_t * ) data;
 
 	// send over all the relevant SyncEntityState
 	// and the SyncPlayerState
-	SV_BuildClientFrameSnap( client );
+	job->culled = SNAP_CullClientFrameSnap( svs.cms, &sv.gi, svs.snap_entity_bits, sv.framenum, svs.gametime,
+		job->client, &sv.gamestates[sv.framenum & UPDATE_MASK], sv_mempool, &job->entities );
+}
+
+/*
+* SV_WriteClientSnapJob
+*/
+static void SV_WriteClientSnapJob( TempAllocator * temp, void * data ) {
+	client_snapjob_t * job = ( client_snapjob_t * ) data;
 
-	SV_WriteFrameSnapToClient( client, &tmpMessage );
+	SNAP_WriteFrameSnapToClient( &sv.gi, job->client, &job->msg, sv.framenum, svs.gametime,
+		sv.baselines, &svs.client_entities, svs.entity_delta_cache );
 
-	return SV_SendMessageToClient( client, &tmpMessage );
+	uint8_t * scratch = ALLOC_MANY( temp, uint8_t, MAX_MSGLEN );
+	int zerror = Netchan_CompressMessage( &job->client->netchan, &job->msg, scratch, MAX_MSGLEN );
+	if( zerror < 0 ) { // it's compression error, just send uncompressed
+		Com_DPrintf( "SV_WriteClientSnapJob (ignoring compression): Compression error %i\n", zerror );
+	}
 }
 
 /*
 * SV_SendClientMessages
+*
+* Snapshots are culled, delta encoded and compressed for every spawned client
+* in parallel, each with their own message buffer. The parts that touch shared
+* state (claiming client_entities and transmitting) run in client order on this
+* thread so the output doesn't depend on how the jobs were scheduled.
+*
+* Everything sent to UDP clients from here is queued and goes out in a single
+* batch at the end.
 */
 void SV_SendClientMessages() {
 	ZoneScoped;
 
 	int i;
 	client_t *client;
+	size_t num_jobs = 0;
+
+	NET_BeginQueueingPackets( SV_QueuedSendError );
+	defer {
+		if( !NET_FlushQueuedPackets() ) {
+			Com_Printf( "NET_FlushQueuedPackets: Error: %s\n", NET_ErrorString() );
+		}
+	};
 
 	// send a message to each connected client
 	for( i = 0, client = svs.clients; i < sv_maxclients->integer; i++, client++ ) {
@@ -413,12 +519,12 @@ void SV_SendClientMessages() {
 		}
 
 		if( client->state == CS_SPAWNED ) {
-			if( !SV_SendClientDatagram( client ) ) {
-				Com_Printf( "Error sending message to %s: %s\n", client->name, NET_ErrorString() );
-				if( client->reliable ) {
-					SV_DropClient( client, DROP_TYPE_GENERAL, "Error sending message: %s\n", NET_ErrorString() );
-				}
-			}
+			client_snapjob_t *job = &svs.snapjobs[num_jobs];
+			num_jobs++;
+
+			job->client = client;
+			SV_InitClientMessage( client, &job->msg, job->msgData, sizeof( job->msgData ) );
+			SV_AddReliableCommandsToMessage( client, &job->msg );
 		} else {
 			// send pending reliable commands, or send heartbeats for not timing out
 			if( client->reliableSequence > client->reliableAcknowledge ||
@@ -426,12 +532,37 @@ void SV_SendClientMessages() {
 				SV_InitClientMessage( client, &tmpMessage, NULL, 0 );
 				SV_AddReliableCommandsToMessage( client, &tmpMessage );
 				if( !SV_SendMessageToClient( client, &tmpMessage ) ) {
-					Com_Printf( "Error sending message to %s: %s\n", client->name, NET_ErrorString() );
-					if( client->reliable ) {
-						SV_DropClient( client, DROP_TYPE_GENERAL, "Error sending message: %s\n", NET_ErrorString() );
-					}
+					SV_SendClientError( client );
 				}
 			}
 		}
 	}
+
+	if( num_jobs == 0 ) {
+		return;
+	}
+
+	Span< client_snapjob_t > jobs( svs.snapjobs, num_jobs );
+
+	SV_FrameGameState();
+	SV_GatherSnapEntities();
+
+	ParallelFor( jobs, SV_CullClientSnapJob );
+
+	for( client_snapjob_t & job : jobs ) {
+		if( job.culled ) {
+			SNAP_StoreClientFrameEntities( &sv.gi, job.client, sv.framenum, &svs.client_entities, &job.entities );
+		}
+	}
+
+	// clients that acked the same frame share entity deltas
+	SNAP_ClearEntityDeltaCache( svs.entity_delta_cache );
+	ParallelFor( jobs, SV_WriteClientSnapJob );
+
+	for( client_snapjob_t & job : jobs ) {
+		job.client->lastPacketSentTime = svs.realtime;
+		if( !SV_Netchan_TransmitCompressed( &job.client->netchan, &job.msg ) ) {
+			SV_SendClientError( job.client );
+		}
+	}
 }
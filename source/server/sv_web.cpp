@@ -114,6 +114,10 @@ struct sv_http_connection_t {
 
 	bool is_upstream;
 
+	// edge-triggered readiness, cleared when a read or write would block
+	bool readable;
+	bool writable;
+
 	sv_http_connection_t *next;
 	sv_http_connection_t *prev;
 };
@@ -132,6 +136,7 @@ static sv_http_connection_t sv_http_connection_headnode, *sv_free_http_connectio
 
 static socket_t sv_socket_http;
 static socket_t sv_socket_http6;
+static net_poller_t *sv_http_poller;
 
 static netadr_t sv_web_upstream_addr;
 
@@ -257,6 +262,8 @@ static sv_http_connection_t *SV_Web_AllocConnection() {
 	con->state = HTTP_CONN_STATE_NONE;
 	con->close_after_resp = false;
 	con->is_upstream = false;
+	con->readable = false;
+	con->writable = false;
 	return con;
 }
 
@@ -306,6 +313,7 @@ static void SV_Web_ShutdownConnections() {
 	for( con = hnode->prev; con != hnode; con = next ) {
 		next = con->prev;
 		if( con->open ) {
+			NET_PollerRemove( sv_http_poller, &con->socket );
 			NET_CloseSocket( &con->socket );
 			SV_Web_FreeConnection( con );
 		}
@@ -457,6 +465,8 @@ static int SV_Web_Get( sv_http_connection_t *con, void *recvbuf, size_t recvbuf_
 	if( read < 0 ) {
 		con->open = false;
 		Com_DPrintf( "HTTP connection recv error from %s\n", NET_AddressToString( &con->address ) );
+	} else if( read == 0 ) {
+		con->readable = false;
 	}
 	return read;
 }
@@ -471,6 +481,8 @@ static int SV_Web_Send( sv_http_connection_t *con, void *sendbuf, size_t sendbuf
 	if( sent < 0 ) {
 		Com_DPrintf( "HTTP transmission error to %s\n", NET_AddressToString( &con->address ) );
 		con->open = false;
+	} else if( sent == 0 ) {
+		con->writable = false;
 	}
 	return sent;
 }
@@ -490,6 +502,8 @@ static int64_t SV_Web_SendFile( sv_http_connection_t *con, int fileno, size_t *p
 	if( sent < 0 ) {
 		Com_DPrintf( "HTTP file transmission error to %s\n", NET_AddressToString( &con->address ) );
 		con->open = false;
+	} else if( sent == 0 ) {
+		con->writable = false;
 	} else {
 		*pos += sent;
 	}
@@ -765,9 +779,6 @@ static void SV_Web_ReceiveRequest( socket_t *socket, sv_http_connection_t *con )
 		ret = SV_Web_Get( con, recvbuf, recvbuf_size - 1 );
 		if( ret <= 0 ) {
 			if( total_received == 0 ) {
-				// no data on the socket after select() call,
-				// the connection has probably been closed on the other end
-				con->open = false;
 				return;
 			}
 			break;
@@ -1217,11 +1228,19 @@ static void SV_Web_Listen( socket_t *socket ) {
 		}
 
 		if( !block ) {
-			Com_DPrintf( "HTTP connection accepted from %s\n", NET_AddressToString( &newaddress ) );
 			con = SV_Web_AllocConnection();
 			if( !con ) {
-				break;
+				Com_DPrintf( "HTTP connection refused for %s: too many connections\n", NET_AddressToString( &newaddress ) );
+				NET_CloseSocket( &newsocket );
+				continue;
+			}
+			if( !NET_PollerAdd( sv_http_poller, &newsocket, true, con ) ) {
+				Com_Printf( "NET_PollerAdd: Error: %s\n", NET_ErrorString() );
+				SV_Web_FreeConnection( con );
+				NET_CloseSocket( &newsocket );
+				continue;
 			}
+			Com_DPrintf( "HTTP connection accepted from %s\n", NET_AddressToString( &newaddress ) );
 			con->socket = newsocket;
 			con->address = newaddress;
 			con->last_active = Sys_Milliseconds();
@@ -1259,6 +1278,22 @@ void SV_Web_Init() {
 		return;
 	}
 
+	sv_http_poller = NET_NewPoller();
+	if( sv_http_poller == NULL ) {
+		Com_Printf( "Couldn't start web server: %s\n", NET_ErrorString() );
+		NET_CloseSocket( &sv_socket_http );
+		NET_CloseSocket( &sv_socket_http6 );
+		sv_http_initialized = false;
+		return;
+	}
+
+	if( sv_socket_http.address.type == NA_IP ) {
+		NET_PollerAdd( sv_http_poller, &sv_socket_http, false, &sv_socket_http );
+	}
+	if( sv_socket_http6.address.type == NA_IP6 ) {
+		NET_PollerAdd( sv_http_poller, &sv_socket_http6, false, &sv_socket_http6 );
+	}
+
 	sv_http_running = true;
 
 	Trie_Create( TRIE_CASE_SENSITIVE, &sv_http_clients );
@@ -1266,14 +1301,34 @@ void SV_Web_Init() {
 	sv_http_thread = NewThread( SV_Web_ThreadProc );
 }
 
+/*
+* SV_Web_CanMakeProgress
+*/
+static bool SV_Web_CanMakeProgress( const sv_http_connection_t *con ) {
+	if( !con->open ) {
+		return true;
+	}
+
+	switch( con->state ) {
+		case HTTP_CONN_STATE_RECV:
+			return con->readable;
+		case HTTP_CONN_STATE_RESP:
+		case HTTP_CONN_STATE_SEND:
+			return con->writable;
+		default:
+			return false;
+	}
+}
+
 /*
 * SV_Web_Frame
+*
+* Sockets are registered with sv_http_poller once, so instead of polling
+* every connection we only wake up for the ones the poller reports and keep
+* serving a connection until its reads or writes would block.
 */
 static void SV_Web_Frame() {
 	sv_http_connection_t *con, *next, *hnode = &sv_http_connection_headnode;
-	socket_t *sockets[MAX_INCOMING_HTTP_CONNECTIONS + 1];
-	void *connections[MAX_INCOMING_HTTP_CONNECTIONS];
-	int num_sockets = 0;
 	bool upstream_is_set;
 
 	if( !sv_http_initialized ) {
@@ -1292,47 +1347,47 @@ static void SV_Web_Frame() {
 		}
 	}
 
-	// accept new connections
-	if( sv_socket_http.address.type == NA_IP ) {
-		SV_Web_Listen( &sv_socket_http );
+	// only block when no connection can make progress without hearing from the socket
+	int timeout = HTTP_SERVER_SLEEP_TIME;
+	for( con = hnode->prev; con != hnode; con = con->prev ) {
+		if( SV_Web_CanMakeProgress( con ) ) {
+			timeout = 0;
+			break;
+		}
 	}
-	if( sv_socket_http6.address.type == NA_IP6 ) {
-		SV_Web_Listen( &sv_socket_http6 );
+
+	net_poll_event_t events[MAX_INCOMING_HTTP_CONNECTIONS + 2];
+	int num_events = NET_PollerWait( sv_http_poller, timeout, events, ARRAY_COUNT( events ) );
+	if( num_events == -1 ) {
+		Com_Printf( "NET_PollerWait: Error: %s\n", NET_ErrorString() );
+		num_events = 0;
+	}
+
+	for( int i = 0; i < num_events; i++ ) {
+		if( events[i].user == &sv_socket_http || events[i].user == &sv_socket_http6 ) {
+			// accept new connections
+			SV_Web_Listen( ( socket_t * ) events[i].user );
+			continue;
+		}
+
+		con = ( sv_http_connection_t * ) events[i].user;
+		con->readable = con->readable || events[i].readable;
+		con->writable = con->writable || events[i].writable;
 	}
 
-	// handle incoming data
-	num_sockets = 0;
+	// handle incoming data and send responses
 	for( con = hnode->prev; con != hnode; con = next ) {
 		next = con->prev;
-		switch( con->state ) {
-			case HTTP_CONN_STATE_RECV:
-			case HTTP_CONN_STATE_RESP:
-			case HTTP_CONN_STATE_SEND:
-				sockets[num_sockets] = &con->socket;
-				connections[num_sockets] = con;
-				num_sockets++;
-				break;
-			default:
-				break;
+		if( !con->open ) {
+			continue;
 		}
-	}
-	sockets[num_sockets] = NULL;
 
-	if( num_sockets != 0 ) {
-		NET_Monitor( HTTP_SERVER_SLEEP_TIME, sockets,
-					 ( void ( * )( socket_t *, void* ) )SV_Web_ReceiveRequest,
-					 ( void ( * )( socket_t *, void* ) )SV_Web_WriteResponse,
-					 NULL, connections );
-	} else {
-		// sleep on network sockets if got nothing else to do
-		if( sv_socket_http.address.type == NA_IP ) {
-			sockets[num_sockets++] = &sv_socket_http;
+		if( con->readable && con->state == HTTP_CONN_STATE_RECV ) {
+			SV_Web_ReceiveRequest( &con->socket, con );
 		}
-		if( sv_socket_http6.address.type == NA_IP6 ) {
-			sockets[num_sockets++] = &sv_socket_http6;
+		if( con->open && con->writable && ( con->state == HTTP_CONN_STATE_RESP || con->state == HTTP_CONN_STATE_SEND ) ) {
+			SV_Web_WriteResponse( &con->socket, con );
 		}
-		sockets[num_sockets] = NULL;
-		NET_Sleep( HTTP_SERVER_SLEEP_TIME, sockets );
 	}
 
 	// close dead connections
@@ -1364,6 +1419,7 @@ static void SV_Web_Frame() {
 		}
 
 		if( !con->open ) {
+			NET_PollerRemove( sv_http_poller, &con->socket );
 			NET_CloseSocket( &con->socket );
 			SV_Web_FreeConnection( con );
 		}
@@ -1402,6 +1458,9 @@ void SV_Web_Shutdown() {
 	NET_CloseSocket( &sv_socket_http );
 	NET_CloseSocket( &sv_socket_http6 );
 
+	NET_DeletePoller( sv_http_poller );
+	sv_http_poller = NULL;
+
 	sv_http_initialized = false;
 }
 
@@ -112,6 +112,30 @@ void Wait( Semaphore * sem ) {
 	}
 }
 
+s32 AtomicAdd( s32 * x, s32 n ) {
+	return __atomic_add_fetch( x, n, __ATOMIC_SEQ_CST );
+}
+
+s32 AtomicLoad( const s32 * x ) {
+	return __atomic_load_n( x, __ATOMIC_SEQ_CST );
+}
+
+s64 AtomicLoad( const s64 * x ) {
+	return __atomic_load_n( x, __ATOMIC_SEQ_CST );
+}
+
+void AtomicStore( s32 * x, s32 value ) {
+	__atomic_store_n( x, value, __ATOMIC_SEQ_CST );
+}
+
+void AtomicStore( s64 * x, s64 value ) {
+	__atomic_store_n( x, value, __ATOMIC_SEQ_CST );
+}
+
+bool AtomicCompareExchange( s64 * x, s64 expected, s64 desired ) {
+	return __atomic_compare_exchange_n( x, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
 u32 GetCoreCount() {
 	long ok = sysconf( _SC_NPROCESSORS_ONLN );
 	if( ok == -1 ) {
@@ -20,6 +20,12 @@ u64 Sys_Microseconds() {
 	return usec - base_usec;
 }
 
+u64 Sys_Nanoseconds() {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return u64( ts.tv_sec ) * 1000000000 + u64( ts.tv_nsec );
+}
+
 s64 Sys_Milliseconds() {
 	return Sys_Microseconds() / 1000;
 }
@@ -97,6 +97,36 @@ void Wait( Semaphore * sem ) {
 	WaitForSingleObject( sem->handle, INFINITE );
 }
 
+s32 AtomicAdd( s32 * x, s32 n ) {
+	return InterlockedAdd( ( volatile LONG * ) x, n );
+}
+
+// aligned loads are atomic and the stores below are full barriers, so loads
+// only need a fence to stop them moving, not a locked instruction
+s32 AtomicLoad( const s32 * x ) {
+	s32 value = *( const volatile s32 * ) x;
+	MemoryBarrier();
+	return value;
+}
+
+s64 AtomicLoad( const s64 * x ) {
+	s64 value = *( const volatile s64 * ) x;
+	MemoryBarrier();
+	return value;
+}
+
+void AtomicStore( s32 * x, s32 value ) {
+	InterlockedExchange( ( volatile LONG * ) x, value );
+}
+
+void AtomicStore( s64 * x, s64 value ) {
+	InterlockedExchange64( ( volatile LONG64 * ) x, value );
+}
+
+bool AtomicCompareExchange( s64 * x, s64 expected, s64 desired ) {
+	return InterlockedCompareExchange64( ( volatile LONG64 * ) x, desired, expected ) == expected;
+}
+
 u32 GetCoreCount() {
 	SYSTEM_INFO info;
 	GetSystemInfo( &info );
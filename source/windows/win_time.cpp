@@ -29,6 +29,16 @@ u64 Sys_Microseconds() {
 	return usec - base_usec;
 }
 
+u64 Sys_Nanoseconds() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter( &now );
+
+	// split up to avoid overflowing
+	u64 seconds = now.QuadPart / hwtimer_freq.QuadPart;
+	u64 remainder = now.QuadPart % hwtimer_freq.QuadPart;
+	return seconds * 1000000000 + ( remainder * 1000000000 ) / hwtimer_freq.QuadPart;
+}
+
 s64 Sys_Milliseconds() {
 	return Sys_Microseconds() / 1000;
 }